@@ -40,9 +40,14 @@ struct Material
 };
 
 
-struct Triangle
+// Positions are read by every triangle test, attributes only for the closest hit
+struct TrianglePositions
+{
+    float3 v0, v1, v2;
+};
+
+struct TriangleAttributes
 {
-    float3 v0, v1, v2; // Vertex positions
     int MaterialIndex;
     float3 n0, n1, n2; // Vertex normals
     float2 tc0, tc1, tc2;
@@ -79,9 +84,12 @@ struct ModelInstance
     uint BaseTriangleIndex;
     uint BaseNodeIndex;
     uint MaterialOffset;
-    float _padding0;
+    uint InstanceMask; // InstanceMaskBits in ModelLoader.h
 };
 
+#define INSTANCE_MASK_CAMERA 0x1
+#define INSTANCE_MASK_SECONDARY 0x2
+
 
 // =========================================================================
 // RESOURCES AND CONSTANTS
@@ -101,7 +109,7 @@ cbuffer SceneConstants : register(b0)
 };
 
 StructuredBuffer<Material> g_Materials : register(t0);
-StructuredBuffer<Triangle> g_UberTriangles : register(t1);
+StructuredBuffer<TrianglePositions> g_UberTriangles : register(t1);
 StructuredBuffer<BVHNode> g_UberBLAS : register(t2);
 StructuredBuffer<BVHNode> g_TLAS : register(t3);
 StructuredBuffer<ModelInstance> g_Instances : register(t4);
@@ -112,6 +120,8 @@ RWTexture2D<float4> g_OutputTexture : register(u1);
 Texture2D g_EnvironmentTexture : register(t5);
 SamplerState g_StaticSampler : register(s0);
 
+StructuredBuffer<TriangleAttributes> g_UberTriangleAttributes : register(t6);
+
 Texture2D g_Textures[] : register(t0, space1);
 
 // =========================================================================
@@ -199,7 +209,8 @@ float3 LinearToSRGB(float3 rgb)
 // TRACE RAY FUNCTIONS
 // =========================================================================
 
-HitData IntersectTriangle(Ray ray, Triangle tri, uint triIndex)
+// TexCoord holds the barycentrics (u, v) until ResolveHitAttributes is called for the closest hit.
+HitData IntersectTriangle(Ray ray, TrianglePositions tri, uint triIndex)
 {
     HitData hit;
     hit.HitDistance = -1.0f;
@@ -234,16 +245,24 @@ HitData IntersectTriangle(Ray ray, Triangle tri, uint triIndex)
     {
         hit.HitDistance = t;
         hit.HitPosition = ray.Origin + ray.Direction * t;
-        float w = 1.0f - u - v;
-        float3 interpolatedNormal = w * tri.n0 + u * tri.n1 + v * tri.n2;
-        hit.HitNormal = normalize(interpolatedNormal);
-        hit.TexCoord = w * tri.tc0 + u * tri.tc1 + v * tri.tc2;
+        hit.TexCoord = float2(u, v);
         hit.PrimitiveIndex = triIndex;
     }
     
     return hit;
 }
 
+void ResolveHitAttributes(inout HitData hit)
+{
+    TriangleAttributes tri = g_UberTriangleAttributes[hit.PrimitiveIndex];
+    float u = hit.TexCoord.x;
+    float v = hit.TexCoord.y;
+    float w = 1.0f - u - v;
+    float3 interpolatedNormal = w * tri.n0 + u * tri.n1 + v * tri.n2;
+    hit.HitNormal = normalize(interpolatedNormal);
+    hit.TexCoord = w * tri.tc0 + u * tri.tc1 + v * tri.tc2;
+}
+
 bool RayAABB(Ray ray, float3 min_aabb, float3 max_aabb, out float hitDist)
 {
     float3 invD = 1.0f / ray.Direction;
@@ -265,9 +284,11 @@ bool RayAABB(Ray ray, float3 min_aabb, float3 max_aabb, out float hitDist)
     return false;
 }
 
+// HeadlessRenderer -verifybuild checks the CPU traversal against a C++ port of this function (TraverseBLASLikeGpu);
+// keep the two in step.
 HitData TraverseBLAS(Ray modelSpaceRay, uint baseNodeIndex, uint baseTriangleIndex)
 {
-    int stack[32];
+    int stack[32]; // One entry per level; the builders cap BLASes at BVHBuilder::MAX_DEPTH = 32 levels
     int stackPtr = 0;
     stack[stackPtr++] = baseNodeIndex; // Start at the root of this model's BLAS
     HitData closestHit;
@@ -348,11 +369,17 @@ HitData TraverseBLAS(Ray modelSpaceRay, uint baseNodeIndex, uint baseTriangleInd
             }
         }
     }
+
+    if (closestHit.PrimitiveIndex != -1)
+    {
+        ResolveHitAttributes(closestHit);
+    }
     return closestHit;
 
 }
 
-HitData TraceRay(Ray ray)
+// Instances whose InstanceMask shares no bit with rayMask are skipped
+HitData TraceRay(Ray ray, uint rayMask)
 {
         
     const bool DEBUG_VISUALIZE_TLAS = false;
@@ -394,6 +421,8 @@ HitData TraceRay(Ray ray)
                 
                 uint instanceID = node.leftChildOrFirstTriangleIndex;
                 ModelInstance inst = g_Instances[instanceID];
+                if ((inst.InstanceMask & rayMask) == 0)
+                    continue;
 
                 // Transform ray into model's local space
                 Ray modelSpaceRay;
@@ -548,7 +577,7 @@ float3 DispatchRay(Ray ray, inout uint seed)
     for (uint i = 0; i < g_numBounces; i++)
     {
 
-        HitData hitData = TraceRay(ray);
+        HitData hitData = TraceRay(ray, i == 0 ? INSTANCE_MASK_CAMERA : INSTANCE_MASK_SECONDARY);
         
         if (hitData.PrimitiveIndex == -2)
         {
@@ -567,7 +596,7 @@ float3 DispatchRay(Ray ray, inout uint seed)
             break;
         }
         
-        Triangle hitTriangle = g_UberTriangles[hitData.PrimitiveIndex];
+        TriangleAttributes hitTriangle = g_UberTriangleAttributes[hitData.PrimitiveIndex];
         ModelInstance inst = g_Instances[hitData.InstanceIndex];
         Material material = g_Materials[inst.MaterialOffset + hitTriangle.MaterialIndex];
         
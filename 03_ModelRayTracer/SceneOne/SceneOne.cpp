@@ -22,11 +22,12 @@ HRESULT SceneOne::Initialize(RenderEngine* pRenderEngine)
 		descriptorRangeBindlessSRV.Flags = D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE;
 		descriptorRangeBindlessSRV.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
 
-		D3D12_DESCRIPTOR_RANGE1 descriptorRangeSpace0[4];
+		D3D12_DESCRIPTOR_RANGE1 descriptorRangeSpace0[5];
 		descriptorRangeSpace0[0] = { D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC };
 		descriptorRangeSpace0[1] = { D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 2, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_VOLATILE, D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND };
 		descriptorRangeSpace0[2] = { D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 5, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_NONE, D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND };
 		descriptorRangeSpace0[3] = { D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 5, 0, D3D12_DESCRIPTOR_RANGE_FLAG_NONE, D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND };
+		descriptorRangeSpace0[4] = { D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 6, 0, D3D12_DESCRIPTOR_RANGE_FLAG_NONE, D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND };
 
 		D3D12_ROOT_PARAMETER1 rootParameter[2];
 		ZeroMemory(&rootParameter[0], sizeof(D3D12_ROOT_PARAMETER1));
@@ -237,7 +238,9 @@ HRESULT SceneOne::InitializeAccelerationStructures()
 
 	}
 
-	// 2. Perform the initial CPU-side build.
+	// 2. Perform the initial CPU-side build, with every BLAS queued so far.
+	accelManager->WaitForBLASBuilds();
+	accelManager->PublishCompletedBLASes(cmdList);
 	accelManager->BuildTLAS(m_ModelInstances);
 
 	// 3. Record the commands to create the GPU buffers.
@@ -377,6 +380,7 @@ HRESULT SceneOne::UpdateStaticGeometryDescriptors()
 	const UINT MATERIAL_SRV_SLOT = 3;
 	const UINT TRIANGLE_SRV_SLOT = 4;
 	const UINT BLAS_SRV_SLOT = 5;
+	const UINT TRIANGLE_ATTRIBUTE_SRV_SLOT = 9;
 
 
 	// SRV for Material Buffer (t0)
@@ -400,6 +404,12 @@ HRESULT SceneOne::UpdateStaticGeometryDescriptors()
 	srvDesc.Buffer.NumElements = accelManager->GetUberBlasNodeCount();
 	pDevice->CreateShaderResourceView(uberBlas, &srvDesc, m_computeDescriptorTable.GetCpuHandle(BLAS_SRV_SLOT));
 
+	// SRV for Triangle Attribute Buffer (t6)
+	ID3D12Resource* uberTriangleAttributes = accelManager->GetUberTriangleAttributeBuffer();
+	srvDesc.Buffer.StructureByteStride = accelManager->GetUberTriangleAttributeBufferStride();
+	srvDesc.Buffer.NumElements = accelManager->GetUberTriangleAttributeCount();
+	pDevice->CreateShaderResourceView(uberTriangleAttributes, &srvDesc, m_computeDescriptorTable.GetCpuHandle(TRIANGLE_ATTRIBUTE_SRV_SLOT));
+
 	return S_OK;
 	
 }
@@ -452,8 +462,8 @@ void SceneOne::AddModelInstance(Model* model, const std::string& modelKey)
 
 	m_ModelInstances.push_back(inst);
 
-	// 3. Build the BLAS for the model's geometry
-	accelManager->GetOrBuildBLAS(m_pRenderEngine->m_commandList.Get(), model);
+	// 3. Build the BLAS for the model's geometry in the background; the instance joins the TLAS once it is published
+	accelManager->BuildBLASAsync(model);
 
 	// 4. Mark scene as dirty to trigger buffer and TLAS updates
 	m_sceneDataDirty = true;
@@ -512,6 +522,17 @@ void SceneOne::PopulateCommandList(void)
 	};
 	cmdList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
 
+	// BLASes finished in the background are spliced into the uber buffers; their instances join the TLAS
+	if (accelManager->PublishCompletedBLASes(cmdList) > 0)
+	{
+		accelManager->UpdateTLAS(m_ModelInstances);
+		if (accelManager->StaticGeometrySrvsNeedUpdate())
+		{
+			UpdateStaticGeometryDescriptors();
+		}
+		m_tlasDirty = true;
+	}
+
 	if (m_sceneDataDirty)
 	{
 		m_materialBuffer.Sync(m_pRenderEngine, cmdList, m_materials.data(), m_materials.size());
@@ -602,8 +623,8 @@ void SceneOne::Update(void)
 			inst.InverseTransform = XMMatrixInverse(nullptr, inst.Transform);
 		}
 
-		//accelManager->RefitTLAS(m_ModelInstances);
-		accelManager->BuildTLAS(m_ModelInstances);
+		// Refits while instances only move; rebuilds when one is added or the tree degrades
+		accelManager->UpdateTLAS(m_ModelInstances);
 		OnViewChanged();
 	}
 
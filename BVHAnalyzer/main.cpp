@@ -0,0 +1,172 @@
+// Offline BVH quality analyzer: builds the BLAS of a glTF model with every available builder and prints
+// a comparison of build time, SAH cost, end-point overlap, sibling overlap, leaf sizes and memory.
+// No window or D3D12 device is created.
+//
+// usage: BVHAnalyzer <model.gltf|glb> [-treelets passes] [-width 2|4|8] [-compressed] [-leafsize n] [-noepo]
+
+#include "IApplication.h"
+#include "CoreHelper Files/AccelerationStructureManager.h"
+#include "RenderEngine Files/Timer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// D3D.cpp (pulled in through gpFile) references the application factory; there is none here.
+std::unique_ptr<IApplication> CreateApplication()
+{
+    return nullptr;
+}
+
+struct AnalyzerOptions
+{
+    std::string ModelPath;
+    BVHOptimizeSettings Optimize;
+    CpuBVHLayout Layout = CpuBVHLayout::BVH4;
+    uint32_t MaxLeafSize = 4;
+    bool ComputeEPO = true;
+};
+
+struct BuilderConfig
+{
+    const char* Name;
+    BVHBuildSettings Settings;
+};
+
+static void PrintUsage()
+{
+    printf("usage: BVHAnalyzer <model.gltf|glb> [-treelets passes] [-width 2|4|8] [-compressed] [-leafsize n] [-noepo]\n");
+}
+
+static bool ParseArguments(int argc, char* argv[], AnalyzerOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        bool hasValue = (i + 1) < argc;
+
+        if (strcmp(arg, "-treelets") == 0 && hasValue) options.Optimize.TreeletPasses = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(arg, "-noepo") == 0) options.ComputeEPO = false;
+        else if (strcmp(arg, "-leafsize") == 0 && hasValue) options.MaxLeafSize = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(arg, "-width") == 0 && hasValue)
+        {
+            int width = atoi(argv[++i]);
+            if (width == 2) options.Layout = CpuBVHLayout::Binary;
+            else if (width == 4) options.Layout = CpuBVHLayout::BVH4;
+            else if (width == 8) options.Layout = CpuBVHLayout::BVH8;
+            else return false;
+        }
+        else if (strcmp(arg, "-compressed") == 0) options.Layout = CpuBVHLayout::Compressed;
+        else if (arg[0] != '-' && options.ModelPath.empty()) options.ModelPath = arg;
+        else return false;
+    }
+    return !options.ModelPath.empty() && options.MaxLeafSize > 0;
+}
+
+static std::vector<BuilderConfig> GetBuilderConfigs()
+{
+    std::vector<BuilderConfig> configs(4);
+
+    configs[0].Name = "Binned SAH";
+    configs[0].Settings.Mode = BVHBuildMode::BinnedSAH;
+
+    configs[1].Name = "SBVH";
+    configs[1].Settings.Mode = BVHBuildMode::SpatialSplits;
+
+    configs[2].Name = "LBVH";
+    configs[2].Settings.Mode = BVHBuildMode::Linear;
+
+    configs[3].Name = "HLBVH";
+    configs[3].Settings.Mode = BVHBuildMode::Linear;
+    configs[3].Settings.SAHTopLevelBits = 15;
+
+    return configs;
+}
+
+int main(int argc, char* argv[])
+{
+    AnalyzerOptions options;
+    if (!ParseArguments(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    fopen_s(&gpFile, gszLogFileName, "w");
+
+    // 1. Load the model on the CPU only
+    Model model;
+    ModelLoader loader;
+    if (FAILED(loader.LoadGLTF(nullptr, options.ModelPath, model)))
+    {
+        printf("Failed to load model '%s'\n", options.ModelPath.c_str());
+        return 1;
+    }
+
+    // 2. Build and analyze with every builder. Each one gets its own manager so the BLAS cache starts empty.
+    std::vector<BuilderConfig> configs = GetBuilderConfigs();
+    std::vector<BLASStats> results(configs.size());
+    std::vector<float> buildTimes(configs.size(), 0.0f);
+
+    for (size_t i = 0; i < configs.size(); ++i)
+    {
+        auto accelManager = std::make_unique<AccelerationStructureManager>();
+        configs[i].Settings.MaxLeafSize = options.MaxLeafSize;
+        accelManager->SetBLASBuildSettings(configs[i].Settings);
+        accelManager->SetBLASOptimizeSettings(options.Optimize);
+        accelManager->SetCpuBVHLayout(options.Layout);
+
+        Timer buildTimer;
+        const BuiltBLAS* blas = accelManager->GetOrBuildBLAS(nullptr, &model);
+        buildTimes[i] = buildTimer.ElapsedMillis();
+        if (!blas)
+        {
+            printf("%s: failed to build a BLAS for '%s'\n", configs[i].Name, options.ModelPath.c_str());
+            return 1;
+        }
+
+        results[i] = accelManager->AnalyzeBLAS(blas, options.ComputeEPO);
+    }
+
+    // 3. Comparison table
+    printf("\n%s\n\n", options.ModelPath.c_str());
+    printf("%-12s %10s %9s %9s %6s %9s %9s %8s %8s %8s %10s %10s\n",
+        "Builder", "Build ms", "Nodes", "Leaves", "Depth", "Tris/Leaf", "Tris", "SAH", "EPO", "Overlap", "Nodes MB", "CPU MB");
+    for (size_t i = 0; i < configs.size(); ++i)
+    {
+        const BLASStats& stats = results[i];
+        char epo[16] = "-";
+        if (options.ComputeEPO)
+        {
+            snprintf(epo, sizeof(epo), "%.3f", stats.epo);
+        }
+        printf("%-12s %10.2f %9u %9u %6u %9.2f %9u %8.2f %8s %8.3f %10.2f %10.2f\n",
+            configs[i].Name, buildTimes[i], stats.nodeCount, stats.leafNodeCount, stats.maxDepth, stats.averageTrianglesPerLeaf,
+            stats.triangleCount, stats.sahCost, epo, stats.siblingOverlap,
+            stats.nodeBytes / (1024.0 * 1024.0), stats.wideNodeBytes / (1024.0 * 1024.0));
+    }
+
+    // 4. Leaf size histograms
+    printf("\nLeaves by triangle count:\n");
+    for (size_t i = 0; i < configs.size(); ++i)
+    {
+        printf("%-12s", configs[i].Name);
+        const std::vector<uint32_t>& histogram = results[i].leafSizeHistogram;
+        for (size_t size = 1; size < histogram.size(); ++size)
+        {
+            if (histogram[size] > 0)
+            {
+                printf("  %zu:%u", size, histogram[size]);
+            }
+        }
+        printf("\n");
+    }
+
+    if (gpFile)
+    {
+        fclose(gpFile);
+        gpFile = NULL;
+    }
+    return 0;
+}
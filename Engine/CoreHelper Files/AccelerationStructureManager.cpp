@@ -1,12 +1,522 @@
 #include "AccelerationStructureManager.h"
 #include "../RenderEngine Files/RenderEngine.h"
 #include "CommonFunction.h"
+#include "TaskScheduler.h"
+#include "CpuFeatures.h"
+#include "RayQuery.h"
+#include "../RenderEngine Files/Timer.h"
 #include <stack>
 #include <algorithm>
+#include <chrono>
 
 // Static instance for the singleton
 static std::unique_ptr<AccelerationStructureManager> s_instance;
 
+// =========================================================================
+// BLAS ANALYSIS HELPERS
+// =========================================================================
+
+namespace
+{
+    float BoxSurfaceArea(const XMFLOAT3& aabbMin, const XMFLOAT3& aabbMax)
+    {
+        float ex = aabbMax.x - aabbMin.x;
+        float ey = aabbMax.y - aabbMin.y;
+        float ez = aabbMax.z - aabbMin.z;
+        return 2.0f * (ex * ey + ex * ez + ey * ez);
+    }
+
+    // A BLAS in DFS order. The left child of an internal node at position p is at p + 1 and its right child at
+    // lastInSubtree[p + 1] + 1.
+    struct BLASLayout
+    {
+        std::vector<uint32_t> nodes;          // Global node index per position
+        std::vector<uint32_t> depths;
+        std::vector<uint32_t> lastInSubtree;  // Position of the last node of the subtree rooted at each position
+    };
+
+    void BuildBLASLayout(const std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth, BLASLayout& layout)
+    {
+        const uint32_t pos = static_cast<uint32_t>(layout.nodes.size());
+        layout.nodes.push_back(nodeIndex);
+        layout.depths.push_back(depth);
+        layout.lastInSubtree.push_back(pos);
+
+        const BVHNode& node = nodes[nodeIndex];
+        if (node.triangleCount == 0)
+        {
+            BuildBLASLayout(nodes, node.leftChildOrFirstTriangleIndex, depth + 1, layout);
+            BuildBLASLayout(nodes, node.leftChildOrFirstTriangleIndex + 1, depth + 1, layout);
+        }
+        layout.lastInSubtree[pos] = static_cast<uint32_t>(layout.nodes.size()) - 1;
+    }
+
+    template <typename NodeType>
+    uint32_t CountWideNodes(const std::vector<NodeType>& nodes, uint32_t rootIndex)
+    {
+        uint32_t count = 0;
+        std::vector<uint32_t> stack = { rootIndex };
+        while (!stack.empty())
+        {
+            const NodeType& node = nodes[stack.back()];
+            stack.pop_back();
+            count++;
+            for (int i = 0; i < NodeType::WIDTH; ++i)
+            {
+                if (node.Child[i] >= 0 && node.PrimitiveCount[i] == 0)
+                {
+                    stack.push_back(static_cast<uint32_t>(node.Child[i]));
+                }
+            }
+        }
+        return count;
+    }
+
+    // When an append does not fit, grow by at least half so that importing models one by one reallocates the uber
+    // arrays a logarithmic number of times.
+    template <typename T>
+    void ReserveForAppend(std::vector<T>& values, size_t extra)
+    {
+        const size_t required = values.size() + extra;
+        if (required > values.capacity())
+        {
+            values.reserve((std::max)(required, values.capacity() + values.capacity() / 2));
+        }
+    }
+
+    // Resizes an uber array to its allocator's size. Memory is given back only once the array has shrunk to a
+    // quarter of its capacity, so releasing and importing models in turn does not reallocate every time.
+    template <typename T>
+    void ResizeUberArray(std::vector<T>& values, size_t size)
+    {
+        if (size > values.size())
+        {
+            ReserveForAppend(values, size - values.size());
+        }
+        values.resize(size);
+        if (size < values.capacity() / 4)
+        {
+            values.shrink_to_fit();
+        }
+    }
+
+    float TriangleArea(const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c)
+    {
+        XMVECTOR v0 = XMLoadFloat3(&a);
+        XMVECTOR cross = XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&b), v0), XMVectorSubtract(XMLoadFloat3(&c), v0));
+        return 0.5f * XMVectorGetX(XMVector3Length(cross));
+    }
+
+    // Area of the part of the triangle inside the box (Sutherland-Hodgman against the six slab planes).
+    float ClippedTriangleArea(const TrianglePositions& tri, const XMFLOAT3& boxMin, const XMFLOAT3& boxMax)
+    {
+        const int MAX_POLYGON = 9; // A triangle clipped by six planes has at most 9 vertices
+        XMFLOAT3 polygon[MAX_POLYGON] = { tri.v0, tri.v1, tri.v2 };
+        int count = 3;
+
+        for (int plane = 0; plane < 6 && count > 0; ++plane)
+        {
+            const int axis = plane >> 1;
+            const bool isMax = (plane & 1) != 0;
+            const float bound = isMax ? (&boxMax.x)[axis] : (&boxMin.x)[axis];
+
+            XMFLOAT3 clipped[MAX_POLYGON];
+            int clippedCount = 0;
+            for (int i = 0; i < count; ++i)
+            {
+                const XMFLOAT3& current = polygon[i];
+                const XMFLOAT3& next = polygon[(i + 1) % count];
+                float dCurrent = isMax ? bound - (&current.x)[axis] : (&current.x)[axis] - bound;
+                float dNext = isMax ? bound - (&next.x)[axis] : (&next.x)[axis] - bound;
+
+                if (dCurrent >= 0.0f && clippedCount < MAX_POLYGON)
+                {
+                    clipped[clippedCount++] = current;
+                }
+                if ((dCurrent >= 0.0f) != (dNext >= 0.0f) && clippedCount < MAX_POLYGON)
+                {
+                    float t = dCurrent / (dCurrent - dNext);
+                    clipped[clippedCount++] = {
+                        current.x + (next.x - current.x) * t,
+                        current.y + (next.y - current.y) * t,
+                        current.z + (next.z - current.z) * t };
+                }
+            }
+
+            count = clippedCount;
+            for (int i = 0; i < count; ++i)
+            {
+                polygon[i] = clipped[i];
+            }
+        }
+
+        float area = 0.0f;
+        for (int i = 1; i + 1 < count; ++i)
+        {
+            area += TriangleArea(polygon[0], polygon[i], polygon[i + 1]);
+        }
+        return area;
+    }
+
+    // End-point overlap (Aila, Karras and Laine, "On Quality Metrics of Bounding Volume Hierarchies", 2013):
+    // for every node, the area of the triangles that are not in its subtree but lie inside its box, weighted by
+    // the node's cost and divided by the total triangle area. Spatial split duplicates are copies of the same source
+    // triangle, so they are merged first and a node owns a triangle if any copy is in its subtree.
+    // sourceTriangles: the BLAS's slot-to-model-triangle map (BuiltBLAS::SourceTriangles).
+    float ComputeEndPointOverlap(const std::vector<BVHNode>& nodes, const std::vector<TrianglePositions>& triangles, uint32_t baseTriangleIndex,
+        const std::vector<uint32_t>& sourceTriangles, const BLASLayout& layout)
+    {
+        // 1. Group the leaf slots by triangle and remember where each copy lives
+        struct TriangleCopies
+        {
+            uint32_t slot;
+            std::vector<uint32_t> leafPositions;
+        };
+        std::vector<TriangleCopies> uniqueTriangles;
+        std::vector<uint32_t> triangleIds; // Per source triangle, its entry in uniqueTriangles
+        if (!sourceTriangles.empty())
+        {
+            triangleIds.assign(*std::max_element(sourceTriangles.begin(), sourceTriangles.end()) + size_t(1), UINT32_MAX);
+        }
+
+        for (uint32_t pos = 0; pos < layout.nodes.size(); ++pos)
+        {
+            const BVHNode& node = nodes[layout.nodes[pos]];
+            for (int i = 0; i < node.triangleCount; ++i)
+            {
+                const uint32_t localSlot = node.leftChildOrFirstTriangleIndex + i;
+                const uint32_t slot = baseTriangleIndex + localSlot;
+                if (localSlot >= sourceTriangles.size())
+                {
+                    uniqueTriangles.push_back({ slot, { pos } });
+                    continue;
+                }
+
+                uint32_t& id = triangleIds[sourceTriangles[localSlot]];
+                if (id == UINT32_MAX)
+                {
+                    id = static_cast<uint32_t>(uniqueTriangles.size());
+                    uniqueTriangles.push_back({ slot, {} });
+                }
+                uniqueTriangles[id].leafPositions.push_back(pos);
+            }
+        }
+
+        // 2. Walk the nodes overlapping each triangle; chunk sums are added in order so the result is deterministic
+        const uint32_t GRAIN_SIZE = 1024;
+        const uint32_t triangleTotal = static_cast<uint32_t>(uniqueTriangles.size());
+        const uint32_t chunkCount = (triangleTotal + GRAIN_SIZE - 1) / GRAIN_SIZE;
+        std::vector<double> overlapPerChunk(chunkCount, 0.0);
+        std::vector<double> areaPerChunk(chunkCount, 0.0);
+
+        TaskScheduler::Get()->ParallelFor(triangleTotal, GRAIN_SIZE, [&](uint32_t begin, uint32_t end)
+        {
+            double overlap = 0.0, area = 0.0;
+            std::vector<uint32_t> stack;
+            for (uint32_t t = begin; t < end; ++t)
+            {
+                const TriangleCopies& copies = uniqueTriangles[t];
+                const TrianglePositions& tri = triangles[copies.slot];
+                const float triangleArea = TriangleArea(tri.v0, tri.v1, tri.v2);
+                area += triangleArea;
+
+                XMFLOAT3 triMin = { min(tri.v0.x, min(tri.v1.x, tri.v2.x)), min(tri.v0.y, min(tri.v1.y, tri.v2.y)), min(tri.v0.z, min(tri.v1.z, tri.v2.z)) };
+                XMFLOAT3 triMax = { max(tri.v0.x, max(tri.v1.x, tri.v2.x)), max(tri.v0.y, max(tri.v1.y, tri.v2.y)), max(tri.v0.z, max(tri.v1.z, tri.v2.z)) };
+
+                stack.assign(1, 0);
+                while (!stack.empty())
+                {
+                    const uint32_t pos = stack.back();
+                    stack.pop_back();
+
+                    const BVHNode& node = nodes[layout.nodes[pos]];
+                    if (triMin.x > node.aabbMax.x || triMax.x < node.aabbMin.x ||
+                        triMin.y > node.aabbMax.y || triMax.y < node.aabbMin.y ||
+                        triMin.z > node.aabbMax.z || triMax.z < node.aabbMin.z)
+                        continue;
+
+                    bool owned = false;
+                    for (uint32_t leafPos : copies.leafPositions)
+                    {
+                        owned |= leafPos >= pos && leafPos <= layout.lastInSubtree[pos];
+                    }
+                    if (!owned)
+                    {
+                        // Only triangles crossing the box boundary need clipping
+                        bool inside = triMin.x >= node.aabbMin.x && triMax.x <= node.aabbMax.x &&
+                            triMin.y >= node.aabbMin.y && triMax.y <= node.aabbMax.y &&
+                            triMin.z >= node.aabbMin.z && triMax.z <= node.aabbMax.z;
+                        float cost = node.triangleCount > 0 ? (float)node.triangleCount : 1.0f;
+                        overlap += cost * (inside ? triangleArea : ClippedTriangleArea(tri, node.aabbMin, node.aabbMax));
+                    }
+
+                    if (node.triangleCount == 0)
+                    {
+                        stack.push_back(pos + 1);
+                        stack.push_back(layout.lastInSubtree[pos + 1] + 1);
+                    }
+                }
+            }
+            overlapPerChunk[begin / GRAIN_SIZE] = overlap;
+            areaPerChunk[begin / GRAIN_SIZE] = area;
+        });
+
+        double totalOverlap = 0.0, totalArea = 0.0;
+        for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+        {
+            totalOverlap += overlapPerChunk[chunk];
+            totalArea += areaPerChunk[chunk];
+        }
+        return totalArea > 0.0 ? static_cast<float>(totalOverlap / totalArea) : 0.0f;
+    }
+
+    // Topology, SAH and sibling overlap of the binary tree rooted at nodes[rootIndex], shared by the BLAS and
+    // TLAS analyses (a TLAS leaf counts its single instance as a triangle). Returns the number of leaf items.
+    uint64_t AnalyzeTree(const std::vector<BVHNode>& nodes, uint32_t rootIndex, BLASLayout& layout, BLASStats& stats)
+    {
+        // The subtree of position p is [p, lastInSubtree[p]]
+        BuildBLASLayout(nodes, rootIndex, 1, layout);
+
+        uint64_t totalTrianglesInLeaves = 0;
+        double sahSum = 0.0;
+        double overlapSum = 0.0;
+
+        for (size_t pos = 0; pos < layout.nodes.size(); ++pos)
+        {
+            const BVHNode& node = nodes[layout.nodes[pos]];
+            const float area = BoxSurfaceArea(node.aabbMin, node.aabbMax);
+
+            stats.nodeCount++;
+            stats.maxDepth = max(stats.maxDepth, layout.depths[pos]);
+
+            if (node.triangleCount > 0) // It's a leaf node
+            {
+                stats.leafNodeCount++;
+                stats.minTrianglesPerLeaf = min(stats.minTrianglesPerLeaf, (uint32_t)node.triangleCount);
+                stats.maxTrianglesPerLeaf = max(stats.maxTrianglesPerLeaf, (uint32_t)node.triangleCount);
+                totalTrianglesInLeaves += node.triangleCount;
+
+                if (stats.leafSizeHistogram.size() <= (size_t)node.triangleCount)
+                {
+                    stats.leafSizeHistogram.resize(node.triangleCount + 1, 0);
+                }
+                stats.leafSizeHistogram[node.triangleCount]++;
+                sahSum += (double)area * node.triangleCount;
+            }
+            else // It's an internal node
+            {
+                stats.internalNodeCount++;
+                sahSum += area;
+
+                const BVHNode& left = nodes[node.leftChildOrFirstTriangleIndex];
+                const BVHNode& right = nodes[node.leftChildOrFirstTriangleIndex + 1];
+                XMFLOAT3 overlapMin = { max(left.aabbMin.x, right.aabbMin.x), max(left.aabbMin.y, right.aabbMin.y), max(left.aabbMin.z, right.aabbMin.z) };
+                XMFLOAT3 overlapMax = { min(left.aabbMax.x, right.aabbMax.x), min(left.aabbMax.y, right.aabbMax.y), min(left.aabbMax.z, right.aabbMax.z) };
+                if (overlapMin.x <= overlapMax.x && overlapMin.y <= overlapMax.y && overlapMin.z <= overlapMax.z)
+                {
+                    overlapSum += BoxSurfaceArea(overlapMin, overlapMax);
+                }
+            }
+        }
+
+        if (stats.leafNodeCount > 0)
+        {
+            stats.averageTrianglesPerLeaf = static_cast<float>(totalTrianglesInLeaves) / stats.leafNodeCount;
+        }
+        else
+        {
+            stats.minTrianglesPerLeaf = 0; // Handle case with no leaves
+        }
+
+        const BVHNode& root = nodes[rootIndex];
+        const float rootArea = BoxSurfaceArea(root.aabbMin, root.aabbMax);
+        if (rootArea > 0.0f)
+        {
+            stats.sahCost = static_cast<float>(sahSum / rootArea);
+            stats.siblingOverlap = static_cast<float>(overlapSum / rootArea);
+        }
+
+        // Memory of the binary nodes
+        stats.triangleCount = static_cast<uint32_t>(totalTrianglesInLeaves);
+        stats.nodeBytes = (uint64_t)stats.nodeCount * sizeof(BVHNode);
+
+        return totalTrianglesInLeaves;
+    }
+}
+
+// =========================================================================
+// BLAS BUILD CONTEXT
+// =========================================================================
+
+// Everything a BLAS build needs besides the uber arrays, so that builds can also run off the main thread.
+struct BLASBuildContext
+{
+    // Settings at the time of the request
+    BVHBuildSettings BuildSettings;
+    BVHOptimizeSettings OptimizeSettings;
+    std::filesystem::path CacheDirectory;
+
+    // Temporaries
+    std::vector<Triangle> Triangles;
+    std::vector<BVHNode> Nodes;
+    std::vector<TrianglePositions> Positions;
+    std::vector<TriangleAttributes> Attributes;
+    std::vector<uint32_t> SourceTriangles;
+    BLASCacheFile CacheFile;
+
+    // Output of PrepareBLAS: the arrays to splice, in the temporaries above or in the mapped cache file. A failed
+    // build has nothing to splice.
+    HRESULT Result = S_OK;
+    BLASCacheData Prepared;
+    bool CacheHit = false;
+    bool CacheWriteFailed = false;
+    bool Optimized = false;
+    BVHOptimizeStats OptimizeStats;
+};
+
+// A background build. Finished is set by the worker, Published by the main thread once the BLAS is spliced.
+struct PendingBLASBuild
+{
+    Model* SourceModel = nullptr;
+    BLASBuildContext Context;
+
+    std::promise<void> FinishedPromise;
+    std::future<void> Finished;
+    std::promise<const BuiltBLAS*> PublishedPromise;
+    std::shared_future<const BuiltBLAS*> Published;
+};
+
+namespace
+{
+    // Gathers the model's triangles and loads them from the on-disk cache or builds the BLAS in local space.
+    // Touches nothing but the model (read-only) and the context, so it may run on any thread.
+    void PrepareBLAS(const Model& model, BLASBuildContext& context, TaskScheduler* scheduler)
+    {
+        context.Result = S_OK;
+        context.CacheHit = false;
+        context.CacheWriteFailed = false;
+        context.Optimized = false;
+
+        // 1. Gather the triangles into the reused build array
+        std::vector<Triangle>& modelTriangles = context.Triangles;
+        AccelerationStructureManager::GatherTriangles(model, modelTriangles);
+        const size_t triangleCount = modelTriangles.size();
+
+        // 2. Look the geometry up in the on-disk cache before building
+        uint64_t cacheKey = 0;
+        std::filesystem::path cachePath;
+        if (!context.CacheDirectory.empty())
+        {
+            cacheKey = BLASCache::ComputeKey(modelTriangles, context.BuildSettings, context.OptimizeSettings);
+            cachePath = BLASCache::GetFilePath(context.CacheDirectory, cacheKey);
+            HRESULT hr = context.CacheFile.Open(cachePath, cacheKey, static_cast<uint32_t>(modelTriangles.size()));
+            context.CacheHit = (hr == S_OK);
+            if (FAILED(hr) && gpFile)
+            {
+                fprintf(gpFile, "BLAS cache: ignoring unreadable or stale file %s (0x%08X)\n", cachePath.string().c_str(), (unsigned)hr);
+            }
+        }
+
+        if (context.CacheHit)
+        {
+            // 3a. Splice straight from the mapped file
+            context.Prepared = context.CacheFile.GetData();
+            return;
+        }
+
+        // 3b. Build the BLAS in local space.
+        // With spatial splits the builder may append duplicated triangles, so the count is only known afterwards.
+        std::vector<BVHNode>& blasNodes = context.Nodes;
+        BVHBuilder::Build(modelTriangles, blasNodes, 0, context.BuildSettings, scheduler, &context.SourceTriangles);
+
+        if (context.OptimizeSettings.TreeletPasses > 0)
+        {
+            context.OptimizeStats = BVHOptimizer::OptimizeTreelets(blasNodes, context.OptimizeSettings, scheduler);
+            context.Optimized = true;
+        }
+
+        // The builders and the optimizer stay within the traversal stacks; a deeper tree would lose hits on the GPU
+        const uint32_t depth = BVHBuilder::ComputeDepth(blasNodes);
+        if (depth > BVHBuilder::MAX_DEPTH)
+        {
+            context.Result = E_FAIL;
+            if (gpFile) fprintf(gpFile, "BLAS build: %u levels exceed the traversal limit of %u\n", depth, BVHBuilder::MAX_DEPTH);
+            return;
+        }
+
+        // Split into the position array walked by traversal and the attributes read for the closest hit
+        const uint32_t builtTriangleCount = static_cast<uint32_t>(modelTriangles.size());
+        context.Positions.resize(builtTriangleCount);
+        context.Attributes.resize(builtTriangleCount);
+        scheduler->ParallelFor(builtTriangleCount, 4096, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                const Triangle& tri = modelTriangles[i];
+                context.Positions[i] = { tri.v0, tri.v1, tri.v2 };
+                context.Attributes[i] = { tri.MaterialIndex, tri.n0, tri.n1, tri.n2, tri.tc0, tri.tc1, tri.tc2 };
+            }
+        });
+
+        BLASCacheData& prepared = context.Prepared;
+        prepared.Key = cacheKey;
+        prepared.SourceTriangleCount = static_cast<uint32_t>(triangleCount);
+        prepared.TriangleCount = builtTriangleCount;
+        prepared.NodeCount = static_cast<uint32_t>(blasNodes.size());
+        prepared.BuildSAHCost = BVHOptimizer::ComputeSAHCost(blasNodes);
+        prepared.Positions = context.Positions.data();
+        prepared.Attributes = context.Attributes.data();
+        prepared.Nodes = blasNodes.data();
+        prepared.SourceTriangles = context.SourceTriangles.data();
+
+        // 4. Write misses back to the cache
+        if (!context.CacheDirectory.empty())
+        {
+            HRESULT hr = BLASCache::Write(cachePath, prepared);
+            if (FAILED(hr))
+            {
+                context.CacheWriteFailed = true;
+                if (gpFile) fprintf(gpFile, "BLAS cache: failed to write %s (0x%08X)\n", cachePath.string().c_str(), (unsigned)hr);
+            }
+        }
+    }
+}
+
+void AccelerationStructureManager::ReleaseBuildScratch()
+{
+    m_buildContext.reset();
+    BVHBuilder::ReleaseThreadScratch();
+}
+
+HRESULT AccelerationStructureManager::SetBLASCacheDirectory(const std::string& directory)
+{
+    if (directory.empty())
+    {
+        m_blasCacheDirectory.clear();
+        return S_OK;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error)
+    {
+        if (gpFile) fprintf(gpFile, "BLAS cache: cannot create directory %s\n", directory.c_str());
+        m_blasCacheDirectory.clear();
+        return HRESULT_FROM_WIN32(error.value());
+    }
+
+    m_blasCacheDirectory = directory;
+    return S_OK;
+}
+
+AccelerationStructureManager::AccelerationStructureManager() = default;
+
+AccelerationStructureManager::~AccelerationStructureManager()
+{
+    // Background builds hold pointers into the manager's jobs
+    WaitForBLASBuilds();
+}
+
 AccelerationStructureManager* AccelerationStructureManager::Get()
 {
     if (!s_instance) {
@@ -20,7 +530,8 @@ HRESULT AccelerationStructureManager::Initialize(ID3D12Device* device, RenderEng
     m_device = device;
     m_pRenderEngine = engine;
 
-    m_uberTriangleBuffer.Stride = sizeof(Triangle);
+    m_uberTriangleBuffer.Stride = sizeof(TrianglePositions);
+    m_uberTriangleAttributeBuffer.Stride = sizeof(TriangleAttributes);
     m_uberBlasNodeBuffer.Stride = sizeof(BVHNode);
     m_tlasNodeBuffer.Stride = sizeof(BVHNode);
     m_instanceDataBuffer.Stride = sizeof(ModelInstanceGPUData);
@@ -36,81 +547,120 @@ const BuiltBLAS* AccelerationStructureManager::GetOrBuildBLAS(ID3D12GraphicsComm
         return it->second.get();
     }
 
+    // Already queued in the background: finish it instead of building twice
+    for (const auto& job : m_pendingBlasBuilds)
+    {
+        if (job->SourceModel == model)
+        {
+            job->Finished.wait();
+            PublishCompletedBLASes(cmdList);
+            return GetCachedBLAS(model);
+        }
+    }
+
     return BuildBLASFromModel(cmdList, model);
 }
 
-const BuiltBLAS* AccelerationStructureManager::GetCachedBLAS(const Model* model) const
+std::shared_future<const BuiltBLAS*> AccelerationStructureManager::BuildBLASAsync(Model* model)
 {
-    auto it = m_blasCache.find(model);
-    if (it != m_blasCache.end())
+    const BuiltBLAS* cached = GetCachedBLAS(model);
+    if (cached || !model)
     {
-        return it->second.get();
+        std::promise<const BuiltBLAS*> ready;
+        ready.set_value(cached);
+        return ready.get_future().share();
     }
-    
-    return nullptr;
-}
 
-BLASStats AccelerationStructureManager::AnalyzeBLAS(const BuiltBLAS* blas)
-{
-    BLASStats stats = {};
-    if (!blas || blas->BaseNodeIndex >= m_allBlasNodes.size())
+    for (const auto& job : m_pendingBlasBuilds)
     {
-        stats.minTrianglesPerLeaf = 0;
-        return stats;
+        if (job->SourceModel == model)
+            return job->Published;
     }
 
-    std::stack<std::pair<uint32_t, uint32_t>> stack; // Pair: {node global index, depth}
-    stack.push({ blas->BaseNodeIndex, 1 });
+    // 1. The pool is started on first use. The main thread never helps it (WaitForBLASBuilds blocks on the jobs
+    //    instead of waiting on the group), so every thread is a worker.
+    if (!m_backgroundScheduler)
+    {
+        const uint32_t workerCount = (std::max)(1u, std::thread::hardware_concurrency() / 2);
+        m_backgroundScheduler = std::make_unique<TaskScheduler>(workerCount, false);
+        m_backgroundBuilds = std::make_unique<TaskGroup>(m_backgroundScheduler.get());
+    }
 
-    uint64_t totalTrianglesInLeaves = 0;
+    // 2. The job takes a copy of the settings
+    auto job = std::make_unique<PendingBLASBuild>();
+    job->SourceModel = model;
+    job->Context.BuildSettings = m_blasBuildSettings;
+    job->Context.OptimizeSettings = m_blasOptimizeSettings;
+    job->Context.CacheDirectory = m_blasCacheDirectory;
+    job->Finished = job->FinishedPromise.get_future();
+    job->Published = job->PublishedPromise.get_future().share();
 
-    while (!stack.empty())
+    // 3. Queue it; the uber arrays are left to PublishCompletedBLASes
+    PendingBLASBuild* pendingBuild = job.get();
+    TaskScheduler* scheduler = m_backgroundScheduler.get();
+    m_backgroundBuilds->Run([pendingBuild, scheduler]()
     {
-        auto [currentNodeIndex, currentDepth] = stack.top();
-        stack.pop();
+        PrepareBLAS(*pendingBuild->SourceModel, pendingBuild->Context, scheduler);
+        pendingBuild->FinishedPromise.set_value();
+    });
 
-        stats.nodeCount++;
-        stats.maxDepth = max(stats.maxDepth, currentDepth);
-
-        const BVHNode& node = m_allBlasNodes[currentNodeIndex];
+    std::shared_future<const BuiltBLAS*> published = job->Published;
+    m_pendingBlasBuilds.push_back(std::move(job));
+    return published;
+}
 
-        if (node.triangleCount > 0) // It's a leaf node
+uint32_t AccelerationStructureManager::PublishCompletedBLASes(ID3D12GraphicsCommandList* cmdList)
+{
+    // Splice every finished build in request order, then upload once
+    uint32_t publishedCount = 0;
+    for (auto it = m_pendingBlasBuilds.begin(); it != m_pendingBlasBuilds.end();)
+    {
+        PendingBLASBuild& job = **it;
+        if (job.Finished.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
         {
-            stats.leafNodeCount++;
-            stats.minTrianglesPerLeaf = min(stats.minTrianglesPerLeaf, (uint32_t)node.triangleCount);
-            stats.maxTrianglesPerLeaf = max(stats.maxTrianglesPerLeaf, (uint32_t)node.triangleCount);
-            totalTrianglesInLeaves += node.triangleCount;
+            ++it;
+            continue;
         }
-        else // It's an internal node
-        {
-            stats.internalNodeCount++;
-            // Push children onto the stack to be processed.
-            uint32_t leftChildIndex = node.leftChildOrFirstTriangleIndex;
-            uint32_t rightChildIndex = leftChildIndex + 1;
 
-            if (leftChildIndex < m_allBlasNodes.size()) stack.push({ leftChildIndex, currentDepth + 1 });
-            if (rightChildIndex < m_allBlasNodes.size()) stack.push({ rightChildIndex, currentDepth + 1 });
-        }
+        const BuiltBLAS* blas = SpliceBLAS(job.SourceModel, job.Context);
+        job.PublishedPromise.set_value(blas);
+        it = m_pendingBlasBuilds.erase(it);
+        if (blas) publishedCount++;
     }
 
-    if (stats.leafNodeCount > 0)
+    if (publishedCount > 0)
     {
-        stats.averageTrianglesPerLeaf = static_cast<float>(totalTrianglesInLeaves) / stats.leafNodeCount;
+        SyncBLASGpuBuffers(cmdList);
     }
-    else
+    return publishedCount;
+}
+
+void AccelerationStructureManager::WaitForBLASBuilds()
+{
+    // Block on the jobs themselves: TaskGroup::Wait would run queued builds on this thread
+    for (const auto& job : m_pendingBlasBuilds)
     {
-        stats.minTrianglesPerLeaf = 0; // Handle case with no leaves
+        job->Finished.wait();
     }
-
-    return stats;
 }
 
-const BuiltBLAS* AccelerationStructureManager::BuildBLASFromModel(ID3D12GraphicsCommandList* cmdList, Model* model)
+void AccelerationStructureManager::GatherTriangles(const Model& model, std::vector<Triangle>& outTriangles)
 {
-    std::vector<Triangle> modelTriangles;
+    // Sized up front, as the array is reused between builds
+    size_t triangleCount = 0;
+    for (const auto& mesh : model.Meshes)
+    {
+        for (const auto& primitive : mesh.Primitives)
+        {
+            triangleCount += primitive.IndexCount / 3;
+        }
+    }
+
+    outTriangles.resize(triangleCount);
+    size_t triangleIndex = 0;
 
     // Go through each mesh in the model
-    for (const auto& mesh : model->Meshes)
+    for (const auto& mesh : model.Meshes)
     {
         // Go through each primitive (sub-mesh with a material) in the mesh
         for (const auto& primitive : mesh.Primitives)
@@ -119,9 +669,9 @@ const BuiltBLAS* AccelerationStructureManager::BuildBLASFromModel(ID3D12Graphics
             const auto& indices = mesh.Indices;
 
             // Process the indices for this primitive only
-            for (size_t i = 0; i < primitive.IndexCount; i += 3)
+            for (size_t i = 0; i + 2 < primitive.IndexCount; i += 3)
             {
-                Triangle tri = {};
+                Triangle& tri = outTriangles[triangleIndex++];
 
                 // Get indices relative to this primitive's start location
                 uint32_t i0 = indices[primitive.StartIndexLocation + i + 0];
@@ -150,85 +700,741 @@ const BuiltBLAS* AccelerationStructureManager::BuildBLASFromModel(ID3D12Graphics
                 else {
                     tri.MaterialIndex = 0; // Default material if none is specified
                 }
-
-                modelTriangles.push_back(tri);
             }
         }
     }
+}
 
-    // 2. Build the BLAS in local space
-    std::vector<BVHNode> blasNodes;
-    uint32_t baseTriangleIndex = static_cast<uint32_t>(m_allTriangles.size());
-    BVHBuilder::Build(modelTriangles, blasNodes, baseTriangleIndex);
+const BuiltBLAS* AccelerationStructureManager::GetCachedBLAS(const Model* model) const
+{
+    auto it = m_blasCache.find(model);
+    if (it != m_blasCache.end())
+    {
+        return it->second.get();
+    }
+    
+    return nullptr;
+}
 
-    // 3. Store the results and update the uber-buffers
-    auto builtBlas = std::make_unique<BuiltBLAS>();
-    builtBlas->BaseTriangleIndex = baseTriangleIndex;
-    builtBlas->BaseNodeIndex = static_cast<uint32_t>(m_allBlasNodes.size());
-    for (auto& node : blasNodes)
+BLASStats AccelerationStructureManager::AnalyzeBLAS(const BuiltBLAS* blas, bool computeEPO)
+{
+    BLASStats stats = {};
+    if (!blas || blas->BaseNodeIndex >= m_allBlasNodes.size())
     {
-        if (node.triangleCount == 0) 
-        {
-            node.leftChildOrFirstTriangleIndex += builtBlas->BaseNodeIndex;
-        }
-        else
-        {
-            node.leftChildOrFirstTriangleIndex += baseTriangleIndex;
-        }
+        stats.minTrianglesPerLeaf = 0;
+        return stats;
     }
-    builtBlas->RootNode = blasNodes.empty() ? BVHNode{} : blasNodes[0];
 
-    m_allTriangles.insert(m_allTriangles.end(), modelTriangles.begin(), modelTriangles.end());
-    m_allBlasNodes.insert(m_allBlasNodes.end(), blasNodes.begin(), blasNodes.end());
+    // 1. Lay the tree out in DFS order and walk it
+    BLASLayout layout;
+    uint64_t totalTrianglesInLeaves = AnalyzeTree(m_allBlasNodes, blas->BaseNodeIndex, layout, stats);
 
-    m_uberTriangleBuffer.Sync(m_pRenderEngine, cmdList, m_allTriangles.data(), m_allTriangles.size());
-    if (m_uberTriangleBuffer.GpuResourceDirty) {
-        m_staticGeometrySrvsDirty = true; 
-        if (m_uberTriangleBuffer.Resource) m_uberTriangleBuffer.Resource->SetName(L"Uber Triangle Buffer");
+    // 2. Memory
+    stats.triangleBytes = totalTrianglesInLeaves * (sizeof(TrianglePositions) + sizeof(TriangleAttributes));
+    if (m_cpuBvhLayout == CpuBVHLayout::BVH4 && blas->BaseWideNodeIndex < m_wideBlasNodes4.size())
+    {
+        stats.wideNodeBytes = (uint64_t)CountWideNodes(m_wideBlasNodes4, blas->BaseWideNodeIndex) * sizeof(BVH4Node);
+    }
+    else if (m_cpuBvhLayout == CpuBVHLayout::BVH8 && blas->BaseWideNodeIndex < m_wideBlasNodes8.size())
+    {
+        stats.wideNodeBytes = (uint64_t)CountWideNodes(m_wideBlasNodes8, blas->BaseWideNodeIndex) * sizeof(BVH8Node);
+    }
+    else if (m_cpuBvhLayout == CpuBVHLayout::Compressed && blas->BaseWideNodeIndex < m_compressedBlasNodes.size())
+    {
+        stats.wideNodeBytes = (uint64_t)stats.nodeCount * sizeof(CompressedBVHNode); // One per binary node
     }
 
-    m_uberBlasNodeBuffer.Sync(m_pRenderEngine, cmdList, m_allBlasNodes.data(), m_allBlasNodes.size());
-    if (m_uberBlasNodeBuffer.GpuResourceDirty) {
-        m_staticGeometrySrvsDirty = true; 
-        if (m_uberBlasNodeBuffer.Resource) m_uberBlasNodeBuffer.Resource->SetName(L"Uber BLAS Node Buffer");
+    // 3. End-point overlap
+    if (computeEPO)
+    {
+        stats.epo = ComputeEndPointOverlap(m_allBlasNodes, m_allTrianglePositions, blas->BaseTriangleIndex, blas->SourceTriangles, layout);
     }
 
-    // 4. Return a handle
-    const Model* modelKey = model;
-    m_blasCache[modelKey] = std::move(builtBlas);
-    return m_blasCache[modelKey].get();
+    return stats;
 }
 
-void AccelerationStructureManager::BuildTLAS(const std::vector<ModelInstance>& instances)
+BLASStats AccelerationStructureManager::AnalyzeTLAS()
 {
-    if (instances.empty())
+    BLASStats stats = {};
+    if (m_tlasNodes.empty())
     {
-        m_tlasNodes.clear();
-        return;
+        stats.minTrianglesPerLeaf = 0;
+        return stats;
     }
 
-    TLASBuilder::Build(instances, m_tlasNodes, this);
-}
+    BLASLayout layout;
+    AnalyzeTree(m_tlasNodes, 0, layout, stats);
 
-void AccelerationStructureManager::UpdateGpuBuffers(ID3D12GraphicsCommandList* cmdList, const std::vector<ModelInstance>& instances)
+    if (m_cpuBvhLayout == CpuBVHLayout::BVH4)
+    {
+        stats.wideNodeBytes = (uint64_t)m_wideTlasNodes4.size() * sizeof(BVH4Node);
+    }
+    else if (m_cpuBvhLayout == CpuBVHLayout::BVH8)
+    {
+        stats.wideNodeBytes = (uint64_t)m_wideTlasNodes8.size() * sizeof(BVH8Node);
+    }
+    return stats;
+}
+
+const BuiltBLAS* AccelerationStructureManager::BuildBLASFromModel(ID3D12GraphicsCommandList* cmdList, Model* model)
 {
-    std::vector<ModelInstanceGPUData> instanceGpuData;
-    if (!instances.empty())
+    // 1. Build (or load) with the temporaries kept between builds
+    if (!m_buildContext)
     {
-        instanceGpuData.reserve(instances.size());
-        for (const auto& inst : instances)
+        m_buildContext = std::make_unique<BLASBuildContext>();
+    }
+    BLASBuildContext& context = *m_buildContext;
+    context.BuildSettings = m_blasBuildSettings;
+    context.OptimizeSettings = m_blasOptimizeSettings;
+    context.CacheDirectory = m_blasCacheDirectory;
+    PrepareBLAS(*model, context, TaskScheduler::Get());
+
+    // 2. Splice it into the uber arrays.
+    // Headless (CPU-only) builds have no command list; the CPU arrays are all they need.
+    // Otherwise the upload waits for the next UpdateGpuBuffers.
+    const BuiltBLAS* blas = SpliceBLAS(model, context);
+    SyncBLASGpuBuffers(cmdList);
+    return blas;
+}
+
+const BuiltBLAS* AccelerationStructureManager::SpliceBLAS(const Model* model, BLASBuildContext& context)
+{
+    if (FAILED(context.Result))
+    {
+        return nullptr;
+    }
+
+    // 1. Take ranges of the uber arrays (holes first, else appended) and copy the arrays in; only the child
+    //    indices need rebasing. Leaf triangle indices stay relative to the BLAS; traversal adds the instance's
+    //    BaseTriangleIndex.
+    const BLASCacheData& prepared = context.Prepared;
+    auto builtBlas = std::make_unique<BuiltBLAS>();
+    builtBlas->TriangleCount = prepared.TriangleCount;
+    builtBlas->NodeCount = prepared.NodeCount;
+    builtBlas->SourceTriangles.assign(prepared.SourceTriangles, prepared.SourceTriangles + prepared.TriangleCount);
+    builtBlas->BuildSAHCost = prepared.BuildSAHCost;
+    builtBlas->SAHCost = prepared.BuildSAHCost;
+
+    builtBlas->BaseTriangleIndex = m_triangleRanges.Allocate(prepared.TriangleCount);
+    builtBlas->BaseNodeIndex = m_nodeRanges.Allocate(prepared.NodeCount);
+    ResizeBLASArrays();
+    for (uint32_t i = 0; i < prepared.NodeCount; ++i)
+    {
+        BVHNode& node = m_allBlasNodes[builtBlas->BaseNodeIndex + i];
+        node = prepared.Nodes[i];
+        if (node.triangleCount == 0)
         {
-            const BuiltBLAS* blas = GetCachedBLAS(inst.SourceModel);
-            if (!blas) continue;
+            node.leftChildOrFirstTriangleIndex += builtBlas->BaseNodeIndex;
+        }
+    }
+    std::copy(prepared.Positions, prepared.Positions + prepared.TriangleCount, m_allTrianglePositions.begin() + builtBlas->BaseTriangleIndex);
+    std::copy(prepared.Attributes, prepared.Attributes + prepared.TriangleCount, m_allTriangleAttributes.begin() + builtBlas->BaseTriangleIndex);
+    builtBlas->RootNode = builtBlas->NodeCount == 0 ? BVHNode{} : m_allBlasNodes[builtBlas->BaseNodeIndex];
+
+    CollapseBLASForCpu(*builtBlas);
+    PackBLASTrianglesForCpu(*builtBlas);
+
+    // 2. Statistics of the build, kept for the main thread
+    if (!context.CacheDirectory.empty())
+    {
+        if (context.CacheHit)
+        {
+            m_blasCacheStats.Hits++;
+        }
+        else
+        {
+            m_blasCacheStats.Misses++;
+            if (context.CacheWriteFailed) m_blasCacheStats.WriteFailures++;
+        }
+    }
+    if (context.Optimized)
+    {
+        m_lastBlasOptimizeStats = context.OptimizeStats;
+        if (gpFile)
+        {
+            fprintf(gpFile, "BLAS treelet optimization: SAH %.2f -> %.2f (%u treelets, %.2f ms)\n",
+                m_lastBlasOptimizeStats.SAHCostBefore, m_lastBlasOptimizeStats.SAHCostAfter,
+                m_lastBlasOptimizeStats.TreeletsRestructured, m_lastBlasOptimizeStats.OptimizeTimeMs);
+        }
+    }
+    context.CacheFile.Close();
+
+    // 3. Return a handle
+    const Model* modelKey = model;
+    m_blasCache[modelKey] = std::move(builtBlas);
+    return m_blasCache[modelKey].get();
+}
+
+void AccelerationStructureManager::ResizeBLASArrays()
+{
+    ResizeUberArray(m_allTrianglePositions, m_triangleRanges.GetSize());
+    ResizeUberArray(m_allTriangleAttributes, m_triangleRanges.GetSize());
+    ResizeUberArray(m_allBlasNodes, m_nodeRanges.GetSize());
+}
+
+void AccelerationStructureManager::SyncBLASGpuBuffers(ID3D12GraphicsCommandList* cmdList)
+{
+    if (!cmdList)
+    {
+        m_blasGpuBuffersStale = true;
+        return;
+    }
+    m_blasGpuBuffersStale = false;
+
+    m_uberTriangleBuffer.Sync(m_pRenderEngine, cmdList, m_allTrianglePositions.data(), m_allTrianglePositions.size());
+    if (m_uberTriangleBuffer.GpuResourceDirty) {
+        m_staticGeometrySrvsDirty = true; 
+        if (m_uberTriangleBuffer.Resource) m_uberTriangleBuffer.Resource->SetName(L"Uber Triangle Buffer");
+    }
+
+    m_uberTriangleAttributeBuffer.Sync(m_pRenderEngine, cmdList, m_allTriangleAttributes.data(), m_allTriangleAttributes.size());
+    if (m_uberTriangleAttributeBuffer.GpuResourceDirty) {
+        m_staticGeometrySrvsDirty = true; 
+        if (m_uberTriangleAttributeBuffer.Resource) m_uberTriangleAttributeBuffer.Resource->SetName(L"Uber Triangle Attribute Buffer");
+    }
+
+    m_uberBlasNodeBuffer.Sync(m_pRenderEngine, cmdList, m_allBlasNodes.data(), m_allBlasNodes.size());
+    if (m_uberBlasNodeBuffer.GpuResourceDirty) {
+        m_staticGeometrySrvsDirty = true; 
+        if (m_uberBlasNodeBuffer.Resource) m_uberBlasNodeBuffer.Resource->SetName(L"Uber BLAS Node Buffer");
+    }
+}
+
+HRESULT AccelerationStructureManager::RefitBLAS(ID3D12GraphicsCommandList* cmdList, const Model* model, const std::vector<XMFLOAT3>& newVertexPositions)
+{
+    auto it = m_blasCache.find(model);
+    if (it == m_blasCache.end())
+        return E_INVALIDARG;
+
+    BuiltBLAS& blas = *it->second;
+    if (blas.NodeCount == 0)
+        return S_OK; // No geometry, nothing to move
+
+    Timer refitTimer;
+
+    // 1. Vertex indices of every model triangle, gathered in the same order as BuildBLASFromModel
+    std::vector<uint32_t> triangleVertices;
+    uint32_t vertexBase = 0;
+    for (const auto& mesh : model->Meshes)
+    {
+        for (const auto& primitive : mesh.Primitives)
+        {
+            for (size_t i = 0; i + 2 < primitive.IndexCount; i += 3)
+            {
+                for (size_t corner = 0; corner < 3; ++corner)
+                {
+                    triangleVertices.push_back(vertexBase + mesh.Indices[primitive.StartIndexLocation + i + corner]);
+                }
+            }
+        }
+        vertexBase += static_cast<uint32_t>(mesh.Vertices.size());
+    }
+
+    const uint32_t modelTriangleCount = static_cast<uint32_t>(triangleVertices.size() / 3);
+    if (newVertexPositions.size() != vertexBase ||
+        *std::max_element(blas.SourceTriangles.begin(), blas.SourceTriangles.end()) >= modelTriangleCount)
+    {
+        if (gpFile) fprintf(gpFile, "RefitBLAS: the vertex positions do not match the model the BLAS was built from\n");
+        return E_INVALIDARG;
+    }
 
-            ModelInstanceGPUData data = {};
-            data.Transform = inst.Transform;
-            data.InverseTransform = inst.InverseTransform;
+    // 2. Move every triangle slot (spatial split duplicates included) to its new vertices
+    TaskScheduler::Get()->ParallelFor(blas.TriangleCount, 4096, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t slot = begin; slot < end; ++slot)
+        {
+            const uint32_t* vertices = &triangleVertices[3 * blas.SourceTriangles[slot]];
+            m_allTrianglePositions[blas.BaseTriangleIndex + slot] = {
+                newVertexPositions[vertices[0]], newVertexPositions[vertices[1]], newVertexPositions[vertices[2]] };
+        }
+    });
+
+    // 3. Refit the binary nodes bottom-up, then the CPU copies derived from them
+    blas.SAHCost = BVHBuilder::Refit(m_allBlasNodes, blas.BaseNodeIndex, m_allTrianglePositions, blas.BaseTriangleIndex);
+    blas.RootNode = m_allBlasNodes[blas.BaseNodeIndex];
+    RefitBLASForCpu(blas);
+
+    m_lastBlasRefitStats = {};
+    m_lastBlasRefitStats.SAHCost = blas.SAHCost;
+    m_lastBlasRefitStats.BuildSAHCost = blas.BuildSAHCost;
+    m_lastBlasRefitStats.SAHDegradation = blas.BuildSAHCost > 0.0f ? blas.SAHCost / blas.BuildSAHCost : 1.0f;
+    m_lastBlasRefitStats.RebuildRecommended = m_lastBlasRefitStats.SAHDegradation > m_blasRebuildThreshold;
+    m_lastBlasRefitStats.RefitTimeMs = refitTimer.ElapsedMillis();
+
+    // 4. Upload only this BLAS's slice of the uber buffers; their size is unchanged, so the SRVs stay valid
+    if (cmdList)
+    {
+        m_uberTriangleBuffer.UpdateRange(m_pRenderEngine, cmdList, m_allTrianglePositions.data(), blas.BaseTriangleIndex, blas.TriangleCount);
+        m_uberBlasNodeBuffer.UpdateRange(m_pRenderEngine, cmdList, m_allBlasNodes.data(), blas.BaseNodeIndex, blas.NodeCount);
+    }
+
+    return S_OK;
+}
+
+void AccelerationStructureManager::RefitBLASForCpu(const BuiltBLAS& blas)
+{
+    switch (m_cpuBvhLayout)
+    {
+    case CpuBVHLayout::BVH4:
+        WideBVH::Refit<4>(m_wideBlasNodes4, blas.BaseWideNodeIndex, m_allTrianglePositions, blas.BaseTriangleIndex);
+        break;
+    case CpuBVHLayout::BVH8:
+        WideBVH::Refit<8>(m_wideBlasNodes8, blas.BaseWideNodeIndex, m_allTrianglePositions, blas.BaseTriangleIndex);
+        break;
+    case CpuBVHLayout::Compressed:
+        CompressedBVH::Refit(m_allBlasNodes, blas.BaseNodeIndex, m_compressedBlasNodes, blas.BaseWideNodeIndex);
+        break;
+    default:
+        break;
+    }
+
+    if (blas.TriangleBlockCount == 0)
+        return;
+
+    const uint32_t firstBlock = m_leafFirstBlock[blas.BaseTriangleIndex];
+    if (m_cpuTriangleBlockWidth == 4)
+    {
+        TriangleBlocks::Refit<4>(m_triangleBlocks4, firstBlock, blas.TriangleBlockCount, m_allTrianglePositions);
+    }
+    else if (m_cpuTriangleBlockWidth == 8)
+    {
+        TriangleBlocks::Refit<8>(m_triangleBlocks8, firstBlock, blas.TriangleBlockCount, m_allTrianglePositions);
+    }
+}
+
+HRESULT AccelerationStructureManager::ReleaseBLAS(ID3D12GraphicsCommandList* cmdList, const Model* model)
+{
+    // A background build still reads the model, so let it finish and drop the result
+    for (auto job = m_pendingBlasBuilds.begin(); job != m_pendingBlasBuilds.end(); ++job)
+    {
+        if ((*job)->SourceModel == model)
+        {
+            (*job)->Finished.wait();
+            (*job)->Context.CacheFile.Close();
+            (*job)->PublishedPromise.set_value(nullptr);
+            m_pendingBlasBuilds.erase(job);
+            return S_OK;
+        }
+    }
+
+    auto it = m_blasCache.find(model);
+    if (it == m_blasCache.end())
+        return E_INVALIDARG;
+
+    // 1. Instances of the model in the current TLAS would read whatever reuses its ranges: mask them out, and forget
+    //    their model so that the next UpdateTLAS rebuilds without them
+    bool maskedInstances = false;
+    for (size_t i = 0; i < m_tlasInstanceModels.size() && i < m_instanceData.size(); ++i)
+    {
+        if (m_tlasInstanceModels[i] == model)
+        {
+            m_instanceData[i].InstanceMask = 0;
+            m_tlasInstanceModels[i] = nullptr;
+            maskedInstances = true;
+        }
+    }
+    if (maskedInstances)
+    {
+        UpdateTLASMasks();
+    }
+
+    // 2. Its ranges of the uber arrays become holes; a hole at the end shrinks them
+    const BuiltBLAS& blas = *it->second;
+    m_triangleRanges.Free(blas.BaseTriangleIndex, blas.TriangleCount);
+    m_nodeRanges.Free(blas.BaseNodeIndex, blas.NodeCount);
+    m_deadCpuNodes += blas.WideNodeCount;
+    m_deadCpuBlocks += blas.TriangleBlockCount;
+    m_blasCache.erase(it);
+    ResizeBLASArrays();
+
+    // 3. The CPU copies are only ever appended to; re-derive them once most of them belong to released BLASes
+    const size_t cpuNodes = m_wideBlasNodes4.size() + m_wideBlasNodes8.size() + m_compressedBlasNodes.size();
+    const size_t cpuBlocks = m_triangleBlocks4.size() + m_triangleBlocks8.size();
+    if (2 * size_t(m_deadCpuNodes) > cpuNodes || 2 * size_t(m_deadCpuBlocks) > cpuBlocks)
+    {
+        RederiveBLASesForCpu();
+    }
+
+    // 4. Nothing references the holes, so the GPU buffers only need an upload once compaction moves data
+    const uint32_t triangleSlots = m_triangleRanges.GetSize();
+    if (triangleSlots > 0 && m_triangleRanges.GetFreeCount() > m_blasCompactionThreshold * triangleSlots)
+    {
+        CompactBLASBuffers(cmdList, m_blasCompactionBudget, m_blasCompactionNodeBudget);
+    }
+    return S_OK;
+}
+
+bool AccelerationStructureManager::CompactBLASBuffers(ID3D12GraphicsCommandList* cmdList, uint32_t triangleBudget, uint32_t nodeBudget)
+{
+    if (nodeBudget == 0)
+    {
+        const uint64_t liveTriangles = m_triangleRanges.GetSize() - m_triangleRanges.GetFreeCount();
+        const uint64_t liveNodes = m_nodeRanges.GetSize() - m_nodeRanges.GetFreeCount();
+        nodeBudget = (triangleBudget == UINT32_MAX || liveTriangles == 0)
+            ? UINT32_MAX
+            : static_cast<uint32_t>((std::min)(uint64_t(triangleBudget) * liveNodes / liveTriangles, uint64_t(UINT32_MAX)));
+    }
+
+    // 1. Live BLASes with their bases before the moves, to find their instances afterwards
+    std::vector<BuiltBLAS*> blases;
+    std::vector<std::pair<uint64_t, BuiltBLAS*>> oldBases;
+    for (auto& entry : m_blasCache)
+    {
+        blases.push_back(entry.second.get());
+        oldBases.emplace_back((uint64_t(entry.second->BaseTriangleIndex) << 32) | entry.second->BaseNodeIndex, entry.second.get());
+    }
+
+    // 2. Slide triangle ranges down into the lowest hole, in address order. Everything below the hole is packed
+    //    and everything between the hole and the next BLAS is free, so a forward copy never overwrites live data.
+    std::sort(blases.begin(), blases.end(), [](const BuiltBLAS* a, const BuiltBLAS* b) { return a->BaseTriangleIndex < b->BaseTriangleIndex; });
+    uint32_t moved = 0;
+    for (BuiltBLAS* blas : blases)
+    {
+        const uint32_t target = m_triangleRanges.GetFirstFreeOffset();
+        const uint32_t source = blas->BaseTriangleIndex;
+        const uint32_t count = blas->TriangleCount;
+        if (count == 0 || target >= source)
+            continue;
+        if (moved > 0 && moved + count > triangleBudget)
+            break;
+
+        std::copy(m_allTrianglePositions.begin() + source, m_allTrianglePositions.begin() + source + count, m_allTrianglePositions.begin() + target);
+        std::copy(m_allTriangleAttributes.begin() + source, m_allTriangleAttributes.begin() + source + count, m_allTriangleAttributes.begin() + target);
+
+        // The triangle blocks stay where they are; only the triangles they were packed from moved
+        if (blas->TriangleBlockCount > 0)
+        {
+            std::copy(m_leafFirstBlock.begin() + source, m_leafFirstBlock.begin() + source + count, m_leafFirstBlock.begin() + target);
+            const uint32_t firstBlock = m_leafFirstBlock[target];
+            for (uint32_t b = firstBlock; b < firstBlock + blas->TriangleBlockCount; ++b)
+            {
+                if (m_cpuTriangleBlockWidth == 4) m_triangleBlocks4[b].FirstTriangle -= source - target;
+                else m_triangleBlocks8[b].FirstTriangle -= source - target;
+            }
+        }
+
+        m_triangleRanges.Free(source, count);
+        m_triangleRanges.AllocateAt(target, count);
+        blas->BaseTriangleIndex = target;
+        moved += count;
+    }
+
+    // 3. The same for the node ranges, rebasing the internal nodes' child indices. Wide and compressed nodes index
+    //    their own arrays and hold BLAS-relative triangles, so they are unaffected.
+    std::sort(blases.begin(), blases.end(), [](const BuiltBLAS* a, const BuiltBLAS* b) { return a->BaseNodeIndex < b->BaseNodeIndex; });
+    uint32_t movedNodes = 0;
+    for (BuiltBLAS* blas : blases)
+    {
+        const uint32_t target = m_nodeRanges.GetFirstFreeOffset();
+        const uint32_t source = blas->BaseNodeIndex;
+        const uint32_t count = blas->NodeCount;
+        if (count == 0 || target >= source)
+            continue;
+        if (movedNodes > 0 && movedNodes + count > nodeBudget)
+            break;
+
+        std::copy(m_allBlasNodes.begin() + source, m_allBlasNodes.begin() + source + count, m_allBlasNodes.begin() + target);
+        for (uint32_t i = target; i < target + count; ++i)
+        {
+            if (m_allBlasNodes[i].triangleCount == 0)
+            {
+                m_allBlasNodes[i].leftChildOrFirstTriangleIndex -= static_cast<int>(source - target);
+            }
+        }
+
+        m_nodeRanges.Free(source, count);
+        m_nodeRanges.AllocateAt(target, count);
+        blas->BaseNodeIndex = target;
+        blas->RootNode = m_allBlasNodes[target];
+        movedNodes += count;
+    }
+
+    // 4. Instances keep their BLASes; rebase their copies of the bases and upload everything that moved
+    if (moved > 0 || movedNodes > 0)
+    {
+        std::unordered_map<uint64_t, const BuiltBLAS*> movedBlases;
+        for (const auto& oldBase : oldBases)
+        {
+            if (oldBase.first != ((uint64_t(oldBase.second->BaseTriangleIndex) << 32) | oldBase.second->BaseNodeIndex))
+            {
+                movedBlases[oldBase.first] = oldBase.second;
+            }
+        }
+        for (ModelInstanceGPUData& data : m_instanceData)
+        {
+            auto it = movedBlases.find((uint64_t(data.BaseTriangleIndex) << 32) | data.BaseNodeIndex);
+            if (it != movedBlases.end())
+            {
+                data.BaseTriangleIndex = it->second->BaseTriangleIndex;
+                data.BaseNodeIndex = it->second->BaseNodeIndex;
+            }
+        }
+
+        ResizeBLASArrays();
+        SyncBLASGpuBuffers(cmdList);
+        if (gpFile)
+        {
+            fprintf(gpFile, "BLAS compaction: moved %u triangles and %u nodes, %u and %u free slots left\n",
+                moved, movedNodes, m_triangleRanges.GetFreeCount(), m_nodeRanges.GetFreeCount());
+        }
+    }
+
+    return m_triangleRanges.GetFreeCount() == 0 && m_nodeRanges.GetFreeCount() == 0;
+}
+
+void AccelerationStructureManager::RederiveBLASesForCpu()
+{
+    m_wideBlasNodes4.clear();
+    m_wideBlasNodes8.clear();
+    m_compressedBlasNodes.clear();
+    m_triangleBlocks4.clear();
+    m_triangleBlocks8.clear();
+    m_leafFirstBlock.clear();
+    m_deadCpuNodes = 0;
+    m_deadCpuBlocks = 0;
+
+    std::unordered_map<uint32_t, uint32_t> wideRootByBaseNode;
+    for (auto& entry : m_blasCache)
+    {
+        CollapseBLASForCpu(*entry.second);
+        PackBLASTrianglesForCpu(*entry.second);
+        wideRootByBaseNode[entry.second->BaseNodeIndex] = entry.second->BaseWideNodeIndex;
+    }
+
+    for (size_t i = 0; i < m_instanceWideRoots.size(); ++i)
+    {
+        auto it = wideRootByBaseNode.find(m_instanceData[i].BaseNodeIndex);
+        m_instanceWideRoots[i] = (it != wideRootByBaseNode.end()) ? it->second : 0;
+    }
+}
+
+BLASMemoryStats AccelerationStructureManager::GetBLASMemoryStats() const
+{
+    BLASMemoryStats stats;
+    stats.BLASCount = static_cast<uint32_t>(m_blasCache.size());
+    stats.TriangleSlots = m_triangleRanges.GetSize();
+    stats.FreeTriangleSlots = m_triangleRanges.GetFreeCount();
+    stats.LargestFreeTriangleRange = m_triangleRanges.GetLargestFreeRange();
+    stats.NodeSlots = m_nodeRanges.GetSize();
+    stats.FreeNodeSlots = m_nodeRanges.GetFreeCount();
+    stats.DeadCpuNodes = m_deadCpuNodes;
+    stats.DeadCpuTriangleBlocks = m_deadCpuBlocks;
+    return stats;
+}
+
+void AccelerationStructureManager::BuildTLAS(const std::vector<ModelInstance>& instances)
+{
+    if (instances.empty())
+    {
+        m_tlasNodes.clear();
+        m_instanceData.clear();
+        m_instanceWideRoots.clear();
+        m_lastTlasBuildStats = TLASBuildStats();
+        m_tlasInstanceModels.clear();
+        BuildTLASRefitLevels();
+        CollapseTLASForCpu();
+        return;
+    }
+
+    // Rebuilt whenever instances move, so the stats are kept for the caller rather than logged
+    m_lastTlasBuildStats = TLASBuilder::Build(instances, m_tlasNodes, this, m_tlasBuildSettings);
+    m_tlasInstanceModels.resize(instances.size());
+    for (size_t i = 0; i < instances.size(); ++i)
+    {
+        m_tlasInstanceModels[i] = instances[i].SourceModel;
+    }
+    BuildTLASRefitLevels();
+    CollapseTLASForCpu();
+    BuildInstanceData(instances);
+}
+
+void AccelerationStructureManager::SetCpuBVHLayout(CpuBVHLayout layout)
+{
+    if (layout == m_cpuBvhLayout)
+        return;
+
+    m_cpuBvhLayout = layout;
+    m_wideBlasNodes4.clear();
+    m_wideBlasNodes8.clear();
+    m_compressedBlasNodes.clear();
+    m_deadCpuNodes = 0;
+    std::unordered_map<uint32_t, uint32_t> wideRootByBaseNode;
+    for (auto& entry : m_blasCache)
+    {
+        CollapseBLASForCpu(*entry.second);
+        wideRootByBaseNode[entry.second->BaseNodeIndex] = entry.second->BaseWideNodeIndex;
+    }
+    CollapseTLASForCpu();
+
+    // Instances keep pointing at the same BLASes; only their CPU roots moved.
+    for (size_t i = 0; i < m_instanceWideRoots.size(); ++i)
+    {
+        auto it = wideRootByBaseNode.find(m_instanceData[i].BaseNodeIndex);
+        m_instanceWideRoots[i] = (it != wideRootByBaseNode.end()) ? it->second : 0;
+    }
+}
+
+void AccelerationStructureManager::SetCpuTriangleBlockWidth(uint32_t width)
+{
+    if (width != 0 && width != 4 && width != 8)
+        return;
+    if (width == 8 && !CpuFeatures::Get().AVX)
+        width = 4;
+    if (width == m_cpuTriangleBlockWidth)
+        return;
+
+    m_cpuTriangleBlockWidth = width;
+    m_triangleBlocks4.clear();
+    m_triangleBlocks8.clear();
+    m_leafFirstBlock.clear();
+    m_deadCpuBlocks = 0;
+    for (auto& entry : m_blasCache)
+    {
+        PackBLASTrianglesForCpu(*entry.second);
+    }
+}
+
+void AccelerationStructureManager::PackBLASTrianglesForCpu(BuiltBLAS& blas)
+{
+    blas.TriangleBlockCount = 0;
+    if (blas.NodeCount == 0)
+        return;
+
+    if (m_cpuTriangleBlockWidth == 4)
+    {
+        const size_t firstBlock = m_triangleBlocks4.size();
+        TriangleBlocks::Pack<4>(m_allBlasNodes, blas.BaseNodeIndex, m_allTrianglePositions, blas.BaseTriangleIndex, m_triangleBlocks4, m_leafFirstBlock);
+        blas.TriangleBlockCount = static_cast<uint32_t>(m_triangleBlocks4.size() - firstBlock);
+    }
+    else if (m_cpuTriangleBlockWidth == 8)
+    {
+        const size_t firstBlock = m_triangleBlocks8.size();
+        TriangleBlocks::Pack<8>(m_allBlasNodes, blas.BaseNodeIndex, m_allTrianglePositions, blas.BaseTriangleIndex, m_triangleBlocks8, m_leafFirstBlock);
+        blas.TriangleBlockCount = static_cast<uint32_t>(m_triangleBlocks8.size() - firstBlock);
+    }
+}
+
+void AccelerationStructureManager::CollapseBLASForCpu(BuiltBLAS& blas)
+{
+    blas.BaseWideNodeIndex = 0;
+    blas.WideNodeCount = 0;
+    if (blas.NodeCount == 0)
+        return;
+
+    const size_t cpuNodesBefore = m_wideBlasNodes4.size() + m_wideBlasNodes8.size() + m_compressedBlasNodes.size();
+
+    // Wide leaves may hold up to one triangle per lane.
+    switch (m_cpuBvhLayout)
+    {
+    case CpuBVHLayout::BVH4:
+        blas.BaseWideNodeIndex = WideBVH::Collapse<4>(m_allBlasNodes, blas.BaseNodeIndex, m_wideBlasNodes4, 4);
+        break;
+    case CpuBVHLayout::BVH8:
+        blas.BaseWideNodeIndex = WideBVH::Collapse<8>(m_allBlasNodes, blas.BaseNodeIndex, m_wideBlasNodes8, 8);
+        break;
+    case CpuBVHLayout::Compressed:
+        blas.BaseWideNodeIndex = CompressedBVH::Encode(m_allBlasNodes, blas.BaseNodeIndex, m_compressedBlasNodes);
+        break;
+    default:
+        break;
+    }
+
+    blas.WideNodeCount = static_cast<uint32_t>(m_wideBlasNodes4.size() + m_wideBlasNodes8.size() + m_compressedBlasNodes.size() - cpuNodesBefore);
+}
+
+void AccelerationStructureManager::CollapseTLASForCpu()
+{
+    m_wideTlasNodes4.clear();
+    m_wideTlasNodes8.clear();
+
+    // TLAS leaves are single instances with unrelated indices, so no leaf collapsing.
+    if (!m_tlasNodes.empty() && m_cpuBvhLayout == CpuBVHLayout::BVH4)
+    {
+        WideBVH::Collapse<4>(m_tlasNodes, 0, m_wideTlasNodes4, 1);
+    }
+    else if (!m_tlasNodes.empty() && m_cpuBvhLayout == CpuBVHLayout::BVH8)
+    {
+        WideBVH::Collapse<8>(m_tlasNodes, 0, m_wideTlasNodes8, 1);
+    }
+    UpdateTLASMasks();
+}
+
+void AccelerationStructureManager::UpdateTLASMasks()
+{
+    std::vector<uint8_t> instanceMasks(m_instanceData.size());
+    for (size_t i = 0; i < m_instanceData.size(); ++i)
+    {
+        instanceMasks[i] = static_cast<uint8_t>(m_instanceData[i].InstanceMask);
+    }
+
+    // 1. Binary TLAS: a leaf takes the masks of its instances, an internal node the OR of its children. Children
+    //    are stored after their parent, so a reverse sweep reaches every node after its children.
+    const uint32_t nodeCount = static_cast<uint32_t>(m_tlasNodes.size());
+    m_tlasNodeMasks.assign(nodeCount, 0);
+    for (uint32_t i = nodeCount; i-- > 0;)
+    {
+        const BVHNode& node = m_tlasNodes[i];
+        if (node.triangleCount > 0)
+        {
+            for (int k = 0; k < node.triangleCount; ++k)
+            {
+                const size_t instanceIndex = static_cast<size_t>(node.leftChildOrFirstTriangleIndex) + k;
+                m_tlasNodeMasks[i] |= instanceIndex < instanceMasks.size() ? instanceMasks[instanceIndex] : 0;
+            }
+        }
+        else
+        {
+            m_tlasNodeMasks[i] = m_tlasNodeMasks[node.leftChildOrFirstTriangleIndex] | m_tlasNodeMasks[node.leftChildOrFirstTriangleIndex + 1];
+        }
+    }
+
+    // 2. The wide TLAS of the current layout
+    m_wideTlasChildMasks.clear();
+    if (!m_wideTlasNodes4.empty())
+    {
+        WideBVH::ComputeChildMasks(m_wideTlasNodes4, instanceMasks, m_wideTlasChildMasks);
+    }
+    else if (!m_wideTlasNodes8.empty())
+    {
+        WideBVH::ComputeChildMasks(m_wideTlasNodes8, instanceMasks, m_wideTlasChildMasks);
+    }
+}
+
+void AccelerationStructureManager::BuildInstanceData(const std::vector<ModelInstance>& instances)
+{
+    // One entry per instance so that the instance index stored in TLAS leaves can be used directly.
+    m_instanceData.clear();
+    m_instanceData.reserve(instances.size());
+    m_instanceWideRoots.assign(instances.size(), 0);
+    for (const auto& inst : instances)
+    {
+        ModelInstanceGPUData data = {};
+        data.Transform = inst.Transform;
+        data.InverseTransform = inst.InverseTransform;
+        data.MaterialOffset = inst.MaterialOffset;
+
+        // Instances without a BLAS (not built yet, or released) stay masked out: their bases would address
+        // another model's data
+        const BuiltBLAS* blas = GetCachedBLAS(inst.SourceModel);
+        if (blas)
+        {
+            data.InstanceMask = inst.InstanceMask;
             data.BaseTriangleIndex = blas->BaseTriangleIndex;
             data.BaseNodeIndex = blas->BaseNodeIndex;
-            data.MaterialOffset = inst.MaterialOffset;
-            instanceGpuData.push_back(data);
+            m_instanceWideRoots[m_instanceData.size()] = blas->BaseWideNodeIndex;
         }
+        m_instanceData.push_back(data);
+    }
+    UpdateTLASMasks();
+}
+
+void AccelerationStructureManager::UpdateGpuBuffers(ID3D12GraphicsCommandList* cmdList, const std::vector<ModelInstance>& instances)
+{
+    BuildInstanceData(instances);
+
+    if (m_blasGpuBuffersStale)
+    {
+        SyncBLASGpuBuffers(cmdList);
     }
 
     m_tlasNodeBuffer.Sync(m_pRenderEngine, cmdList, m_tlasNodes.data(), m_tlasNodes.size());
@@ -237,7 +1443,7 @@ void AccelerationStructureManager::UpdateGpuBuffers(ID3D12GraphicsCommandList* c
         if (m_tlasNodeBuffer.Resource) m_tlasNodeBuffer.Resource->SetName(L"TLAS Node Buffer");
     }
 
-    m_instanceDataBuffer.Sync(m_pRenderEngine, cmdList, instanceGpuData.data(), instanceGpuData.size());
+    m_instanceDataBuffer.Sync(m_pRenderEngine, cmdList, m_instanceData.data(), m_instanceData.size());
     if (m_instanceDataBuffer.GpuResourceDirty) {
         m_instanceSrvsDirty = true; 
         if (m_instanceDataBuffer.Resource) m_instanceDataBuffer.Resource->SetName(L"Instance Data Buffer");
@@ -245,46 +1451,117 @@ void AccelerationStructureManager::UpdateGpuBuffers(ID3D12GraphicsCommandList* c
 
 }
 
-void AccelerationStructureManager::RefitNodeRecursive(int nodeIndex, const std::vector<ModelInstance>& instances)
+float AccelerationStructureManager::RefitTLASNodes(const std::vector<ModelInstance>& instances)
 {
-    // Get a reference to the current node in the TLAS.
-    BVHNode& node = m_tlasNodes[nodeIndex];
-
-    if (node.triangleCount > 0) // It's a leaf node.
+    // 1. Leaves and instance data, in parallel blocks for large TLASes
+    const uint32_t nodeCount = static_cast<uint32_t>(m_tlasNodes.size());
+    TaskScheduler::Get()->ParallelFor(nodeCount, 4096, [&](uint32_t begin, uint32_t end)
     {
-        // if leaaf node ,update AABB
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            BVHNode& node = m_tlasNodes[i];
+            if (node.triangleCount == 0) continue;
 
-        uint32_t instanceIndex = node.leftChildOrFirstTriangleIndex;
-        const auto& inst = instances[instanceIndex];
+            uint32_t instanceIndex = node.leftChildOrFirstTriangleIndex;
+            if (instanceIndex >= instances.size()) continue;
 
-        const BuiltBLAS* blas = GetCachedBLAS(inst.SourceModel);
-        if (!blas) return;
+            const auto& inst = instances[instanceIndex];
+            const BuiltBLAS* blas = GetCachedBLAS(inst.SourceModel);
+            if (!blas) continue;
+
+            TLASBuilder::TransformAABB(blas->RootNode.aabbMin, blas->RootNode.aabbMax, inst.Transform, node.aabbMin, node.aabbMax);
+            if (instanceIndex < m_instanceData.size())
+            {
+                ModelInstanceGPUData& data = m_instanceData[instanceIndex];
+                data.Transform = inst.Transform;
+                data.InverseTransform = inst.InverseTransform;
+                data.MaterialOffset = inst.MaterialOffset;
+                data.InstanceMask = inst.InstanceMask;
+            }
+        }
+    });
+
+    // 2. Internal nodes bottom-up, one depth at a time: the nodes of a depth only read the deeper ones
+    for (size_t level = 0; level + 1 < m_tlasRefitLevels.size(); ++level)
+    {
+        const uint32_t* levelNodes = m_tlasRefitNodes.data() + m_tlasRefitLevels[level];
+        const uint32_t levelSize = m_tlasRefitLevels[level + 1] - m_tlasRefitLevels[level];
+        TaskScheduler::Get()->ParallelFor(levelSize, 4096, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                BVHNode& node = m_tlasNodes[levelNodes[i]];
+                const BVHNode& leftChild = m_tlasNodes[node.leftChildOrFirstTriangleIndex];
+                const BVHNode& rightChild = m_tlasNodes[node.leftChildOrFirstTriangleIndex + 1];
+                XMStoreFloat3(&node.aabbMin, XMVectorMin(XMLoadFloat3(&leftChild.aabbMin), XMLoadFloat3(&rightChild.aabbMin)));
+                XMStoreFloat3(&node.aabbMax, XMVectorMax(XMLoadFloat3(&leftChild.aabbMax), XMLoadFloat3(&rightChild.aabbMax)));
+            }
+        });
+    }
 
-        DirectX::XMFLOAT3 newWorldMin, newWorldMax;
-        TLASBuilder::TransformAABB(blas->RootNode.aabbMin, blas->RootNode.aabbMax, inst.Transform, newWorldMin, newWorldMax);
+    // 3. SAH cost (unit cost per instance), summed per fixed block and then in block order so that it does not
+    //    depend on the thread count
+    const uint32_t costBlockSize = 4096;
+    std::vector<double> blockCosts((nodeCount + costBlockSize - 1) / costBlockSize, 0.0);
+    TaskScheduler::Get()->ParallelFor(nodeCount, costBlockSize, [&](uint32_t begin, uint32_t end)
+    {
+        double blockCost = 0.0;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            blockCost += BoxSurfaceArea(m_tlasNodes[i].aabbMin, m_tlasNodes[i].aabbMax);
+        }
+        blockCosts[begin / costBlockSize] = blockCost;
+    });
 
-        // Update the node's bounds.
-        node.aabbMin = newWorldMin;
-        node.aabbMax = newWorldMax;
+    double cost = 0.0;
+    for (double blockCost : blockCosts)
+    {
+        cost += blockCost;
     }
-    else // It's an internal node.
+
+    const float rootArea = BoxSurfaceArea(m_tlasNodes[0].aabbMin, m_tlasNodes[0].aabbMax);
+    return rootArea > 0.0f ? static_cast<float>(cost / rootArea) : 0.0f;
+}
+
+void AccelerationStructureManager::BuildTLASRefitLevels()
+{
+    // 1. Depth of every node by a forward sweep; TLASBuilder stores children after their parent
+    const uint32_t nodeCount = static_cast<uint32_t>(m_tlasNodes.size());
+    std::vector<uint32_t> depths(nodeCount, 0);
+    uint32_t maxDepth = 0;
+    for (uint32_t i = 0; i < nodeCount; ++i)
     {
-        RefitNodeRecursive(node.leftChildOrFirstTriangleIndex, instances);     // Recurse on the left child
-        RefitNodeRecursive(node.leftChildOrFirstTriangleIndex + 1, instances); // Recurse on the right child
+        const BVHNode& node = m_tlasNodes[i];
+        if (node.triangleCount > 0)
+            continue;
 
-        // After the children have been updated, we can update this parent node.
-        // The parent's AABB is the union of its two children's AABBs.
-        const BVHNode& leftChild = m_tlasNodes[node.leftChildOrFirstTriangleIndex];
-        const BVHNode& rightChild = m_tlasNodes[node.leftChildOrFirstTriangleIndex + 1];
+        const uint32_t leftChild = node.leftChildOrFirstTriangleIndex;
+        depths[leftChild] = depths[leftChild + 1] = depths[i] + 1;
+        maxDepth = (std::max)(maxDepth, depths[i]);
+    }
 
-        using namespace DirectX;
-        XMVECTOR leftMinV = XMLoadFloat3(&leftChild.aabbMin);
-        XMVECTOR leftMaxV = XMLoadFloat3(&leftChild.aabbMax);
-        XMVECTOR rightMinV = XMLoadFloat3(&rightChild.aabbMin);
-        XMVECTOR rightMaxV = XMLoadFloat3(&rightChild.aabbMax);
+    // 2. Counting sort of the internal nodes by depth, deepest first
+    m_tlasRefitLevels.assign(nodeCount > 1 ? maxDepth + 2 : 0, 0);
+    m_tlasRefitNodes.clear();
+    if (nodeCount <= 1)
+        return;
 
-        XMStoreFloat3(&node.aabbMin, XMVectorMin(leftMinV, rightMinV));
-        XMStoreFloat3(&node.aabbMax, XMVectorMax(leftMaxV, rightMaxV));
+    for (uint32_t i = 0; i < nodeCount; ++i)
+    {
+        if (m_tlasNodes[i].triangleCount == 0)
+            m_tlasRefitLevels[maxDepth - depths[i] + 1]++;
+    }
+    for (size_t level = 1; level < m_tlasRefitLevels.size(); ++level)
+    {
+        m_tlasRefitLevels[level] += m_tlasRefitLevels[level - 1];
+    }
+
+    m_tlasRefitNodes.resize(m_tlasRefitLevels.back());
+    std::vector<uint32_t> cursors(m_tlasRefitLevels.begin(), m_tlasRefitLevels.end() - 1);
+    for (uint32_t i = 0; i < nodeCount; ++i)
+    {
+        if (m_tlasNodes[i].triangleCount == 0)
+            m_tlasRefitNodes[cursors[maxDepth - depths[i]]++] = i;
     }
 }
 
@@ -295,5 +1572,61 @@ void AccelerationStructureManager::RefitTLAS(const std::vector<ModelInstance>& i
         return;
     }
 
-    RefitNodeRecursive(0, instances);
+    RefitTLASNodes(instances);
+    CollapseTLASForCpu();
+}
+
+void AccelerationStructureManager::UpdateTLAS(const std::vector<ModelInstance>& instances)
+{
+    Timer updateTimer;
+    TLASUpdateStats stats;
+
+    // 1. A different instance set needs new leaves: compare the models and how many of them have a BLAS
+    bool rebuild = m_tlasNodes.empty() || instances.size() != m_tlasInstanceModels.size();
+    uint32_t instancesWithBlas = 0;
+    for (size_t i = 0; !rebuild && i < instances.size(); ++i)
+    {
+        rebuild = instances[i].SourceModel != m_tlasInstanceModels[i];
+        if (GetCachedBLAS(instances[i].SourceModel)) instancesWithBlas++;
+    }
+    rebuild = rebuild || instancesWithBlas != m_lastTlasBuildStats.InstanceCount;
+
+    // 2. Otherwise refit, and rebuild anyway if the tree has degraded too much
+    if (!rebuild)
+    {
+        stats.SAHCost = RefitTLASNodes(instances);
+        stats.BuildSAHCost = m_lastTlasBuildStats.SAHCost;
+        stats.SAHDegradation = stats.BuildSAHCost > 0.0f ? stats.SAHCost / stats.BuildSAHCost : 1.0f;
+        rebuild = stats.SAHDegradation > m_tlasRebuildThreshold;
+        if (rebuild && gpFile)
+        {
+            fprintf(gpFile, "TLAS refit degraded SAH %.2f -> %.2f (x%.2f), rebuilding\n", stats.BuildSAHCost, stats.SAHCost, stats.SAHDegradation);
+        }
+    }
+
+    if (rebuild)
+    {
+        BuildTLAS(instances);
+        stats.Rebuilt = true;
+        stats.SAHCost = m_lastTlasBuildStats.SAHCost;
+        stats.BuildSAHCost = m_lastTlasBuildStats.SAHCost;
+        stats.SAHDegradation = 1.0f;
+    }
+    else
+    {
+        CollapseTLASForCpu();
+    }
+
+    stats.UpdateTimeMs = updateTimer.ElapsedMillis();
+    m_lastTlasUpdateStats = stats;
+}
+
+RayHit AccelerationStructureManager::Intersect(const Ray& ray, float tMax, uint8_t rayMask) const
+{
+    return RayQuery::Intersect(RayQuery::GetScene(*this), ray, tMax, rayMask);
+}
+
+bool AccelerationStructureManager::Occluded(const Ray& ray, float tMax, uint8_t rayMask) const
+{
+    return RayQuery::Occluded(RayQuery::GetScene(*this), ray, tMax, rayMask);
 }
\ No newline at end of file
@@ -5,7 +5,15 @@
 #include "Mesh.h"
 #include "TLASBuilder.h"
 #include "BVHBuilder.h"
+#include "BVHOptimizer.h"
+#include "WideBVH.h"
+#include "CompressedBVH.h"
+#include "TriangleBlock.h"
 #include "GpuBuffer.h"
+#include "BLASCache.h"
+#include "RangeAllocator.h"
+#include "Ray.h"
+#include <future>
 
 // A handle to refer to a built BLAS, hiding the implementation details.
 using BLASHandle = size_t;
@@ -16,6 +24,33 @@ struct BuiltBLAS
 
     uint32_t BaseTriangleIndex;
     uint32_t BaseNodeIndex;
+    uint32_t BaseWideNodeIndex; // Root in the CPU wide or compressed node array of the current CpuBVHLayout
+    uint32_t TriangleCount;     // Slots in the uber triangle arrays, including spatial split duplicates
+    uint32_t NodeCount;
+    uint32_t WideNodeCount;     // Nodes in the CPU wide or compressed node array
+    uint32_t TriangleBlockCount; // Consecutive CPU triangle blocks from the first leaf's block on
+
+    // Per triangle slot, the index of the model triangle it was built from (mesh, then primitive order). RefitBLAS
+    // uses it to find the moved vertices of every slot.
+    std::vector<uint32_t> SourceTriangles;
+
+    // SAH cost after the build and after the latest RefitBLAS (see BVHOptimizer::ComputeSAHCost). Refit leaves bound
+    // whole triangles, so an SBVH's cost rises a little on its first refit even without motion.
+    float BuildSAHCost;
+    float SAHCost;
+};
+
+// Node layout of the CPU-only copies of the acceleration structures that the CPU ray tracer walks.
+// The GPU buffers always hold the binary nodes.
+enum class CpuBVHLayout
+{
+    Binary,
+    BVH4,
+    BVH8,
+    // 16-byte quantized binary BLAS nodes; the TLAS stays binary. They are kept next to the 32-byte binary nodes,
+    // which the GPU upload and refit still need, so BLAS node memory grows to 1.5x; the CPU traversal reads half the
+    // node bytes.
+    Compressed
 };
 
 struct BLASStats
@@ -27,14 +62,68 @@ struct BLASStats
     uint32_t minTrianglesPerLeaf = (std::numeric_limits<uint32_t>::max)();
     uint32_t maxTrianglesPerLeaf = 0;
     float averageTrianglesPerLeaf = 0.0f;
+    uint32_t triangleCount = 0; // Triangle slots referenced by leaves, including spatial split duplicates
+    std::vector<uint32_t> leafSizeHistogram; // [n] = number of leaves holding n triangles
+
+    // Quality, with unit costs for a node visit and a triangle test (the cost model the builders minimize)
+    float sahCost = 0.0f;        // Relative to the root surface area
+    float epo = 0.0f;            // End-point overlap: cost-weighted triangle area inside nodes that do not own the triangle, over the total triangle area
+    float siblingOverlap = 0.0f; // Surface area of the intersections of sibling boxes, relative to the root
+
+    // Memory
+    uint64_t nodeBytes = 0;      // Binary nodes, as uploaded to the GPU
+    uint64_t triangleBytes = 0;  // Positions and attributes
+    uint64_t wideNodeBytes = 0;  // CPU traversal copy for the current CpuBVHLayout, in addition to nodeBytes
+};
+
+struct BLASRefitStats
+{
+    float SAHCost = 0.0f;
+    float BuildSAHCost = 0.0f;
+    float SAHDegradation = 1.0f;     // SAHCost / BuildSAHCost
+    bool RebuildRecommended = false; // SAHDegradation exceeds the manager's BLAS rebuild threshold
+    float RefitTimeMs = 0.0f;
+};
+
+struct BLASCacheStats
+{
+    uint32_t Hits = 0;   // BLASes loaded from the cache directory instead of built
+    uint32_t Misses = 0; // Built, then written to the cache directory
+    uint32_t WriteFailures = 0;
+};
+
+struct BLASMemoryStats
+{
+    uint32_t BLASCount = 0;
+    uint32_t TriangleSlots = 0;         // Size of the uber triangle arrays
+    uint32_t FreeTriangleSlots = 0;     // In holes left by released BLASes
+    uint32_t LargestFreeTriangleRange = 0;
+    uint32_t NodeSlots = 0;             // Size of the uber BLAS node array
+    uint32_t FreeNodeSlots = 0;
+    uint32_t DeadCpuNodes = 0;          // Wide or compressed nodes of released BLASes, dropped at the next re-derive
+    uint32_t DeadCpuTriangleBlocks = 0;
+};
+
+struct TLASUpdateStats
+{
+    bool Rebuilt = false;        // Built from scratch: the instance set changed or the refit degraded past the threshold
+    float SAHCost = 0.0f;
+    float BuildSAHCost = 0.0f;   // SAH cost of the latest full build
+    float SAHDegradation = 1.0f; // SAHCost / BuildSAHCost after the refit
+    float UpdateTimeMs = 0.0f;
 };
 
 class RenderEngine;
+class TaskScheduler;
+class TaskGroup;
+struct BLASBuildContext;
+struct PendingBLASBuild;
 
 class AccelerationStructureManager
 {
 public:
-    AccelerationStructureManager() = default;
+    AccelerationStructureManager();
+    ~AccelerationStructureManager();
 
     static AccelerationStructureManager* Get();
 
@@ -44,12 +133,121 @@ public:
 
     const BuiltBLAS* GetCachedBLAS(const Model* model) const;
 
-    BLASStats AnalyzeBLAS(const BuiltBLAS* blas);
+    // The model's triangles as every BLAS build gathers them: mesh by mesh, primitive by primitive, before the
+    // builder reorders them.
+    static void GatherTriangles(const Model& model, std::vector<Triangle>& outTriangles);
+
+    // Walks the BLAS and computes its statistics. EPO clips every triangle against the nodes it overlaps and is by
+    // far the most expensive part, so it can be skipped.
+    BLASStats AnalyzeBLAS(const BuiltBLAS* blas, bool computeEPO = true);
+
+    // The same statistics for the current TLAS. Every leaf holds one instance, counted in the triangle fields;
+    // triangle bytes and EPO are not computed.
+    BLASStats AnalyzeTLAS();
+
+    // Background builds, so that importing a big model does not stall the frame. The build runs on a pool of half the
+    // hardware threads, kept apart from the shared pool so that frame work never waits behind it; models queued
+    // together build concurrently. Finished builds wait until PublishCompletedBLASes, which the main thread calls
+    // once per frame: it splices all of them into the uber arrays and uploads the buffers once, so the arrays and
+    // the GPU only ever see whole BLASes. The future is fulfilled at publication. Until then instances of the model
+    // are left out of the TLAS. A build whose tree would exceed BVHBuilder::MAX_DEPTH fails and publishes nullptr, as
+    // GetOrBuildBLAS returns it.
+    // The model must stay alive until its BLAS is published or released.
+    std::shared_future<const BuiltBLAS*> BuildBLASAsync(Model* model);
+
+    // Returns the number of BLASes published; when non-zero, update the TLAS so that their instances join it.
+    uint32_t PublishCompletedBLASes(ID3D12GraphicsCommandList* cmdList);
+
+    // Blocks until every queued build has finished. They still need publishing.
+    void WaitForBLASBuilds();
+
+    // Synchronous BLAS builds reuse their temporaries (the gathered triangles, the local node and triangle arrays and
+    // the builder's per-thread scratch), so importing models one after another allocates little once warmed up.
+    // Frees them, e.g. after a scene load.
+    void ReleaseBuildScratch();
+
+    // On-disk BLAS cache (off by default). Every BLAS build first looks for a file keyed by a hash of the model's
+    // triangles and the build and optimize settings; on a hit the file is memory-mapped and its arrays are copied
+    // into the uber arrays without building. Misses are built and written back. An empty path disables the cache.
+    HRESULT SetBLASCacheDirectory(const std::string& directory);
+    const BLASCacheStats& GetBLASCacheStats() const { return m_blasCacheStats; }
+
+    // Releases a cached BLAS, e.g. when its model is unloaded. Its ranges of the uber arrays become holes that later
+    // builds reuse first-fit; a hole at the end shrinks the arrays. Once the holes exceed the compaction threshold,
+    // CompactBLASBuffers runs with the default budget. Instances of the model in the current TLAS are masked out (their
+    // InstanceMask becomes 0) and the next UpdateTLAS rebuilds; they must be dropped from the instance list before it.
+    // The GPU buffers are uploaded with the command list, or at the next UpdateGpuBuffers without one.
+    HRESULT ReleaseBLAS(ID3D12GraphicsCommandList* cmdList, const Model* model);
+
+    // Incremental compaction: slides BLASes down into the holes in address order, moving at most triangleBudget
+    // triangles and nodeBudget nodes per call but always at least one BLAS of each, and rebases the BLASes, their
+    // instance data and CPU triangle blocks. nodeBudget 0 scales triangleBudget by the live node-to-triangle ratio.
+    // Returns true once no holes are left. Call it with a small budget on idle frames.
+    bool CompactBLASBuffers(ID3D12GraphicsCommandList* cmdList, uint32_t triangleBudget = UINT32_MAX, uint32_t nodeBudget = 0);
+
+    // Fraction of free triangle slots above which ReleaseBLAS compacts, and the triangles and nodes it moves per call.
+    void SetBLASCompactionThreshold(float freeFraction) { m_blasCompactionThreshold = freeFraction; }
+    float GetBLASCompactionThreshold() const { return m_blasCompactionThreshold; }
+    void SetBLASCompactionBudget(uint32_t triangleBudget, uint32_t nodeBudget = 0)
+    {
+        m_blasCompactionBudget = triangleBudget;
+        m_blasCompactionNodeBudget = nodeBudget;
+    }
+
+    BLASMemoryStats GetBLASMemoryStats() const;
+
+    // Settings for BLASes built from now on; already cached BLASes are not rebuilt.
+    void SetBLASBuildSettings(const BVHBuildSettings& settings) { m_blasBuildSettings = settings; }
+    const BVHBuildSettings& GetBLASBuildSettings() const { return m_blasBuildSettings; }
+
+    // Optional treelet restructuring after each BLAS build (off by default).
+    void SetBLASOptimizeSettings(const BVHOptimizeSettings& settings) { m_blasOptimizeSettings = settings; }
+    const BVHOptimizeStats& GetLastBLASOptimizeStats() const { return m_lastBlasOptimizeStats; }
+
+    // Wide and compressed layouts are derived from the binary trees after every BLAS/TLAS build or refit.
+    // Changing the layout re-derives the cached BLASes.
+    void SetCpuBVHLayout(CpuBVHLayout layout);
+    CpuBVHLayout GetCpuBVHLayout() const { return m_cpuBvhLayout; }
+
+    // BLAS leaves are also packed into SoA triangle blocks of this width for the CPU ray tracer: 4 (SSE), 8 (AVX)
+    // or 0 for scalar per-triangle tests. 8 falls back to 4 on CPUs without AVX. Changing it repacks the cached
+    // BLASes. Pair it with BVHBuildSettings::MaxLeafSize so leaves fill whole blocks.
+    void SetCpuTriangleBlockWidth(uint32_t width);
+    uint32_t GetCpuTriangleBlockWidth() const { return m_cpuTriangleBlockWidth; }
+
+    // Deforming meshes: moves the vertices of a cached BLAS and refits its nodes bottom-up, keeping the topology.
+    // newVertexPositions holds one position per vertex of model->Meshes, mesh after mesh (as in ModelMesh::Vertices).
+    // Normals and texture coordinates are kept. Only the BLAS's own ranges of the triangle and node buffers are
+    // uploaded (nothing without a command list). Call RefitTLAS afterwards so the instances see the new bounds.
+    HRESULT RefitBLAS(ID3D12GraphicsCommandList* cmdList, const Model* model, const std::vector<XMFLOAT3>& newVertexPositions);
+    const BLASRefitStats& GetLastBLASRefitStats() const { return m_lastBlasRefitStats; }
+
+    // A refit keeps the tree built for the original positions, so its SAH cost grows as the mesh deforms.
+    // RefitBLAS recommends a rebuild once the cost exceeds the build cost by this factor.
+    void SetBLASRebuildThreshold(float sahRatio) { m_blasRebuildThreshold = sahRatio; }
+    float GetBLASRebuildThreshold() const { return m_blasRebuildThreshold; }
+
+    // Binned SAH by default; the midpoint builder is faster but gives a slower TLAS for overlapping instances.
+    void SetTLASBuildSettings(const TLASBuildSettings& settings) { m_tlasBuildSettings = settings; }
+    const TLASBuildSettings& GetTLASBuildSettings() const { return m_tlasBuildSettings; }
+    const TLASBuildStats& GetLastTLASBuildStats() const { return m_lastTlasBuildStats; }
 
     void BuildTLAS(const std::vector<ModelInstance>& instances);
     void UpdateGpuBuffers(ID3D12GraphicsCommandList* cmdList, const std::vector<ModelInstance>& instances);
+
+    // Moves the TLAS to the instances' current transforms, keeping its topology. The instances must be the ones
+    // of the latest BuildTLAS.
     void RefitTLAS(const std::vector<ModelInstance>& instances);
 
+    // Per-frame update for moving instances. Refits while only transforms (or material offsets) change, rebuilds
+    // when instances are added, removed or point at another model, and also rebuilds once the refitted tree's SAH
+    // cost exceeds the latest build's by the TLAS rebuild threshold.
+    void UpdateTLAS(const std::vector<ModelInstance>& instances);
+    const TLASUpdateStats& GetLastTLASUpdateStats() const { return m_lastTlasUpdateStats; }
+
+    void SetTLASRebuildThreshold(float sahRatio) { m_tlasRebuildThreshold = sahRatio; }
+    float GetTLASRebuildThreshold() const { return m_tlasRebuildThreshold; }
+
     bool StaticGeometrySrvsNeedUpdate() { bool dirty = m_staticGeometrySrvsDirty; m_staticGeometrySrvsDirty = false; return dirty; }
     bool InstanceSrvsNeedUpdate() { bool dirty = m_instanceSrvsDirty; m_instanceSrvsDirty = false; return dirty; }
 
@@ -57,6 +255,10 @@ public:
     UINT GetUberTriangleCount() const { return m_uberTriangleBuffer.Size; }
     UINT GetUberTriangleBufferStride() const { return m_uberTriangleBuffer.Stride; }
 
+    ID3D12Resource* GetUberTriangleAttributeBuffer() const { return m_uberTriangleAttributeBuffer.Resource.Get(); }
+    UINT GetUberTriangleAttributeCount() const { return m_uberTriangleAttributeBuffer.Size; }
+    UINT GetUberTriangleAttributeBufferStride() const { return m_uberTriangleAttributeBuffer.Stride; }
+
     ID3D12Resource* GetUberBlasNodeBuffer() const { return m_uberBlasNodeBuffer.Resource.Get(); }
     UINT GetUberBlasNodeCount() const { return m_uberBlasNodeBuffer.Size; }
     UINT GetUberBlasNodeBufferStride() const { return m_uberBlasNodeBuffer.Stride; }
@@ -69,29 +271,121 @@ public:
     UINT GetInstanceCount() const { return m_instanceDataBuffer.Size; }
     UINT GetInstanceBufferStride() const { return m_instanceDataBuffer.Stride; }
 
+    // CPU-side mirrors of the GPU buffers, used by the CPU ray tracer and tools.
+    const std::vector<TrianglePositions>& GetCpuTrianglePositions() const { return m_allTrianglePositions; }
+    const std::vector<TriangleAttributes>& GetCpuTriangleAttributes() const { return m_allTriangleAttributes; }
+    const std::vector<BVHNode>& GetCpuBlasNodes() const { return m_allBlasNodes; }
+    const std::vector<BVHNode>& GetCpuTLASNodes() const { return m_tlasNodes; }
+    const std::vector<ModelInstanceGPUData>& GetCpuInstanceData() const { return m_instanceData; }
+
+    // Wide copies for the current CpuBVHLayout (empty for the other layouts). The TLAS root is node 0.
+    const std::vector<BVH4Node>& GetCpuWideBlasNodes4() const { return m_wideBlasNodes4; }
+    const std::vector<BVH4Node>& GetCpuWideTLASNodes4() const { return m_wideTlasNodes4; }
+    const std::vector<BVH8Node>& GetCpuWideBlasNodes8() const { return m_wideBlasNodes8; }
+    const std::vector<BVH8Node>& GetCpuWideTLASNodes8() const { return m_wideTlasNodes8; }
+    const std::vector<CompressedBVHNode>& GetCpuCompressedBlasNodes() const { return m_compressedBlasNodes; }
+
+    // Triangle blocks for the current block width (empty for the other width). Indexed by absolute triangle index,
+    // GetCpuLeafFirstBlock() gives the first block of the leaf starting at that triangle.
+    const std::vector<TriangleBlock4>& GetCpuTriangleBlocks4() const { return m_triangleBlocks4; }
+    const std::vector<TriangleBlock8>& GetCpuTriangleBlocks8() const { return m_triangleBlocks8; }
+    const std::vector<uint32_t>& GetCpuLeafFirstBlock() const { return m_leafFirstBlock; }
+    const std::vector<uint32_t>& GetCpuInstanceWideRoots() const { return m_instanceWideRoots; } // Per instance, like m_instanceData
+
+    // Instance masks gathered up the TLAS, so that rays can skip subtrees holding no instance they see: the OR of
+    // the InstanceMask of every instance below each binary TLAS node, and below each child of every wide TLAS node
+    // of the current layout (Width entries per node, see WideBVH::ComputeChildMasks).
+    const std::vector<uint8_t>& GetCpuTLASNodeMasks() const { return m_tlasNodeMasks; }
+    const std::vector<uint8_t>& GetCpuWideTLASChildMasks() const { return m_wideTlasChildMasks; }
+
+    // CPU ray queries against the arrays above (see RayQuery.h). ray.Direction must be normalized; tMax and the hit
+    // distance are measured along it in world space. Safe from any number of threads at once, as long as nothing
+    // builds, publishes, releases or refits meanwhile. Batches should gather a RayQuery::Scene once instead.
+    // Only instances whose InstanceMask shares a bit with rayMask are hit.
+    RayHit Intersect(const Ray& ray, float tMax = FLT_MAX, uint8_t rayMask = INSTANCE_MASK_ALL) const;
+    bool Occluded(const Ray& ray, float tMax, uint8_t rayMask = INSTANCE_MASK_ALL) const;
 
 
 private:
     RenderEngine* m_pRenderEngine = nullptr;
 
-    void RefitNodeRecursive(int nodeIndex, const std::vector<ModelInstance>& instances);
+    float RefitTLASNodes(const std::vector<ModelInstance>& instances);
+    void BuildTLASRefitLevels();
+    void BuildInstanceData(const std::vector<ModelInstance>& instances);
 
     const BuiltBLAS* BuildBLASFromModel(ID3D12GraphicsCommandList* cmdList, Model* model);
+    const BuiltBLAS* SpliceBLAS(const Model* model, BLASBuildContext& context);
+    void CollapseBLASForCpu(BuiltBLAS& blas);
+    void CollapseTLASForCpu();
+    void UpdateTLASMasks();
+    void PackBLASTrianglesForCpu(BuiltBLAS& blas);
+    void RefitBLASForCpu(const BuiltBLAS& blas);
+    void ResizeBLASArrays();
+    void RederiveBLASesForCpu();
+    void SyncBLASGpuBuffers(ID3D12GraphicsCommandList* cmdList);
 
     ID3D12Device* m_device = nullptr;
 
+    BVHBuildSettings m_blasBuildSettings;
+    BVHOptimizeSettings m_blasOptimizeSettings;
+    BVHOptimizeStats m_lastBlasOptimizeStats;
+    BLASRefitStats m_lastBlasRefitStats;
+    TLASBuildSettings m_tlasBuildSettings;
+    TLASBuildStats m_lastTlasBuildStats;
+    TLASUpdateStats m_lastTlasUpdateStats;
+    float m_tlasRebuildThreshold = 1.3f;
+    std::vector<const Model*> m_tlasInstanceModels; // SourceModel of every instance at the latest BuildTLAS
+    std::vector<uint32_t> m_tlasRefitNodes;         // Internal TLAS nodes by depth, deepest first
+    std::vector<uint32_t> m_tlasRefitLevels;        // Start of every depth in m_tlasRefitNodes, plus its end
+    float m_blasRebuildThreshold = 1.5f;
+    std::filesystem::path m_blasCacheDirectory;
+    BLASCacheStats m_blasCacheStats;
+    float m_blasCompactionThreshold = 0.25f;
+    uint32_t m_blasCompactionBudget = 1u << 20;
+    uint32_t m_blasCompactionNodeBudget = 0;
+    CpuBVHLayout m_cpuBvhLayout = CpuBVHLayout::BVH4;
+    uint32_t m_cpuTriangleBlockWidth = 4;
+
     bool m_staticGeometrySrvsDirty = false;
     bool m_instanceSrvsDirty = false;
+    bool m_blasGpuBuffersStale = false; // Released or compacted without a command list
 
-    ResizableBuffer m_uberTriangleBuffer;
+    ResizableBuffer m_uberTriangleBuffer;          // TrianglePositions
+    ResizableBuffer m_uberTriangleAttributeBuffer; // TriangleAttributes, same indexing
     ResizableBuffer m_uberBlasNodeBuffer;
     ResizableBuffer m_tlasNodeBuffer;
     ResizableBuffer m_instanceDataBuffer;
 
     // CPU-side data
-    std::vector<Triangle> m_allTriangles;
+    std::vector<TrianglePositions> m_allTrianglePositions;
+    std::vector<TriangleAttributes> m_allTriangleAttributes;
     std::vector<BVHNode> m_allBlasNodes;
+    RangeAllocator m_triangleRanges; // Ranges of m_allTrianglePositions and m_allTriangleAttributes
+    RangeAllocator m_nodeRanges;     // Ranges of m_allBlasNodes
     std::vector<BVHNode> m_tlasNodes;
+    std::vector<ModelInstanceGPUData> m_instanceData; // Indexed by the instance index stored in TLAS leaves
+    std::vector<uint8_t> m_tlasNodeMasks;             // Per m_tlasNodes entry
+    std::vector<uint8_t> m_wideTlasChildMasks;        // Per child of m_wideTlasNodes4 or m_wideTlasNodes8
+
+    std::vector<BVH4Node> m_wideBlasNodes4;
+    std::vector<BVH4Node> m_wideTlasNodes4;
+    std::vector<BVH8Node> m_wideBlasNodes8;
+    std::vector<BVH8Node> m_wideTlasNodes8;
+    std::vector<CompressedBVHNode> m_compressedBlasNodes;
+    std::vector<TriangleBlock4> m_triangleBlocks4;
+    std::vector<TriangleBlock8> m_triangleBlocks8;
+    std::vector<uint32_t> m_leafFirstBlock;
+    std::vector<uint32_t> m_instanceWideRoots;
+    uint32_t m_deadCpuNodes = 0;  // Wide or compressed nodes and triangle blocks of released BLASes
+    uint32_t m_deadCpuBlocks = 0;
 
     std::unordered_map<const Model*, std::unique_ptr<BuiltBLAS>> m_blasCache;
+
+    // BLAS build temporaries, kept between synchronous builds
+    std::unique_ptr<BLASBuildContext> m_buildContext;
+
+    // Background BLAS builds, in request order. The scheduler outlives the group that waits on it.
+    std::unique_ptr<TaskScheduler> m_backgroundScheduler;
+    std::unique_ptr<TaskGroup> m_backgroundBuilds;
+    std::vector<std::unique_ptr<PendingBLASBuild>> m_pendingBlasBuilds;
 };
\ No newline at end of file
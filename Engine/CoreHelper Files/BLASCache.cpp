@@ -0,0 +1,298 @@
+#include "BLASCache.h"
+#include <fstream>
+#include <cstring>
+#include <atomic>
+
+namespace
+{
+    // Byte offsets of the arrays in a cache file
+    struct BLASCacheLayout
+    {
+        uint64_t Positions;
+        uint64_t Attributes;
+        uint64_t Nodes;
+        uint64_t SourceTriangles;
+        uint64_t FileSize;
+    };
+
+    uint64_t AlignUp(uint64_t value)
+    {
+        return (value + 15) & ~uint64_t(15);
+    }
+
+    BLASCacheLayout ComputeLayout(uint32_t triangleCount, uint32_t nodeCount)
+    {
+        BLASCacheLayout layout;
+        layout.Positions = AlignUp(sizeof(BLASCacheHeader));
+        layout.Attributes = AlignUp(layout.Positions + uint64_t(triangleCount) * sizeof(TrianglePositions));
+        layout.Nodes = AlignUp(layout.Attributes + uint64_t(triangleCount) * sizeof(TriangleAttributes));
+        layout.SourceTriangles = AlignUp(layout.Nodes + uint64_t(nodeCount) * sizeof(BVHNode));
+        layout.FileSize = layout.SourceTriangles + uint64_t(triangleCount) * sizeof(uint32_t);
+        return layout;
+    }
+
+    // Word-wise 64-bit hash; the finalizer is the one from MurmurHash3
+    struct KeyHasher
+    {
+        uint64_t Hash = 0x9E3779B97F4A7C15ull;
+
+        void AddWord(uint32_t word)
+        {
+            Hash = (Hash ^ word) * 0x100000001B3ull;
+            Hash ^= Hash >> 29;
+        }
+
+        void AddFloat(float value)
+        {
+            uint32_t word;
+            memcpy(&word, &value, sizeof(word));
+            AddWord(word);
+        }
+
+        void AddWords(const void* data, size_t byteCount)
+        {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            for (size_t offset = 0; offset + 4 <= byteCount; offset += 4)
+            {
+                uint32_t word;
+                memcpy(&word, bytes + offset, sizeof(word));
+                AddWord(word);
+            }
+        }
+
+        uint64_t Finish() const
+        {
+            uint64_t h = Hash;
+            h ^= h >> 33;
+            h *= 0xFF51AFD7ED558CCDull;
+            h ^= h >> 33;
+            h *= 0xC4CEB9FE1A85EC53ull;
+            h ^= h >> 33;
+            return h;
+        }
+    };
+
+    // Every node reachable from the root exactly once, inside the node array, and every leaf inside the triangles.
+    // Guards traversal against a damaged file, which would otherwise read out of bounds or loop forever. Trees deeper
+    // than BVHBuilder::MAX_DEPTH would overflow the traversal stacks, so they are rejected too.
+    bool ValidateNodes(const BVHNode* nodes, uint32_t nodeCount, uint32_t triangleCount)
+    {
+        if (nodeCount == 0) return true;
+
+        std::vector<uint8_t> visited(nodeCount, 0);
+        std::vector<std::pair<uint32_t, uint32_t>> stack; // Node, level
+        stack.push_back({ 0u, 1u });
+        while (!stack.empty())
+        {
+            uint32_t nodeIndex = stack.back().first;
+            uint32_t level = stack.back().second;
+            stack.pop_back();
+            if (visited[nodeIndex] || level > BVHBuilder::MAX_DEPTH) return false;
+            visited[nodeIndex] = 1;
+
+            const BVHNode& node = nodes[nodeIndex];
+            if (node.triangleCount < 0 || node.leftChildOrFirstTriangleIndex < 0) return false;
+
+            if (node.triangleCount > 0)
+            {
+                if (uint64_t(node.leftChildOrFirstTriangleIndex) + uint64_t(node.triangleCount) > triangleCount) return false;
+            }
+            else
+            {
+                uint32_t left = static_cast<uint32_t>(node.leftChildOrFirstTriangleIndex);
+                if (uint64_t(left) + 1 >= nodeCount) return false;
+                stack.push_back({ left, level + 1 });
+                stack.push_back({ left + 1, level + 1 });
+            }
+        }
+        return true;
+    }
+}
+
+uint64_t BLASCache::ComputeKey(const std::vector<Triangle>& triangles, const BVHBuildSettings& buildSettings, const BVHOptimizeSettings& optimizeSettings)
+{
+    KeyHasher hasher;
+    hasher.AddWord(FORMAT_VERSION);
+
+    // 1. Settings that change the tree
+    hasher.AddWord(static_cast<uint32_t>(buildSettings.Mode));
+    hasher.AddWord(buildSettings.MaxLeafSize);
+    hasher.AddFloat(buildSettings.SpatialSplitBudget);
+    hasher.AddFloat(buildSettings.SpatialSplitOverlapThreshold);
+    hasher.AddWord(buildSettings.MortonCodeBits);
+    hasher.AddWord(buildSettings.SAHTopLevelBits);
+    hasher.AddWord(optimizeSettings.TreeletPasses);
+    hasher.AddWord(optimizeSettings.TreeletSize);
+
+    // 2. The geometry, including the attributes since they are stored too
+    hasher.AddWord(static_cast<uint32_t>(triangles.size()));
+    hasher.AddWords(triangles.data(), triangles.size() * sizeof(Triangle));
+
+    return hasher.Finish();
+}
+
+std::filesystem::path BLASCache::GetFilePath(const std::filesystem::path& directory, uint64_t key)
+{
+    char fileName[32];
+    sprintf_s(fileName, "%016llx.blas", (unsigned long long)key);
+    return directory / fileName;
+}
+
+HRESULT BLASCache::Write(const std::filesystem::path& path, const BLASCacheData& data)
+{
+    const BLASCacheLayout layout = ComputeLayout(data.TriangleCount, data.NodeCount);
+
+    BLASCacheHeader header = {};
+    header.Magic = MAGIC;
+    header.Version = FORMAT_VERSION;
+    header.Key = data.Key;
+    header.SourceTriangleCount = data.SourceTriangleCount;
+    header.TriangleCount = data.TriangleCount;
+    header.NodeCount = data.NodeCount;
+    header.BuildSAHCost = data.BuildSAHCost;
+    header.FileSize = layout.FileSize;
+
+    // 1. Write everything to a temporary file, zero-padding up to each array. Background builds of identical
+    //    geometry may write the same key at once, so every write gets its own temporary file.
+    static std::atomic<uint32_t> s_tempFileCounter{ 0 };
+    std::filesystem::path tempPath = path;
+    tempPath += ".tmp" + std::to_string(s_tempFileCounter++);
+    {
+        std::ofstream outFile(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!outFile)
+            return E_FAIL;
+
+        const char padding[16] = {};
+        uint64_t written = 0;
+        auto writeAt = [&](uint64_t offset, const void* bytes, uint64_t byteCount)
+        {
+            outFile.write(padding, static_cast<std::streamsize>(offset - written));
+            outFile.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(byteCount));
+            written = offset + byteCount;
+        };
+
+        writeAt(0, &header, sizeof(header));
+        writeAt(layout.Positions, data.Positions, uint64_t(data.TriangleCount) * sizeof(TrianglePositions));
+        writeAt(layout.Attributes, data.Attributes, uint64_t(data.TriangleCount) * sizeof(TriangleAttributes));
+        writeAt(layout.Nodes, data.Nodes, uint64_t(data.NodeCount) * sizeof(BVHNode));
+        writeAt(layout.SourceTriangles, data.SourceTriangles, uint64_t(data.TriangleCount) * sizeof(uint32_t));
+
+        outFile.close();
+        if (!outFile)
+        {
+            std::error_code ignored;
+            std::filesystem::remove(tempPath, ignored);
+            return E_FAIL;
+        }
+    }
+
+    // 2. Replace the cache file in one step
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    if (error)
+    {
+        std::error_code ignored;
+        std::filesystem::remove(tempPath, ignored);
+        return HRESULT_FROM_WIN32(error.value());
+    }
+    return S_OK;
+}
+
+BLASCacheFile::~BLASCacheFile()
+{
+    Close();
+}
+
+HRESULT BLASCacheFile::Open(const std::filesystem::path& path, uint64_t key, uint32_t sourceTriangleCount)
+{
+    Close();
+
+    // 1. Map the whole file read-only
+    m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        DWORD error = GetLastError();
+        return (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) ? S_FALSE : HRESULT_FROM_WIN32(error);
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(m_file, &fileSize) || uint64_t(fileSize.QuadPart) < sizeof(BLASCacheHeader))
+    {
+        Close();
+        return E_FAIL;
+    }
+
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        Close();
+        return hr;
+    }
+
+    m_view = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_view)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        Close();
+        return hr;
+    }
+
+    // 2. The header must describe this key, this geometry and exactly this file
+    const uint8_t* bytes = static_cast<const uint8_t*>(m_view);
+    BLASCacheHeader header;
+    memcpy(&header, bytes, sizeof(header));
+
+    const BLASCacheLayout layout = ComputeLayout(header.TriangleCount, header.NodeCount);
+    if (header.Magic != BLASCache::MAGIC || header.Version != BLASCache::FORMAT_VERSION || header.Key != key ||
+        header.SourceTriangleCount != sourceTriangleCount || header.TriangleCount < sourceTriangleCount ||
+        header.FileSize != layout.FileSize || uint64_t(fileSize.QuadPart) != layout.FileSize)
+    {
+        Close();
+        return E_FAIL;
+    }
+
+    m_data.Key = header.Key;
+    m_data.SourceTriangleCount = header.SourceTriangleCount;
+    m_data.TriangleCount = header.TriangleCount;
+    m_data.NodeCount = header.NodeCount;
+    m_data.BuildSAHCost = header.BuildSAHCost;
+    m_data.Positions = reinterpret_cast<const TrianglePositions*>(bytes + layout.Positions);
+    m_data.Attributes = reinterpret_cast<const TriangleAttributes*>(bytes + layout.Attributes);
+    m_data.Nodes = reinterpret_cast<const BVHNode*>(bytes + layout.Nodes);
+    m_data.SourceTriangles = reinterpret_cast<const uint32_t*>(bytes + layout.SourceTriangles);
+
+    // 3. Every index must stay in range
+    bool valid = ValidateNodes(m_data.Nodes, m_data.NodeCount, m_data.TriangleCount);
+    for (uint32_t i = 0; valid && i < m_data.TriangleCount; ++i)
+    {
+        valid = m_data.SourceTriangles[i] < sourceTriangleCount;
+    }
+    if (!valid)
+    {
+        Close();
+        return E_FAIL;
+    }
+
+    return S_OK;
+}
+
+void BLASCacheFile::Close()
+{
+    if (m_view)
+    {
+        UnmapViewOfFile(m_view);
+        m_view = nullptr;
+    }
+    if (m_mapping)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+    m_data = BLASCacheData();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "../RenderEngine Files/global.h"
+#include <vector>
+#include "Mesh.h"
+#include "BVHBuilder.h"
+#include "BVHOptimizer.h"
+
+// On-disk cache of built BLASes, so that loading a scene again skips the builds. There is one file per BLAS, named
+// after a hash of the source triangles and of every setting that changes the result. A file holds the final
+// triangle arrays, the nodes (child indices local to the BLAS) and the source triangle of every slot. Files are
+// memory-mapped for loading, so the arrays are copied from the page cache straight into the uber arrays.
+//
+// Layout: BLASCacheHeader, then positions, attributes, nodes and source triangles, each starting on a 16-byte
+// boundary.
+
+struct BLASCacheHeader
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t Key;
+    uint32_t SourceTriangleCount; // Triangles gathered from the model, before spatial split duplicates
+    uint32_t TriangleCount;
+    uint32_t NodeCount;
+    float BuildSAHCost;
+    uint64_t FileSize;
+};
+
+// One BLAS as written to or mapped from a cache file. The pointers are not owned.
+struct BLASCacheData
+{
+    uint64_t Key = 0;
+    uint32_t SourceTriangleCount = 0;
+    uint32_t TriangleCount = 0;
+    uint32_t NodeCount = 0;
+    float BuildSAHCost = 0.0f;
+    const TrianglePositions* Positions = nullptr;
+    const TriangleAttributes* Attributes = nullptr;
+    const BVHNode* Nodes = nullptr; // Child indices local to the BLAS, root at 0
+    const uint32_t* SourceTriangles = nullptr;
+};
+
+namespace BLASCache
+{
+    const uint32_t MAGIC = 0x53414C42; // "BLAS"
+    const uint32_t FORMAT_VERSION = 2; // Bump whenever the file layout or the builders' output changes (2: depth-limited trees)
+
+    // Key of a BLAS: the gathered triangles (before the build reorders them), the format version and the settings.
+    uint64_t ComputeKey(const std::vector<Triangle>& triangles, const BVHBuildSettings& buildSettings, const BVHOptimizeSettings& optimizeSettings);
+
+    std::filesystem::path GetFilePath(const std::filesystem::path& directory, uint64_t key);
+
+    // Writes to a temporary file next to the target and renames it, so readers never see a partial file.
+    // Safe to call from several threads.
+    HRESULT Write(const std::filesystem::path& path, const BLASCacheData& data);
+}
+
+// A read-only mapping of one cache file. Open validates the header, every node against the array sizes and the
+// tree's depth, so a stale or damaged file is reported as a miss instead of being traversed. The data stays valid
+// until Close.
+class BLASCacheFile
+{
+public:
+    BLASCacheFile() = default;
+    ~BLASCacheFile();
+
+    BLASCacheFile(const BLASCacheFile&) = delete;
+    BLASCacheFile& operator=(const BLASCacheFile&) = delete;
+
+    // S_FALSE when there is no file for the key, E_FAIL when it does not match or is damaged.
+    HRESULT Open(const std::filesystem::path& path, uint64_t key, uint32_t sourceTriangleCount);
+    void Close();
+
+    const BLASCacheData& GetData() const { return m_data; }
+
+private:
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+    const void* m_view = nullptr;
+    BLASCacheData m_data;
+};
@@ -1,23 +1,13 @@
 #include "BVHBuilder.h"
+#include "TaskScheduler.h"
+#include "CpuFeatures.h"
 #include <algorithm>
-#include <atomic> 
-#include <future>
-
-// Helper to compute the AABB for a range of triangles
-void ComputeAABB(const std::vector<Triangle>& triangles, uint32_t startIndex, uint32_t count, DirectX::XMFLOAT3& outMin, DirectX::XMFLOAT3& outMax)
-{
-    outMin = { FLT_MAX, FLT_MAX, FLT_MAX };
-    outMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
-
-    for (uint32_t i = 0; i < count; ++i) {
-        const Triangle& tri = triangles[startIndex + i];
-        auto min_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z)); };
-        auto max_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z)); };
-
-        outMin = min_v(outMin, tri.v0); outMin = min_v(outMin, tri.v1); outMin = min_v(outMin, tri.v2);
-        outMax = max_v(outMax, tri.v0); outMax = max_v(outMax, tri.v1); outMax = max_v(outMax, tri.v2);
-    }
-}
+#include <atomic>
+#include <immintrin.h>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
 
 float SurfaceArea(const DirectX::XMFLOAT3& aabbMin, const DirectX::XMFLOAT3& aabbMax)
 {
@@ -32,428 +22,2188 @@ float SurfaceArea(const DirectX::XMFLOAT3& aabbMin, const DirectX::XMFLOAT3& aab
     return 2.0f * (extent.x * extent.y + extent.x * extent.z + extent.y * extent.z);
 }
 
-
-// The main recursive builder function
-void SubdivideSortNode(BVHNode& node, std::vector<Triangle>& triangles, std::vector<BVHNode>& bvhNodes, uint32_t startIndex, uint32_t count, uint32_t baseTriangleIndex, uint32_t& nodesUsed)
+// --- Parallel Binned SAH Builder ---
+// The build never touches the Triangle records: it works on compact SoA arrays of per-primitive centroids
+// and bounds and only permutes a 32-bit index array. The triangles are reordered once at the very end.
+// Subtrees are built as tasks on the shared TaskScheduler and large nodes also bin and partition in
+// parallel. All work splits use fixed sizes, partitions are stable and the bin reductions (counts,
+// min/max) are exact, so the resulting tree is identical for any number of threads. The tree is first
+// built into temporary nodes and then flattened depth-first in the same order the serial builder used.
+namespace
 {
-    // If a node has 4 or fewer triangles, it becomes a leaf. This is a tunable parameter.
-    if (count <= 4 ) {
-        node.leftChildOrFirstTriangleIndex = baseTriangleIndex + startIndex;
-        node.triangleCount = count;
-        return;
-    }
+    const int NUM_BINS = 16;
 
-    float bestCost = FLT_MAX;
-    int bestAxis = -1;
-    uint32_t bestSplitIndex = 0;
+    // Nodes with at least this many primitives bin, partition and compute bounds in parallel...
+    const uint32_t PARALLEL_NODE_THRESHOLD = 32 * 1024;
+    // ...split into blocks of this many primitives.
+    const uint32_t PARALLEL_BLOCK_SIZE = 8 * 1024;
+    // Children with at least this many primitives are built as separate tasks.
+    const uint32_t SUBTREE_TASK_THRESHOLD = 1024;
 
-    // Iterate through all three axes to find the best split
-    for (int axis = 0; axis < 3; ++axis)
+    // Same semantics as _mm_min_ps/_mm_max_ps, so the scalar and SIMD kernels produce identical bits.
+    inline float MinF(float a, float b) { return a < b ? a : b; }
+    inline float MaxF(float a, float b) { return a > b ? a : b; }
+
+    // Per-primitive build data in SoA form, indexed by the primitive's original position.
+    struct PrimitiveRefs
     {
-        // Sort triangles along the current axis based on their centroid
-        std::sort(triangles.begin() + startIndex, triangles.begin() + startIndex + count,
-            [axis](const Triangle& a, const Triangle& b) {
-                float centerA = (a.v0.x + a.v1.x + a.v2.x) * 0.3333f;
-                if (axis == 1) centerA = (a.v0.y + a.v1.y + a.v2.y) * 0.3333f;
-                if (axis == 2) centerA = (a.v0.z + a.v1.z + a.v2.z) * 0.3333f;
+        std::vector<float> centroid[3];
+        std::vector<float> boundsMin[3];
+        std::vector<float> boundsMax[3];
 
-                float centerB = (b.v0.x + b.v1.x + b.v2.x) * 0.3333f;
-                if (axis == 1) centerB = (b.v0.y + b.v1.y + b.v2.y) * 0.3333f;
-                if (axis == 2) centerB = (b.v0.z + b.v1.z + b.v2.z) * 0.3333f;
+        void Initialize(const std::vector<Triangle>& triangles, TaskScheduler* scheduler)
+        {
+            const uint32_t count = static_cast<uint32_t>(triangles.size());
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                centroid[axis].resize(count);
+                boundsMin[axis].resize(count);
+                boundsMax[axis].resize(count);
+            }
 
-                return centerA < centerB;
-            });
+            scheduler->ParallelFor(count, PARALLEL_BLOCK_SIZE, [&](uint32_t begin, uint32_t end)
+                {
+                    for (uint32_t i = begin; i < end; ++i)
+                    {
+                        const Triangle& tri = triangles[i];
+                        centroid[0][i] = (tri.v0.x + tri.v1.x + tri.v2.x) * 0.3333f;
+                        centroid[1][i] = (tri.v0.y + tri.v1.y + tri.v2.y) * 0.3333f;
+                        centroid[2][i] = (tri.v0.z + tri.v1.z + tri.v2.z) * 0.3333f;
+                        boundsMin[0][i] = MinF(MinF(tri.v0.x, tri.v1.x), tri.v2.x);
+                        boundsMin[1][i] = MinF(MinF(tri.v0.y, tri.v1.y), tri.v2.y);
+                        boundsMin[2][i] = MinF(MinF(tri.v0.z, tri.v1.z), tri.v2.z);
+                        boundsMax[0][i] = MaxF(MaxF(tri.v0.x, tri.v1.x), tri.v2.x);
+                        boundsMax[1][i] = MaxF(MaxF(tri.v0.y, tri.v1.y), tri.v2.y);
+                        boundsMax[2][i] = MaxF(MaxF(tri.v0.z, tri.v1.z), tri.v2.z);
+                    }
+                });
+        }
+    };
 
-        // Test N-1 possible splits between the sorted triangles
-        for (uint32_t i = 1; i < count; ++i)
-        {
-            uint32_t splitIndex = startIndex + i;
+    struct BuildNode
+    {
+        DirectX::XMFLOAT3 aabbMin;
+        DirectX::XMFLOAT3 aabbMax;
+        uint32_t startIndex = 0;
+        uint32_t count = 0;
+        BuildNode* children[2] = { nullptr, nullptr };
+    };
 
-            // Compute AABB for the left and right sides of the potential split
-            DirectX::XMFLOAT3 leftMin, leftMax, rightMin, rightMax;
-            ComputeAABB(triangles, startIndex, i, leftMin, leftMax); // Left side has 'i' triangles
-            ComputeAABB(triangles, splitIndex, count - i, rightMin, rightMax); // Right side has 'count - i' triangles
+    struct AxisBins
+    {
+        Bin bins[3][NUM_BINS];
+    };
 
-            // Calculate the SAH cost for this split
-            float cost = SurfaceArea(leftMin, leftMax) * i + SurfaceArea(rightMin, rightMax) * (count - i);
+    // Per-block temporaries of the passes that split a large node (or the whole mesh) into PARALLEL_BLOCK_SIZE
+    // blocks. Refilled with assign/resize, so they only allocate when a bigger node than before comes along.
+    struct BlockScratch
+    {
+        std::vector<AxisBins> bins;
+        std::vector<uint32_t> leftCount;
+        std::vector<uint32_t> leftOffset;
+        std::vector<uint32_t> rightOffset;
+        std::vector<DirectX::XMFLOAT3> boundsMin;
+        std::vector<DirectX::XMFLOAT3> boundsMax;
+        std::vector<uint32_t> histograms;
+    };
 
-            if (cost < bestCost)
+    // Node storage in fixed-size chunks: addresses stay stable while the arena grows, and clear() keeps the chunks
+    // so the next build on the same thread allocates nothing.
+    class BuildNodeArena
+    {
+    public:
+        BuildNode& emplace_back()
+        {
+            if (m_size == m_chunks.size() * CHUNK_SIZE)
             {
-                bestCost = cost;
-                bestAxis = axis;
-                bestSplitIndex = splitIndex;
+                m_chunks.emplace_back(new BuildNode[CHUNK_SIZE]);
             }
+            BuildNode& node = m_chunks[m_size / CHUNK_SIZE][m_size % CHUNK_SIZE];
+            node = BuildNode();
+            m_size++;
+            return node;
         }
-    }
 
-    // If we didn't find a good split (e.g., all triangles are at the same point), fall back to a simple split
-    if (bestAxis == -1)
+        size_t size() const { return m_size; }
+        void clear() { m_size = 0; }
+
+        // Only the task that owns the arena splits nodes with it, so its block scratch needs no synchronisation
+        BlockScratch& blocks() { return m_blocks; }
+
+    private:
+        static const size_t CHUNK_SIZE = 256;
+        std::vector<std::unique_ptr<BuildNode[]>> m_chunks;
+        size_t m_size = 0;
+        BlockScratch m_blocks;
+    };
+
+    // Temporaries of the object-split and linear builders. Each thread keeps one between builds, so importing
+    // models one after another reuses the same memory instead of allocating and freeing it per build.
+    struct BuildScratch
     {
-        bestSplitIndex = startIndex + count / 2;
-    }
-    else
+        PrimitiveRefs refs;
+        std::vector<uint32_t> indices;
+        std::vector<uint32_t> scratch;
+        std::vector<std::unique_ptr<BuildNodeArena>> arenas;
+        std::vector<Triangle> sortedTriangles;
+        std::vector<uint64_t> mortonCodes;
+        std::vector<uint64_t> scratchCodes;
+        BlockScratch blocks; // For the whole-mesh passes of the linear builder
+        bool inUse = false;
+    };
+
+    thread_local std::unique_ptr<BuildScratch> t_buildScratch;
+
+    // Hands out the calling thread's scratch for the duration of one build. A build started on a thread whose
+    // scratch is taken (a build task run while another build waits) gets a temporary one instead.
+    class ScratchLease
     {
-        // Re-sort the triangles along the best axis found to ensure the partition is correct
-        std::sort(triangles.begin() + startIndex, triangles.begin() + startIndex + count,
-            [bestAxis](const Triangle& a, const Triangle& b) {
-                float centerA = (a.v0.x + a.v1.x + a.v2.x) * 0.3333f;
-                if (bestAxis == 1) centerA = (a.v0.y + a.v1.y + a.v2.y) * 0.3333f;
-                if (bestAxis == 2) centerA = (a.v0.z + a.v1.z + a.v2.z) * 0.3333f;
+    public:
+        ScratchLease()
+        {
+            if (!t_buildScratch)
+            {
+                t_buildScratch = std::make_unique<BuildScratch>();
+            }
+            if (!t_buildScratch->inUse)
+            {
+                m_scratch = t_buildScratch.get();
+                m_scratch->inUse = true;
+            }
+            else
+            {
+                m_owned = std::make_unique<BuildScratch>();
+                m_scratch = m_owned.get();
+            }
+        }
 
-                float centerB = (b.v0.x + b.v1.x + b.v2.x) * 0.3333f;
-                if (bestAxis == 1) centerB = (b.v0.y + b.v1.y + b.v2.y) * 0.3333f;
-                if (bestAxis == 2) centerB = (b.v0.z + b.v1.z + b.v2.z) * 0.3333f;
+        ~ScratchLease()
+        {
+            if (!m_owned)
+            {
+                m_scratch->inUse = false;
+            }
+        }
 
-                return centerA < centerB;
-            });
-    }
+        ScratchLease(const ScratchLease&) = delete;
+        ScratchLease& operator=(const ScratchLease&) = delete;
 
-    uint32_t leftCount = bestSplitIndex - startIndex;
-    if (leftCount == 0 || leftCount == count) {
-        leftCount = count / 2;
-    }
+        BuildScratch& Get() { return *m_scratch; }
 
-    // If the partition failed (all triangles on one side), force a 50/50 split.
-    if (leftCount == 0 || leftCount == count) {
-        leftCount = count / 2;
-    }
+    private:
+        BuildScratch* m_scratch = nullptr;
+        std::unique_ptr<BuildScratch> m_owned;
+    };
 
-    // 3. Create child nodes
-    uint32_t leftChildIndex = nodesUsed++;
-    uint32_t rightChildIndex = nodesUsed++;
+    struct BuildContext;
+    struct BinningSetup;
+    struct SplitCandidate;
 
-    // The current node is now an internal node
-    node.leftChildOrFirstTriangleIndex = leftChildIndex;
-    node.triangleCount = 0;
+    // Binning and SAH sweep implementations, picked once per build from the CPU's features.
+    using BinningKernelFunc = void(*)(const BuildContext&, uint32_t, uint32_t, const BinningSetup&, AxisBins&);
+    using SweepKernelFunc = SplitCandidate(*)(const AxisBins&, const bool[3]);
 
-    // 4. Initialize children: compute their AABBs and recurse
-    BVHNode& leftChild = bvhNodes[leftChildIndex];
-    uint32_t leftStartIndex = startIndex;
-    ComputeAABB(triangles, leftStartIndex, leftCount, leftChild.aabbMin, leftChild.aabbMax);
+    struct BuildKernels
+    {
+        BinningKernelFunc bin;
+        SweepKernelFunc sweep;
+    };
 
-    BVHNode& rightChild = bvhNodes[rightChildIndex];
-    uint32_t rightStartIndex = startIndex + leftCount;
-    int rightCount = count - leftCount;
-    ComputeAABB(triangles, rightStartIndex, rightCount, rightChild.aabbMin, rightChild.aabbMax);
+    struct BuildContext
+    {
+        BuildScratch& storage;
+        PrimitiveRefs& refs;
+        std::vector<uint32_t>& indices; // Primitive permutation; node ranges index into this
+        std::vector<uint32_t>& scratch;
+        TaskScheduler* scheduler;
+        TaskGroup* subtreeTasks;
+        BuildKernels kernels;
+        uint32_t maxLeafSize = 4;
+
+        // One arena per subtree task, so node allocation needs no synchronisation. The first arenaCount arenas
+        // of the scratch belong to this build.
+        std::mutex arenaMutex;
+        size_t arenaCount = 0;
+
+        BuildContext(BuildScratch& buildScratch, TaskScheduler* taskScheduler, TaskGroup* tasks, const BuildKernels& buildKernels)
+            : storage(buildScratch), refs(buildScratch.refs), indices(buildScratch.indices), scratch(buildScratch.scratch),
+              scheduler(taskScheduler), subtreeTasks(tasks), kernels(buildKernels) {}
+
+        BuildNodeArena& NewArena()
+        {
+            std::lock_guard<std::mutex> lock(arenaMutex);
+            if (arenaCount == storage.arenas.size())
+            {
+                storage.arenas.push_back(std::make_unique<BuildNodeArena>());
+            }
+            BuildNodeArena& arena = *storage.arenas[arenaCount++];
+            arena.clear();
+            return arena;
+        }
+    };
 
-    SubdivideSortNode(leftChild, triangles, bvhNodes, leftStartIndex, leftCount, baseTriangleIndex,nodesUsed);
-    SubdivideSortNode(rightChild, triangles, bvhNodes, rightStartIndex, rightCount, baseTriangleIndex,nodesUsed);
-}
+    inline DirectX::XMFLOAT3 Min3(const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(MinF(a.x, b.x), MinF(a.y, b.y), MinF(a.z, b.z)); }
+    inline DirectX::XMFLOAT3 Max3(const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(MaxF(a.x, b.x), MaxF(a.y, b.y), MaxF(a.z, b.z)); }
 
-void SubdivideBinningPartitionNode(BVHNode& node, std::vector<Triangle>& triangles, std::vector<BVHNode>& bvhNodes, uint32_t startIndex, uint32_t count, uint32_t baseTriangleIndex, uint32_t& nodesUsed)
-{
-    // Leaf node condition: Stop if the number of triangles is small.
-    // This is our primary termination criteria.
-    if (count <= 4) {
-        node.leftChildOrFirstTriangleIndex = baseTriangleIndex + startIndex;
-        node.triangleCount = count;
-        return;
+    inline float AxisValue(const DirectX::XMFLOAT3& v, int axis)
+    {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
     }
 
-    // --- Binned SAH Implementation ---
-    const int NUM_BINS = 16;
-    float bestCost = FLT_MAX;
-    int bestAxis = -1;
-    int bestSplitBinIndex = 0; // The index of the first bin on the right side of the split
+    inline int LongestAxis(const DirectX::XMFLOAT3& aabbMin, const DirectX::XMFLOAT3& aabbMax)
+    {
+        const DirectX::XMFLOAT3 extent = { aabbMax.x - aabbMin.x, aabbMax.y - aabbMin.y, aabbMax.z - aabbMin.z };
+        int axis = extent.y > extent.x ? 1 : 0;
+        if (extent.z > AxisValue(extent, axis))
+            axis = 2;
+        return axis;
+    }
+
+    // Levels of median splits it takes to bring count primitives down to leaves of at most maxLeafSize.
+    inline uint32_t MedianSplitLevels(uint32_t count, uint32_t maxLeafSize)
+    {
+        uint32_t levels = 0;
+        while (count > maxLeafSize)
+        {
+            count -= count / 2;
+            ++levels;
+        }
+        return levels;
+    }
 
-    // 1. Iterate through each axis to find the best possible split.
-    for (int axis = 0; axis < 3; ++axis)
+    // Whether a node at depth (root = 0) may take the split its builder prefers. Neither child is bigger than the
+    // node, so median splits below either of them still end within BVHBuilder::MAX_DEPTH levels. Past this point the builders
+    // split at the median, which keeps the condition true for the children: the tree never exceeds the limit as
+    // long as the root satisfies it (up to maxLeafSize * 2^31 primitives).
+    inline bool CanChooseSplit(uint32_t depth, uint32_t count, uint32_t maxLeafSize)
     {
-        Bin bins[NUM_BINS];
-        DirectX::XMFLOAT3 extent = { node.aabbMax.x - node.aabbMin.x, node.aabbMax.y - node.aabbMin.y, node.aabbMax.z - node.aabbMin.z };
+        return depth + 1 + MedianSplitLevels(count, maxLeafSize) < BVHBuilder::MAX_DEPTH;
+    }
 
-        float axisMin, axisExtent;
-        if (axis == 0) { axisMin = node.aabbMin.x; axisExtent = extent.x; }
-        else if (axis == 1) { axisMin = node.aabbMin.y; axisExtent = extent.y; }
-        else { axisMin = node.aabbMin.z; axisExtent = extent.z; }
+    // Everything the binning kernels need about the node being split.
+    struct BinningSetup
+    {
+        float axisMin[3];
+        float binScale[3]; // 0 for inactive axes
+        bool axisActive[3];
+    };
 
-        // If the node is flat along this axis, we can't split it.
-        if (axisExtent < 1e-6f) continue;
+    // =========================================================================
+    // BINNING KERNELS
+    // Each kernel bins indices[begin, end) along all three axes in a single pass. They visit primitives
+    // in the same order and use the same arithmetic, so all of them fill the bins bit-identically.
+    // =========================================================================
 
-        // 2. Populate the bins for the current axis in a single pass over the triangles.
-        for (uint32_t i = 0; i < count; ++i)
+    void BinPrimitivesScalar(const BuildContext& ctx, uint32_t begin, uint32_t end, const BinningSetup& setup, AxisBins& out)
+    {
+        const PrimitiveRefs& refs = ctx.refs;
+        for (uint32_t i = begin; i < end; ++i)
         {
-            Triangle& tri = triangles[startIndex + i];
-            float centroid;
-            if (axis == 0) centroid = (tri.v0.x + tri.v1.x + tri.v2.x) * 0.3333f;
-            else if (axis == 1) centroid = (tri.v0.y + tri.v1.y + tri.v2.y) * 0.3333f;
-            else centroid = (tri.v0.z + tri.v1.z + tri.v2.z) * 0.3333f;
+            const uint32_t prim = ctx.indices[i];
+            DirectX::XMFLOAT3 primMin = { refs.boundsMin[0][prim], refs.boundsMin[1][prim], refs.boundsMin[2][prim] };
+            DirectX::XMFLOAT3 primMax = { refs.boundsMax[0][prim], refs.boundsMax[1][prim], refs.boundsMax[2][prim] };
 
-            int binIndex = static_cast<int>(NUM_BINS * ((centroid - axisMin) / axisExtent));
-            binIndex = std::clamp(binIndex, 0, NUM_BINS - 1);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if (!setup.axisActive[axis])
+                    continue;
 
-            bins[binIndex].triangleCount++;
-            auto min_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z)); };
-            auto max_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z)); };
+                int binIndex = static_cast<int>(NUM_BINS * ((refs.centroid[axis][prim] - setup.axisMin[axis]) * setup.binScale[axis]));
+                binIndex = std::clamp(binIndex, 0, NUM_BINS - 1);
 
-            bins[binIndex].aabbMin = min_v(bins[binIndex].aabbMin, tri.v0);
-            bins[binIndex].aabbMin = min_v(bins[binIndex].aabbMin, tri.v1);
-            bins[binIndex].aabbMin = min_v(bins[binIndex].aabbMin, tri.v2);
-            bins[binIndex].aabbMax = max_v(bins[binIndex].aabbMax, tri.v0);
-            bins[binIndex].aabbMax = max_v(bins[binIndex].aabbMax, tri.v1);
-            bins[binIndex].aabbMax = max_v(bins[binIndex].aabbMax, tri.v2);
+                Bin& bin = out.bins[axis][binIndex];
+                bin.triangleCount++;
+                bin.aabbMin = Min3(bin.aabbMin, primMin);
+                bin.aabbMax = Max3(bin.aabbMax, primMax);
+            }
         }
+    }
 
-        // 3. Evaluate the N-1 possible split planes between the bins.
-        float leftArea[NUM_BINS - 1], rightArea[NUM_BINS - 1];
-        int leftCount[NUM_BINS - 1], rightCount[NUM_BINS - 1];
+    // SIMD bin storage: one (x, y, z, unused) register per bin bound.
+    struct SimdBins
+    {
+        __m128 aabbMin[3][NUM_BINS];
+        __m128 aabbMax[3][NUM_BINS];
+        uint32_t count[3][NUM_BINS];
 
-        DirectX::XMFLOAT3 leftBoxMin = { FLT_MAX, FLT_MAX, FLT_MAX }, leftBoxMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
-        int leftSum = 0;
-        for (int i = 0; i < NUM_BINS - 1; ++i)
+        SimdBins()
         {
-            leftSum += bins[i].triangleCount;
-            leftCount[i] = leftSum;
-            auto min_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z)); };
-            auto max_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z)); };
-
-            leftBoxMin = min_v(leftBoxMin, bins[i].aabbMin);
-            leftBoxMax = max_v(leftBoxMax, bins[i].aabbMax);
-            leftArea[i] = SurfaceArea(leftBoxMin, leftBoxMax);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                for (int b = 0; b < NUM_BINS; ++b)
+                {
+                    aabbMin[axis][b] = _mm_set1_ps(FLT_MAX);
+                    aabbMax[axis][b] = _mm_set1_ps(-FLT_MAX);
+                    count[axis][b] = 0;
+                }
+            }
         }
 
-        DirectX::XMFLOAT3 rightBoxMin = { FLT_MAX, FLT_MAX, FLT_MAX }, rightBoxMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
-        int rightSum = 0;
-        for (int i = NUM_BINS - 1; i > 0; --i)
+        inline void Add(const int binIndex[3], const bool axisActive[3], __m128 primMin, __m128 primMax)
         {
-            rightSum += bins[i].triangleCount;
-            rightCount[i - 1] = rightSum;
-            auto min_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z)); };
-            auto max_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z)); };
-            rightBoxMin = min_v(rightBoxMin, bins[i].aabbMin);
-            rightBoxMax = max_v(rightBoxMax, bins[i].aabbMax);
-            rightArea[i - 1] = SurfaceArea(rightBoxMin, rightBoxMax);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if (!axisActive[axis])
+                    continue;
+
+                const int b = binIndex[axis];
+                count[axis][b]++;
+                aabbMin[axis][b] = _mm_min_ps(aabbMin[axis][b], primMin);
+                aabbMax[axis][b] = _mm_max_ps(aabbMax[axis][b], primMax);
+            }
         }
 
-        // Calculate the cost for each potential split and find the best one.
-        for (int i = 0; i < NUM_BINS - 1; ++i)
+        void Store(AxisBins& out) const
         {
-            if (leftCount[i] > 0 && rightCount[i] > 0)
+            for (int axis = 0; axis < 3; ++axis)
             {
-                float cost = leftArea[i] * leftCount[i] + rightArea[i] * rightCount[i];
-                if (cost < bestCost)
+                for (int b = 0; b < NUM_BINS; ++b)
                 {
-                    bestCost = cost;
-                    bestAxis = axis;
-                    bestSplitBinIndex = i + 1;
+                    alignas(16) float minValues[4], maxValues[4];
+                    _mm_store_ps(minValues, aabbMin[axis][b]);
+                    _mm_store_ps(maxValues, aabbMax[axis][b]);
+                    out.bins[axis][b].aabbMin = { minValues[0], minValues[1], minValues[2] };
+                    out.bins[axis][b].aabbMax = { maxValues[0], maxValues[1], maxValues[2] };
+                    out.bins[axis][b].triangleCount = count[axis][b];
                 }
             }
         }
-    }
+    };
 
-    // If we didn't find a good split (e.g., cost is higher than not splitting), make this a leaf.
-    float parentCost = SurfaceArea(node.aabbMin, node.aabbMax) * count;
-    if (bestAxis == -1 || bestCost >= parentCost)
+    // Bins a single primitive with the three axes in the lanes of one register.
+    inline void BinOnePrimitiveSSE4(const PrimitiveRefs& refs, uint32_t prim, const BinningSetup& setup,
+        __m128 axisMin, __m128 binScale, SimdBins& bins)
     {
-        node.leftChildOrFirstTriangleIndex = baseTriangleIndex + startIndex;
-        node.triangleCount = count;
-        return;
+        const __m128 numBins = _mm_set1_ps((float)NUM_BINS);
+        const __m128i maxBin = _mm_set1_epi32(NUM_BINS - 1);
+
+        __m128 centroid = _mm_setr_ps(refs.centroid[0][prim], refs.centroid[1][prim], refs.centroid[2][prim], 0.0f);
+        __m128i binIndex = _mm_cvttps_epi32(_mm_mul_ps(numBins, _mm_mul_ps(_mm_sub_ps(centroid, axisMin), binScale)));
+        binIndex = _mm_min_epi32(_mm_max_epi32(binIndex, _mm_setzero_si128()), maxBin);
+
+        alignas(16) int binIndices[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(binIndices), binIndex);
+
+        __m128 primMin = _mm_setr_ps(refs.boundsMin[0][prim], refs.boundsMin[1][prim], refs.boundsMin[2][prim], 0.0f);
+        __m128 primMax = _mm_setr_ps(refs.boundsMax[0][prim], refs.boundsMax[1][prim], refs.boundsMax[2][prim], 0.0f);
+        bins.Add(binIndices, setup.axisActive, primMin, primMax);
     }
 
-    // 4. Partition the triangles in-place using our manual swapping method.
-    float splitPos;
+    void BinPrimitivesSSE4(const BuildContext& ctx, uint32_t begin, uint32_t end, const BinningSetup& setup, AxisBins& out)
     {
-        DirectX::XMFLOAT3 extent = { node.aabbMax.x - node.aabbMin.x, node.aabbMax.y - node.aabbMin.y, node.aabbMax.z - node.aabbMin.z };
-        float axisMin, axisExtent;
-        if (bestAxis == 0) { axisMin = node.aabbMin.x; axisExtent = extent.x; }
-        else if (bestAxis == 1) { axisMin = node.aabbMin.y; axisExtent = extent.y; }
-        else { axisMin = node.aabbMin.z; axisExtent = extent.z; }
-        splitPos = axisMin + axisExtent * (bestSplitBinIndex / (float)NUM_BINS);
+        SimdBins bins;
+        const __m128 axisMin = _mm_setr_ps(setup.axisMin[0], setup.axisMin[1], setup.axisMin[2], 0.0f);
+        const __m128 binScale = _mm_setr_ps(setup.binScale[0], setup.binScale[1], setup.binScale[2], 0.0f);
+
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            BinOnePrimitiveSSE4(ctx.refs, ctx.indices[i], setup, axisMin, binScale, bins);
+        }
+        bins.Store(out);
     }
 
-    uint32_t j = startIndex;
-    for (uint32_t i = startIndex; i < startIndex + count; ++i)
+    // Bins 8 primitives per iteration: bin indices for all three axes are computed on gathered 8-wide
+    // centroids, and the gathered bounds are transposed into one (x, y, z, 0) register per primitive.
+    void BinPrimitivesAVX2(const BuildContext& ctx, uint32_t begin, uint32_t end, const BinningSetup& setup, AxisBins& out)
     {
-        float center;
-        if (bestAxis == 0) center = (triangles[i].v0.x + triangles[i].v1.x + triangles[i].v2.x) * 0.3333f;
-        else if (bestAxis == 1) center = (triangles[i].v0.y + triangles[i].v1.y + triangles[i].v2.y) * 0.3333f;
-        else center = (triangles[i].v0.z + triangles[i].v1.z + triangles[i].v2.z) * 0.3333f;
+        const PrimitiveRefs& refs = ctx.refs;
+        SimdBins bins;
+
+        const __m256 numBins = _mm256_set1_ps((float)NUM_BINS);
+        const __m256i maxBin = _mm256_set1_epi32(NUM_BINS - 1);
+        const __m256i zeroI = _mm256_setzero_si256();
+        const __m256 zero = _mm256_setzero_ps();
 
-        if (center < splitPos)
+        __m256 axisMin8[3], binScale8[3];
+        for (int axis = 0; axis < 3; ++axis)
         {
-            std::swap(triangles[i], triangles[j]);
-            j++;
+            axisMin8[axis] = _mm256_set1_ps(setup.axisMin[axis]);
+            binScale8[axis] = _mm256_set1_ps(setup.binScale[axis]);
         }
-    }
-    int leftCount = j - startIndex;
 
-    // Robustness: If the partition failed, force a 50/50 split to ensure progress.
-    if (leftCount == 0 || leftCount == count) {
-        leftCount = count / 2;
+        uint32_t i = begin;
+        for (; i + 8 <= end; i += 8)
+        {
+            const __m256i prims = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&ctx.indices[i]));
+
+            // 1. Bin indices for 8 primitives x 3 axes
+            alignas(32) int binIndices[3][8];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                __m256 centroid = _mm256_i32gather_ps(refs.centroid[axis].data(), prims, 4);
+                __m256i binIndex = _mm256_cvttps_epi32(_mm256_mul_ps(numBins, _mm256_mul_ps(_mm256_sub_ps(centroid, axisMin8[axis]), binScale8[axis])));
+                binIndex = _mm256_min_epi32(_mm256_max_epi32(binIndex, zeroI), maxBin);
+                _mm256_store_si256(reinterpret_cast<__m256i*>(binIndices[axis]), binIndex);
+            }
+
+            // 2. Gather the bounds and transpose SoA -> one register per primitive
+            __m128 primMin[8], primMax[8];
+            for (int side = 0; side < 2; ++side)
+            {
+                const std::vector<float>* bounds = side == 0 ? refs.boundsMin : refs.boundsMax;
+                __m256 x = _mm256_i32gather_ps(bounds[0].data(), prims, 4);
+                __m256 y = _mm256_i32gather_ps(bounds[1].data(), prims, 4);
+                __m256 z = _mm256_i32gather_ps(bounds[2].data(), prims, 4);
+
+                __m256 xy0 = _mm256_unpacklo_ps(x, y); // x0 y0 x1 y1 | x4 y4 x5 y5
+                __m256 xy1 = _mm256_unpackhi_ps(x, y); // x2 y2 x3 y3 | x6 y6 x7 y7
+                __m256 z0 = _mm256_unpacklo_ps(z, zero); // z0 0 z1 0 | z4 0 z5 0
+                __m256 z1 = _mm256_unpackhi_ps(z, zero); // z2 0 z3 0 | z6 0 z7 0
+
+                __m256 p04 = _mm256_shuffle_ps(xy0, z0, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 p15 = _mm256_shuffle_ps(xy0, z0, _MM_SHUFFLE(3, 2, 3, 2));
+                __m256 p26 = _mm256_shuffle_ps(xy1, z1, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 p37 = _mm256_shuffle_ps(xy1, z1, _MM_SHUFFLE(3, 2, 3, 2));
+
+                __m128* dst = side == 0 ? primMin : primMax;
+                dst[0] = _mm256_castps256_ps128(p04); dst[4] = _mm256_extractf128_ps(p04, 1);
+                dst[1] = _mm256_castps256_ps128(p15); dst[5] = _mm256_extractf128_ps(p15, 1);
+                dst[2] = _mm256_castps256_ps128(p26); dst[6] = _mm256_extractf128_ps(p26, 1);
+                dst[3] = _mm256_castps256_ps128(p37); dst[7] = _mm256_extractf128_ps(p37, 1);
+            }
+
+            // 3. Accumulate in primitive order
+            for (int lane = 0; lane < 8; ++lane)
+            {
+                const int laneBins[3] = { binIndices[0][lane], binIndices[1][lane], binIndices[2][lane] };
+                bins.Add(laneBins, setup.axisActive, primMin[lane], primMax[lane]);
+            }
+        }
+
+        // Remainder, one primitive at a time
+        const __m128 axisMin = _mm_setr_ps(setup.axisMin[0], setup.axisMin[1], setup.axisMin[2], 0.0f);
+        const __m128 binScale = _mm_setr_ps(setup.binScale[0], setup.binScale[1], setup.binScale[2], 0.0f);
+        for (; i < end; ++i)
+        {
+            BinOnePrimitiveSSE4(refs, ctx.indices[i], setup, axisMin, binScale, bins);
+        }
+
+        bins.Store(out);
     }
 
-    // 5. Create child nodes and recurse.
-    uint32_t leftChildIndex = nodesUsed++;
-    uint32_t rightChildIndex = nodesUsed++;
+    // =========================================================================
+    // SAH SWEEP KERNELS
+    // Evaluate the N-1 split planes of every active axis and return the cheapest one. Ties are broken
+    // in axis-major, left-to-right order in both versions.
+    // =========================================================================
 
-    node.leftChildOrFirstTriangleIndex = leftChildIndex;
-    node.triangleCount = 0; // Mark as internal node
+    struct SplitCandidate
+    {
+        float cost = FLT_MAX;
+        int axis = -1;
+        int splitBinIndex = 0; // The index of the first bin on the right side of the split
+    };
 
-    BVHNode& leftChild = bvhNodes[leftChildIndex];
-    ComputeAABB(triangles, startIndex, leftCount, leftChild.aabbMin, leftChild.aabbMax);
+    SplitCandidate EvaluateSplitsScalar(const AxisBins& bins, const bool axisActive[3])
+    {
+        SplitCandidate best;
 
-    BVHNode& rightChild = bvhNodes[rightChildIndex];
-    ComputeAABB(triangles, startIndex + leftCount, count - leftCount, rightChild.aabbMin, rightChild.aabbMax);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (!axisActive[axis])
+                continue;
 
-    SubdivideBinningPartitionNode(leftChild, triangles, bvhNodes, startIndex, leftCount, baseTriangleIndex, nodesUsed);
-    SubdivideBinningPartitionNode(rightChild, triangles, bvhNodes, startIndex + leftCount, count - leftCount, baseTriangleIndex, nodesUsed);
-}
+            const Bin* axisBins = bins.bins[axis];
+            float leftArea[NUM_BINS - 1], rightArea[NUM_BINS - 1];
+            uint32_t leftCount[NUM_BINS - 1], rightCount[NUM_BINS - 1];
 
-void SubdivideNode_Parallel(BVHNode& node, std::vector<Triangle>& triangles, std::vector<BVHNode>& bvhNodes, uint32_t startIndex, uint32_t count, uint32_t baseTriangleIndex, std::atomic<uint32_t>& atomic_nodesUsed, int depth)
-{
-    if (count <= 4) {
-        node.leftChildOrFirstTriangleIndex = baseTriangleIndex + startIndex;
-        node.triangleCount = count;
-        return;
+            DirectX::XMFLOAT3 leftBoxMin = { FLT_MAX, FLT_MAX, FLT_MAX }, leftBoxMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            uint32_t leftSum = 0;
+            for (int i = 0; i < NUM_BINS - 1; ++i)
+            {
+                leftSum += axisBins[i].triangleCount;
+                leftCount[i] = leftSum;
+                leftBoxMin = Min3(leftBoxMin, axisBins[i].aabbMin);
+                leftBoxMax = Max3(leftBoxMax, axisBins[i].aabbMax);
+                leftArea[i] = SurfaceArea(leftBoxMin, leftBoxMax);
+            }
+
+            DirectX::XMFLOAT3 rightBoxMin = { FLT_MAX, FLT_MAX, FLT_MAX }, rightBoxMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            uint32_t rightSum = 0;
+            for (int i = NUM_BINS - 1; i > 0; --i)
+            {
+                rightSum += axisBins[i].triangleCount;
+                rightCount[i - 1] = rightSum;
+                rightBoxMin = Min3(rightBoxMin, axisBins[i].aabbMin);
+                rightBoxMax = Max3(rightBoxMax, axisBins[i].aabbMax);
+                rightArea[i - 1] = SurfaceArea(rightBoxMin, rightBoxMax);
+            }
+
+            for (int i = 0; i < NUM_BINS - 1; ++i)
+            {
+                if (leftCount[i] > 0 && rightCount[i] > 0)
+                {
+                    float cost = leftArea[i] * (float)leftCount[i] + rightArea[i] * (float)rightCount[i];
+                    if (cost < best.cost)
+                    {
+                        best.cost = cost;
+                        best.axis = axis;
+                        best.splitBinIndex = i + 1;
+                    }
+                }
+            }
+        }
+        return best;
     }
 
-    const int NUM_BINS = 16;
-    float bestCost = FLT_MAX;
-    int bestAxis = -1;
-    int bestSplitBinIndex = 0;
-
-    for (int axis = 0; axis < 3; ++axis)
-    {
-        Bin bins[NUM_BINS];
-        DirectX::XMFLOAT3 extent = { node.aabbMax.x - node.aabbMin.x, node.aabbMax.y - node.aabbMin.y, node.aabbMax.z - node.aabbMin.z };
-        float axisMin, axisExtent;
-        if (axis == 0) { axisMin = node.aabbMin.x; axisExtent = extent.x; }
-        else if (axis == 1) { axisMin = node.aabbMin.y; axisExtent = extent.y; }
-        else { axisMin = node.aabbMin.z; axisExtent = extent.z; }
-        if (axisExtent < 1e-6f) continue;
-
-        for (uint32_t i = 0; i < count; ++i)
-        {
-            Triangle& tri = triangles[startIndex + i];
-            float centroid;
-            if (axis == 0) centroid = (tri.v0.x + tri.v1.x + tri.v2.x) * 0.3333f;
-            else if (axis == 1) centroid = (tri.v0.y + tri.v1.y + tri.v2.y) * 0.3333f;
-            else centroid = (tri.v0.z + tri.v1.z + tri.v2.z) * 0.3333f;
-            int binIndex = static_cast<int>(NUM_BINS * ((centroid - axisMin) / axisExtent));
-            binIndex = std::clamp(binIndex, 0, NUM_BINS - 1);
-            bins[binIndex].triangleCount++;
-            auto min_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z)); };
-            auto max_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z)); };
-            bins[binIndex].aabbMin = min_v(bins[binIndex].aabbMin, tri.v0); bins[binIndex].aabbMin = min_v(bins[binIndex].aabbMin, tri.v1); bins[binIndex].aabbMin = min_v(bins[binIndex].aabbMin, tri.v2);
-            bins[binIndex].aabbMax = max_v(bins[binIndex].aabbMax, tri.v0); bins[binIndex].aabbMax = max_v(bins[binIndex].aabbMax, tri.v1); bins[binIndex].aabbMax = max_v(bins[binIndex].aabbMax, tri.v2);
-        }
-        float leftArea[NUM_BINS - 1], rightArea[NUM_BINS - 1];
-        int leftCount[NUM_BINS - 1], rightCount[NUM_BINS - 1];
-        DirectX::XMFLOAT3 leftBoxMin = { FLT_MAX, FLT_MAX, FLT_MAX }, leftBoxMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
-        int leftSum = 0;
+    // Same sweep with the three axes in the lanes of SSE registers.
+    SplitCandidate EvaluateSplitsSSE(const AxisBins& bins, const bool axisActive[3])
+    {
+        // 1. Transpose the bins: one register per bound component, lane = axis
+        __m128 binMin[3][NUM_BINS], binMax[3][NUM_BINS];
+        __m128i binCount[NUM_BINS];
+        for (int b = 0; b < NUM_BINS; ++b)
+        {
+            const Bin& b0 = bins.bins[0][b];
+            const Bin& b1 = bins.bins[1][b];
+            const Bin& b2 = bins.bins[2][b];
+            binMin[0][b] = _mm_setr_ps(b0.aabbMin.x, b1.aabbMin.x, b2.aabbMin.x, 0.0f);
+            binMin[1][b] = _mm_setr_ps(b0.aabbMin.y, b1.aabbMin.y, b2.aabbMin.y, 0.0f);
+            binMin[2][b] = _mm_setr_ps(b0.aabbMin.z, b1.aabbMin.z, b2.aabbMin.z, 0.0f);
+            binMax[0][b] = _mm_setr_ps(b0.aabbMax.x, b1.aabbMax.x, b2.aabbMax.x, 0.0f);
+            binMax[1][b] = _mm_setr_ps(b0.aabbMax.y, b1.aabbMax.y, b2.aabbMax.y, 0.0f);
+            binMax[2][b] = _mm_setr_ps(b0.aabbMax.z, b1.aabbMax.z, b2.aabbMax.z, 0.0f);
+            binCount[b] = _mm_setr_epi32((int)b0.triangleCount, (int)b1.triangleCount, (int)b2.triangleCount, 0);
+        }
+
+        // Matches SurfaceArea(): 2 * (ex*ey + ex*ez + ey*ez), evaluated in the same order
+        auto surfaceArea = [](const __m128 boxMin[3], const __m128 boxMax[3])
+        {
+            __m128 ex = _mm_sub_ps(boxMax[0], boxMin[0]);
+            __m128 ey = _mm_sub_ps(boxMax[1], boxMin[1]);
+            __m128 ez = _mm_sub_ps(boxMax[2], boxMin[2]);
+            __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ey), _mm_mul_ps(ex, ez)), _mm_mul_ps(ey, ez));
+            return _mm_mul_ps(_mm_set1_ps(2.0f), sum);
+        };
+
+        // 2. Left and right sweeps
+        __m128 leftArea[NUM_BINS - 1], rightArea[NUM_BINS - 1];
+        __m128i leftCount[NUM_BINS - 1], rightCount[NUM_BINS - 1];
+
+        __m128 boxMin[3] = { _mm_set1_ps(FLT_MAX), _mm_set1_ps(FLT_MAX), _mm_set1_ps(FLT_MAX) };
+        __m128 boxMax[3] = { _mm_set1_ps(-FLT_MAX), _mm_set1_ps(-FLT_MAX), _mm_set1_ps(-FLT_MAX) };
+        __m128i sum = _mm_setzero_si128();
         for (int i = 0; i < NUM_BINS - 1; ++i)
         {
-            leftSum += bins[i].triangleCount; leftCount[i] = leftSum;
-            auto min_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z)); };
-            auto max_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z)); };
-            leftBoxMin = min_v(leftBoxMin, bins[i].aabbMin); leftBoxMax = max_v(leftBoxMax, bins[i].aabbMax);
-            leftArea[i] = SurfaceArea(leftBoxMin, leftBoxMax);
+            sum = _mm_add_epi32(sum, binCount[i]);
+            leftCount[i] = sum;
+            for (int c = 0; c < 3; ++c)
+            {
+                boxMin[c] = _mm_min_ps(boxMin[c], binMin[c][i]);
+                boxMax[c] = _mm_max_ps(boxMax[c], binMax[c][i]);
+            }
+            leftArea[i] = surfaceArea(boxMin, boxMax);
+        }
+
+        for (int c = 0; c < 3; ++c)
+        {
+            boxMin[c] = _mm_set1_ps(FLT_MAX);
+            boxMax[c] = _mm_set1_ps(-FLT_MAX);
         }
-        DirectX::XMFLOAT3 rightBoxMin = { FLT_MAX, FLT_MAX, FLT_MAX }, rightBoxMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
-        int rightSum = 0;
+        sum = _mm_setzero_si128();
         for (int i = NUM_BINS - 1; i > 0; --i)
         {
-            rightSum += bins[i].triangleCount; rightCount[i - 1] = rightSum;
-            auto min_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z)); };
-            auto max_v = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z)); };
-            rightBoxMin = min_v(rightBoxMin, bins[i].aabbMin); rightBoxMax = max_v(rightBoxMax, bins[i].aabbMax);
-            rightArea[i - 1] = SurfaceArea(rightBoxMin, rightBoxMax);
+            sum = _mm_add_epi32(sum, binCount[i]);
+            rightCount[i - 1] = sum;
+            for (int c = 0; c < 3; ++c)
+            {
+                boxMin[c] = _mm_min_ps(boxMin[c], binMin[c][i]);
+                boxMax[c] = _mm_max_ps(boxMax[c], binMax[c][i]);
+            }
+            rightArea[i - 1] = surfaceArea(boxMin, boxMax);
         }
+
+        // 3. Costs for all planes, then pick the cheapest valid one
+        alignas(16) float cost[NUM_BINS - 1][4];
+        alignas(16) int valid[NUM_BINS - 1][4];
+        const __m128i zeroI = _mm_setzero_si128();
         for (int i = 0; i < NUM_BINS - 1; ++i)
         {
-            if (leftCount[i] > 0 && rightCount[i] > 0)
+            __m128 c = _mm_add_ps(_mm_mul_ps(leftArea[i], _mm_cvtepi32_ps(leftCount[i])), _mm_mul_ps(rightArea[i], _mm_cvtepi32_ps(rightCount[i])));
+            __m128i v = _mm_and_si128(_mm_cmpgt_epi32(leftCount[i], zeroI), _mm_cmpgt_epi32(rightCount[i], zeroI));
+            _mm_store_ps(cost[i], c);
+            _mm_store_si128(reinterpret_cast<__m128i*>(valid[i]), v);
+        }
+
+        SplitCandidate best;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (!axisActive[axis])
+                continue;
+
+            for (int i = 0; i < NUM_BINS - 1; ++i)
             {
-                float cost = leftArea[i] * leftCount[i] + rightArea[i] * rightCount[i];
-                if (cost < bestCost)
+                if (valid[i][axis] && cost[i][axis] < best.cost)
+                {
+                    best.cost = cost[i][axis];
+                    best.axis = axis;
+                    best.splitBinIndex = i + 1;
+                }
+            }
+        }
+        return best;
+    }
+
+    // =========================================================================
+    // KERNEL SELECTION
+    // =========================================================================
+
+    std::atomic<BVHBuilder::BinningKernel> s_requestedKernel{ BVHBuilder::BinningKernel::Auto };
+
+    BuildKernels SelectKernels()
+    {
+        const CpuFeatures& cpu = CpuFeatures::Get();
+        BVHBuilder::BinningKernel kernel = s_requestedKernel.load();
+
+        // Fall back to the best level the CPU actually supports
+        if (kernel == BVHBuilder::BinningKernel::Auto || (kernel == BVHBuilder::BinningKernel::AVX2 && !cpu.AVX2))
+            kernel = cpu.AVX2 ? BVHBuilder::BinningKernel::AVX2 : BVHBuilder::BinningKernel::SSE4;
+        if (kernel == BVHBuilder::BinningKernel::SSE4 && !cpu.SSE41)
+            kernel = BVHBuilder::BinningKernel::Scalar;
+
+        switch (kernel)
+        {
+        case BVHBuilder::BinningKernel::AVX2: return { BinPrimitivesAVX2, EvaluateSplitsSSE };
+        case BVHBuilder::BinningKernel::SSE4: return { BinPrimitivesSSE4, EvaluateSplitsSSE };
+        default:                              return { BinPrimitivesScalar, EvaluateSplitsScalar };
+        }
+    }
+
+    // Finds the cheapest split plane for a node. Returns false if no split beats leaving the node as a leaf.
+    bool FindBestSplit(BuildContext& ctx, const BuildNode& node, BlockScratch& blocks, int& outAxis, float& outSplitPos)
+    {
+        BinningSetup setup;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            setup.axisMin[axis] = AxisValue(node.aabbMin, axis);
+            float axisExtent = AxisValue(node.aabbMax, axis) - setup.axisMin[axis];
+
+            // If the node is flat along this axis, we can't split it.
+            setup.axisActive[axis] = axisExtent >= 1e-6f;
+            setup.binScale[axis] = setup.axisActive[axis] ? 1.0f / axisExtent : 0.0f;
+        }
+
+        // 1. Populate the bins, in blocks for large nodes. Merging per-block bins is exact, so the
+        //    result does not depend on how the blocks were scheduled.
+        AxisBins bins;
+        const uint32_t endIndex = node.startIndex + node.count;
+        if (node.count >= PARALLEL_NODE_THRESHOLD)
+        {
+            const uint32_t blockCount = (node.count + PARALLEL_BLOCK_SIZE - 1) / PARALLEL_BLOCK_SIZE;
+            std::vector<AxisBins>& blockBins = blocks.bins;
+            blockBins.assign(blockCount, AxisBins());
+            ctx.scheduler->ParallelFor(blockCount, 1, [&](uint32_t begin, uint32_t end)
                 {
-                    bestCost = cost; bestAxis = axis; bestSplitBinIndex = i + 1;
+                    for (uint32_t block = begin; block < end; ++block)
+                    {
+                        uint32_t blockStart = node.startIndex + block * PARALLEL_BLOCK_SIZE;
+                        uint32_t blockEnd = (std::min)(blockStart + PARALLEL_BLOCK_SIZE, endIndex);
+                        ctx.kernels.bin(ctx, blockStart, blockEnd, setup, blockBins[block]);
+                    }
+                });
+
+            for (const AxisBins& block : blockBins)
+            {
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    for (int b = 0; b < NUM_BINS; ++b)
+                    {
+                        bins.bins[axis][b].triangleCount += block.bins[axis][b].triangleCount;
+                        bins.bins[axis][b].aabbMin = Min3(bins.bins[axis][b].aabbMin, block.bins[axis][b].aabbMin);
+                        bins.bins[axis][b].aabbMax = Max3(bins.bins[axis][b].aabbMax, block.bins[axis][b].aabbMax);
+                    }
                 }
             }
         }
+        else
+        {
+            ctx.kernels.bin(ctx, node.startIndex, endIndex, setup, bins);
+        }
+
+        // 2. Evaluate the N-1 possible split planes between the bins of each axis.
+        SplitCandidate best = ctx.kernels.sweep(bins, setup.axisActive);
+        float bestCost = best.cost;
+        int bestAxis = best.axis;
+        int bestSplitBinIndex = best.splitBinIndex;
+
+        // If we didn't find a good split (e.g., cost is higher than not splitting), make this a leaf.
+        float parentCost = SurfaceArea(node.aabbMin, node.aabbMax) * node.count;
+        if (bestAxis == -1 || bestCost >= parentCost)
+            return false;
+
+        float axisMin = AxisValue(node.aabbMin, bestAxis);
+        float axisExtent = AxisValue(node.aabbMax, bestAxis) - axisMin;
+        outAxis = bestAxis;
+        outSplitPos = axisMin + axisExtent * (bestSplitBinIndex / (float)NUM_BINS);
+        return true;
     }
 
-    float parentCost = SurfaceArea(node.aabbMin, node.aabbMax) * count;
-    if (bestAxis == -1 || bestCost >= parentCost)
+    // Stable partition of the node's index range: primitives left of the split keep their relative order,
+    // as do the ones on the right. Returns the number of primitives on the left.
+    uint32_t PartitionPrimitives(BuildContext& ctx, const BuildNode& node, BlockScratch& blocks, int axis, float splitPos)
     {
-        node.leftChildOrFirstTriangleIndex = baseTriangleIndex + startIndex;
-        node.triangleCount = count;
-        return;
+        std::vector<uint32_t>& indices = ctx.indices;
+        const float* centroids = ctx.refs.centroid[axis].data();
+        const uint32_t startIndex = node.startIndex;
+        const uint32_t endIndex = node.startIndex + node.count;
+
+        if (node.count < PARALLEL_NODE_THRESHOLD)
+        {
+            // Compact the left side in place and park the right side in the scratch buffer.
+            uint32_t leftEnd = startIndex;
+            uint32_t rightCount = 0;
+            for (uint32_t i = startIndex; i < endIndex; ++i)
+            {
+                uint32_t prim = indices[i];
+                if (centroids[prim] < splitPos)
+                    indices[leftEnd++] = prim;
+                else
+                    ctx.scratch[startIndex + rightCount++] = prim;
+            }
+            std::copy(ctx.scratch.begin() + startIndex, ctx.scratch.begin() + startIndex + rightCount, indices.begin() + leftEnd);
+            return leftEnd - startIndex;
+        }
+
+        // 1. Count the left-side primitives of each block
+        const uint32_t blockCount = (node.count + PARALLEL_BLOCK_SIZE - 1) / PARALLEL_BLOCK_SIZE;
+        std::vector<uint32_t>& blockLeftCount = blocks.leftCount;
+        blockLeftCount.assign(blockCount, 0);
+        ctx.scheduler->ParallelFor(blockCount, 1, [&](uint32_t begin, uint32_t end)
+            {
+                for (uint32_t block = begin; block < end; ++block)
+                {
+                    uint32_t blockStart = startIndex + block * PARALLEL_BLOCK_SIZE;
+                    uint32_t blockEnd = (std::min)(blockStart + PARALLEL_BLOCK_SIZE, endIndex);
+                    uint32_t leftCount = 0;
+                    for (uint32_t i = blockStart; i < blockEnd; ++i)
+                    {
+                        if (centroids[indices[i]] < splitPos)
+                            leftCount++;
+                    }
+                    blockLeftCount[block] = leftCount;
+                }
+            });
+
+        // 2. Exclusive prefix sums give every block its output offsets on both sides
+        std::vector<uint32_t>& blockLeftOffset = blocks.leftOffset;
+        std::vector<uint32_t>& blockRightOffset = blocks.rightOffset;
+        blockLeftOffset.resize(blockCount);
+        blockRightOffset.resize(blockCount);
+        uint32_t totalLeft = 0;
+        for (uint32_t block = 0; block < blockCount; ++block)
+        {
+            blockLeftOffset[block] = totalLeft;
+            totalLeft += blockLeftCount[block];
+        }
+        for (uint32_t block = 0; block < blockCount; ++block)
+        {
+            uint32_t blockStart = block * PARALLEL_BLOCK_SIZE;
+            blockRightOffset[block] = totalLeft + (blockStart - blockLeftOffset[block]);
+        }
+
+        // 3. Scatter into the scratch buffer, then copy the partitioned range back
+        ctx.scheduler->ParallelFor(blockCount, 1, [&](uint32_t begin, uint32_t end)
+            {
+                for (uint32_t block = begin; block < end; ++block)
+                {
+                    uint32_t blockStart = startIndex + block * PARALLEL_BLOCK_SIZE;
+                    uint32_t blockEnd = (std::min)(blockStart + PARALLEL_BLOCK_SIZE, endIndex);
+                    uint32_t left = startIndex + blockLeftOffset[block];
+                    uint32_t right = startIndex + blockRightOffset[block];
+                    for (uint32_t i = blockStart; i < blockEnd; ++i)
+                    {
+                        uint32_t prim = indices[i];
+                        if (centroids[prim] < splitPos)
+                            ctx.scratch[left++] = prim;
+                        else
+                            ctx.scratch[right++] = prim;
+                    }
+                }
+            });
+
+        ctx.scheduler->ParallelFor(node.count, PARALLEL_BLOCK_SIZE, [&](uint32_t begin, uint32_t end)
+            {
+                std::copy(ctx.scratch.begin() + startIndex + begin, ctx.scratch.begin() + startIndex + end, indices.begin() + startIndex + begin);
+            });
+
+        return totalLeft;
     }
 
-    float splitPos;
+    void ComputeRangeBounds(const BuildContext& ctx, uint32_t begin, uint32_t end, DirectX::XMFLOAT3& outMin, DirectX::XMFLOAT3& outMax)
     {
-        DirectX::XMFLOAT3 extent = { node.aabbMax.x - node.aabbMin.x, node.aabbMax.y - node.aabbMin.y, node.aabbMax.z - node.aabbMin.z };
-        float axisMin, axisExtent;
-        if (bestAxis == 0) { axisMin = node.aabbMin.x; axisExtent = extent.x; }
-        else if (bestAxis == 1) { axisMin = node.aabbMin.y; axisExtent = extent.y; }
-        else { axisMin = node.aabbMin.z; axisExtent = extent.z; }
-        splitPos = axisMin + axisExtent * (bestSplitBinIndex / (float)NUM_BINS);
+        const PrimitiveRefs& refs = ctx.refs;
+        outMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+        outMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const uint32_t prim = ctx.indices[i];
+            outMin = Min3(outMin, DirectX::XMFLOAT3(refs.boundsMin[0][prim], refs.boundsMin[1][prim], refs.boundsMin[2][prim]));
+            outMax = Max3(outMax, DirectX::XMFLOAT3(refs.boundsMax[0][prim], refs.boundsMax[1][prim], refs.boundsMax[2][prim]));
+        }
     }
-    uint32_t j = startIndex;
-    for (uint32_t i = startIndex; i < startIndex + count; ++i)
+
+    void ComputeNodeBounds(BuildContext& ctx, BuildNode& node, BlockScratch& blocks)
     {
-        float center;
-        if (bestAxis == 0) center = (triangles[i].v0.x + triangles[i].v1.x + triangles[i].v2.x) * 0.3333f;
-        else if (bestAxis == 1) center = (triangles[i].v0.y + triangles[i].v1.y + triangles[i].v2.y) * 0.3333f;
-        else center = (triangles[i].v0.z + triangles[i].v1.z + triangles[i].v2.z) * 0.3333f;
-        if (center < splitPos)
+        if (node.count < PARALLEL_NODE_THRESHOLD)
+        {
+            ComputeRangeBounds(ctx, node.startIndex, node.startIndex + node.count, node.aabbMin, node.aabbMax);
+            return;
+        }
+
+        const uint32_t blockCount = (node.count + PARALLEL_BLOCK_SIZE - 1) / PARALLEL_BLOCK_SIZE;
+        std::vector<DirectX::XMFLOAT3>& blockMin = blocks.boundsMin;
+        std::vector<DirectX::XMFLOAT3>& blockMax = blocks.boundsMax;
+        blockMin.resize(blockCount);
+        blockMax.resize(blockCount);
+        ctx.scheduler->ParallelFor(node.count, PARALLEL_BLOCK_SIZE, [&](uint32_t begin, uint32_t end)
+            {
+                uint32_t block = begin / PARALLEL_BLOCK_SIZE;
+                ComputeRangeBounds(ctx, node.startIndex + begin, node.startIndex + end, blockMin[block], blockMax[block]);
+            });
+
+        node.aabbMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+        node.aabbMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (uint32_t block = 0; block < blockCount; ++block)
         {
-            std::swap(triangles[i], triangles[j]);
-            j++;
+            node.aabbMin = Min3(node.aabbMin, blockMin[block]);
+            node.aabbMax = Max3(node.aabbMax, blockMax[block]);
         }
     }
-    int leftCount = j - startIndex;
-    if (leftCount == 0 || leftCount == count) {
-        leftCount = count / 2;
+
+    // Orders the node's range around its median centroid along the longest axis and returns the size of the lower
+    // half. Ties are broken by primitive index, so the halves do not depend on the order the range arrived in.
+    uint32_t PartitionAtMedian(BuildContext& ctx, const BuildNode& node)
+    {
+        const float* centroids = ctx.refs.centroid[LongestAxis(node.aabbMin, node.aabbMax)].data();
+        auto first = ctx.indices.begin() + node.startIndex;
+        const uint32_t half = node.count / 2;
+        std::nth_element(first, first + half, first + node.count, [centroids](uint32_t a, uint32_t b)
+        {
+            return centroids[a] < centroids[b] || (centroids[a] == centroids[b] && a < b);
+        });
+        return half;
     }
 
+    void SubdivideBuildNode(BuildContext& ctx, BuildNode& node, uint32_t depth, BuildNodeArena& arena)
+    {
+        // Leaf node condition: Stop if the number of primitives is small.
+        if (node.count <= ctx.maxLeafSize)
+            return;
+
+        uint32_t leftCount;
+        if (CanChooseSplit(depth, node.count, ctx.maxLeafSize))
+        {
+            int axis;
+            float splitPos;
+            if (!FindBestSplit(ctx, node, arena.blocks(), axis, splitPos))
+                return;
 
-    uint32_t leftChildIndex = atomic_nodesUsed.fetch_add(1);
-    uint32_t rightChildIndex = atomic_nodesUsed.fetch_add(1);
+            leftCount = PartitionPrimitives(ctx, node, arena.blocks(), axis, splitPos);
 
-    node.leftChildOrFirstTriangleIndex = leftChildIndex;
-    node.triangleCount = 0;
+            // Robustness: If the partition failed, force a 50/50 split to ensure progress.
+            if (leftCount == 0 || leftCount == node.count) {
+                leftCount = node.count / 2;
+            }
+        }
+        else
+        {
+            leftCount = PartitionAtMedian(ctx, node);
+        }
 
-    BVHNode& leftChild = bvhNodes[leftChildIndex];
-    ComputeAABB(triangles, startIndex, leftCount, leftChild.aabbMin, leftChild.aabbMax);
+        BuildNode& leftChild = arena.emplace_back();
+        leftChild.startIndex = node.startIndex;
+        leftChild.count = leftCount;
+        ComputeNodeBounds(ctx, leftChild, arena.blocks());
 
-    BVHNode& rightChild = bvhNodes[rightChildIndex];
-    uint32_t rightStartIndex = startIndex + leftCount;
-    uint32_t rightCount = count - leftCount;
-    ComputeAABB(triangles, rightStartIndex, rightCount, rightChild.aabbMin, rightChild.aabbMax);
+        BuildNode& rightChild = arena.emplace_back();
+        rightChild.startIndex = node.startIndex + leftCount;
+        rightChild.count = node.count - leftCount;
+        ComputeNodeBounds(ctx, rightChild, arena.blocks());
 
+        node.children[0] = &leftChild;
+        node.children[1] = &rightChild;
 
-    const int PARALLEL_DEPTH_THRESHOLD = 4;
+        // Hand the right subtree to another worker if it is big enough to be worth it, keep the left one.
+        if (rightChild.count >= SUBTREE_TASK_THRESHOLD)
+        {
+            BuildNode* right = &rightChild;
+            ctx.subtreeTasks->Run([&ctx, right, depth] { SubdivideBuildNode(ctx, *right, depth + 1, ctx.NewArena()); });
+        }
+        else
+        {
+            SubdivideBuildNode(ctx, rightChild, depth + 1, arena);
+        }
+        SubdivideBuildNode(ctx, leftChild, depth + 1, arena);
+    }
 
-    if (depth < PARALLEL_DEPTH_THRESHOLD)
+    // Writes the temporary tree in the serial builder's layout: a node's two children are allocated as a
+    // pair when the node is visited, then the left subtree is laid out before the right one.
+    void FlattenBuildNode(const BuildNode& node, uint32_t nodeIndex, std::vector<BVHNode>& bvhNodes, uint32_t baseTriangleIndex)
     {
-        auto future = std::async(std::launch::async, [&] {
-            SubdivideNode_Parallel(rightChild, triangles, bvhNodes, rightStartIndex, rightCount, baseTriangleIndex, atomic_nodesUsed, depth + 1);
-            });
+        bvhNodes[nodeIndex].aabbMin = node.aabbMin;
+        bvhNodes[nodeIndex].aabbMax = node.aabbMax;
+
+        if (!node.children[0])
+        {
+            bvhNodes[nodeIndex].leftChildOrFirstTriangleIndex = baseTriangleIndex + node.startIndex;
+            bvhNodes[nodeIndex].triangleCount = node.count;
+            return;
+        }
 
-        SubdivideNode_Parallel(leftChild, triangles, bvhNodes, startIndex, leftCount, baseTriangleIndex, atomic_nodesUsed, depth + 1);
+        uint32_t leftChildIndex = static_cast<uint32_t>(bvhNodes.size());
+        bvhNodes.resize(leftChildIndex + 2);
+        bvhNodes[nodeIndex].leftChildOrFirstTriangleIndex = leftChildIndex;
+        bvhNodes[nodeIndex].triangleCount = 0; // Mark as internal node
 
-        future.get();
+        FlattenBuildNode(*node.children[0], leftChildIndex, bvhNodes, baseTriangleIndex);
+        FlattenBuildNode(*node.children[1], leftChildIndex + 1, bvhNodes, baseTriangleIndex);
     }
-    else
+
+    // Gathers the SoA build data and starts from the identity permutation.
+    void InitializeBuild(BuildContext& ctx, const std::vector<Triangle>& triangles)
     {
-        SubdivideNode_Parallel(leftChild, triangles, bvhNodes, startIndex, leftCount, baseTriangleIndex, atomic_nodesUsed, depth + 1);
-        SubdivideNode_Parallel(rightChild, triangles, bvhNodes, rightStartIndex, rightCount, baseTriangleIndex, atomic_nodesUsed, depth + 1);
+        const uint32_t primitiveCount = static_cast<uint32_t>(triangles.size());
+        ctx.refs.Initialize(triangles, ctx.scheduler);
+        ctx.indices.resize(primitiveCount);
+        ctx.scratch.resize(primitiveCount);
+        for (uint32_t i = 0; i < primitiveCount; ++i)
+        {
+            ctx.indices[i] = i;
+        }
+    }
+
+    // Flattens the finished temporary tree into the final node array and applies the primitive permutation to the
+    // triangles in a single pass.
+    void FinishBuild(BuildContext& ctx, const BuildNode& root, std::vector<Triangle>& triangles, std::vector<BVHNode>& outBvhNodes, uint32_t baseTriangleIndex,
+        std::vector<uint32_t>* outSourceIndices)
+    {
+        size_t nodeCount = 0;
+        for (size_t arena = 0; arena < ctx.arenaCount; ++arena)
+        {
+            nodeCount += ctx.storage.arenas[arena]->size();
+        }
+        outBvhNodes.reserve(nodeCount);
+        outBvhNodes.resize(1);
+        FlattenBuildNode(root, 0, outBvhNodes, baseTriangleIndex);
+
+        const uint32_t primitiveCount = static_cast<uint32_t>(triangles.size());
+        // The caller's old triangle array stays in the scratch for the next build
+        std::vector<Triangle>& sortedTriangles = ctx.storage.sortedTriangles;
+        sortedTriangles.resize(primitiveCount);
+        ctx.scheduler->ParallelFor(primitiveCount, PARALLEL_BLOCK_SIZE, [&](uint32_t begin, uint32_t end)
+            {
+                for (uint32_t i = begin; i < end; ++i)
+                {
+                    sortedTriangles[i] = triangles[ctx.indices[i]];
+                }
+            });
+        triangles.swap(sortedTriangles);
+
+        if (outSourceIndices)
+        {
+            outSourceIndices->assign(ctx.indices.begin(), ctx.indices.begin() + primitiveCount);
+        }
     }
 }
 
-void BVHBuilder::Build(std::vector<Triangle>& triangles, std::vector<BVHNode>& outBvhNodes, uint32_t baseTriangleIndex)
+// --- Spatial Split BVH (SBVH) Builder ---
+// Stich et al., "Spatial Splits in Bounding Volume Hierarchies" (2009). Nodes own a list of references: a triangle
+// plus the part of its bounds that lies inside the node. Besides the binned object split, a node can be split in
+// space, in which case references straddling the plane are clipped into both children. This keeps large, thin
+// triangles (floors, walls) from inflating every node they pass through, at the cost of duplicated references.
+// Subtrees are built as tasks and the duplication budget is handed down the tree in proportion to the child sizes,
+// so like the object-split builder the result is the same for any number of threads.
+namespace
 {
-    outBvhNodes.resize(triangles.size() * 2);
+    const int NUM_SPATIAL_BINS = 32;
 
-    BVHNode& root = outBvhNodes[0];
-    ComputeAABB(triangles, 0, (uint32_t)triangles.size(), root.aabbMin, root.aabbMax);
+    struct Reference
+    {
+        DirectX::XMFLOAT3 aabbMin;
+        DirectX::XMFLOAT3 aabbMax;
+        uint32_t primitive;
+    };
 
-    uint32_t nodesUsed = 1; // 0 is root
-    //std::atomic<uint32_t> nodesUsed(1);
+    struct SpatialBuildNode
+    {
+        DirectX::XMFLOAT3 aabbMin;
+        DirectX::XMFLOAT3 aabbMax;
+        std::vector<Reference> references; // Released once the node is split; leaves keep theirs
+        SpatialBuildNode* children[2] = { nullptr, nullptr };
+    };
+
+    using SpatialBuildNodeArena = std::deque<SpatialBuildNode>;
+
+    struct SpatialBuildContext
+    {
+        const std::vector<Triangle>& triangles;
+        TaskGroup* subtreeTasks;
+        float overlapThreshold; // Absolute surface area
+        uint32_t maxLeafSize = 4;
+
+        std::mutex arenaMutex;
+        std::list<SpatialBuildNodeArena> arenas;
+
+        SpatialBuildContext(const std::vector<Triangle>& sourceTriangles, TaskGroup* tasks, float minOverlapArea)
+            : triangles(sourceTriangles), subtreeTasks(tasks), overlapThreshold(minOverlapArea) {}
+
+        SpatialBuildNodeArena& NewArena()
+        {
+            std::lock_guard<std::mutex> lock(arenaMutex);
+            arenas.emplace_back();
+            return arenas.back();
+        }
+    };
+
+    inline float& AxisValue(DirectX::XMFLOAT3& v, int axis)
+    {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+
+    inline void ResetBounds(DirectX::XMFLOAT3& aabbMin, DirectX::XMFLOAT3& aabbMax)
+    {
+        aabbMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+        aabbMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    }
+
+    inline bool IsValidBounds(const DirectX::XMFLOAT3& aabbMin, const DirectX::XMFLOAT3& aabbMax)
+    {
+        return aabbMin.x <= aabbMax.x && aabbMin.y <= aabbMax.y && aabbMin.z <= aabbMax.z;
+    }
+
+    inline void GrowBounds(DirectX::XMFLOAT3& aabbMin, DirectX::XMFLOAT3& aabbMax, const DirectX::XMFLOAT3& otherMin, const DirectX::XMFLOAT3& otherMax)
+    {
+        aabbMin = Min3(aabbMin, otherMin);
+        aabbMax = Max3(aabbMax, otherMax);
+    }
+
+    // Surface area that treats empty boxes as 0 instead of a huge negative-extent value.
+    inline float SafeSurfaceArea(const DirectX::XMFLOAT3& aabbMin, const DirectX::XMFLOAT3& aabbMax)
+    {
+        return IsValidBounds(aabbMin, aabbMax) ? SurfaceArea(aabbMin, aabbMax) : 0.0f;
+    }
+
+    void ComputeReferenceBounds(const std::vector<Reference>& references, DirectX::XMFLOAT3& outMin, DirectX::XMFLOAT3& outMax)
+    {
+        ResetBounds(outMin, outMax);
+        for (const Reference& ref : references)
+        {
+            GrowBounds(outMin, outMax, ref.aabbMin, ref.aabbMax);
+        }
+    }
+
+    // Clips a reference against the plane at pos along axis. The resulting boxes are the bounds of the parts of the
+    // triangle on each side, limited to the original reference bounds; either may come out empty.
+    void SplitReference(const SpatialBuildContext& ctx, const Reference& ref, int axis, float pos, Reference& outLeft, Reference& outRight)
+    {
+        outLeft.primitive = outRight.primitive = ref.primitive;
+        ResetBounds(outLeft.aabbMin, outLeft.aabbMax);
+        ResetBounds(outRight.aabbMin, outRight.aabbMax);
+
+        const Triangle& tri = ctx.triangles[ref.primitive];
+        const DirectX::XMFLOAT3* vertices[3] = { &tri.v0, &tri.v1, &tri.v2 };
+
+        // Walk the edges, adding every vertex to the side(s) it lies on and every edge/plane intersection to both.
+        const DirectX::XMFLOAT3* start = vertices[2];
+        for (int i = 0; i < 3; ++i)
+        {
+            const DirectX::XMFLOAT3* end = vertices[i];
+            float startPos = AxisValue(*start, axis);
+            float endPos = AxisValue(*end, axis);
+
+            if (startPos <= pos)
+                GrowBounds(outLeft.aabbMin, outLeft.aabbMax, *start, *start);
+            if (startPos >= pos)
+                GrowBounds(outRight.aabbMin, outRight.aabbMax, *start, *start);
+
+            if ((startPos < pos && endPos > pos) || (startPos > pos && endPos < pos))
+            {
+                float t = std::clamp((pos - startPos) / (endPos - startPos), 0.0f, 1.0f);
+                DirectX::XMFLOAT3 hit = {
+                    start->x + (end->x - start->x) * t,
+                    start->y + (end->y - start->y) * t,
+                    start->z + (end->z - start->z) * t
+                };
+                GrowBounds(outLeft.aabbMin, outLeft.aabbMax, hit, hit);
+                GrowBounds(outRight.aabbMin, outRight.aabbMax, hit, hit);
+            }
+            start = end;
+        }
+
+        // The plane itself bounds both halves exactly (the interpolated points may be off by an ulp).
+        AxisValue(outLeft.aabbMax, axis) = pos;
+        AxisValue(outRight.aabbMin, axis) = pos;
+
+        outLeft.aabbMin = Max3(outLeft.aabbMin, ref.aabbMin);
+        outLeft.aabbMax = Min3(outLeft.aabbMax, ref.aabbMax);
+        outRight.aabbMin = Max3(outRight.aabbMin, ref.aabbMin);
+        outRight.aabbMax = Min3(outRight.aabbMax, ref.aabbMax);
+    }
+
+    // =========================================================================
+    // OBJECT SPLITS
+    // =========================================================================
+
+    struct ObjectSplit
+    {
+        float cost = FLT_MAX;
+        int axis = -1;
+        int splitBinIndex = 0;
+        float centroidMin = 0.0f;
+        float binScale = 0.0f;
+        DirectX::XMFLOAT3 leftMin, leftMax, rightMin, rightMax;
+    };
+
+    // The triangle's centroid, clamped into the reference bounds. Unclipped references bin exactly like the
+    // object-split builder; the centre of the box would put every long sliver in the middle of the node.
+    inline float ReferenceCentroid(const SpatialBuildContext& ctx, const Reference& ref, int axis)
+    {
+        const Triangle& tri = ctx.triangles[ref.primitive];
+        float centroid = (AxisValue(tri.v0, axis) + AxisValue(tri.v1, axis) + AxisValue(tri.v2, axis)) * 0.3333f;
+        return std::clamp(centroid, AxisValue(ref.aabbMin, axis), AxisValue(ref.aabbMax, axis));
+    }
+
+    inline int ObjectBinIndex(const SpatialBuildContext& ctx, const Reference& ref, int axis, float centroidMin, float binScale)
+    {
+        int binIndex = static_cast<int>(NUM_BINS * ((ReferenceCentroid(ctx, ref, axis) - centroidMin) * binScale));
+        return std::clamp(binIndex, 0, NUM_BINS - 1);
+    }
+
+    // Binned SAH over the reference centroids. Clipping moves centroids around, so the bins span the centroid
+    // bounds rather than the node bounds.
+    ObjectSplit FindObjectSplit(const SpatialBuildContext& ctx, const std::vector<Reference>& references)
+    {
+        DirectX::XMFLOAT3 centroidMin, centroidMax;
+        ResetBounds(centroidMin, centroidMax);
+        for (const Reference& ref : references)
+        {
+            DirectX::XMFLOAT3 centroid = { ReferenceCentroid(ctx, ref, 0), ReferenceCentroid(ctx, ref, 1), ReferenceCentroid(ctx, ref, 2) };
+            GrowBounds(centroidMin, centroidMax, centroid, centroid);
+        }
+
+        ObjectSplit best;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float axisMin = AxisValue(centroidMin, axis);
+            float axisExtent = AxisValue(centroidMax, axis) - axisMin;
+            if (axisExtent < 1e-6f)
+                continue;
+
+            float binScale = 1.0f / axisExtent;
+            Bin bins[NUM_BINS];
+            for (const Reference& ref : references)
+            {
+                Bin& bin = bins[ObjectBinIndex(ctx, ref, axis, axisMin, binScale)];
+                bin.triangleCount++;
+                GrowBounds(bin.aabbMin, bin.aabbMax, ref.aabbMin, ref.aabbMax);
+            }
+
+            DirectX::XMFLOAT3 leftMin[NUM_BINS - 1], leftMax[NUM_BINS - 1];
+            uint32_t leftCount[NUM_BINS - 1];
+            DirectX::XMFLOAT3 boxMin, boxMax;
+            ResetBounds(boxMin, boxMax);
+            uint32_t sum = 0;
+            for (int i = 0; i < NUM_BINS - 1; ++i)
+            {
+                sum += bins[i].triangleCount;
+                GrowBounds(boxMin, boxMax, bins[i].aabbMin, bins[i].aabbMax);
+                leftMin[i] = boxMin;
+                leftMax[i] = boxMax;
+                leftCount[i] = sum;
+            }
+
+            ResetBounds(boxMin, boxMax);
+            sum = 0;
+            for (int i = NUM_BINS - 1; i > 0; --i)
+            {
+                sum += bins[i].triangleCount;
+                GrowBounds(boxMin, boxMax, bins[i].aabbMin, bins[i].aabbMax);
+
+                if (leftCount[i - 1] == 0 || sum == 0)
+                    continue;
+
+                float cost = SurfaceArea(leftMin[i - 1], leftMax[i - 1]) * (float)leftCount[i - 1] + SurfaceArea(boxMin, boxMax) * (float)sum;
+                // Scanning right to left, so ties go to the leftmost plane like in the object-split builder
+                if (cost < best.cost || (cost == best.cost && best.axis == axis))
+                {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.splitBinIndex = i;
+                    best.centroidMin = axisMin;
+                    best.binScale = binScale;
+                    best.leftMin = leftMin[i - 1];
+                    best.leftMax = leftMax[i - 1];
+                    best.rightMin = boxMin;
+                    best.rightMax = boxMax;
+                }
+            }
+        }
+        return best;
+    }
+
+    void PerformObjectSplit(const SpatialBuildContext& ctx, const std::vector<Reference>& references, const ObjectSplit& split, std::vector<Reference>& outLeft, std::vector<Reference>& outRight)
+    {
+        for (const Reference& ref : references)
+        {
+            if (ObjectBinIndex(ctx, ref, split.axis, split.centroidMin, split.binScale) < split.splitBinIndex)
+                outLeft.push_back(ref);
+            else
+                outRight.push_back(ref);
+        }
+    }
+
+    // Halves the references at the median centroid along the node's longest axis; ties are ordered by primitive.
+    void PerformMedianSplit(const SpatialBuildContext& ctx, const SpatialBuildNode& node, std::vector<Reference>& outLeft, std::vector<Reference>& outRight)
+    {
+        const int axis = LongestAxis(node.aabbMin, node.aabbMax);
+        std::vector<Reference> ordered = node.references;
+        const size_t half = ordered.size() / 2;
+        std::nth_element(ordered.begin(), ordered.begin() + half, ordered.end(), [&ctx, axis](const Reference& a, const Reference& b)
+        {
+            const float centroidA = ReferenceCentroid(ctx, a, axis);
+            const float centroidB = ReferenceCentroid(ctx, b, axis);
+            return centroidA < centroidB || (centroidA == centroidB && a.primitive < b.primitive);
+        });
+        outLeft.assign(ordered.begin(), ordered.begin() + half);
+        outRight.assign(ordered.begin() + half, ordered.end());
+    }
+
+    // =========================================================================
+    // SPATIAL SPLITS
+    // =========================================================================
+
+    struct SpatialSplit
+    {
+        float cost = FLT_MAX;
+        int axis = -1;
+        float position = 0.0f;
+    };
+
+    struct SpatialBin
+    {
+        DirectX::XMFLOAT3 aabbMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+        DirectX::XMFLOAT3 aabbMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        uint32_t entryCount = 0; // References starting in this bin
+        uint32_t exitCount = 0;  // References ending in this bin
+    };
+
+    // Chops every reference into the spatial bins it overlaps and sweeps the bin boundaries. A reference is counted
+    // on the left of a plane if it starts before it and on the right if it ends after it, so straddling references
+    // are counted (and their clipped bounds added) on both sides.
+    SpatialSplit FindSpatialSplit(const SpatialBuildContext& ctx, const SpatialBuildNode& node, const std::vector<Reference>& references)
+    {
+        SpatialSplit best;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float origin = AxisValue(node.aabbMin, axis);
+            float axisExtent = AxisValue(node.aabbMax, axis) - origin;
+            if (axisExtent < 1e-6f)
+                continue;
+
+            float binWidth = axisExtent / NUM_SPATIAL_BINS;
+            float invBinWidth = 1.0f / binWidth;
+
+            SpatialBin bins[NUM_SPATIAL_BINS];
+            for (const Reference& ref : references)
+            {
+                int firstBin = std::clamp(static_cast<int>((AxisValue(ref.aabbMin, axis) - origin) * invBinWidth), 0, NUM_SPATIAL_BINS - 1);
+                int lastBin = std::clamp(static_cast<int>((AxisValue(ref.aabbMax, axis) - origin) * invBinWidth), firstBin, NUM_SPATIAL_BINS - 1);
+
+                Reference remaining = ref;
+                for (int b = firstBin; b < lastBin; ++b)
+                {
+                    Reference left, right;
+                    SplitReference(ctx, remaining, axis, origin + binWidth * (float)(b + 1), left, right);
+                    if (IsValidBounds(left.aabbMin, left.aabbMax))
+                        GrowBounds(bins[b].aabbMin, bins[b].aabbMax, left.aabbMin, left.aabbMax);
+                    remaining = right;
+                }
+                if (IsValidBounds(remaining.aabbMin, remaining.aabbMax))
+                    GrowBounds(bins[lastBin].aabbMin, bins[lastBin].aabbMax, remaining.aabbMin, remaining.aabbMax);
+
+                bins[firstBin].entryCount++;
+                bins[lastBin].exitCount++;
+            }
+
+            float leftArea[NUM_SPATIAL_BINS - 1];
+            uint32_t leftCount[NUM_SPATIAL_BINS - 1];
+            DirectX::XMFLOAT3 boxMin, boxMax;
+            ResetBounds(boxMin, boxMax);
+            uint32_t sum = 0;
+            for (int i = 0; i < NUM_SPATIAL_BINS - 1; ++i)
+            {
+                sum += bins[i].entryCount;
+                GrowBounds(boxMin, boxMax, bins[i].aabbMin, bins[i].aabbMax);
+                leftArea[i] = SafeSurfaceArea(boxMin, boxMax);
+                leftCount[i] = sum;
+            }
+
+            ResetBounds(boxMin, boxMax);
+            sum = 0;
+            for (int i = NUM_SPATIAL_BINS - 1; i > 0; --i)
+            {
+                sum += bins[i].exitCount;
+                GrowBounds(boxMin, boxMax, bins[i].aabbMin, bins[i].aabbMax);
+
+                if (leftCount[i - 1] == 0 || sum == 0)
+                    continue;
+
+                float cost = leftArea[i - 1] * (float)leftCount[i - 1] + SafeSurfaceArea(boxMin, boxMax) * (float)sum;
+                if (cost < best.cost || (cost == best.cost && best.axis == axis))
+                {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.position = origin + binWidth * (float)i;
+                }
+            }
+        }
+        return best;
+    }
+
+    // Distributes the references of a spatial split. Straddling references are split in two unless keeping them
+    // whole on one side is cheaper ("reference unsplitting"). Returns false if the split degenerates or would
+    // duplicate more references than the node's budget allows.
+    bool PerformSpatialSplit(const SpatialBuildContext& ctx, const std::vector<Reference>& references, const SpatialSplit& split, uint32_t budget,
+        std::vector<Reference>& outLeft, std::vector<Reference>& outRight)
+    {
+        const int axis = split.axis;
+        const float pos = split.position;
+
+        // 1. References entirely on one side go straight into that child
+        std::vector<Reference> straddling;
+        DirectX::XMFLOAT3 leftMin, leftMax, rightMin, rightMax;
+        ResetBounds(leftMin, leftMax);
+        ResetBounds(rightMin, rightMax);
+        for (const Reference& ref : references)
+        {
+            if (AxisValue(ref.aabbMax, axis) <= pos)
+            {
+                outLeft.push_back(ref);
+                GrowBounds(leftMin, leftMax, ref.aabbMin, ref.aabbMax);
+            }
+            else if (AxisValue(ref.aabbMin, axis) >= pos)
+            {
+                outRight.push_back(ref);
+                GrowBounds(rightMin, rightMax, ref.aabbMin, ref.aabbMax);
+            }
+            else
+            {
+                straddling.push_back(ref);
+            }
+        }
+
+        // 2. Start from the fully split configuration...
+        std::vector<Reference> leftParts(straddling.size()), rightParts(straddling.size());
+        for (size_t i = 0; i < straddling.size(); ++i)
+        {
+            SplitReference(ctx, straddling[i], axis, pos, leftParts[i], rightParts[i]);
+            if (IsValidBounds(leftParts[i].aabbMin, leftParts[i].aabbMax))
+                GrowBounds(leftMin, leftMax, leftParts[i].aabbMin, leftParts[i].aabbMax);
+            if (IsValidBounds(rightParts[i].aabbMin, rightParts[i].aabbMax))
+                GrowBounds(rightMin, rightMax, rightParts[i].aabbMin, rightParts[i].aabbMax);
+        }
+
+        // 3. ...then move each straddling reference wholly to one side when that lowers the SAH
+        uint32_t leftCount = static_cast<uint32_t>(outLeft.size() + straddling.size());
+        uint32_t rightCount = static_cast<uint32_t>(outRight.size() + straddling.size());
+        for (size_t i = 0; i < straddling.size(); ++i)
+        {
+            const Reference& ref = straddling[i];
+            const bool leftValid = IsValidBounds(leftParts[i].aabbMin, leftParts[i].aabbMax);
+            const bool rightValid = IsValidBounds(rightParts[i].aabbMin, rightParts[i].aabbMax);
+
+            float leftArea = SafeSurfaceArea(leftMin, leftMax);
+            float rightArea = SafeSurfaceArea(rightMin, rightMax);
+            float splitCost = leftArea * (float)leftCount + rightArea * (float)rightCount;
+            float unsplitLeftCost = SurfaceArea(Min3(leftMin, ref.aabbMin), Max3(leftMax, ref.aabbMax)) * (float)leftCount + rightArea * (float)(rightCount - 1);
+            float unsplitRightCost = leftArea * (float)(leftCount - 1) + SurfaceArea(Min3(rightMin, ref.aabbMin), Max3(rightMax, ref.aabbMax)) * (float)rightCount;
+
+            if (!rightValid || (leftValid && unsplitLeftCost < splitCost && unsplitLeftCost <= unsplitRightCost))
+            {
+                outLeft.push_back(ref);
+                GrowBounds(leftMin, leftMax, ref.aabbMin, ref.aabbMax);
+                rightCount--;
+            }
+            else if (!leftValid || unsplitRightCost < splitCost)
+            {
+                outRight.push_back(ref);
+                GrowBounds(rightMin, rightMax, ref.aabbMin, ref.aabbMax);
+                leftCount--;
+            }
+            else
+            {
+                outLeft.push_back(leftParts[i]);
+                outRight.push_back(rightParts[i]);
+            }
+        }
+
+        const size_t duplicates = outLeft.size() + outRight.size() - references.size();
+        if (outLeft.empty() || outRight.empty() || duplicates > budget)
+        {
+            outLeft.clear();
+            outRight.clear();
+            return false;
+        }
+        return true;
+    }
+
+    // =========================================================================
+    // RECURSION
+    // =========================================================================
+
+    // Picks and performs the cheapest object or spatial split. Returns false if the node is cheaper as a leaf.
+    bool SplitSpatialNode(SpatialBuildContext& ctx, const SpatialBuildNode& node, uint32_t budget, std::vector<Reference>& left, std::vector<Reference>& right)
+    {
+        const uint32_t count = static_cast<uint32_t>(node.references.size());
+
+        // 1. Best object split, and a spatial split if the object split's children overlap enough to make one worthwhile
+        ObjectSplit objectSplit = FindObjectSplit(ctx, node.references);
+
+        SpatialSplit spatialSplit;
+        if (budget > 0)
+        {
+            float overlapArea = objectSplit.axis == -1 ? FLT_MAX :
+                SafeSurfaceArea(Max3(objectSplit.leftMin, objectSplit.rightMin), Min3(objectSplit.leftMax, objectSplit.rightMax));
+            if (overlapArea > ctx.overlapThreshold)
+                spatialSplit = FindSpatialSplit(ctx, node, node.references);
+        }
+
+        float parentCost = SurfaceArea(node.aabbMin, node.aabbMax) * count;
+        if ((std::min)(objectSplit.cost, spatialSplit.cost) >= parentCost)
+            return false;
+
+        // 2. Split, preferring the spatial split when it is cheaper and fits the budget
+        bool split = false;
+        if (spatialSplit.cost < objectSplit.cost)
+        {
+            left.reserve(count);
+            right.reserve(count);
+            split = PerformSpatialSplit(ctx, node.references, spatialSplit, budget, left, right);
+        }
+        if (!split)
+        {
+            if (objectSplit.axis == -1 || objectSplit.cost >= parentCost)
+                return false;
+            PerformObjectSplit(ctx, node.references, objectSplit, left, right);
+        }
+        return true;
+    }
+
+    void SubdivideSpatialNode(SpatialBuildContext& ctx, SpatialBuildNode& node, uint32_t budget, uint32_t depth, SpatialBuildNodeArena& arena)
+    {
+        const uint32_t count = static_cast<uint32_t>(node.references.size());
+        if (count <= ctx.maxLeafSize)
+            return;
+
+        // 1. SAH split with spatial splits while the depth limit leaves room, median object splits after that
+        std::vector<Reference> left, right;
+        if (CanChooseSplit(depth, count, ctx.maxLeafSize))
+        {
+            if (!SplitSpatialNode(ctx, node, budget, left, right))
+                return;
+        }
+        else
+        {
+            PerformMedianSplit(ctx, node, left, right);
+        }
+        std::vector<Reference>().swap(node.references);
+
+        // 2. Share what is left of the budget between the children in proportion to their size
+        const uint32_t duplicates = static_cast<uint32_t>(left.size() + right.size()) - count;
+        const uint32_t remainingBudget = budget - duplicates;
+        const uint32_t leftBudget = static_cast<uint32_t>((uint64_t)remainingBudget * left.size() / (left.size() + right.size()));
+        const uint32_t rightBudget = remainingBudget - leftBudget;
+
+        SpatialBuildNode& leftChild = arena.emplace_back();
+        ComputeReferenceBounds(left, leftChild.aabbMin, leftChild.aabbMax);
+        leftChild.references = std::move(left);
+
+        SpatialBuildNode& rightChild = arena.emplace_back();
+        ComputeReferenceBounds(right, rightChild.aabbMin, rightChild.aabbMax);
+        rightChild.references = std::move(right);
+
+        node.children[0] = &leftChild;
+        node.children[1] = &rightChild;
+
+        if (rightChild.references.size() >= SUBTREE_TASK_THRESHOLD)
+        {
+            SpatialBuildNode* rightNode = &rightChild;
+            ctx.subtreeTasks->Run([&ctx, rightNode, rightBudget, depth] { SubdivideSpatialNode(ctx, *rightNode, rightBudget, depth + 1, ctx.NewArena()); });
+        }
+        else
+        {
+            SubdivideSpatialNode(ctx, rightChild, rightBudget, depth + 1, arena);
+        }
+        SubdivideSpatialNode(ctx, leftChild, leftBudget, depth + 1, arena);
+    }
+
+    // Same layout as FlattenBuildNode. Leaves copy their referenced triangles into outTriangles, so a triangle
+    // referenced by several leaves is stored once per leaf and every leaf addresses a contiguous range.
+    void FlattenSpatialNode(const SpatialBuildNode& node, uint32_t nodeIndex, std::vector<BVHNode>& bvhNodes, const std::vector<Triangle>& triangles,
+        std::vector<Triangle>& outTriangles, uint32_t baseTriangleIndex, std::vector<uint32_t>* outSourceIndices)
+    {
+        bvhNodes[nodeIndex].aabbMin = node.aabbMin;
+        bvhNodes[nodeIndex].aabbMax = node.aabbMax;
+
+        if (!node.children[0])
+        {
+            bvhNodes[nodeIndex].leftChildOrFirstTriangleIndex = baseTriangleIndex + static_cast<uint32_t>(outTriangles.size());
+            bvhNodes[nodeIndex].triangleCount = static_cast<int>(node.references.size());
+            for (const Reference& ref : node.references)
+            {
+                outTriangles.push_back(triangles[ref.primitive]);
+                if (outSourceIndices) outSourceIndices->push_back(ref.primitive);
+            }
+            return;
+        }
+
+        uint32_t leftChildIndex = static_cast<uint32_t>(bvhNodes.size());
+        bvhNodes.resize(leftChildIndex + 2);
+        bvhNodes[nodeIndex].leftChildOrFirstTriangleIndex = leftChildIndex;
+        bvhNodes[nodeIndex].triangleCount = 0; // Mark as internal node
+
+        FlattenSpatialNode(*node.children[0], leftChildIndex, bvhNodes, triangles, outTriangles, baseTriangleIndex, outSourceIndices);
+        FlattenSpatialNode(*node.children[1], leftChildIndex + 1, bvhNodes, triangles, outTriangles, baseTriangleIndex, outSourceIndices);
+    }
+
+    void BuildSpatialSplits(std::vector<Triangle>& triangles, std::vector<BVHNode>& outBvhNodes, uint32_t baseTriangleIndex,
+        const BVHBuildSettings& settings, TaskScheduler* scheduler, std::vector<uint32_t>* outSourceIndices)
+    {
+        const uint32_t primitiveCount = static_cast<uint32_t>(triangles.size());
+
+        // 1. One reference per triangle, covering the whole triangle
+        SpatialBuildNode root;
+        root.references.resize(primitiveCount);
+        scheduler->ParallelFor(primitiveCount, PARALLEL_BLOCK_SIZE, [&](uint32_t begin, uint32_t end)
+            {
+                for (uint32_t i = begin; i < end; ++i)
+                {
+                    const Triangle& tri = triangles[i];
+                    Reference& ref = root.references[i];
+                    ref.aabbMin = Min3(Min3(tri.v0, tri.v1), tri.v2);
+                    ref.aabbMax = Max3(Max3(tri.v0, tri.v1), tri.v2);
+                    ref.primitive = i;
+                }
+            });
+        ComputeReferenceBounds(root.references, root.aabbMin, root.aabbMax);
+
+        // 2. Build the temporary tree
+        TaskGroup subtreeTasks(scheduler);
+        float overlapThreshold = settings.SpatialSplitOverlapThreshold * SurfaceArea(root.aabbMin, root.aabbMax);
+        SpatialBuildContext ctx(triangles, &subtreeTasks, overlapThreshold);
+        ctx.maxLeafSize = (std::max)(settings.MaxLeafSize, 1u);
+
+        uint32_t budget = static_cast<uint32_t>((std::max)(0.0f, settings.SpatialSplitBudget) * (float)primitiveCount);
+        SubdivideSpatialNode(ctx, root, budget, 0, ctx.NewArena());
+        subtreeTasks.Wait();
+
+        // 3. Flatten, emitting one triangle per leaf reference
+        size_t nodeCount = 1;
+        for (const SpatialBuildNodeArena& arena : ctx.arenas)
+        {
+            nodeCount += arena.size();
+        }
+        outBvhNodes.reserve(nodeCount);
+        outBvhNodes.resize(1);
+
+        std::vector<Triangle> leafTriangles;
+        leafTriangles.reserve(primitiveCount + budget);
+        if (outSourceIndices)
+        {
+            outSourceIndices->clear();
+            outSourceIndices->reserve(primitiveCount + budget);
+        }
+        FlattenSpatialNode(root, 0, outBvhNodes, triangles, leafTriangles, baseTriangleIndex, outSourceIndices);
+        triangles.swap(leafTriangles);
+    }
+}
 
-    // Start the recursive subdivision
-    SubdivideBinningPartitionNode(root, triangles, outBvhNodes, 0, (uint32_t)triangles.size(), baseTriangleIndex,nodesUsed);
+// --- Linear BVH (LBVH / HLBVH) Builder ---
+// Lauterbach et al. 2009, Pantaleoni and Luebke 2010. Primitives are sorted along a Morton curve through their
+// centroids and the hierarchy falls out of the sorted codes: every node splits its range where the highest
+// differing bit of its codes flips. There is no SAH evaluation below the optional top levels, so the build is
+// much faster than the binned builder at the cost of trace performance. Shares BuildNode and the flattening step
+// with the binned builder, and like it produces the same tree for any number of threads.
+namespace
+{
+    const int RADIX_BITS = 8;
+    const uint32_t RADIX_BUCKETS = 1u << RADIX_BITS;
+
+    // Spreads the low bits of v so that two zero bits separate each of them.
+    inline uint64_t ExpandBits10(uint64_t v)
+    {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    inline uint64_t ExpandBits21(uint64_t v)
+    {
+        v &= 0x1fffff;
+        v = (v | (v << 32)) & 0x001f00000000ffffull;
+        v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+        v = (v | (v << 8)) & 0x100f00f00f00f00full;
+        v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+        v = (v | (v << 2)) & 0x1249249249249249ull;
+        return v;
+    }
+
+    inline int HighestSetBit(uint64_t v)
+    {
+        int bit = -1;
+        while (v)
+        {
+            v >>= 1;
+            ++bit;
+        }
+        return bit;
+    }
+
+    struct LinearBuildContext
+    {
+        BuildContext& build;
+        std::vector<uint64_t>& mortonCodes; // Sorted, parallel to build.indices
+
+        explicit LinearBuildContext(BuildContext& buildContext) : build(buildContext), mortonCodes(buildContext.storage.mortonCodes) {}
+    };
+
+    // 1. Morton codes from the centroids, quantized over the centroid bounds of the whole mesh
+    void ComputeMortonCodes(LinearBuildContext& ctx, uint32_t codeBits)
+    {
+        const PrimitiveRefs& refs = ctx.build.refs;
+        const uint32_t primitiveCount = static_cast<uint32_t>(ctx.build.indices.size());
+
+        const uint32_t blockCount = (primitiveCount + PARALLEL_BLOCK_SIZE - 1) / PARALLEL_BLOCK_SIZE;
+        std::vector<DirectX::XMFLOAT3>& blockMin = ctx.build.storage.blocks.boundsMin;
+        std::vector<DirectX::XMFLOAT3>& blockMax = ctx.build.storage.blocks.boundsMax;
+        blockMin.resize(blockCount);
+        blockMax.resize(blockCount);
+        ctx.build.scheduler->ParallelFor(primitiveCount, PARALLEL_BLOCK_SIZE, [&](uint32_t begin, uint32_t end)
+            {
+                DirectX::XMFLOAT3 centroidMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+                DirectX::XMFLOAT3 centroidMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+                for (uint32_t i = begin; i < end; ++i)
+                {
+                    DirectX::XMFLOAT3 centroid = { refs.centroid[0][i], refs.centroid[1][i], refs.centroid[2][i] };
+                    centroidMin = Min3(centroidMin, centroid);
+                    centroidMax = Max3(centroidMax, centroid);
+                }
+                blockMin[begin / PARALLEL_BLOCK_SIZE] = centroidMin;
+                blockMax[begin / PARALLEL_BLOCK_SIZE] = centroidMax;
+            });
+
+        DirectX::XMFLOAT3 centroidMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+        DirectX::XMFLOAT3 centroidMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (uint32_t block = 0; block < blockCount; ++block)
+        {
+            centroidMin = Min3(centroidMin, blockMin[block]);
+            centroidMax = Max3(centroidMax, blockMax[block]);
+        }
+
+        const bool wideCodes = codeBits > 30;
+        const float cellCount = wideCodes ? (float)(1 << 21) : (float)(1 << 10);
+        float scale[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float extent = AxisValue(centroidMax, axis) - AxisValue(centroidMin, axis);
+            scale[axis] = extent > 1e-6f ? cellCount / extent : 0.0f;
+        }
+
+        ctx.mortonCodes.resize(primitiveCount);
+        ctx.build.scheduler->ParallelFor(primitiveCount, PARALLEL_BLOCK_SIZE, [&](uint32_t begin, uint32_t end)
+            {
+                const float maxCell = cellCount - 1.0f;
+                for (uint32_t i = begin; i < end; ++i)
+                {
+                    uint64_t cell[3];
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        float c = (refs.centroid[axis][i] - AxisValue(centroidMin, axis)) * scale[axis];
+                        cell[axis] = static_cast<uint64_t>(std::clamp(c, 0.0f, maxCell));
+                    }
+
+                    ctx.mortonCodes[i] = wideCodes
+                        ? (ExpandBits21(cell[0]) << 2) | (ExpandBits21(cell[1]) << 1) | ExpandBits21(cell[2])
+                        : (ExpandBits10(cell[0]) << 2) | (ExpandBits10(cell[1]) << 1) | ExpandBits10(cell[2]);
+                }
+            });
+    }
+
+    // 2. Parallel LSD radix sort of (code, primitive) pairs, 8 bits per pass. Every pass histograms fixed-size blocks
+    //    in parallel, turns the histograms into per-block offsets in block order and scatters, so the sort is stable
+    //    and its result does not depend on scheduling. Codes are sorted in place of their primitive index.
+    void SortMortonCodes(LinearBuildContext& ctx, uint32_t codeBits)
+    {
+        TaskScheduler* scheduler = ctx.build.scheduler;
+        std::vector<uint64_t>& codes = ctx.mortonCodes;
+        std::vector<uint32_t>& indices = ctx.build.indices;
+        const uint32_t count = static_cast<uint32_t>(codes.size());
+        const uint32_t blockCount = (count + PARALLEL_BLOCK_SIZE - 1) / PARALLEL_BLOCK_SIZE;
+
+        // codes[i] belongs to indices[i]; both are permuted together
+        std::vector<uint64_t>& scratchCodes = ctx.build.storage.scratchCodes;
+        scratchCodes.resize(count);
+        std::vector<uint32_t>& scratchIndices = ctx.build.scratch;
+        std::vector<uint32_t>& histograms = ctx.build.storage.blocks.histograms;
+        histograms.resize(blockCount * RADIX_BUCKETS);
+
+        for (uint32_t shift = 0; shift < codeBits; shift += RADIX_BITS)
+        {
+            std::fill(histograms.begin(), histograms.end(), 0u);
+            scheduler->ParallelFor(count, PARALLEL_BLOCK_SIZE, [&](uint32_t begin, uint32_t end)
+                {
+                    uint32_t* histogram = &histograms[(begin / PARALLEL_BLOCK_SIZE) * RADIX_BUCKETS];
+                    for (uint32_t i = begin; i < end; ++i)
+                    {
+                        histogram[(codes[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                    }
+                });
+
+            // Skip passes where every code has the same digit (common for the top digits of 30-bit codes)
+            bool trivialPass = false;
+            for (uint32_t bucket = 0; bucket < RADIX_BUCKETS && !trivialPass; ++bucket)
+            {
+                uint32_t bucketTotal = 0;
+                for (uint32_t block = 0; block < blockCount; ++block)
+                {
+                    bucketTotal += histograms[block * RADIX_BUCKETS + bucket];
+                }
+                trivialPass = bucketTotal == count;
+            }
+            if (trivialPass)
+                continue;
+
+            // Bucket-major, block-minor exclusive prefix sum
+            uint32_t offset = 0;
+            for (uint32_t bucket = 0; bucket < RADIX_BUCKETS; ++bucket)
+            {
+                for (uint32_t block = 0; block < blockCount; ++block)
+                {
+                    uint32_t& entry = histograms[block * RADIX_BUCKETS + bucket];
+                    uint32_t bucketCount = entry;
+                    entry = offset;
+                    offset += bucketCount;
+                }
+            }
+
+            scheduler->ParallelFor(count, PARALLEL_BLOCK_SIZE, [&](uint32_t begin, uint32_t end)
+                {
+                    uint32_t* offsets = &histograms[(begin / PARALLEL_BLOCK_SIZE) * RADIX_BUCKETS];
+                    for (uint32_t i = begin; i < end; ++i)
+                    {
+                        uint32_t destination = offsets[(codes[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                        scratchCodes[destination] = codes[i];
+                        scratchIndices[destination] = indices[i];
+                    }
+                });
+
+            codes.swap(scratchCodes);
+            indices.swap(scratchIndices);
+        }
+    }
+
+    // 3. Emits the subtree for a sorted range, splitting where the highest differing Morton bit flips. Ranges whose
+    //    codes are all equal, and ranges too deep for an unbalanced split (see CanChooseSplit), are split in the
+    //    middle. Bounds are merged bottom-up once both children are done.
+    void EmitLinearNode(LinearBuildContext& ctx, BuildNode& node, uint32_t depth, BuildNodeArena& arena)
+    {
+        if (node.count <= ctx.build.maxLeafSize)
+        {
+            ComputeRangeBounds(ctx.build, node.startIndex, node.startIndex + node.count, node.aabbMin, node.aabbMax);
+            return;
+        }
+
+        const uint32_t endIndex = node.startIndex + node.count;
+        const uint64_t firstCode = ctx.mortonCodes[node.startIndex];
+        const uint64_t lastCode = ctx.mortonCodes[endIndex - 1];
+
+        uint32_t splitIndex = node.startIndex + node.count / 2;
+        if (firstCode != lastCode && CanChooseSplit(depth, node.count, ctx.build.maxLeafSize))
+        {
+            // The first code with the differing bit set starts the right child
+            int bit = HighestSetBit(firstCode ^ lastCode);
+            uint64_t splitCode = ((firstCode >> bit) | 1) << bit;
+            auto first = ctx.mortonCodes.begin() + node.startIndex;
+            auto last = ctx.mortonCodes.begin() + endIndex;
+            splitIndex = static_cast<uint32_t>(std::lower_bound(first, last, splitCode) - ctx.mortonCodes.begin());
+        }
+
+        BuildNode& leftChild = arena.emplace_back();
+        leftChild.startIndex = node.startIndex;
+        leftChild.count = splitIndex - node.startIndex;
+
+        BuildNode& rightChild = arena.emplace_back();
+        rightChild.startIndex = splitIndex;
+        rightChild.count = endIndex - splitIndex;
+
+        node.children[0] = &leftChild;
+        node.children[1] = &rightChild;
+
+        if (rightChild.count >= SUBTREE_TASK_THRESHOLD)
+        {
+            TaskGroup rightTask(ctx.build.scheduler);
+            BuildNode* right = &rightChild;
+            rightTask.Run([&ctx, right, depth] { EmitLinearNode(ctx, *right, depth + 1, ctx.build.NewArena()); });
+            EmitLinearNode(ctx, leftChild, depth + 1, arena);
+            rightTask.Wait();
+        }
+        else
+        {
+            EmitLinearNode(ctx, leftChild, depth + 1, arena);
+            EmitLinearNode(ctx, rightChild, depth + 1, arena);
+        }
+
+        node.aabbMin = Min3(leftChild.aabbMin, rightChild.aabbMin);
+        node.aabbMax = Max3(leftChild.aabbMax, rightChild.aabbMax);
+    }
+
+    // A range of primitives sharing their leading Morton bits; the leaves of the HLBVH top levels
+    struct LinearCluster
+    {
+        BuildNode* node = nullptr;
+        uint32_t levels = 0; // MedianSplitLevels of its primitives
+        uint32_t depth = 0;  // Of the cluster node (root = 0), set by BuildClusterTree
+    };
+
+    // Whether clusters[begin, end) at depth can be connected by halving the list and every cluster then emitted
+    // within BVHBuilder::MAX_DEPTH levels, i.e. the cluster tree's counterpart of CanChooseSplit
+    bool ClustersFitBelow(const std::vector<LinearCluster>& clusters, uint32_t begin, uint32_t end, uint32_t depth)
+    {
+        uint32_t clusterLevels = 0;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            clusterLevels = (std::max)(clusterLevels, clusters[i].levels);
+        }
+        return depth + MedianSplitLevels(end - begin, 1) + clusterLevels < BVHBuilder::MAX_DEPTH;
+    }
+
+    // HLBVH top levels: a binned SAH build over the clusters, whose own subtrees are emitted linearly afterwards.
+    // Where an SAH split could leave a cluster too deep, the list is halved instead. Clusters are few, so this runs
+    // serially.
+    BuildNode* BuildClusterTree(std::vector<LinearCluster>& clusters, uint32_t begin, uint32_t end, uint32_t depth, BuildNodeArena& arena)
+    {
+        if (end - begin == 1)
+        {
+            clusters[begin].depth = depth;
+            return clusters[begin].node;
+        }
+
+        DirectX::XMFLOAT3 boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX }, boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        DirectX::XMFLOAT3 centroidMin = { FLT_MAX, FLT_MAX, FLT_MAX }, centroidMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        auto centroidOf = [](const LinearCluster& cluster, int axis)
+        {
+            return (AxisValue(cluster.node->aabbMin, axis) + AxisValue(cluster.node->aabbMax, axis)) * 0.5f;
+        };
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            boundsMin = Min3(boundsMin, clusters[i].node->aabbMin);
+            boundsMax = Max3(boundsMax, clusters[i].node->aabbMax);
+            DirectX::XMFLOAT3 centroid = { centroidOf(clusters[i], 0), centroidOf(clusters[i], 1), centroidOf(clusters[i], 2) };
+            centroidMin = Min3(centroidMin, centroid);
+            centroidMax = Max3(centroidMax, centroid);
+        }
+
+        // Same sweep as FindBestSplit, weighting every cluster by its primitive count. Either child has fewer
+        // clusters, so halving below it still fits whenever this node's list fits one level further down.
+        float bestCost = FLT_MAX;
+        int bestAxis = -1;
+        int bestSplitBinIndex = 0;
+        const bool canChooseSplit = ClustersFitBelow(clusters, begin, end, depth + 1);
+        for (int axis = 0; canChooseSplit && axis < 3; ++axis)
+        {
+            float axisMin = AxisValue(centroidMin, axis);
+            float axisExtent = AxisValue(centroidMax, axis) - axisMin;
+            if (axisExtent < 1e-6f)
+                continue;
+
+            Bin bins[NUM_BINS];
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                int binIndex = std::clamp(static_cast<int>(NUM_BINS * ((centroidOf(clusters[i], axis) - axisMin) / axisExtent)), 0, NUM_BINS - 1);
+                bins[binIndex].triangleCount += clusters[i].node->count;
+                bins[binIndex].aabbMin = Min3(bins[binIndex].aabbMin, clusters[i].node->aabbMin);
+                bins[binIndex].aabbMax = Max3(bins[binIndex].aabbMax, clusters[i].node->aabbMax);
+            }
+
+            for (int split = 1; split < NUM_BINS; ++split)
+            {
+                Bin left, right;
+                for (int b = 0; b < NUM_BINS; ++b)
+                {
+                    Bin& side = b < split ? left : right;
+                    side.triangleCount += bins[b].triangleCount;
+                    side.aabbMin = Min3(side.aabbMin, bins[b].aabbMin);
+                    side.aabbMax = Max3(side.aabbMax, bins[b].aabbMax);
+                }
+                if (left.triangleCount == 0 || right.triangleCount == 0)
+                    continue;
+
+                float cost = SurfaceArea(left.aabbMin, left.aabbMax) * left.triangleCount + SurfaceArea(right.aabbMin, right.aabbMax) * right.triangleCount;
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplitBinIndex = split;
+                }
+            }
+        }
+
+        // Stable partition of the cluster list; fall back to halving it (in Morton order) if nothing separates them or
+        // the depth limit is near
+        uint32_t middle = begin + (end - begin) / 2;
+        if (bestAxis != -1)
+        {
+            float axisMin = AxisValue(centroidMin, bestAxis);
+            float axisExtent = AxisValue(centroidMax, bestAxis) - axisMin;
+            auto isLeft = [&](const LinearCluster& cluster)
+            {
+                int binIndex = std::clamp(static_cast<int>(NUM_BINS * ((centroidOf(cluster, bestAxis) - axisMin) / axisExtent)), 0, NUM_BINS - 1);
+                return binIndex < bestSplitBinIndex;
+            };
+            middle = static_cast<uint32_t>(std::stable_partition(clusters.begin() + begin, clusters.begin() + end, isLeft) - clusters.begin());
+        }
+
+        BuildNode& node = arena.emplace_back();
+        node.aabbMin = boundsMin;
+        node.aabbMax = boundsMax;
+        node.children[0] = BuildClusterTree(clusters, begin, middle, depth + 1, arena);
+        node.children[1] = BuildClusterTree(clusters, middle, end, depth + 1, arena);
+        return &node;
+    }
+
+    void BuildLinear(BuildContext& buildContext, BuildNode& root, const BVHBuildSettings& settings)
+    {
+        LinearBuildContext ctx(buildContext);
+        const uint32_t codeBits = settings.MortonCodeBits > 30 ? 63 : 30;
+
+        ComputeMortonCodes(ctx, codeBits);
+        SortMortonCodes(ctx, codeBits);
+
+        const uint32_t topLevelBits = (std::min)(settings.SAHTopLevelBits, codeBits);
+        if (topLevelBits == 0)
+        {
+            EmitLinearNode(ctx, root, 0, *buildContext.storage.arenas.front());
+            return;
+        }
+
+        // HLBVH: connect the clusters with SAH, then emit every cluster linearly (in parallel) from its depth
+        const uint32_t clusterShift = codeBits - topLevelBits;
+        BuildNodeArena& clusterArena = buildContext.NewArena();
+        std::vector<LinearCluster> clusters;
+        for (uint32_t start = 0; start < root.count;)
+        {
+            uint32_t end = start + 1;
+            while (end < root.count && (ctx.mortonCodes[end] >> clusterShift) == (ctx.mortonCodes[start] >> clusterShift))
+            {
+                ++end;
+            }
+
+            BuildNode& cluster = clusterArena.emplace_back();
+            cluster.startIndex = start;
+            cluster.count = end - start;
+            clusters.push_back({ &cluster, MedianSplitLevels(cluster.count, buildContext.maxLeafSize) });
+            start = end;
+        }
+
+        // A single cluster, or clusters too many and too large to stay within the depth limit: plain LBVH
+        const uint32_t clusterCount = static_cast<uint32_t>(clusters.size());
+        if (clusterCount == 1 || !ClustersFitBelow(clusters, 0, clusterCount, 0))
+        {
+            EmitLinearNode(ctx, root, 0, *buildContext.storage.arenas.front());
+            return;
+        }
+
+        buildContext.scheduler->ParallelFor(clusterCount, 16, [&](uint32_t begin, uint32_t end)
+            {
+                for (uint32_t i = begin; i < end; ++i)
+                {
+                    BuildNode& cluster = *clusters[i].node;
+                    ComputeRangeBounds(buildContext, cluster.startIndex, cluster.startIndex + cluster.count, cluster.aabbMin, cluster.aabbMax);
+                }
+            });
+
+        BuildNode* top = BuildClusterTree(clusters, 0, clusterCount, 0, clusterArena);
+        root.children[0] = top->children[0];
+        root.children[1] = top->children[1];
+
+        buildContext.scheduler->ParallelFor(clusterCount, 16, [&](uint32_t begin, uint32_t end)
+            {
+                BuildNodeArena& arena = buildContext.NewArena();
+                for (uint32_t i = begin; i < end; ++i)
+                {
+                    EmitLinearNode(ctx, *clusters[i].node, clusters[i].depth, arena);
+                }
+            });
+    }
+}
+
+// --- Refit ---
+// Deforming meshes keep their tree and only move its boxes: leaves take the bounds of their (moved) triangles and
+// internal nodes the union of their children, post-order. The topology was chosen for the original positions, so
+// the SAH cost drifts upwards as the mesh deforms; the returned cost tells the caller when a rebuild pays off.
+
+namespace
+{
+    // Subtrees below this depth are refit by the task that reaches them; above it the right child is forked.
+    const uint32_t REFIT_TASK_DEPTH = 6;
+
+    struct RefitContext
+    {
+        std::vector<BVHNode>& nodes;
+        const std::vector<TrianglePositions>& triangles;
+        uint32_t baseTriangleIndex;
+        TaskScheduler* scheduler;
+    };
+
+    // Returns the unnormalized SAH cost of the subtree. Sibling subtrees touch disjoint nodes, and min/max are
+    // exact, so the bounds do not depend on the number of threads.
+    double RefitSubtree(RefitContext& ctx, uint32_t nodeIndex, uint32_t depth)
+    {
+        BVHNode& node = ctx.nodes[nodeIndex];
+        if (node.triangleCount > 0)
+        {
+            const uint32_t first = ctx.baseTriangleIndex + static_cast<uint32_t>(node.leftChildOrFirstTriangleIndex);
+            DirectX::XMFLOAT3 boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+            DirectX::XMFLOAT3 boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for (int i = 0; i < node.triangleCount; ++i)
+            {
+                const TrianglePositions& tri = ctx.triangles[first + i];
+                boundsMin = Min3(boundsMin, Min3(Min3(tri.v0, tri.v1), tri.v2));
+                boundsMax = Max3(boundsMax, Max3(Max3(tri.v0, tri.v1), tri.v2));
+            }
+            node.aabbMin = boundsMin;
+            node.aabbMax = boundsMax;
+            return (double)SurfaceArea(boundsMin, boundsMax) * node.triangleCount;
+        }
+
+        const uint32_t leftChild = static_cast<uint32_t>(node.leftChildOrFirstTriangleIndex);
+        double leftCost, rightCost;
+        if (depth < REFIT_TASK_DEPTH)
+        {
+            TaskGroup rightTask(ctx.scheduler);
+            rightTask.Run([&ctx, &rightCost, leftChild, depth] { rightCost = RefitSubtree(ctx, leftChild + 1, depth + 1); });
+            leftCost = RefitSubtree(ctx, leftChild, depth + 1);
+            rightTask.Wait();
+        }
+        else
+        {
+            leftCost = RefitSubtree(ctx, leftChild, depth + 1);
+            rightCost = RefitSubtree(ctx, leftChild + 1, depth + 1);
+        }
+
+        const BVHNode& left = ctx.nodes[leftChild];
+        const BVHNode& right = ctx.nodes[leftChild + 1];
+        node.aabbMin = Min3(left.aabbMin, right.aabbMin);
+        node.aabbMax = Max3(left.aabbMax, right.aabbMax);
+        return (double)SurfaceArea(node.aabbMin, node.aabbMax) + leftCost + rightCost;
+    }
+}
+
+float BVHBuilder::Refit(std::vector<BVHNode>& nodes, uint32_t rootIndex, const std::vector<TrianglePositions>& triangles,
+    uint32_t baseTriangleIndex, TaskScheduler* scheduler)
+{
+    if (rootIndex >= nodes.size())
+        return 0.0f;
+
+    if (!scheduler)
+        scheduler = TaskScheduler::Get();
+
+    RefitContext ctx = { nodes, triangles, baseTriangleIndex, scheduler };
+    const double cost = RefitSubtree(ctx, rootIndex, 0);
+
+    const float rootArea = SurfaceArea(nodes[rootIndex].aabbMin, nodes[rootIndex].aabbMax);
+    return rootArea > 0.0f ? static_cast<float>(cost / rootArea) : 0.0f;
+}
+
+void BVHBuilder::ReleaseThreadScratch()
+{
+    if (t_buildScratch && !t_buildScratch->inUse)
+    {
+        t_buildScratch.reset();
+    }
+}
+
+void BVHBuilder::SetBinningKernel(BinningKernel kernel)
+{
+    s_requestedKernel.store(kernel);
+}
+
+uint32_t BVHBuilder::ComputeDepth(const std::vector<BVHNode>& nodes)
+{
+    if (nodes.empty())
+        return 0;
+
+    uint32_t depth = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0u, 1u } }; // Node, level
+    while (!stack.empty())
+    {
+        const uint32_t nodeIndex = stack.back().first;
+        const uint32_t level = stack.back().second;
+        stack.pop_back();
+        depth = (std::max)(depth, level);
+
+        const BVHNode& node = nodes[nodeIndex];
+        if (node.triangleCount == 0)
+        {
+            stack.push_back({ static_cast<uint32_t>(node.leftChildOrFirstTriangleIndex), level + 1 });
+            stack.push_back({ static_cast<uint32_t>(node.leftChildOrFirstTriangleIndex) + 1, level + 1 });
+        }
+    }
+    return depth;
+}
+
+void BVHBuilder::Build(std::vector<Triangle>& triangles, std::vector<BVHNode>& outBvhNodes, uint32_t baseTriangleIndex, TaskScheduler* scheduler)
+{
+    Build(triangles, outBvhNodes, baseTriangleIndex, BVHBuildSettings(), scheduler);
+}
+
+void BVHBuilder::Build(std::vector<Triangle>& triangles, std::vector<BVHNode>& outBvhNodes, uint32_t baseTriangleIndex,
+    const BVHBuildSettings& settings, TaskScheduler* scheduler, std::vector<uint32_t>* outSourceIndices)
+{
+    outBvhNodes.clear();
+    if (outSourceIndices)
+        outSourceIndices->clear();
+    if (triangles.empty())
+        return;
+
+    if (!scheduler)
+        scheduler = TaskScheduler::Get();
+
+    if (settings.Mode == BVHBuildMode::SpatialSplits)
+    {
+        BuildSpatialSplits(triangles, outBvhNodes, baseTriangleIndex, settings, scheduler, outSourceIndices);
+        return;
+    }
+
+    const uint32_t primitiveCount = static_cast<uint32_t>(triangles.size());
+    ScratchLease scratch;
+    TaskGroup subtreeTasks(scheduler);
+    BuildContext ctx(scratch.Get(), scheduler, &subtreeTasks, SelectKernels());
+    ctx.maxLeafSize = (std::max)(settings.MaxLeafSize, 1u);
+
+    // 1. Gather centroids and bounds into SoA arrays and start from the identity permutation
+    InitializeBuild(ctx, triangles);
+
+    // 2. Build the temporary tree in parallel
+    BuildNodeArena& rootArena = ctx.NewArena();
+    BuildNode& root = rootArena.emplace_back();
+    root.startIndex = 0;
+    root.count = primitiveCount;
+    ComputeNodeBounds(ctx, root, rootArena.blocks());
+
+    if (settings.Mode == BVHBuildMode::Linear)
+    {
+        BuildLinear(ctx, root, settings);
+    }
+    else
+    {
+        SubdivideBuildNode(ctx, root, 0, rootArena);
+        subtreeTasks.Wait();
+    }
 
-    outBvhNodes.resize(nodesUsed);
+    // 3. Flatten it into the final node array and reorder the triangles to match
+    FinishBuild(ctx, root, triangles, outBvhNodes, baseTriangleIndex, outSourceIndices);
 }
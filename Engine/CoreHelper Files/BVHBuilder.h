@@ -3,9 +3,86 @@
 #include <vector>
 #include "Mesh.h"
 
+class TaskScheduler;
+
+enum class BVHBuildMode
+{
+    BinnedSAH,      // Object splits only; every triangle is referenced by exactly one leaf
+    SpatialSplits,  // SBVH: also splits space, duplicating triangles that straddle the split plane
+    Linear          // LBVH/HLBVH: Morton-order build for fast rebuilds; lower trace quality
+};
+
+struct BVHBuildSettings
+{
+    BVHBuildMode Mode = BVHBuildMode::BinnedSAH;
+
+    // Nodes with at most this many triangles become leaves. Match it to the CPU triangle block width
+    // (AccelerationStructureManager::SetCpuTriangleBlockWidth) so that every leaf is tested as a single block.
+    uint32_t MaxLeafSize = 4;
+
+    // SBVH only. Extra triangle references allowed, as a fraction of the input triangle count
+    // (0.3 = the triangle array may grow by up to 30%).
+    float SpatialSplitBudget = 0.3f;
+
+    // SBVH only. Spatial splits are only evaluated when the children of the best object split overlap by
+    // more than this fraction of the root's surface area (alpha in Stich et al. 2009).
+    float SpatialSplitOverlapThreshold = 1e-5f;
+
+    // Linear only. Morton code length: 30 (10 bits per axis) or 63 (21 bits per axis, for large or very unevenly
+    // distributed meshes where 1024 cells per axis leave many primitives with identical codes).
+    uint32_t MortonCodeBits = 30;
+
+    // Linear only. 0 = plain LBVH. Otherwise primitives sharing this many leading Morton bits form a cluster; the
+    // clusters are built linearly and the levels above them with binned SAH (HLBVH). 15 with 30-bit codes gives
+    // 32 cells per axis. Clusters too many and too large to fit within BVHBuilder::MAX_DEPTH get a plain LBVH.
+    uint32_t SAHTopLevelBits = 0;
+};
+
 namespace BVHBuilder
 {
-    void Build(std::vector<Triangle>& triangles, std::vector<BVHNode>& outBvhNodes, uint32_t baseTriangleIndex);
+    // Most levels any builder produces (a lone root is one level, as in BLASStats::maxDepth). Traversing a tree of
+    // n levels takes at most n stack entries, and the smallest traversal stack is the GPU's (TraverseBLAS in
+    // RayTracerCS.hlsl, 32 entries); the CPU stacks hold 64. Near the limit every builder switches to median splits,
+    // which reach leaves of MaxLeafSize in the fewest levels.
+    const uint32_t MAX_DEPTH = 32;
+
+    // Levels of the tree rooted at nodes[0]; child indices local to the array, as returned by Build.
+    uint32_t ComputeDepth(const std::vector<BVHNode>& nodes);
+
+    // Parallel binned SAH build. The node layout and triangle order are identical for any thread count.
+    // scheduler: pool to run on (nullptr = the shared TaskScheduler::Get()).
+    void Build(std::vector<Triangle>& triangles, std::vector<BVHNode>& outBvhNodes, uint32_t baseTriangleIndex, TaskScheduler* scheduler = nullptr);
+
+    // As above, with an explicit build mode. In SpatialSplits mode, triangles referenced by several leaves
+    // are duplicated in the output, so triangles.size() can grow (within SpatialSplitBudget); leaves still
+    // address a contiguous triangle range, so BaseTriangleIndex and the uber buffers work unchanged.
+    // outSourceIndices (optional) receives, for every output triangle, its index in the input array.
+    void Build(std::vector<Triangle>& triangles, std::vector<BVHNode>& outBvhNodes, uint32_t baseTriangleIndex,
+        const BVHBuildSettings& settings, TaskScheduler* scheduler = nullptr, std::vector<uint32_t>* outSourceIndices = nullptr);
+
+    // Recomputes the bounds of the tree rooted at nodes[rootIndex] from moved triangles, keeping the topology.
+    // Leaf triangle indices are relative to baseTriangleIndex and child indices absolute, as in the uber BLAS
+    // array. Sibling subtrees are refit in parallel. Returns the SAH cost of the refit tree (same cost model as
+    // BVHOptimizer::ComputeSAHCost), so callers can compare it with the cost after the build.
+    float Refit(std::vector<BVHNode>& nodes, uint32_t rootIndex, const std::vector<TrianglePositions>& triangles,
+        uint32_t baseTriangleIndex, TaskScheduler* scheduler = nullptr);
+
+    // The binned SAH and linear builders keep their temporaries per thread between builds, so repeated builds of
+    // similar size allocate nothing once warmed up. Frees the calling thread's copy (the largest build's worth).
+    void ReleaseThreadScratch();
+
+    // Instruction set used for SAH binning. Auto picks the best one the CPU supports; requesting an
+    // unsupported level falls back to the next lower one. All kernels build bit-identical trees.
+    enum class BinningKernel
+    {
+        Auto,
+        Scalar,
+        SSE4,
+        AVX2
+    };
+
+    // Applies to builds started after the call.
+    void SetBinningKernel(BinningKernel kernel);
 }
 struct Bin
 {
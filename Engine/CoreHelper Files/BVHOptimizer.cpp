@@ -0,0 +1,291 @@
+#include "BVHOptimizer.h"
+#include "BVHBuilder.h"
+#include "TaskScheduler.h"
+#include "../RenderEngine Files/Timer.h"
+#include <algorithm>
+#include <atomic>
+
+namespace
+{
+    const uint32_t MAX_TREELET_SIZE = 7;
+    const uint32_t MAX_TREELET_SUBSETS = 1u << MAX_TREELET_SIZE;
+
+    // Subtrees closer to the root than this are optimized as separate tasks.
+    const uint32_t TASK_DEPTH = 10;
+
+    inline float NodeSurfaceArea(const DirectX::XMFLOAT3& aabbMin, const DirectX::XMFLOAT3& aabbMax)
+    {
+        float ex = aabbMax.x - aabbMin.x;
+        float ey = aabbMax.y - aabbMin.y;
+        float ez = aabbMax.z - aabbMin.z;
+        return 2.0f * (ex * ey + ex * ez + ey * ez);
+    }
+
+    struct OptimizeContext
+    {
+        std::vector<BVHNode>& nodes;
+        TaskScheduler* scheduler;
+        uint32_t treeletSize;
+        std::vector<uint8_t> heights; // Levels of the subtree in every node slot, refreshed bottom-up by each pass
+        std::atomic<uint32_t> restructuredCount{ 0 };
+
+        OptimizeContext(std::vector<BVHNode>& bvhNodes, TaskScheduler* taskScheduler, uint32_t size)
+            : nodes(bvhNodes), scheduler(taskScheduler), treeletSize(size), heights(bvhNodes.size(), 1) {}
+    };
+
+    // Per-treelet scratch; small enough to live on the stack.
+    struct Treelet
+    {
+        uint32_t leafCount = 0;
+        uint32_t leafSlots[MAX_TREELET_SIZE];
+        BVHNode leafNodes[MAX_TREELET_SIZE];
+        uint8_t leafHeights[MAX_TREELET_SIZE];
+
+        uint32_t internalCount = 0;
+        uint32_t pairSlots[MAX_TREELET_SIZE - 1]; // First index of each internal node's child pair
+
+        DirectX::XMFLOAT3 subsetMin[MAX_TREELET_SUBSETS];
+        DirectX::XMFLOAT3 subsetMax[MAX_TREELET_SUBSETS];
+        float subsetCost[MAX_TREELET_SUBSETS];
+        uint8_t subsetPartition[MAX_TREELET_SUBSETS];
+        uint8_t subsetHeight[MAX_TREELET_SUBSETS];
+
+        uint32_t nextPair = 0;
+    };
+
+    // Writes the optimal topology for a subset of the treelet leaves into slot, taking child pairs in DFS order.
+    void EmitTreelet(OptimizeContext& ctx, Treelet& treelet, uint32_t subset, uint32_t slot)
+    {
+        if ((subset & (subset - 1)) == 0)
+        {
+            uint32_t leaf = 0;
+            while (!(subset & (1u << leaf))) ++leaf;
+            ctx.nodes[slot] = treelet.leafNodes[leaf];
+            ctx.heights[slot] = treelet.leafHeights[leaf];
+            return;
+        }
+
+        const uint32_t pair = treelet.pairSlots[treelet.nextPair++];
+        BVHNode& node = ctx.nodes[slot];
+        node.aabbMin = treelet.subsetMin[subset];
+        node.aabbMax = treelet.subsetMax[subset];
+        node.leftChildOrFirstTriangleIndex = static_cast<int>(pair);
+        node.triangleCount = 0;
+        ctx.heights[slot] = treelet.subsetHeight[subset];
+
+        const uint32_t left = treelet.subsetPartition[subset];
+        EmitTreelet(ctx, treelet, left, pair);
+        EmitTreelet(ctx, treelet, subset ^ left, pair + 1);
+    }
+
+    // depth: of the treelet root (root of the tree = 0). A topology that would take the tree past
+    // BVHBuilder::MAX_DEPTH is not used, so the optimizer never deepens a tree beyond what traversal supports.
+    void RestructureTreelet(OptimizeContext& ctx, uint32_t rootIndex, uint32_t depth)
+    {
+        std::vector<BVHNode>& nodes = ctx.nodes;
+        Treelet treelet;
+
+        // 1. Grow the treelet from the root's children by repeatedly opening the leaf with the largest surface area.
+        //    The summed area of the opened (internal) nodes is the cost of the current topology.
+        float currentCost = NodeSurfaceArea(nodes[rootIndex].aabbMin, nodes[rootIndex].aabbMax);
+        uint32_t rootPair = static_cast<uint32_t>(nodes[rootIndex].leftChildOrFirstTriangleIndex);
+        treelet.pairSlots[treelet.internalCount++] = rootPair;
+        treelet.leafSlots[treelet.leafCount++] = rootPair;
+        treelet.leafSlots[treelet.leafCount++] = rootPair + 1;
+
+        while (treelet.leafCount < ctx.treeletSize)
+        {
+            int largest = -1;
+            float largestArea = -1.0f;
+            for (uint32_t i = 0; i < treelet.leafCount; ++i)
+            {
+                const BVHNode& leaf = nodes[treelet.leafSlots[i]];
+                if (leaf.triangleCount > 0)
+                    continue;
+
+                float area = NodeSurfaceArea(leaf.aabbMin, leaf.aabbMax);
+                if (area > largestArea)
+                {
+                    largestArea = area;
+                    largest = static_cast<int>(i);
+                }
+            }
+            if (largest == -1)
+                break;
+
+            currentCost += largestArea;
+            uint32_t pair = static_cast<uint32_t>(nodes[treelet.leafSlots[largest]].leftChildOrFirstTriangleIndex);
+            treelet.pairSlots[treelet.internalCount++] = pair;
+            treelet.leafSlots[largest] = pair;
+            treelet.leafSlots[treelet.leafCount++] = pair + 1;
+        }
+
+        if (treelet.leafCount < 3)
+            return; // A root with two leaves has only one topology
+
+        // 2. Bounds and area of every subset of leaves
+        const uint32_t leafCount = treelet.leafCount;
+        const uint32_t fullSet = (1u << leafCount) - 1;
+        for (uint32_t i = 0; i < leafCount; ++i)
+        {
+            treelet.leafNodes[i] = nodes[treelet.leafSlots[i]];
+            treelet.leafHeights[i] = ctx.heights[treelet.leafSlots[i]];
+        }
+
+        treelet.subsetMin[0] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        treelet.subsetMax[0] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (uint32_t subset = 1; subset <= fullSet; ++subset)
+        {
+            uint32_t leaf = 0;
+            while (!(subset & (1u << leaf))) ++leaf;
+            const uint32_t rest = subset & (subset - 1);
+            const BVHNode& leafNode = treelet.leafNodes[leaf];
+
+            treelet.subsetMin[subset] = {
+                (std::min)(treelet.subsetMin[rest].x, leafNode.aabbMin.x),
+                (std::min)(treelet.subsetMin[rest].y, leafNode.aabbMin.y),
+                (std::min)(treelet.subsetMin[rest].z, leafNode.aabbMin.z) };
+            treelet.subsetMax[subset] = {
+                (std::max)(treelet.subsetMax[rest].x, leafNode.aabbMax.x),
+                (std::max)(treelet.subsetMax[rest].y, leafNode.aabbMax.y),
+                (std::max)(treelet.subsetMax[rest].z, leafNode.aabbMax.z) };
+        }
+
+        // 3. Dynamic programming over subsets. The subtrees below the treelet leaves are fixed, so the cost to
+        //    minimize is the summed area of the treelet's internal nodes. Submasks are numerically smaller than their
+        //    mask, so increasing order visits them first.
+        for (uint32_t subset = 1; subset <= fullSet; ++subset)
+        {
+            if ((subset & (subset - 1)) == 0)
+            {
+                uint32_t leaf = 0;
+                while (!(subset & (1u << leaf))) ++leaf;
+                treelet.subsetCost[subset] = 0.0f;
+                treelet.subsetHeight[subset] = treelet.leafHeights[leaf];
+                continue;
+            }
+
+            // Only partitions whose left side holds the lowest leaf, so each split is tried once
+            const uint32_t lowest = subset & (0u - subset);
+            const uint32_t rest = subset ^ lowest;
+            float bestCost = FLT_MAX;
+            uint32_t bestLeft = lowest;
+            for (uint32_t part = (rest - 1) & rest;; part = (part - 1) & rest)
+            {
+                const uint32_t left = part | lowest;
+                if (left != subset)
+                {
+                    float cost = treelet.subsetCost[left] + treelet.subsetCost[subset ^ left];
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestLeft = left;
+                    }
+                }
+                if (part == 0)
+                    break;
+            }
+
+            treelet.subsetCost[subset] = NodeSurfaceArea(treelet.subsetMin[subset], treelet.subsetMax[subset]) + bestCost;
+            treelet.subsetPartition[subset] = static_cast<uint8_t>(bestLeft);
+            treelet.subsetHeight[subset] = static_cast<uint8_t>(1 + (std::max)(treelet.subsetHeight[bestLeft], treelet.subsetHeight[subset ^ bestLeft]));
+        }
+
+        // 4. Replace the treelet only if that is a real improvement (ties would just shuffle nodes around) and keeps
+        //    the tree within the depth limit
+        if (treelet.subsetCost[fullSet] >= currentCost * 0.9999f || depth + treelet.subsetHeight[fullSet] > BVHBuilder::MAX_DEPTH)
+            return;
+
+        // Child pairs are handed out in ascending order so the rewritten treelet keeps the DFS-like layout
+        std::sort(treelet.pairSlots, treelet.pairSlots + treelet.internalCount);
+        treelet.nextPair = 0;
+        EmitTreelet(ctx, treelet, fullSet, rootIndex);
+        ctx.restructuredCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Post-order: both subtrees are finished before the treelet above them is formed. Sibling subtrees own disjoint
+    // node slots, so they can be processed concurrently.
+    void OptimizeSubtree(OptimizeContext& ctx, uint32_t nodeIndex, uint32_t depth)
+    {
+        if (ctx.nodes[nodeIndex].triangleCount > 0)
+        {
+            ctx.heights[nodeIndex] = 1;
+            return;
+        }
+
+        const uint32_t leftChild = static_cast<uint32_t>(ctx.nodes[nodeIndex].leftChildOrFirstTriangleIndex);
+        if (depth < TASK_DEPTH)
+        {
+            TaskGroup rightTask(ctx.scheduler);
+            rightTask.Run([&ctx, leftChild, depth] { OptimizeSubtree(ctx, leftChild + 1, depth + 1); });
+            OptimizeSubtree(ctx, leftChild, depth + 1);
+            rightTask.Wait();
+        }
+        else
+        {
+            OptimizeSubtree(ctx, leftChild, depth + 1);
+            OptimizeSubtree(ctx, leftChild + 1, depth + 1);
+        }
+
+        RestructureTreelet(ctx, nodeIndex, depth);
+
+        const uint32_t pair = static_cast<uint32_t>(ctx.nodes[nodeIndex].leftChildOrFirstTriangleIndex);
+        ctx.heights[nodeIndex] = static_cast<uint8_t>(1 + (std::max)(ctx.heights[pair], ctx.heights[pair + 1]));
+    }
+}
+
+float BVHOptimizer::ComputeSAHCost(const std::vector<BVHNode>& nodes)
+{
+    if (nodes.empty())
+        return 0.0f;
+
+    double cost = 0.0;
+    std::vector<uint32_t> stack = { 0 };
+    while (!stack.empty())
+    {
+        const BVHNode& node = nodes[stack.back()];
+        stack.pop_back();
+
+        float area = NodeSurfaceArea(node.aabbMin, node.aabbMax);
+        if (node.triangleCount > 0)
+        {
+            cost += (double)area * node.triangleCount;
+        }
+        else
+        {
+            cost += area;
+            stack.push_back(node.leftChildOrFirstTriangleIndex);
+            stack.push_back(node.leftChildOrFirstTriangleIndex + 1);
+        }
+    }
+
+    float rootArea = NodeSurfaceArea(nodes[0].aabbMin, nodes[0].aabbMax);
+    return rootArea > 0.0f ? static_cast<float>(cost / rootArea) : 0.0f;
+}
+
+BVHOptimizeStats BVHOptimizer::OptimizeTreelets(std::vector<BVHNode>& nodes, const BVHOptimizeSettings& settings, TaskScheduler* scheduler)
+{
+    BVHOptimizeStats stats;
+    stats.SAHCostBefore = ComputeSAHCost(nodes);
+    stats.SAHCostAfter = stats.SAHCostBefore;
+    if (nodes.size() < 5 || settings.TreeletPasses == 0)
+        return stats;
+
+    Timer timer;
+    if (!scheduler)
+        scheduler = TaskScheduler::Get();
+
+    OptimizeContext ctx(nodes, scheduler, std::clamp(settings.TreeletSize, 3u, MAX_TREELET_SIZE));
+    for (uint32_t pass = 0; pass < settings.TreeletPasses; ++pass)
+    {
+        uint32_t restructuredBefore = ctx.restructuredCount.load();
+        OptimizeSubtree(ctx, 0, 0);
+        if (ctx.restructuredCount.load() == restructuredBefore)
+            break; // Converged
+    }
+
+    stats.TreeletsRestructured = ctx.restructuredCount.load();
+    stats.SAHCostAfter = ComputeSAHCost(nodes);
+    stats.OptimizeTimeMs = timer.ElapsedMillis();
+    return stats;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include "Mesh.h"
+
+class TaskScheduler;
+
+struct BVHOptimizeSettings
+{
+    // Bottom-up restructuring passes over the tree; 0 disables the optimizer. Most of the gain comes from the first.
+    uint32_t TreeletPasses = 0;
+
+    // Leaves per treelet (3..7). The optimal topology is found exhaustively, so the cost grows as 3^n.
+    uint32_t TreeletSize = 7;
+};
+
+struct BVHOptimizeStats
+{
+    float SAHCostBefore = 0.0f;
+    float SAHCostAfter = 0.0f;
+    uint32_t TreeletsRestructured = 0;
+    float OptimizeTimeMs = 0.0f;
+};
+
+// Post-build BVH optimization by treelet restructuring (Karras and Aila, "Fast Parallel Construction of
+// High-Quality Bounding Volume Hierarchies", 2013). Works on a finished node array as produced by BVHBuilder:
+// the topology of small treelets is replaced by the SAH-optimal one, reusing the same node slots, so leaves keep
+// their triangle ranges and the array can go into the uber buffers unchanged.
+namespace BVHOptimizer
+{
+    // SAH cost of the tree rooted at nodes[0], relative to the root's surface area, with unit costs for a node
+    // visit and a triangle test (the same cost model the builders minimize).
+    float ComputeSAHCost(const std::vector<BVHNode>& nodes);
+
+    // Child indices must be local to the array (as returned by BVHBuilder::Build). Subtrees are optimized in
+    // parallel; the result is the same for any number of threads. Treelets are only restructured where the result
+    // stays within BVHBuilder::MAX_DEPTH levels.
+    BVHOptimizeStats OptimizeTreelets(std::vector<BVHNode>& nodes, const BVHOptimizeSettings& settings, TaskScheduler* scheduler = nullptr);
+}
@@ -47,6 +47,14 @@ public:
 		//RecalculateRayDirections();
 	}
 
+	void SetForwardDirection(const XMFLOAT3 &direction)
+	{
+		XMVECTOR forward = XMVector3Normalize(XMLoadFloat3(&direction));
+		XMStoreFloat3(&m_ForwardDirection, forward);
+		XMStoreFloat3(&m_RightDirection, XMVector3Normalize(XMVector3Cross(forward, XMVectorSet(0, 1, 0, 0))));
+		RecalculateView();
+	}
+
 
 	const std::vector<XMFLOAT3> &GetRayDirection() const { return m_RayDirections; }
 	
@@ -0,0 +1,119 @@
+#include "CompressedBVH.h"
+#include <cmath>
+
+namespace
+{
+    // Largest q in [0, 255] with nodeMin + q * scale <= value.
+    uint8_t QuantizeMin(float value, float nodeMin, float scale)
+    {
+        if (!(scale > 0.0f))
+            return 0;
+
+        int q = (std::min)((std::max)(static_cast<int>(floorf((value - nodeMin) / scale)), 0), 255);
+        while (q > 0 && nodeMin + static_cast<float>(q) * scale > value) --q;
+        return static_cast<uint8_t>(q);
+    }
+
+    // Smallest q in [0, 255] with nodeMax - (255 - q) * scale >= value.
+    uint8_t QuantizeMax(float value, float nodeMax, float scale)
+    {
+        if (!(scale > 0.0f))
+            return 255;
+
+        int steps = (std::min)((std::max)(static_cast<int>(floorf((nodeMax - value) / scale)), 0), 255);
+        while (steps > 0 && nodeMax - static_cast<float>(steps) * scale < value) --steps;
+        return static_cast<uint8_t>(255 - steps);
+    }
+
+    // Children are quantized against the node's decoded box, i.e. exactly what the traversal will reconstruct.
+    void QuantizeChildren(const std::vector<BVHNode>& binaryNodes, uint32_t left, const float nodeMin[3], const float nodeMax[3],
+        CompressedBVHNode& compressed)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const float scale = (nodeMax[axis] - nodeMin[axis]) / 255.0f;
+            for (int child = 0; child < 2; ++child)
+            {
+                const BVHNode& childNode = binaryNodes[left + child];
+                compressed.QuantizedMin[child][axis] = QuantizeMin((&childNode.aabbMin.x)[axis], nodeMin[axis], scale);
+                compressed.QuantizedMax[child][axis] = QuantizeMax((&childNode.aabbMax.x)[axis], nodeMax[axis], scale);
+            }
+        }
+    }
+
+    // Writes the node to outNodes[slot] and appends its child pair, depth-first.
+    void EncodeNode(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex, uint32_t slot,
+        const float nodeMin[3], const float nodeMax[3], std::vector<CompressedBVHNode>& outNodes)
+    {
+        const BVHNode& node = binaryNodes[binaryIndex];
+        CompressedBVHNode compressed = {};
+
+        if (node.triangleCount > 0)
+        {
+            uint32_t first = static_cast<uint32_t>(node.leftChildOrFirstTriangleIndex);
+            memcpy(compressed.QuantizedMin, &first, sizeof(first));
+            compressed.Data = CompressedBVHNode::LEAF_FLAG | static_cast<uint32_t>(node.triangleCount);
+            outNodes[slot] = compressed;
+            return;
+        }
+
+        // 1. Quantize both children on this node's grid
+        const uint32_t left = static_cast<uint32_t>(node.leftChildOrFirstTriangleIndex);
+        QuantizeChildren(binaryNodes, left, nodeMin, nodeMax, compressed);
+
+        // 2. Allocate the child pair and recurse with the decoded child boxes
+        const uint32_t pair = static_cast<uint32_t>(outNodes.size());
+        outNodes.resize(pair + 2);
+        compressed.Data = pair;
+        outNodes[slot] = compressed;
+
+        float childMin[2][3], childMax[2][3];
+        CompressedBVH::DecodeChildBounds(compressed, nodeMin, nodeMax, childMin, childMax);
+        EncodeNode(binaryNodes, left, pair, childMin[0], childMax[0], outNodes);
+        EncodeNode(binaryNodes, left + 1, pair + 1, childMin[1], childMax[1], outNodes);
+    }
+
+    // Same walk as EncodeNode over an already encoded tree: the topology (and so every index) is unchanged, only
+    // the child grids are recomputed from the binary bounds.
+    void RequantizeNode(const std::vector<BVHNode>& binaryNodes, uint32_t binaryIndex, std::vector<CompressedBVHNode>& nodes,
+        uint32_t index, const float nodeMin[3], const float nodeMax[3])
+    {
+        CompressedBVHNode& compressed = nodes[index];
+        if (compressed.IsLeaf())
+            return;
+
+        const uint32_t left = static_cast<uint32_t>(binaryNodes[binaryIndex].leftChildOrFirstTriangleIndex);
+        QuantizeChildren(binaryNodes, left, nodeMin, nodeMax, compressed);
+
+        float childMin[2][3], childMax[2][3];
+        CompressedBVH::DecodeChildBounds(compressed, nodeMin, nodeMax, childMin, childMax);
+        RequantizeNode(binaryNodes, left, nodes, compressed.GetFirstChild(), childMin[0], childMax[0]);
+        RequantizeNode(binaryNodes, left + 1, nodes, compressed.GetFirstChild() + 1, childMin[1], childMax[1]);
+    }
+}
+
+namespace CompressedBVH
+{
+    uint32_t Encode(const std::vector<BVHNode>& binaryNodes, uint32_t rootIndex, std::vector<CompressedBVHNode>& outNodes)
+    {
+        const uint32_t root = static_cast<uint32_t>(outNodes.size());
+        outNodes.resize(root + 1);
+
+        const BVHNode& rootNode = binaryNodes[rootIndex];
+        const float rootMin[3] = { rootNode.aabbMin.x, rootNode.aabbMin.y, rootNode.aabbMin.z };
+        const float rootMax[3] = { rootNode.aabbMax.x, rootNode.aabbMax.y, rootNode.aabbMax.z };
+        EncodeNode(binaryNodes, rootIndex, root, rootMin, rootMax, outNodes);
+        return root;
+    }
+
+    void Refit(const std::vector<BVHNode>& binaryNodes, uint32_t binaryRootIndex, std::vector<CompressedBVHNode>& nodes, uint32_t rootIndex)
+    {
+        if (rootIndex >= nodes.size())
+            return;
+
+        const BVHNode& rootNode = binaryNodes[binaryRootIndex];
+        const float rootMin[3] = { rootNode.aabbMin.x, rootNode.aabbMin.y, rootNode.aabbMin.z };
+        const float rootMax[3] = { rootNode.aabbMax.x, rootNode.aabbMax.y, rootNode.aabbMax.z };
+        RequantizeNode(binaryNodes, binaryRootIndex, nodes, rootIndex, rootMin, rootMax);
+    }
+}
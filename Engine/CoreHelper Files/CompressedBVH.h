@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "Mesh.h"
+#include "WideBVH.h"
+
+// 16-byte binary BVH node, half the size of BVHNode. An internal node stores the bounds of its two children
+// quantized to 8 bits on a grid spanning its own (decoded) box; the children sit next to each other, like in
+// BVHNode arrays. A leaf reuses the bound bytes for its first triangle index.
+// Boxes are decoded top-down from the root bounds, so traversal carries each node's box on its stack.
+struct alignas(16) CompressedBVHNode
+{
+    // Internal: [child][axis]. Min counts up from the node's min, max counts down from the node's max, so both
+    // grid ends decode exactly and a decoded child always contains the original one.
+    // Leaf: the first 4 bytes hold the first triangle index.
+    uint8_t QuantizedMin[2][3];
+    uint8_t QuantizedMax[2][3];
+
+    // Internal: index of the left child (the right child follows). Leaf: LEAF_FLAG | triangle count.
+    uint32_t Data;
+
+    static constexpr uint32_t LEAF_FLAG = 0x80000000u;
+
+    bool IsLeaf() const { return (Data & LEAF_FLAG) != 0; }
+    uint32_t GetFirstChild() const { return Data; }
+    uint32_t GetTriangleCount() const { return Data & ~LEAF_FLAG; }
+    uint32_t GetFirstTriangle() const
+    {
+        uint32_t first;
+        memcpy(&first, QuantizedMin, sizeof(first));
+        return first;
+    }
+};
+
+static_assert(sizeof(CompressedBVHNode) == 16, "CompressedBVHNode must stay 16 bytes");
+
+namespace CompressedBVH
+{
+    // Encodes the tree rooted at binaryNodes[rootIndex] (child indices absolute, as in the uber BLAS array) and
+    // appends it to outNodes in depth-first order. Returns the index of the root. The node count matches the binary
+    // tree; the root's own bounds are not stored and must be passed to Traverse.
+    uint32_t Encode(const std::vector<BVHNode>& binaryNodes, uint32_t rootIndex, std::vector<CompressedBVHNode>& outNodes);
+
+    // Re-encodes a tree produced by Encode in place after the binary tree it came from was refit (same topology,
+    // new bounds). The root's bounds must then be taken from the refit binary root.
+    void Refit(const std::vector<BVHNode>& binaryNodes, uint32_t binaryRootIndex, std::vector<CompressedBVHNode>& nodes, uint32_t rootIndex);
+
+    // Decodes the boxes of both children of an internal node from the node's own box.
+    // Same arithmetic as the encoder, which relies on it to round outwards.
+    inline void DecodeChildBounds(const CompressedBVHNode& node, const float nodeMin[3], const float nodeMax[3],
+        float outMin[2][3], float outMax[2][3])
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const float scale = (nodeMax[axis] - nodeMin[axis]) / 255.0f;
+            for (int child = 0; child < 2; ++child)
+            {
+                outMin[child][axis] = nodeMin[axis] + static_cast<float>(node.QuantizedMin[child][axis]) * scale;
+                outMax[child][axis] = nodeMax[axis] - static_cast<float>(255 - node.QuantizedMax[child][axis]) * scale;
+            }
+        }
+    }
+
+    // Closest-hit traversal, nearest child first. intersectLeaf(firstTriangle, triangleCount) must lower tMax
+    // when it finds a closer hit. Returns the number of nodes visited.
+    // With AnyHit (occlusion rays), intersectLeaf returns true on any hit below tMax, which ends the walk, and the
+    // children are pushed in stored order.
+    template <bool AnyHit = false, typename LeafFunction>
+    inline uint32_t Traverse(const CompressedBVHNode* nodes, uint32_t rootIndex, const DirectX::XMFLOAT3& rootMin,
+        const DirectX::XMFLOAT3& rootMax, const WideTraversalRay& ray, float& tMax, LeafFunction&& intersectLeaf)
+    {
+        const uint32_t MAX_STACK_DEPTH = 64;
+        struct StackEntry
+        {
+            float BoundsMin[3];
+            float BoundsMax[3];
+            uint32_t NodeIndex;
+            float Distance;
+        };
+
+        const float origin[3] = { ray.Origin.x, ray.Origin.y, ray.Origin.z };
+        const float invDirection[3] = { ray.InvDirection.x, ray.InvDirection.y, ray.InvDirection.z };
+        auto slabTest = [&](const float boundsMin[3], const float boundsMax[3], float& outDistance)
+        {
+            float tEnter = 0.0f, tExit = tMax;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                float t0 = (boundsMin[axis] - origin[axis]) * invDirection[axis];
+                float t1 = (boundsMax[axis] - origin[axis]) * invDirection[axis];
+                tEnter = (std::max)(tEnter, (std::min)(t0, t1));
+                tExit = (std::min)(tExit, (std::max)(t0, t1));
+            }
+            outDistance = tEnter;
+            return tEnter <= tExit;
+        };
+
+        StackEntry stack[MAX_STACK_DEPTH];
+        int stackPtr = 0;
+        StackEntry& root = stack[stackPtr++];
+        root = { { rootMin.x, rootMin.y, rootMin.z }, { rootMax.x, rootMax.y, rootMax.z }, rootIndex, 0.0f };
+        if (!slabTest(root.BoundsMin, root.BoundsMax, root.Distance))
+            return 0;
+
+        uint32_t nodesVisited = 0;
+        while (stackPtr > 0)
+        {
+            const StackEntry entry = stack[--stackPtr];
+            if (entry.Distance > tMax)
+                continue;
+
+            const CompressedBVHNode& node = nodes[entry.NodeIndex];
+            nodesVisited++;
+
+            if (node.IsLeaf())
+            {
+                if constexpr (AnyHit)
+                {
+                    if (intersectLeaf(node.GetFirstTriangle(), node.GetTriangleCount()))
+                        return nodesVisited;
+                }
+                else
+                {
+                    intersectLeaf(node.GetFirstTriangle(), node.GetTriangleCount());
+                }
+                continue;
+            }
+
+            StackEntry children[2];
+            float childMin[2][3], childMax[2][3];
+            DecodeChildBounds(node, entry.BoundsMin, entry.BoundsMax, childMin, childMax);
+
+            bool hit[2];
+            for (int child = 0; child < 2; ++child)
+            {
+                memcpy(children[child].BoundsMin, childMin[child], sizeof(childMin[child]));
+                memcpy(children[child].BoundsMax, childMax[child], sizeof(childMax[child]));
+                children[child].NodeIndex = node.GetFirstChild() + child;
+                hit[child] = slabTest(childMin[child], childMax[child], children[child].Distance);
+            }
+
+            // Push the farther child first so the closer one is processed next
+            if (hit[0] && hit[1] && stackPtr + 2 <= (int)MAX_STACK_DEPTH)
+            {
+                const int nearChild = (AnyHit || children[0].Distance <= children[1].Distance) ? 0 : 1;
+                stack[stackPtr++] = children[1 - nearChild];
+                stack[stackPtr++] = children[nearChild];
+            }
+            else if (hit[0] && stackPtr < (int)MAX_STACK_DEPTH)
+            {
+                stack[stackPtr++] = children[0];
+            }
+            else if (hit[1] && stackPtr < (int)MAX_STACK_DEPTH)
+            {
+                stack[stackPtr++] = children[1];
+            }
+        }
+        return nodesVisited;
+    }
+}
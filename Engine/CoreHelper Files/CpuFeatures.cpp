@@ -0,0 +1,38 @@
+#include "CpuFeatures.h"
+#include <intrin.h>
+
+static CpuFeatures DetectCpuFeatures()
+{
+    CpuFeatures features;
+
+    int info[4] = {};
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    if (maxLeaf < 1)
+        return features;
+
+    __cpuid(info, 1);
+    features.SSE41 = (info[2] & (1 << 19)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    const bool fma = (info[2] & (1 << 12)) != 0;
+
+    // AVX registers are only usable if the OS saves the YMM state on context switches.
+    const bool ymmStateEnabled = osxsave && ((_xgetbv(0) & 0x6) == 0x6);
+    features.AVX = avx && ymmStateEnabled;
+    features.FMA = fma && features.AVX;
+
+    if (maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        features.AVX2 = features.AVX && (info[1] & (1 << 5)) != 0;
+    }
+
+    return features;
+}
+
+const CpuFeatures& CpuFeatures::Get()
+{
+    static const CpuFeatures s_features = DetectCpuFeatures();
+    return s_features;
+}
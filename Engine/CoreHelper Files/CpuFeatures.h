@@ -0,0 +1,13 @@
+#pragma once
+
+// Instruction set extensions available on the running CPU (and enabled by the OS, for AVX state).
+// Used to pick SIMD kernels at runtime; the scalar paths are always available.
+struct CpuFeatures
+{
+    bool SSE41 = false;
+    bool AVX = false;
+    bool AVX2 = false;
+    bool FMA = false;
+
+    static const CpuFeatures& Get();
+};
@@ -0,0 +1,564 @@
+#include "CpuRayTracer.h"
+#include "AccelerationStructureManager.h"
+#include "RayQuery.h"
+#include "RayStream.h"
+#include "TaskScheduler.h"
+#include "../RenderEngine Files/Timer.h"
+#include <atomic>
+
+using namespace DirectX;
+
+struct CpuRayTracer::FrameContext
+{
+    RayQuery::Scene Scene;
+    const std::vector<Material>* Materials = nullptr;
+
+    XMFLOAT3 CameraPosition;
+    XMMATRIX InverseProjection;
+    XMMATRIX InverseView;
+
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint32_t TilesX = 0;
+    uint32_t FrameIndex = 0;
+
+    XMFLOAT4* Accumulation = nullptr;
+    uint32_t* Pixels = nullptr;
+};
+
+// Per-thread scratch of RenderTileSorted: the paths of one tile that are still going, and their rays in SoA form.
+struct CpuRayTracer::PathQueue
+{
+    struct Path
+    {
+        Ray CurrentRay;
+        XMFLOAT3 Light;
+        XMFLOAT3 Color;
+        uint32_t Pixel; // Index within the tile
+    };
+
+    std::vector<Path> Paths;
+    std::vector<RayHit> Hits;
+    std::vector<float> OriginX, OriginY, OriginZ;
+    std::vector<float> DirectionX, DirectionY, DirectionZ;
+    std::vector<uint8_t> Masks;
+
+    std::vector<uint32_t> Seeds;
+    std::vector<XMFLOAT3> TotalColors;
+};
+
+namespace
+{
+    const float PI = 3.1415926535f;
+
+    // =========================================================================
+    // UTILITY AND PHYSICS FUNCTIONS (mirrors RayTracerCS.hlsl)
+    // =========================================================================
+
+    float PCG_RandomFloat(uint32_t& seed)
+    {
+        seed = seed * 747796405u + 2891336453u;
+        uint32_t word = ((seed >> ((seed >> 28u) + 4u)) ^ seed) * 277803737u;
+        word = (word >> 22u) ^ word;
+        return (float)word / 4294967295.0f;
+    }
+
+    XMVECTOR PCG_InUnitSphere(uint32_t& seed)
+    {
+        float z = PCG_RandomFloat(seed) * 2.0f - 1.0f;
+        float a = PCG_RandomFloat(seed) * 2.0f * PI;
+        float r = sqrtf(1.0f - z * z);
+        return XMVectorSet(r * cosf(a), r * sinf(a), z, 0.0f);
+    }
+
+    XMVECTOR PCG_InHemisphere(FXMVECTOR normal, uint32_t& seed)
+    {
+        XMVECTOR p = PCG_InUnitSphere(seed);
+        if (XMVectorGetX(XMVector3Dot(p, normal)) < 0.0f)
+        {
+            p = XMVectorNegate(p);
+        }
+        return p;
+    }
+
+    XMVECTOR Reflect(FXMVECTOR incident, FXMVECTOR normal)
+    {
+        return XMVectorSubtract(incident, XMVectorScale(normal, 2.0f * XMVectorGetX(XMVector3Dot(incident, normal))));
+    }
+
+    XMVECTOR Refract(FXMVECTOR incident, FXMVECTOR normal, float iorRatio)
+    {
+        float cosTheta = fminf(XMVectorGetX(XMVector3Dot(XMVectorNegate(incident), normal)), 1.0f);
+        XMVECTOR rOutPerp = XMVectorScale(XMVectorAdd(incident, XMVectorScale(normal, cosTheta)), iorRatio);
+        XMVECTOR rOutParallel = XMVectorScale(normal, -sqrtf(fabsf(1.0f - XMVectorGetX(XMVector3Dot(rOutPerp, rOutPerp)))));
+        return XMVectorAdd(rOutPerp, rOutParallel);
+    }
+
+    float SchlickReflectance(float cosine, float iorRatio)
+    {
+        float r0 = (1.0f - iorRatio) / (1.0f + iorRatio);
+        r0 = r0 * r0;
+        return r0 + (1.0f - r0) * powf(1.0f - cosine, 5.0f);
+    }
+
+    bool RussianRoulette(XMVECTOR& rayColor, uint32_t& seed)
+    {
+        float p = fmaxf(XMVectorGetX(rayColor), fmaxf(XMVectorGetY(rayColor), XMVectorGetZ(rayColor)));
+        if (PCG_RandomFloat(seed) > p && p < 1.0f)
+        {
+            return true;
+        }
+        rayColor = XMVectorScale(rayColor, 1.0f / p);
+        return false;
+    }
+
+    float ACESFilm(float x)
+    {
+        const float a = 2.51f, b = 0.03f, c = 2.43f, d = 0.59f, e = 0.14f;
+        float v = (x * (a * x + b)) / (x * (c * x + d) + e);
+        return fminf(fmaxf(v, 0.0f), 1.0f);
+    }
+
+    float LinearToSRGB(float c)
+    {
+        c = fminf(fmaxf(c, 0.0f), 1.0f);
+        return (c < 0.0031308f) ? c * 12.92f : powf(c, 1.0f / 2.4f) * 1.055f - 0.055f;
+    }
+
+    // =========================================================================
+    // MATERIAL HANDLING
+    // =========================================================================
+
+    void HandleOpaqueMaterial(Ray& ray, XMVECTOR& rayColor, const Material& material, FXMVECTOR baseColor, float metallic, float roughness, FXMVECTOR normal, uint32_t& seed)
+    {
+        XMVECTOR direction = XMLoadFloat3(&ray.Direction);
+
+        // --- Metal ---
+        if (PCG_RandomFloat(seed) < metallic)
+        {
+            XMVECTOR specularDir = Reflect(direction, normal);
+            XMStoreFloat3(&ray.Direction, XMVector3Normalize(XMVectorAdd(specularDir, XMVectorScale(PCG_InUnitSphere(seed), roughness * roughness))));
+            rayColor = XMVectorMultiply(rayColor, baseColor);
+            return;
+        }
+
+        // --- Dielectric (Plastic, Wood, etc.) ---
+        float cosTheta = fminf(XMVectorGetX(XMVector3Dot(XMVectorNegate(direction), normal)), 1.0f);
+        float iorRatio = 1.0f / material.IOR;
+        float reflectance = SchlickReflectance(cosTheta, iorRatio);
+
+        if (PCG_RandomFloat(seed) < reflectance) // Specular reflection
+        {
+            XMVECTOR specularDir = Reflect(direction, normal);
+            XMStoreFloat3(&ray.Direction, XMVector3Normalize(XMVectorAdd(specularDir, XMVectorScale(PCG_InUnitSphere(seed), roughness * roughness))));
+        }
+        else // Diffuse reflection
+        {
+            XMStoreFloat3(&ray.Direction, XMVector3Normalize(PCG_InHemisphere(normal, seed)));
+            rayColor = XMVectorMultiply(rayColor, baseColor);
+        }
+    }
+
+    void HandleDielectricMaterial(Ray& ray, XMVECTOR& rayColor, const Material& material, FXMVECTOR baseColor, float roughness, bool frontFace, FXMVECTOR normal, uint32_t& seed)
+    {
+        XMVECTOR direction = XMLoadFloat3(&ray.Direction);
+
+        float iorRatio = frontFace ? (1.0f / material.IOR) : material.IOR;
+        float cosTheta = fminf(XMVectorGetX(XMVector3Dot(XMVectorNegate(direction), normal)), 1.0f);
+        float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+
+        bool cannotRefract = iorRatio * sinTheta > 1.0f;
+        float reflectance = SchlickReflectance(cosTheta, iorRatio);
+
+        if (cannotRefract || PCG_RandomFloat(seed) < reflectance)
+        {
+            direction = Reflect(direction, normal);
+        }
+        else
+        {
+            direction = Refract(direction, normal, iorRatio);
+            rayColor = XMVectorMultiply(rayColor, baseColor);
+        }
+
+        // Use 'roughness' for a frosted glass effect
+        XMStoreFloat3(&ray.Direction, XMVector3Normalize(XMVectorAdd(direction, XMVectorScale(PCG_InUnitSphere(seed), roughness * roughness))));
+    }
+}
+
+bool CpuRayTracer::ShadeBounce(const FrameContext& frame, Ray& ray, const RayHit& hitData, uint32_t bounce,
+    XMVECTOR& light, XMVECTOR& rayColor, uint32_t& seed) const
+{
+    static const Material s_defaultMaterial = {};
+
+    if (hitData.PrimitiveIndex == -1)
+    {
+        if (m_settings.UseEnvironment)
+        {
+            light = XMVectorAdd(light, XMVectorMultiply(XMLoadFloat3(&m_settings.EnvironmentColor), rayColor));
+        }
+        return false;
+    }
+
+    const TriangleAttributes& hitTriangle = (*frame.Scene.Attributes)[hitData.PrimitiveIndex];
+    const ModelInstanceGPUData& inst = (*frame.Scene.Instances)[hitData.InstanceIndex];
+    size_t materialIndex = (size_t)inst.MaterialOffset + (size_t)hitTriangle.MaterialIndex;
+    const Material& material = materialIndex < frame.Materials->size() ? (*frame.Materials)[materialIndex] : s_defaultMaterial;
+
+    // Texture sampling is GPU-only; the CPU path uses the material factors.
+    XMVECTOR baseColor = XMLoadFloat4(&material.BaseColorFactor);
+    float metallic = material.MetallicFactor;
+    float roughness = material.RoughnessFactor;
+    XMVECTOR emissive = XMLoadFloat3(&material.EmissiveFactor);
+
+    light = XMVectorAdd(light, XMVectorMultiply(emissive, rayColor));
+
+    XMVECTOR hitNormal = XMLoadFloat3(&hitData.HitNormal);
+    bool frontFace = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&ray.Direction), hitNormal)) < 0.0f;
+    XMVECTOR normal = frontFace ? hitNormal : XMVectorNegate(hitNormal);
+
+    XMStoreFloat3(&ray.Origin, XMVectorAdd(XMLoadFloat3(&hitData.HitPosition), XMVectorScale(normal, 0.0001f)));
+
+    if (material.Transmission > 0.0f)
+    {
+        HandleDielectricMaterial(ray, rayColor, material, baseColor, roughness, frontFace, normal, seed);
+    }
+    else
+    {
+        HandleOpaqueMaterial(ray, rayColor, material, baseColor, metallic, roughness, normal, seed);
+    }
+
+    if (bounce > 2)
+    {
+        if (RussianRoulette(rayColor, seed))
+        {
+            return false; // Terminate ray
+        }
+    }
+    return true;
+}
+
+XMFLOAT3 CpuRayTracer::DispatchRay(const FrameContext& frame, Ray ray, uint32_t& seed, uint64_t& raysTraced, const RayHit* primaryHit) const
+{
+    XMVECTOR light = XMVectorZero();
+    XMVECTOR rayColor = XMVectorSet(1.0f, 1.0f, 1.0f, 0.0f);
+
+    for (uint32_t i = 0; i < m_settings.NumBounces; i++)
+    {
+        const uint8_t rayMask = i == 0 ? INSTANCE_MASK_CAMERA : INSTANCE_MASK_SECONDARY;
+        RayHit hitData = (i == 0 && primaryHit) ? *primaryHit : RayQuery::Intersect(frame.Scene, ray, FLT_MAX, rayMask);
+        raysTraced++;
+
+        if (!ShadeBounce(frame, ray, hitData, i, light, rayColor, seed))
+        {
+            break;
+        }
+    }
+
+    XMFLOAT3 result;
+    XMStoreFloat3(&result, light);
+    return result;
+}
+
+Ray CpuRayTracer::GenerateCameraRay(const FrameContext& frame, uint32_t x, uint32_t y, uint32_t& seed) const
+{
+    // Anti-aliasing jitter
+    float randomX = PCG_RandomFloat(seed);
+    float randomY = PCG_RandomFloat(seed);
+
+    float px = -(2.0f * (x + randomX) / frame.Width - 1.0f);
+    float py = -(2.0f * (y + randomY) / frame.Height - 1.0f);
+
+    XMVECTOR viewSpace = XMVector4Transform(XMVectorSet(px, py, 1.0f, 1.0f), frame.InverseProjection);
+    viewSpace = XMVectorScale(viewSpace, 1.0f / XMVectorGetW(viewSpace));
+    XMVECTOR worldDirection = XMVector3TransformNormal(viewSpace, frame.InverseView);
+
+    Ray ray;
+    ray.Origin = frame.CameraPosition;
+    XMStoreFloat3(&ray.Direction, XMVector3Normalize(worldDirection));
+    return ray;
+}
+
+void CpuRayTracer::AccumulatePixel(const FrameContext& frame, uint32_t x, uint32_t y, FXMVECTOR totalColor) const
+{
+    const uint32_t raysPerPixel = (std::max)(m_settings.NumRaysPerPixel, 1u);
+
+    XMFLOAT4& accumulated = frame.Accumulation[y * frame.Width + x];
+    if (frame.FrameIndex == 0)
+        accumulated = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+
+    XMFLOAT3 sample;
+    XMStoreFloat3(&sample, XMVectorScale(totalColor, 1.0f / raysPerPixel));
+    accumulated.x += sample.x;
+    accumulated.y += sample.y;
+    accumulated.z += sample.z;
+    accumulated.w += 1.0f;
+
+    float scale = m_settings.Exposure / accumulated.w;
+    uint32_t r = (uint32_t)(LinearToSRGB(ACESFilm(accumulated.x * scale)) * 255.0f + 0.5f);
+    uint32_t g = (uint32_t)(LinearToSRGB(ACESFilm(accumulated.y * scale)) * 255.0f + 0.5f);
+    uint32_t b = (uint32_t)(LinearToSRGB(ACESFilm(accumulated.z * scale)) * 255.0f + 0.5f);
+    frame.Pixels[y * frame.Width + x] = r | (g << 8) | (b << 16) | (255u << 24);
+}
+
+void CpuRayTracer::RenderTile(const FrameContext& frame, uint32_t tileIndex, uint64_t& raysTraced) const
+{
+    const uint32_t tileSize = m_settings.TileSize;
+    const uint32_t x0 = (tileIndex % frame.TilesX) * tileSize;
+    const uint32_t y0 = (tileIndex / frame.TilesX) * tileSize;
+    const uint32_t x1 = (std::min)(x0 + tileSize, frame.Width);
+    const uint32_t y1 = (std::min)(y0 + tileSize, frame.Height);
+    const uint32_t raysPerPixel = (std::max)(m_settings.NumRaysPerPixel, 1u);
+
+    // Camera rays of a block of pixels are traced as one packet
+    uint32_t blockWidth = 1, blockHeight = 1;
+    switch (m_settings.PacketSize)
+    {
+    case 4: blockWidth = 2; blockHeight = 2; break;
+    case 8: blockWidth = 4; blockHeight = 2; break;
+    case 16: blockWidth = 4; blockHeight = 4; break;
+    default: break;
+    }
+
+    for (uint32_t by = y0; by < y1; by += blockHeight)
+    {
+        for (uint32_t bx = x0; bx < x1; bx += blockWidth)
+        {
+            const uint32_t width = (std::min)(blockWidth, x1 - bx);
+            const uint32_t pixelCount = width * (std::min)(blockHeight, y1 - by);
+
+            uint32_t seeds[RayQuery::MAX_PACKET_SIZE];
+            XMVECTOR totalColors[RayQuery::MAX_PACKET_SIZE];
+            Ray rays[RayQuery::MAX_PACKET_SIZE];
+            RayHit primaryHits[RayQuery::MAX_PACKET_SIZE];
+            for (uint32_t p = 0; p < pixelCount; ++p)
+            {
+                const uint32_t x = bx + p % width, y = by + p / width;
+                seeds[p] = x + y * frame.Width + frame.FrameIndex * (frame.Width * frame.Height);
+                totalColors[p] = XMVectorZero();
+            }
+
+            for (uint32_t rayIndex = 0; rayIndex < raysPerPixel; rayIndex++)
+            {
+                for (uint32_t p = 0; p < pixelCount; ++p)
+                {
+                    rays[p] = GenerateCameraRay(frame, bx + p % width, by + p / width, seeds[p]);
+                }
+
+                const bool usePacket = pixelCount > 1 && m_settings.NumBounces > 0;
+                if (usePacket)
+                {
+                    RayQuery::IntersectPacket(frame.Scene, rays, pixelCount, primaryHits, FLT_MAX, INSTANCE_MASK_CAMERA);
+                }
+
+                for (uint32_t p = 0; p < pixelCount; ++p)
+                {
+                    XMFLOAT3 color = DispatchRay(frame, rays[p], seeds[p], raysTraced, usePacket ? &primaryHits[p] : nullptr);
+                    totalColors[p] = XMVectorAdd(totalColors[p], XMLoadFloat3(&color));
+                }
+            }
+
+            for (uint32_t p = 0; p < pixelCount; ++p)
+            {
+                AccumulatePixel(frame, bx + p % width, by + p / width, totalColors[p]);
+            }
+        }
+    }
+}
+
+void CpuRayTracer::RenderTileSorted(const FrameContext& frame, uint32_t tileIndex, PathQueue& queue, uint64_t& raysTraced) const
+{
+    const uint32_t tileSize = m_settings.TileSize;
+    const uint32_t x0 = (tileIndex % frame.TilesX) * tileSize;
+    const uint32_t y0 = (tileIndex / frame.TilesX) * tileSize;
+    const uint32_t x1 = (std::min)(x0 + tileSize, frame.Width);
+    const uint32_t y1 = (std::min)(y0 + tileSize, frame.Height);
+    const uint32_t raysPerPixel = (std::max)(m_settings.NumRaysPerPixel, 1u);
+    const uint32_t tileWidth = x1 - x0;
+    const uint32_t pixelCount = tileWidth * (y1 - y0);
+    const uint32_t packetSize = (std::min)(m_settings.PacketSize, RayQuery::MAX_PACKET_SIZE);
+
+    queue.Seeds.resize(pixelCount);
+    queue.TotalColors.assign(pixelCount, XMFLOAT3(0.0f, 0.0f, 0.0f));
+    for (uint32_t p = 0; p < pixelCount; ++p)
+    {
+        const uint32_t x = x0 + p % tileWidth, y = y0 + p / tileWidth;
+        queue.Seeds[p] = x + y * frame.Width + frame.FrameIndex * (frame.Width * frame.Height);
+    }
+
+    // Each pixel's seed is only advanced by its own path, so the image matches RenderTile's.
+    for (uint32_t rayIndex = 0; rayIndex < raysPerPixel; rayIndex++)
+    {
+        // 1. One path per pixel, starting with its camera ray
+        queue.Paths.resize(pixelCount);
+        for (uint32_t p = 0; p < pixelCount; ++p)
+        {
+            PathQueue::Path& path = queue.Paths[p];
+            path.CurrentRay = GenerateCameraRay(frame, x0 + p % tileWidth, y0 + p / tileWidth, queue.Seeds[p]);
+            path.Light = XMFLOAT3(0.0f, 0.0f, 0.0f);
+            path.Color = XMFLOAT3(1.0f, 1.0f, 1.0f);
+            path.Pixel = p;
+        }
+
+        for (uint32_t bounce = 0; bounce < m_settings.NumBounces && !queue.Paths.empty(); ++bounce)
+        {
+            const uint32_t pathCount = (uint32_t)queue.Paths.size();
+            queue.Hits.resize(pathCount);
+
+            // 2. Trace the whole bounce. Camera rays are coherent in pixel order already (packets of consecutive
+            //    pixels of a row, if enabled); the scattered rays of later bounces are sorted first.
+            if (bounce == 0)
+            {
+                for (uint32_t first = 0; first < pathCount; first += (std::max)(packetSize, 1u))
+                {
+                    const uint32_t count = packetSize > 1 ? (std::min)(packetSize, pathCount - first) : 1;
+                    Ray rays[RayQuery::MAX_PACKET_SIZE];
+                    for (uint32_t i = 0; i < count; ++i)
+                    {
+                        rays[i] = queue.Paths[first + i].CurrentRay;
+                    }
+                    RayQuery::IntersectPacket(frame.Scene, rays, count, &queue.Hits[first], FLT_MAX, INSTANCE_MASK_CAMERA);
+                }
+            }
+            else
+            {
+                queue.OriginX.resize(pathCount);
+                queue.OriginY.resize(pathCount);
+                queue.OriginZ.resize(pathCount);
+                queue.DirectionX.resize(pathCount);
+                queue.DirectionY.resize(pathCount);
+                queue.DirectionZ.resize(pathCount);
+                queue.Masks.assign(pathCount, INSTANCE_MASK_SECONDARY);
+                for (uint32_t i = 0; i < pathCount; ++i)
+                {
+                    const Ray& ray = queue.Paths[i].CurrentRay;
+                    queue.OriginX[i] = ray.Origin.x;
+                    queue.OriginY[i] = ray.Origin.y;
+                    queue.OriginZ[i] = ray.Origin.z;
+                    queue.DirectionX[i] = ray.Direction.x;
+                    queue.DirectionY[i] = ray.Direction.y;
+                    queue.DirectionZ[i] = ray.Direction.z;
+                }
+
+                RayStreamBatch batch;
+                batch.OriginX = queue.OriginX.data();
+                batch.OriginY = queue.OriginY.data();
+                batch.OriginZ = queue.OriginZ.data();
+                batch.DirectionX = queue.DirectionX.data();
+                batch.DirectionY = queue.DirectionY.data();
+                batch.DirectionZ = queue.DirectionZ.data();
+                batch.Masks = queue.Masks.data();
+                batch.Count = pathCount;
+                RayStream::Trace(frame.Scene, batch, queue.Hits.data(), nullptr);
+            }
+            raysTraced += pathCount;
+
+            // 3. Shade every hit and keep the paths that go on, in their current order
+            uint32_t keptCount = 0;
+            for (uint32_t i = 0; i < pathCount; ++i)
+            {
+                PathQueue::Path& path = queue.Paths[i];
+                XMVECTOR light = XMLoadFloat3(&path.Light);
+                XMVECTOR rayColor = XMLoadFloat3(&path.Color);
+                const bool alive = ShadeBounce(frame, path.CurrentRay, queue.Hits[i], bounce, light, rayColor, queue.Seeds[path.Pixel]);
+                XMStoreFloat3(&path.Light, light);
+                XMStoreFloat3(&path.Color, rayColor);
+
+                if (alive)
+                {
+                    queue.Paths[keptCount++] = path;
+                }
+                else
+                {
+                    XMStoreFloat3(&queue.TotalColors[path.Pixel], XMVectorAdd(XMLoadFloat3(&queue.TotalColors[path.Pixel]), light));
+                }
+            }
+            queue.Paths.resize(keptCount);
+        }
+
+        // 4. Paths still going after the last bounce
+        for (const PathQueue::Path& path : queue.Paths)
+        {
+            XMStoreFloat3(&queue.TotalColors[path.Pixel], XMVectorAdd(XMLoadFloat3(&queue.TotalColors[path.Pixel]), XMLoadFloat3(&path.Light)));
+        }
+    }
+
+    for (uint32_t p = 0; p < pixelCount; ++p)
+    {
+        AccumulatePixel(frame, x0 + p % tileWidth, y0 + p / tileWidth, XMLoadFloat3(&queue.TotalColors[p]));
+    }
+}
+
+HRESULT CpuRayTracer::RenderFrame(const AccelerationStructureManager* accelManager, const std::vector<Material>& materials,
+    const Camera& camera, uint32_t frameIndex, Image* image)
+{
+    if (!accelManager || !image || !image->GetAccumulationBuffer() || !image->GetPixelBuffer() || m_settings.TileSize == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    FrameContext frame;
+    frame.Scene = RayQuery::GetScene(*accelManager);
+    frame.Materials = &materials;
+    frame.CameraPosition = camera.GetPosition3f();
+    frame.InverseProjection = camera.GetInverseProjection();
+    frame.InverseView = camera.GetInverseView();
+    frame.Width = image->GetWidth();
+    frame.Height = image->GetHeight();
+    frame.FrameIndex = frameIndex;
+    frame.Accumulation = image->GetAccumulationBuffer();
+    frame.Pixels = image->GetPixelBuffer();
+
+    const uint32_t tileSize = m_settings.TileSize;
+    frame.TilesX = (frame.Width + tileSize - 1) / tileSize;
+    const uint32_t tilesY = (frame.Height + tileSize - 1) / tileSize;
+    const uint32_t tileCount = frame.TilesX * tilesY;
+
+    TaskScheduler* scheduler = TaskScheduler::Get();
+    uint32_t threadCount = m_settings.ThreadCount ? m_settings.ThreadCount : scheduler->GetThreadCount();
+    threadCount = (std::max)(1u, (std::min)(threadCount, tileCount));
+
+    Timer timer;
+
+    // Tiles are handed out dynamically so that threads which drew cheap tiles pick up more work.
+    std::atomic<uint32_t> nextTile(0);
+    std::vector<uint64_t> raysPerThread(threadCount, 0);
+    auto worker = [&](uint32_t threadIndex)
+    {
+        uint64_t raysTraced = 0;
+        PathQueue queue;
+        for (uint32_t tile = nextTile.fetch_add(1); tile < tileCount; tile = nextTile.fetch_add(1))
+        {
+            if (m_settings.SortSecondaryRays)
+            {
+                RenderTileSorted(frame, tile, queue, raysTraced);
+            }
+            else
+            {
+                RenderTile(frame, tile, raysTraced);
+            }
+        }
+        raysPerThread[threadIndex] = raysTraced;
+    };
+
+    TaskGroup workers(scheduler);
+    for (uint32_t t = 1; t < threadCount; ++t)
+    {
+        workers.Run([&worker, t] { worker(t); });
+    }
+    worker(0);
+    workers.Wait();
+
+    m_lastFrameStats = {};
+    for (uint64_t rays : raysPerThread)
+    {
+        m_lastFrameStats.RaysTraced += rays;
+    }
+    m_lastFrameStats.TileCount = tileCount;
+    m_lastFrameStats.ThreadCount = threadCount;
+    m_lastFrameStats.RenderTimeMs = timer.ElapsedMillis();
+    m_lastFrameStats.MRaysPerSecond = m_lastFrameStats.RenderTimeMs > 0.0f
+        ? (float)(m_lastFrameStats.RaysTraced / (m_lastFrameStats.RenderTimeMs * 1000.0))
+        : 0.0f;
+
+    return S_OK;
+}
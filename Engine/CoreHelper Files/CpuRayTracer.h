@@ -0,0 +1,83 @@
+#pragma once
+
+#include "../RenderEngine Files/global.h"
+#include "Mesh.h"
+#include "Ray.h"
+#include "RayTracingStructs.h"
+#include "Camera.h"
+#include "Image.h"
+
+#include <vector>
+
+class AccelerationStructureManager;
+
+struct CpuRenderSettings
+{
+    uint32_t NumBounces = 10;
+    uint32_t NumRaysPerPixel = 1;
+    float Exposure = 0.5f;
+
+    // Textures and the environment map live on the GPU only, so a miss returns this color instead.
+    bool UseEnvironment = true;
+    DirectX::XMFLOAT3 EnvironmentColor = { 0.6f, 0.7f, 0.9f };
+
+    uint32_t TileSize = 16;
+    uint32_t ThreadCount = 0; // Tile workers on the shared TaskScheduler, 0 = one per pool thread
+
+    // Camera rays traced as packets of 4, 8 or 16 (blocks of 2x2, 4x2 or 4x4 pixels, see RayQuery::IntersectPacket),
+    // 0 = one by one. Bounces are always traced one by one. Packets walk the binary trees, so they gain most over the
+    // binary and compressed layouts.
+    uint32_t PacketSize = 0;
+
+    // Trace each tile one sample at a time, one bounce at a time: the rays that survive a bounce are queued and
+    // traced together through RayStream, which sorts them by direction octant and origin Morton code so that
+    // neighbouring rays walk the same BVH nodes. Camera rays keep their pixel order (and packets). The image is the
+    // same either way; larger tiles give the sort more rays to group.
+    bool SortSecondaryRays = false;
+};
+
+struct CpuRenderStats
+{
+    uint64_t RaysTraced = 0;
+    uint32_t TileCount = 0;
+    uint32_t ThreadCount = 0;
+    float RenderTimeMs = 0.0f;
+    float MRaysPerSecond = 0.0f;
+};
+
+// Multi-threaded CPU implementation of the path tracer in 03_ModelRayTracer/SceneOne/RayTracerCS.hlsl.
+// Traverses the CPU copies of the TLAS/BLAS/triangles held by the AccelerationStructureManager and
+// writes into the image's accumulation and pixel buffers. Needs no D3D12 device or window.
+// Camera rays see the instances with INSTANCE_MASK_CAMERA, bounce rays those with INSTANCE_MASK_SECONDARY.
+class CpuRayTracer
+{
+public:
+    CpuRayTracer() = default;
+
+    void SetSettings(const CpuRenderSettings& settings) { m_settings = settings; }
+    const CpuRenderSettings& GetSettings() const { return m_settings; }
+
+    // Renders one progressive frame. frameIndex 0 resets the accumulation buffer, like g_FrameIndex on the GPU.
+    HRESULT RenderFrame(const AccelerationStructureManager* accelManager, const std::vector<Material>& materials,
+        const Camera& camera, uint32_t frameIndex, Image* image);
+
+    const CpuRenderStats& GetLastFrameStats() const { return m_lastFrameStats; }
+
+private:
+    struct FrameContext;
+    struct PathQueue;
+
+    void RenderTile(const FrameContext& frame, uint32_t tileIndex, uint64_t& raysTraced) const;
+    void RenderTileSorted(const FrameContext& frame, uint32_t tileIndex, PathQueue& queue, uint64_t& raysTraced) const;
+    // primaryHit, if given, is the packet-traced hit of the camera ray, used for the first bounce.
+    DirectX::XMFLOAT3 DispatchRay(const FrameContext& frame, Ray ray, uint32_t& seed, uint64_t& raysTraced, const RayHit* primaryHit = nullptr) const;
+    // Adds the light of bounce number bounce (the environment for a miss) to the path and scatters ray off the hit.
+    // Returns false once the path ends.
+    bool ShadeBounce(const FrameContext& frame, Ray& ray, const RayHit& hitData, uint32_t bounce,
+        DirectX::XMVECTOR& light, DirectX::XMVECTOR& rayColor, uint32_t& seed) const;
+    Ray GenerateCameraRay(const FrameContext& frame, uint32_t x, uint32_t y, uint32_t& seed) const;
+    void AccumulatePixel(const FrameContext& frame, uint32_t x, uint32_t y, DirectX::FXMVECTOR totalColor) const;
+
+    CpuRenderSettings m_settings;
+    CpuRenderStats m_lastFrameStats;
+};
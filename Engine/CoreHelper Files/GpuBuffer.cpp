@@ -85,4 +85,23 @@ void ResizableBuffer::update(ID3D12GraphicsCommandList* cmdList, const void* dat
         0,
         sizeInBytes
     );
-}
\ No newline at end of file
+}
+
+void ResizableBuffer::UpdateRange(RenderEngine* renderEngine, ID3D12GraphicsCommandList* cmdList, const void* cpuData, UINT firstElement, UINT elementCount)
+{
+    if (!Resource || !Uploader || elementCount == 0 || firstElement + elementCount > Size) return;
+
+    const UINT offsetInBytes = firstElement * Stride;
+    const UINT sizeInBytes = elementCount * Stride;
+
+    // Map, copy the range to the same offset, unmap
+    void* pMappedData = nullptr;
+    D3D12_RANGE readRange = { 0, 0 };
+    Uploader->Map(0, &readRange, &pMappedData);
+    memcpy(static_cast<uint8_t*>(pMappedData) + offsetInBytes, static_cast<const uint8_t*>(cpuData) + offsetInBytes, sizeInBytes);
+    Uploader->Unmap(0, nullptr);
+
+    renderEngine->TransitionResource(cmdList, Resource.Get(), D3D12_RESOURCE_STATE_COPY_DEST);
+    cmdList->CopyBufferRegion(Resource.Get(), offsetInBytes, Uploader.Get(), offsetInBytes, sizeInBytes);
+    renderEngine->TransitionResource(cmdList, Resource.Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+}
@@ -17,4 +17,8 @@ struct ResizableBuffer
     void Sync(RenderEngine* renderEngine, ID3D12GraphicsCommandList* cmdList, const void* cpuData, UINT newElementCount);
 
     void update(ID3D12GraphicsCommandList* cmdList, const void* dataToUpload, UINT sizeInBytes, UINT destOffsetInBytes = 0);
+
+    // Re-uploads elements [firstElement, firstElement + elementCount) of cpuData (the whole CPU array) in place.
+    // They go through the same offset of the upload buffer, so disjoint ranges can be updated in one command list.
+    void UpdateRange(RenderEngine* renderEngine, ID3D12GraphicsCommandList* cmdList, const void* cpuData, UINT firstElement, UINT elementCount);
 };
\ No newline at end of file
@@ -116,11 +116,37 @@ HRESULT Image::Initialize(ID3D12Device* device, ID3D12GraphicsCommandList* cmdLi
 	return S_OK;
 }
 
+HRESULT Image::InitializeCpuOnly(UINT width, UINT height)
+{
+	m_device = nullptr;
+	m_cmdList = nullptr;
+	m_allocator = nullptr;
+	m_width = width;
+	m_height = height;
+	m_flags = D3D12_RESOURCE_FLAG_NONE;
+	m_format = DXGI_FORMAT_R8G8B8A8_UNORM;
+
+	delete[] m_pixelData;
+	delete[] m_accumulateData;
+	m_pixelData = new uint32_t[m_width * m_height];
+	ZeroMemory(m_pixelData, m_width * m_height * sizeof(uint32_t));
+	m_accumulateData = new XMFLOAT4[m_width * m_height];
+	ClearAccumulationData();
+
+	return S_OK;
+}
+
 void Image::Resize(UINT newWidth, UINT newHeight)
 {
 	if (newWidth == m_width && newHeight == m_height)
 		return; // No need to recreate
 
+	if (IsCpuOnly())
+	{
+		InitializeCpuOnly(newWidth, newHeight);
+		return;
+	}
+
 	// Release old resources
 	Internal_FreeViews();
 	m_gpuResource.Reset();
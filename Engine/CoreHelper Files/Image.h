@@ -16,6 +16,11 @@ public:
 	HRESULT Initialize(ID3D12Device* device, ID3D12GraphicsCommandList* cmdList, DescriptorAllocator* allocator,
 		UINT width, UINT height, DXGI_FORMAT format, D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
 
+	// Allocates only the CPU pixel and accumulation buffers (no device required).
+	// Used by headless renderers; CommitChanges must not be called on such an image.
+	HRESULT InitializeCpuOnly(UINT width, UINT height);
+	bool IsCpuOnly() const { return m_device == nullptr; }
+
 	void CommitChanges();
 
 	void Resize(UINT width, UINT height);
@@ -33,8 +38,8 @@ public:
 	UINT GetHeight() const { return m_height; }
 
 private:
-	ID3D12Device* m_device;
-	ID3D12GraphicsCommandList* m_cmdList;
+	ID3D12Device* m_device = nullptr;
+	ID3D12GraphicsCommandList* m_cmdList = nullptr;
 	DescriptorAllocator* m_allocator = nullptr;
 
 	uint32_t* m_pixelData = nullptr;
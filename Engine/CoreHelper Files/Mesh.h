@@ -9,6 +9,20 @@ struct Triangle
     DirectX::XMFLOAT2 tc0, tc1, tc2;
 };
 
+// The acceleration structure buffers split Triangle into a hot part, read by every intersection test, and a cold
+// part that is only fetched for the closest hit. Both arrays are indexed like the Triangle they came from.
+struct TrianglePositions
+{
+    DirectX::XMFLOAT3 v0, v1, v2;
+};
+
+struct TriangleAttributes
+{
+    int MaterialIndex;
+    DirectX::XMFLOAT3 n0, n1, n2;
+    DirectX::XMFLOAT2 tc0, tc1, tc2;
+};
+
 struct BVHNode
 {
     DirectX::XMFLOAT3 aabbMin;
@@ -22,7 +22,8 @@ Texture* ModelLoader::LoadTexture(
     const std::filesystem::path& basePath,
     ResourceManager* resourceManager)
 {
-    if (textureIndex < 0) {
+    // Without a resource manager (headless loads) there is nowhere to create GPU textures.
+    if (textureIndex < 0 || !resourceManager) {
         return nullptr; 
     }
 
@@ -107,8 +108,9 @@ HRESULT ModelLoader::LoadGLTF(ResourceManager* resourceManager, const std::strin
     if (!ret) return E_FAIL;
     std::filesystem::path basePath = std::filesystem::path(filename).parent_path();
 
-    auto device = resourceManager->GetDevice();
-    auto cmdList = resourceManager->GetCommandList();
+    // A null resource manager loads CPU-side geometry and material factors only.
+    auto device = resourceManager ? resourceManager->GetDevice() : nullptr;
+    auto cmdList = resourceManager ? resourceManager->GetCommandList() : nullptr;
 
     outModel.Meshes.clear();
     outModel.Materials.clear();
@@ -448,13 +450,13 @@ HRESULT ModelLoader::LoadGLTF(ResourceManager* resourceManager, const std::strin
         }
 
         // --- Create the single, combined GPU buffers for the entire mesh ---
-        if (!mesh.Vertices.empty())
+        if (device && !mesh.Vertices.empty())
         {
             UINT vbByteSize = (UINT)mesh.Vertices.size() * sizeof(ModelVertex);
             createGeometryVertexResource(device, cmdList, mesh, mesh.Vertices.data(), vbByteSize);
         }
 
-        if (!mesh.Indices.empty())
+        if (device && !mesh.Indices.empty())
         {
             UINT ibByteSize = (UINT)mesh.Indices.size() * sizeof(uint32_t);
             createGeometryIndexResource(device, cmdList, mesh, mesh.Indices.data(), ibByteSize, DXGI_FORMAT_R32_UINT);
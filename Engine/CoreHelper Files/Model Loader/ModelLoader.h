@@ -96,6 +96,17 @@ struct Model
     }
 };
 
+// Visibility classes of an instance. A ray sees an instance when the ray's mask and the instance's mask share a bit,
+// as with DXR instance masks, so clearing a bit hides the instance from that kind of ray for free. Bits 3-7 are
+// left to the application.
+enum InstanceMaskBits : uint8_t
+{
+    INSTANCE_MASK_CAMERA = 1u << 0,    // Camera rays
+    INSTANCE_MASK_SECONDARY = 1u << 1, // Bounce rays: reflections, refraction, indirect light
+    INSTANCE_MASK_SHADOW = 1u << 2,    // Occlusion rays, i.e. the instance casts shadows
+    INSTANCE_MASK_ALL = 0xff,
+};
+
 struct ModelInstance {
     std::string Name = "";
     Model* SourceModel = nullptr;
@@ -108,6 +119,7 @@ struct ModelInstance {
     DirectX::XMMATRIX InverseTransform = DirectX::XMMatrixIdentity();
 
     uint32_t MaterialOffset = 0;
+    uint8_t InstanceMask = INSTANCE_MASK_ALL; // InstanceMaskBits
 };
 
 struct ModelInstanceGPUData
@@ -117,7 +129,7 @@ struct ModelInstanceGPUData
     uint32_t BaseTriangleIndex;
     uint32_t BaseNodeIndex;
     uint32_t MaterialOffset;
-    float _padding0;
+    uint32_t InstanceMask; // ModelInstance::InstanceMask in the low 8 bits
 };
 
 class ModelLoader {
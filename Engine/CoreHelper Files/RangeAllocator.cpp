@@ -0,0 +1,125 @@
+#include "RangeAllocator.h"
+#include <cassert>
+#include <iterator>
+
+uint32_t RangeAllocator::Allocate(uint32_t count)
+{
+    if (count == 0)
+        return m_size;
+
+    // 1. First fit among the holes
+    for (auto it = m_freeRanges.begin(); it != m_freeRanges.end(); ++it)
+    {
+        if (it->second < count)
+            continue;
+
+        const uint32_t offset = it->first;
+        const uint32_t remaining = it->second - count;
+        m_freeRanges.erase(it);
+        if (remaining > 0)
+        {
+            m_freeRanges.emplace(offset + count, remaining);
+        }
+        m_freeCount -= count;
+        return offset;
+    }
+
+    // 2. Grow the array
+    const uint32_t offset = m_size;
+    m_size += count;
+    return offset;
+}
+
+void RangeAllocator::Free(uint32_t offset, uint32_t count)
+{
+    if (count == 0)
+        return;
+    assert(offset + count <= m_size);
+
+    // 1. Merge with the free neighbours
+    uint32_t begin = offset;
+    uint32_t end = offset + count;
+    auto next = m_freeRanges.lower_bound(offset);
+    if (next != m_freeRanges.begin())
+    {
+        auto previous = std::prev(next);
+        assert(previous->first + previous->second <= offset);
+        if (previous->first + previous->second == offset)
+        {
+            begin = previous->first;
+            m_freeCount -= previous->second;
+            m_freeRanges.erase(previous);
+        }
+    }
+    if (next != m_freeRanges.end() && next->first == end)
+    {
+        end += next->second;
+        m_freeCount -= next->second;
+        m_freeRanges.erase(next);
+    }
+
+    // 2. A range reaching the end shrinks the array
+    if (end == m_size)
+    {
+        m_size = begin;
+        return;
+    }
+
+    m_freeRanges.emplace(begin, end - begin);
+    m_freeCount += end - begin;
+}
+
+void RangeAllocator::AllocateAt(uint32_t offset, uint32_t count)
+{
+    if (count == 0)
+        return;
+
+    // Past the end, e.g. when freeing the moved range just trimmed the array down to the hole
+    if (offset >= m_size)
+    {
+        if (offset > m_size)
+        {
+            m_freeRanges.emplace(m_size, offset - m_size);
+            m_freeCount += offset - m_size;
+        }
+        m_size = offset + count;
+        return;
+    }
+
+    auto it = m_freeRanges.upper_bound(offset);
+    assert(it != m_freeRanges.begin());
+    --it;
+
+    const uint32_t rangeBegin = it->first;
+    const uint32_t rangeEnd = it->first + it->second;
+    assert(offset + count <= rangeEnd);
+    m_freeRanges.erase(it);
+
+    // Keep what is left on either side
+    if (offset > rangeBegin)
+    {
+        m_freeRanges.emplace(rangeBegin, offset - rangeBegin);
+    }
+    if (offset + count < rangeEnd)
+    {
+        m_freeRanges.emplace(offset + count, rangeEnd - (offset + count));
+    }
+    m_freeCount -= count;
+}
+
+void RangeAllocator::Reset()
+{
+    m_freeRanges.clear();
+    m_size = 0;
+    m_freeCount = 0;
+}
+
+uint32_t RangeAllocator::GetLargestFreeRange() const
+{
+    uint32_t largest = 0;
+    for (const auto& range : m_freeRanges)
+    {
+        if (range.second > largest) largest = range.second;
+    }
+    return largest;
+}
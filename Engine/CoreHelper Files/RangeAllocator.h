@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+
+// Sub-allocator of element ranges in an array that grows at its end, such as the uber triangle and BLAS node
+// arrays. Freed ranges are merged with free neighbours and handed out again first-fit; a free range that reaches
+// the end shrinks the array instead. Only offsets are tracked, the array itself belongs to the caller.
+class RangeAllocator
+{
+public:
+    // Offset of a new range of `count` elements: the lowest free range that fits, otherwise the end of the array.
+    uint32_t Allocate(uint32_t count);
+    void Free(uint32_t offset, uint32_t count);
+
+    // Takes [offset, offset + count), which must be free. Compaction uses it to move a range into a hole.
+    void AllocateAt(uint32_t offset, uint32_t count);
+
+    void Reset();
+
+    uint32_t GetSize() const { return m_size; }           // Elements the array must hold
+    uint32_t GetFreeCount() const { return m_freeCount; } // Free elements below GetSize()
+    uint32_t GetFreeRangeCount() const { return static_cast<uint32_t>(m_freeRanges.size()); }
+    uint32_t GetLargestFreeRange() const;
+    uint32_t GetFirstFreeOffset() const { return m_freeRanges.empty() ? m_size : m_freeRanges.begin()->first; }
+
+private:
+    std::map<uint32_t, uint32_t> m_freeRanges; // Offset -> count, never adjacent and never touching the end
+    uint32_t m_size = 0;
+    uint32_t m_freeCount = 0;
+};
@@ -9,3 +9,14 @@ struct Ray
 	XMFLOAT3 Origin;
 	XMFLOAT3 Direction;
 };
+
+// CPU counterpart of the HitData struct in RayTracerCS.hlsl.
+struct RayHit
+{
+	float HitDistance = FLT_MAX;
+	int PrimitiveIndex = -1;
+	int InstanceIndex = -1;
+	XMFLOAT3 HitPosition = { 0.0f, 0.0f, 0.0f };
+	XMFLOAT3 HitNormal = { 0.0f, 0.0f, 0.0f };
+	XMFLOAT2 TexCoord = { 0.0f, 0.0f };
+};
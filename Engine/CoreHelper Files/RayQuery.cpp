@@ -0,0 +1,1107 @@
+#include "RayQuery.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+    using RayQuery::Scene;
+    using RayQuery::MAX_PACKET_SIZE;
+
+    // The BLASes fit with room to spare (see BVHBuilder::MAX_DEPTH); the TLAS uses the rest
+    const uint32_t MAX_STACK_DEPTH = 64;
+    static_assert(MAX_STACK_DEPTH >= BVHBuilder::MAX_DEPTH, "BLAS traversal must not run out of stack");
+
+    // =========================================================================
+    // TRACE RAY FUNCTIONS (mirrors RayTracerCS.hlsl)
+    // =========================================================================
+
+    // A ray with its reciprocal direction precomputed once for all slab tests (binary and wide).
+    using TraversalRay = WideTraversalRay;
+
+    TraversalRay MakeTraversalRay(FXMVECTOR origin, FXMVECTOR direction)
+    {
+        XMFLOAT3 o, d;
+        XMStoreFloat3(&o, origin);
+        XMStoreFloat3(&d, direction);
+        return WideBVH::MakeRay(o, d);
+    }
+
+    bool RayAABB(const TraversalRay& ray, const XMFLOAT3& aabbMin, const XMFLOAT3& aabbMax, float& hitDist)
+    {
+        float tx0 = (aabbMin.x - ray.Origin.x) * ray.InvDirection.x, tx1 = (aabbMax.x - ray.Origin.x) * ray.InvDirection.x;
+        float ty0 = (aabbMin.y - ray.Origin.y) * ray.InvDirection.y, ty1 = (aabbMax.y - ray.Origin.y) * ray.InvDirection.y;
+        float tz0 = (aabbMin.z - ray.Origin.z) * ray.InvDirection.z, tz1 = (aabbMax.z - ray.Origin.z) * ray.InvDirection.z;
+
+        float tEnter = fmaxf(fmaxf(fminf(tx0, tx1), fminf(ty0, ty1)), fminf(tz0, tz1));
+        float tExit = fminf(fminf(fmaxf(tx0, tx1), fmaxf(ty0, ty1)), fmaxf(tz0, tz1));
+
+        if (tExit >= tEnter && tExit > 0.0f)
+        {
+            hitDist = fmaxf(tEnter, 0.0f);
+            return true;
+        }
+        hitDist = FLT_MAX;
+        return false;
+    }
+
+    // Moller-Trumbore, identical to IntersectTriangle() in the shader.
+    bool IntersectTriangle(const TraversalRay& ray, const TrianglePositions& tri, float& outT, float& outU, float& outV)
+    {
+        XMFLOAT3 edge1 = { tri.v1.x - tri.v0.x, tri.v1.y - tri.v0.y, tri.v1.z - tri.v0.z };
+        XMFLOAT3 edge2 = { tri.v2.x - tri.v0.x, tri.v2.y - tri.v0.y, tri.v2.z - tri.v0.z };
+        const XMFLOAT3& d = ray.Direction;
+
+        XMFLOAT3 h = { d.y * edge2.z - d.z * edge2.y, d.z * edge2.x - d.x * edge2.z, d.x * edge2.y - d.y * edge2.x };
+        float a = edge1.x * h.x + edge1.y * h.y + edge1.z * h.z;
+        if (a > -1e-6f && a < 1e-6f)
+            return false;
+
+        float f = 1.0f / a;
+        XMFLOAT3 s = { ray.Origin.x - tri.v0.x, ray.Origin.y - tri.v0.y, ray.Origin.z - tri.v0.z };
+        float u = f * (s.x * h.x + s.y * h.y + s.z * h.z);
+        if (u < 0.0f || u > 1.0f)
+            return false;
+
+        XMFLOAT3 q = { s.y * edge1.z - s.z * edge1.y, s.z * edge1.x - s.x * edge1.z, s.x * edge1.y - s.y * edge1.x };
+        float v = f * (d.x * q.x + d.y * q.y + d.z * q.z);
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+
+        float t = f * (edge2.x * q.x + edge2.y * q.y + edge2.z * q.z);
+        if (t <= 0.0001f)
+            return false;
+
+        outT = t;
+        outU = u;
+        outV = v;
+        return true;
+    }
+
+    // Interpolates the shading attributes for the closest hit only; this is the only read of the attribute array.
+    void ResolveBLASHit(const TraversalRay& ray, const std::vector<TriangleAttributes>& attributes, float u, float v, RayHit& closestHit)
+    {
+        if (closestHit.PrimitiveIndex == -1)
+            return;
+
+        const TriangleAttributes& tri = attributes[closestHit.PrimitiveIndex];
+        float w = 1.0f - u - v;
+        float t = closestHit.HitDistance;
+        closestHit.HitPosition = { ray.Origin.x + ray.Direction.x * t, ray.Origin.y + ray.Direction.y * t, ray.Origin.z + ray.Direction.z * t };
+        XMVECTOR n = XMVectorAdd(XMVectorAdd(XMVectorScale(XMLoadFloat3(&tri.n0), w), XMVectorScale(XMLoadFloat3(&tri.n1), u)), XMVectorScale(XMLoadFloat3(&tri.n2), v));
+        XMStoreFloat3(&closestHit.HitNormal, XMVector3Normalize(n));
+        closestHit.TexCoord = { w * tri.tc0.x + u * tri.tc1.x + v * tri.tc2.x, w * tri.tc0.y + u * tri.tc1.y + v * tri.tc2.y };
+    }
+
+    // Tests one ray against the triangles of a leaf stored as consecutive blocks starting at firstBlock.
+    template <typename BlockType>
+    void IntersectLeafBlocks(const TraversalRay& ray, const std::vector<BlockType>& blocks, uint32_t firstBlock, uint32_t triangleCount,
+        RayHit& closestHit, float& bestU, float& bestV)
+    {
+        for (uint32_t covered = 0; covered < triangleCount; ++firstBlock)
+        {
+            const BlockType& block = blocks[firstBlock];
+            TriangleBlockHit hit;
+            if (TriangleBlocks::Intersect(block, ray, closestHit.HitDistance, hit))
+            {
+                closestHit.HitDistance = hit.T;
+                closestHit.PrimitiveIndex = (int)hit.Triangle;
+                bestU = hit.U;
+                bestV = hit.V;
+            }
+            covered += block.Count;
+        }
+    }
+
+    // Tests the leaf triangles [firstTriangle, firstTriangle + triangleCount) (absolute indices) and records the
+    // closest hit below closestHit.HitDistance.
+    void IntersectLeaf(const TraversalRay& ray, const Scene& scene, uint32_t firstTriangle, uint32_t triangleCount,
+        RayHit& closestHit, float& bestU, float& bestV)
+    {
+        if (scene.BlockWidth == 4)
+        {
+            IntersectLeafBlocks(ray, *scene.Blocks4, (*scene.LeafFirstBlock)[firstTriangle], triangleCount, closestHit, bestU, bestV);
+            return;
+        }
+        if (scene.BlockWidth == 8)
+        {
+            IntersectLeafBlocks(ray, *scene.Blocks8, (*scene.LeafFirstBlock)[firstTriangle], triangleCount, closestHit, bestU, bestV);
+            return;
+        }
+
+        for (uint32_t i = 0; i < triangleCount; ++i)
+        {
+            uint32_t triIndex = firstTriangle + i;
+            float t, u, v;
+            if (IntersectTriangle(ray, (*scene.Positions)[triIndex], t, u, v) && t < closestHit.HitDistance)
+            {
+                closestHit.HitDistance = t;
+                closestHit.PrimitiveIndex = (int)triIndex;
+                bestU = u;
+                bestV = v;
+            }
+        }
+    }
+
+    // Walks one BLAS in model space. tMax lets the TLAS closest hit cull BLAS nodes early; since the
+    // instance transform is affine the parametric distance is the same in model and world space.
+    RayHit TraverseBLAS(const TraversalRay& ray, const std::vector<BVHNode>& blasNodes, const Scene& scene,
+        uint32_t baseNodeIndex, uint32_t baseTriangleIndex, float tMax)
+    {
+        RayHit closestHit;
+        closestHit.HitDistance = tMax;
+
+        float bestU = 0.0f, bestV = 0.0f;
+        int stack[MAX_STACK_DEPTH];
+        int stackPtr = 0;
+        stack[stackPtr++] = baseNodeIndex;
+
+        while (stackPtr > 0)
+        {
+            const BVHNode& node = blasNodes[stack[--stackPtr]];
+
+            float distToAABB;
+            if (!RayAABB(ray, node.aabbMin, node.aabbMax, distToAABB) || distToAABB > closestHit.HitDistance)
+                continue;
+
+            if (node.triangleCount > 0)
+            {
+                IntersectLeaf(ray, scene, baseTriangleIndex + node.leftChildOrFirstTriangleIndex, node.triangleCount, closestHit, bestU, bestV);
+            }
+            else
+            {
+                uint32_t leftChildIndex = node.leftChildOrFirstTriangleIndex;
+                uint32_t rightChildIndex = leftChildIndex + 1;
+
+                float distLeft, distRight;
+                bool hitLeft = RayAABB(ray, blasNodes[leftChildIndex].aabbMin, blasNodes[leftChildIndex].aabbMax, distLeft) && distLeft < closestHit.HitDistance;
+                bool hitRight = RayAABB(ray, blasNodes[rightChildIndex].aabbMin, blasNodes[rightChildIndex].aabbMax, distRight) && distRight < closestHit.HitDistance;
+
+                // Push the farther child first so the closer one is processed next
+                if (hitLeft && hitRight && stackPtr + 2 <= (int)MAX_STACK_DEPTH)
+                {
+                    if (distLeft < distRight)
+                    {
+                        stack[stackPtr++] = rightChildIndex;
+                        stack[stackPtr++] = leftChildIndex;
+                    }
+                    else
+                    {
+                        stack[stackPtr++] = leftChildIndex;
+                        stack[stackPtr++] = rightChildIndex;
+                    }
+                }
+                else if (hitLeft && stackPtr < (int)MAX_STACK_DEPTH)
+                {
+                    stack[stackPtr++] = leftChildIndex;
+                }
+                else if (hitRight && stackPtr < (int)MAX_STACK_DEPTH)
+                {
+                    stack[stackPtr++] = rightChildIndex;
+                }
+            }
+        }
+
+        ResolveBLASHit(ray, *scene.Attributes, bestU, bestV, closestHit);
+        return closestHit;
+    }
+
+    // Same as TraverseBLAS over a wide BVH; rootIndex is the BLAS root in the wide node array.
+    template <typename NodeType>
+    RayHit TraverseWideBLAS(const TraversalRay& ray, const std::vector<NodeType>& blasNodes, const Scene& scene,
+        uint32_t rootIndex, uint32_t baseTriangleIndex, float tMax)
+    {
+        RayHit closestHit;
+        closestHit.HitDistance = tMax;
+
+        float bestU = 0.0f, bestV = 0.0f;
+        WideBVH::Traverse(blasNodes.data(), rootIndex, ray, closestHit.HitDistance, [&](uint32_t firstTriangle, uint32_t triangleCount)
+        {
+            IntersectLeaf(ray, scene, baseTriangleIndex + firstTriangle, triangleCount, closestHit, bestU, bestV);
+        });
+
+        ResolveBLASHit(ray, *scene.Attributes, bestU, bestV, closestHit);
+        return closestHit;
+    }
+
+    // Same as TraverseBLAS over a compressed BVH; the root box is taken from the binary root, which is not stored.
+    RayHit TraverseCompressedBLAS(const TraversalRay& ray, const std::vector<CompressedBVHNode>& blasNodes, const Scene& scene,
+        const BVHNode& binaryRoot, uint32_t rootIndex, uint32_t baseTriangleIndex, float tMax)
+    {
+        RayHit closestHit;
+        closestHit.HitDistance = tMax;
+
+        float bestU = 0.0f, bestV = 0.0f;
+        CompressedBVH::Traverse(blasNodes.data(), rootIndex, binaryRoot.aabbMin, binaryRoot.aabbMax, ray, closestHit.HitDistance,
+            [&](uint32_t firstTriangle, uint32_t triangleCount)
+        {
+            IntersectLeaf(ray, scene, baseTriangleIndex + firstTriangle, triangleCount, closestHit, bestU, bestV);
+        });
+
+        ResolveBLASHit(ray, *scene.Attributes, bestU, bestV, closestHit);
+        return closestHit;
+    }
+
+    TraversalRay MakeModelSpaceRay(FXMVECTOR worldOrigin, FXMVECTOR worldDirection, const ModelInstanceGPUData& inst)
+    {
+        return MakeTraversalRay(
+            XMVector3TransformCoord(worldOrigin, inst.InverseTransform),
+            XMVector3TransformNormal(worldDirection, inst.InverseTransform));
+    }
+
+    // Transforms a resolved model-space hit back to world space and keeps it if it is closer than closestHit.
+    void AcceptInstanceHit(FXMVECTOR worldOrigin, const ModelInstanceGPUData& inst, uint32_t instanceID, const RayHit& modelHit, RayHit& closestHit)
+    {
+        XMVECTOR worldHitPos = XMVector3TransformCoord(XMLoadFloat3(&modelHit.HitPosition), inst.Transform);
+        float worldHitDist = XMVectorGetX(XMVector3Length(XMVectorSubtract(worldHitPos, worldOrigin)));
+        if (worldHitDist < closestHit.HitDistance)
+        {
+            closestHit.HitDistance = worldHitDist;
+            XMStoreFloat3(&closestHit.HitPosition, worldHitPos);
+            XMVECTOR worldNormal = XMVector3TransformNormal(XMLoadFloat3(&modelHit.HitNormal), XMMatrixTranspose(inst.InverseTransform));
+            XMStoreFloat3(&closestHit.HitNormal, XMVector3Normalize(worldNormal));
+            closestHit.PrimitiveIndex = modelHit.PrimitiveIndex;
+            closestHit.InstanceIndex = (int)instanceID;
+            closestHit.TexCoord = modelHit.TexCoord;
+        }
+    }
+
+    // Transforms the ray into the instance's model space, walks its BLAS with traverseBLAS(modelSpaceRay, tMax)
+    // and keeps the hit if it is closer than closestHit.
+    template <typename BLASTraversal>
+    void IntersectInstance(FXMVECTOR worldOrigin, FXMVECTOR worldDirection, const ModelInstanceGPUData& inst, uint32_t instanceID,
+        RayHit& closestHit, BLASTraversal&& traverseBLAS)
+    {
+        TraversalRay modelSpaceRay = MakeModelSpaceRay(worldOrigin, worldDirection, inst);
+
+        RayHit modelHit = traverseBLAS(modelSpaceRay, closestHit.HitDistance);
+        if (modelHit.PrimitiveIndex == -1)
+            return;
+
+        AcceptInstanceHit(worldOrigin, inst, instanceID, modelHit, closestHit);
+    }
+
+    // Walks the binary TLAS; traverseBLAS(modelSpaceRay, instanceID, tMax) walks the BLAS of one instance.
+    // Subtrees whose mask in tlasNodeMasks shares no bit with rayMask are skipped before their box is tested.
+    template <typename BLASTraversal>
+    RayHit TraceRay(const Ray& worldRay, float tMax, const std::vector<BVHNode>& tlasNodes, const std::vector<ModelInstanceGPUData>& instances,
+        const std::vector<uint8_t>& tlasNodeMasks, uint8_t rayMask, BLASTraversal&& traverseBLAS)
+    {
+        RayHit closestHit;
+        if (tlasNodes.empty() || (tlasNodeMasks[0] & rayMask) == 0)
+            return closestHit;
+        closestHit.HitDistance = tMax;
+
+        XMVECTOR worldOrigin = XMLoadFloat3(&worldRay.Origin);
+        XMVECTOR worldDirection = XMLoadFloat3(&worldRay.Direction);
+        TraversalRay ray = MakeTraversalRay(worldOrigin, worldDirection);
+
+        int tlasStack[MAX_STACK_DEPTH];
+        int tlasStackPtr = 0;
+        tlasStack[tlasStackPtr++] = 0; // Start at root of TLAS
+
+        while (tlasStackPtr > 0)
+        {
+            const BVHNode& node = tlasNodes[tlasStack[--tlasStackPtr]];
+
+            float distToAABB;
+            if (!RayAABB(ray, node.aabbMin, node.aabbMax, distToAABB) || distToAABB > closestHit.HitDistance)
+                continue;
+
+            if (node.triangleCount > 0) // Leaf node in TLAS points to an instance
+            {
+                uint32_t instanceID = node.leftChildOrFirstTriangleIndex;
+                const ModelInstanceGPUData& inst = instances[instanceID];
+                IntersectInstance(worldOrigin, worldDirection, inst, instanceID, closestHit, [&](const TraversalRay& modelSpaceRay, float tMax)
+                {
+                    return traverseBLAS(modelSpaceRay, instanceID, tMax);
+                });
+            }
+            else // Internal node in TLAS
+            {
+                uint32_t leftChildIndex = node.leftChildOrFirstTriangleIndex;
+                uint32_t rightChildIndex = leftChildIndex + 1;
+
+                float distLeft, distRight;
+                bool hitLeft = (tlasNodeMasks[leftChildIndex] & rayMask) != 0
+                    && RayAABB(ray, tlasNodes[leftChildIndex].aabbMin, tlasNodes[leftChildIndex].aabbMax, distLeft) && distLeft < closestHit.HitDistance;
+                bool hitRight = (tlasNodeMasks[rightChildIndex] & rayMask) != 0
+                    && RayAABB(ray, tlasNodes[rightChildIndex].aabbMin, tlasNodes[rightChildIndex].aabbMax, distRight) && distRight < closestHit.HitDistance;
+
+                if (hitLeft && hitRight && tlasStackPtr + 2 <= (int)MAX_STACK_DEPTH)
+                {
+                    if (distLeft < distRight)
+                    {
+                        tlasStack[tlasStackPtr++] = rightChildIndex;
+                        tlasStack[tlasStackPtr++] = leftChildIndex;
+                    }
+                    else
+                    {
+                        tlasStack[tlasStackPtr++] = leftChildIndex;
+                        tlasStack[tlasStackPtr++] = rightChildIndex;
+                    }
+                }
+                else if (hitLeft && tlasStackPtr < (int)MAX_STACK_DEPTH)
+                {
+                    tlasStack[tlasStackPtr++] = leftChildIndex;
+                }
+                else if (hitRight && tlasStackPtr < (int)MAX_STACK_DEPTH)
+                {
+                    tlasStack[tlasStackPtr++] = rightChildIndex;
+                }
+            }
+        }
+
+        return closestHit;
+    }
+
+    // TraceRay over the wide copies of the TLAS and BLASes; every node tests all of its children at once.
+    template <typename NodeType>
+    RayHit TraceRayWide(const Ray& worldRay, float tMax, uint8_t rayMask, const std::vector<NodeType>& tlasNodes, const std::vector<NodeType>& blasNodes,
+        const Scene& scene, const std::vector<ModelInstanceGPUData>& instances, const std::vector<uint32_t>& instanceWideRoots)
+    {
+        RayHit closestHit;
+        if (tlasNodes.empty())
+            return closestHit;
+        closestHit.HitDistance = tMax;
+
+        XMVECTOR worldOrigin = XMLoadFloat3(&worldRay.Origin);
+        XMVECTOR worldDirection = XMLoadFloat3(&worldRay.Direction);
+        TraversalRay ray = MakeTraversalRay(worldOrigin, worldDirection);
+
+        WideBVH::Traverse(tlasNodes.data(), 0, ray, closestHit.HitDistance, [&](uint32_t instanceID, uint32_t)
+        {
+            const ModelInstanceGPUData& inst = instances[instanceID];
+            IntersectInstance(worldOrigin, worldDirection, inst, instanceID, closestHit, [&](const TraversalRay& modelSpaceRay, float tMax)
+            {
+                return TraverseWideBLAS(modelSpaceRay, blasNodes, scene, instanceWideRoots[instanceID], inst.BaseTriangleIndex, tMax);
+            });
+        }, scene.WideTlasChildMasks->data(), rayMask);
+
+        return closestHit;
+    }
+
+    // Walks the BLAS of one instance in the current layout, for rays that leave a packet.
+    RayHit TraverseInstanceBLAS(const Scene& scene, const TraversalRay& modelSpaceRay, uint32_t instanceID, float tMax)
+    {
+        const ModelInstanceGPUData& inst = (*scene.Instances)[instanceID];
+        switch (scene.Layout)
+        {
+        case CpuBVHLayout::BVH4:
+            return TraverseWideBLAS(modelSpaceRay, *scene.WideBlasNodes4, scene, (*scene.InstanceWideRoots)[instanceID], inst.BaseTriangleIndex, tMax);
+        case CpuBVHLayout::BVH8:
+            return TraverseWideBLAS(modelSpaceRay, *scene.WideBlasNodes8, scene, (*scene.InstanceWideRoots)[instanceID], inst.BaseTriangleIndex, tMax);
+        case CpuBVHLayout::Compressed:
+            return TraverseCompressedBLAS(modelSpaceRay, *scene.CompressedBlasNodes, scene, (*scene.BlasNodes)[inst.BaseNodeIndex],
+                (*scene.InstanceWideRoots)[instanceID], inst.BaseTriangleIndex, tMax);
+        default:
+            return TraverseBLAS(modelSpaceRay, *scene.BlasNodes, scene, inst.BaseNodeIndex, inst.BaseTriangleIndex, tMax);
+        }
+    }
+
+    // =========================================================================
+    // OCCLUSION (ANY-HIT) FUNCTIONS
+    // =========================================================================
+
+    // IntersectTriangle for occlusion rays: u, v and t are compared against the determinant instead of divided by
+    // it, and nothing is kept but the answer.
+    bool OccludesTriangle(const TraversalRay& ray, const TrianglePositions& tri, float tMax)
+    {
+        XMFLOAT3 edge1 = { tri.v1.x - tri.v0.x, tri.v1.y - tri.v0.y, tri.v1.z - tri.v0.z };
+        XMFLOAT3 edge2 = { tri.v2.x - tri.v0.x, tri.v2.y - tri.v0.y, tri.v2.z - tri.v0.z };
+        const XMFLOAT3& d = ray.Direction;
+
+        XMFLOAT3 h = { d.y * edge2.z - d.z * edge2.y, d.z * edge2.x - d.x * edge2.z, d.x * edge2.y - d.y * edge2.x };
+        float a = edge1.x * h.x + edge1.y * h.y + edge1.z * h.z;
+        if (a > -1e-6f && a < 1e-6f)
+            return false;
+
+        // With the sign of a moved onto u, v and t they compare against |a|
+        const float sign = a < 0.0f ? -1.0f : 1.0f;
+        const float det = a * sign;
+        XMFLOAT3 s = { ray.Origin.x - tri.v0.x, ray.Origin.y - tri.v0.y, ray.Origin.z - tri.v0.z };
+        float u = sign * (s.x * h.x + s.y * h.y + s.z * h.z);
+        if (u < 0.0f || u > det)
+            return false;
+
+        XMFLOAT3 q = { s.y * edge1.z - s.z * edge1.y, s.z * edge1.x - s.x * edge1.z, s.x * edge1.y - s.y * edge1.x };
+        float v = sign * (d.x * q.x + d.y * q.y + d.z * q.z);
+        if (v < 0.0f || u + v > det)
+            return false;
+
+        float t = sign * (edge2.x * q.x + edge2.y * q.y + edge2.z * q.z);
+        return t > 0.0001f * det && t < tMax * det;
+    }
+
+    template <typename BlockType>
+    bool OccludedLeafBlocks(const TraversalRay& ray, const std::vector<BlockType>& blocks, uint32_t firstBlock, uint32_t triangleCount, float tMax)
+    {
+        for (uint32_t covered = 0; covered < triangleCount; ++firstBlock)
+        {
+            const BlockType& block = blocks[firstBlock];
+            if (TriangleBlocks::Occluded(block, ray, tMax))
+                return true;
+            covered += block.Count;
+        }
+        return false;
+    }
+
+    // True as soon as one of the leaf triangles [firstTriangle, firstTriangle + triangleCount) is hit below tMax.
+    bool OccludedLeaf(const TraversalRay& ray, const Scene& scene, uint32_t firstTriangle, uint32_t triangleCount, float tMax)
+    {
+        if (scene.BlockWidth == 4)
+            return OccludedLeafBlocks(ray, *scene.Blocks4, (*scene.LeafFirstBlock)[firstTriangle], triangleCount, tMax);
+        if (scene.BlockWidth == 8)
+            return OccludedLeafBlocks(ray, *scene.Blocks8, (*scene.LeafFirstBlock)[firstTriangle], triangleCount, tMax);
+
+        for (uint32_t i = 0; i < triangleCount; ++i)
+        {
+            if (OccludesTriangle(ray, (*scene.Positions)[firstTriangle + i], tMax))
+                return true;
+        }
+        return false;
+    }
+
+    // Any-hit walk of one binary BLAS: every node is tested once when popped and both children are pushed unordered,
+    // since the first hit ends the walk anyway.
+    bool OccludedBLAS(const TraversalRay& ray, const std::vector<BVHNode>& blasNodes, const Scene& scene,
+        uint32_t baseNodeIndex, uint32_t baseTriangleIndex, float tMax)
+    {
+        int stack[MAX_STACK_DEPTH];
+        int stackPtr = 0;
+        stack[stackPtr++] = baseNodeIndex;
+
+        while (stackPtr > 0)
+        {
+            const BVHNode& node = blasNodes[stack[--stackPtr]];
+
+            float distToAABB;
+            if (!RayAABB(ray, node.aabbMin, node.aabbMax, distToAABB) || distToAABB > tMax)
+                continue;
+
+            if (node.triangleCount > 0)
+            {
+                if (OccludedLeaf(ray, scene, baseTriangleIndex + node.leftChildOrFirstTriangleIndex, node.triangleCount, tMax))
+                    return true;
+            }
+            else if (stackPtr + 2 <= (int)MAX_STACK_DEPTH)
+            {
+                stack[stackPtr++] = node.leftChildOrFirstTriangleIndex + 1;
+                stack[stackPtr++] = node.leftChildOrFirstTriangleIndex;
+            }
+        }
+        return false;
+    }
+
+    // Walks the BLAS of one instance in the current layout until the first hit below tMax.
+    bool OccludedInstanceBLAS(const Scene& scene, const TraversalRay& modelSpaceRay, uint32_t instanceID, float tMax)
+    {
+        const ModelInstanceGPUData& inst = (*scene.Instances)[instanceID];
+        bool occluded = false;
+        auto occludedLeaf = [&](uint32_t firstTriangle, uint32_t triangleCount)
+        {
+            occluded = OccludedLeaf(modelSpaceRay, scene, inst.BaseTriangleIndex + firstTriangle, triangleCount, tMax);
+            return occluded;
+        };
+
+        float tLimit = tMax;
+        switch (scene.Layout)
+        {
+        case CpuBVHLayout::BVH4:
+            WideBVH::Traverse<true>(scene.WideBlasNodes4->data(), (*scene.InstanceWideRoots)[instanceID], modelSpaceRay, tLimit, occludedLeaf);
+            return occluded;
+        case CpuBVHLayout::BVH8:
+            WideBVH::Traverse<true>(scene.WideBlasNodes8->data(), (*scene.InstanceWideRoots)[instanceID], modelSpaceRay, tLimit, occludedLeaf);
+            return occluded;
+        case CpuBVHLayout::Compressed:
+        {
+            const BVHNode& binaryRoot = (*scene.BlasNodes)[inst.BaseNodeIndex];
+            CompressedBVH::Traverse<true>(scene.CompressedBlasNodes->data(), (*scene.InstanceWideRoots)[instanceID],
+                binaryRoot.aabbMin, binaryRoot.aabbMax, modelSpaceRay, tLimit, occludedLeaf);
+            return occluded;
+        }
+        default:
+            return OccludedBLAS(modelSpaceRay, *scene.BlasNodes, scene, inst.BaseNodeIndex, inst.BaseTriangleIndex, tMax);
+        }
+    }
+
+    // Any-hit walk of the TLAS (wide for the wide layouts, binary otherwise). Hits are not resolved or transformed
+    // back: the first instance whose BLAS reports one ends the query.
+    bool OccludedTLAS(const Scene& scene, const Ray& worldRay, float tMax, uint8_t rayMask)
+    {
+        const std::vector<BVHNode>& tlasNodes = *scene.TlasNodes;
+        const std::vector<uint8_t>& tlasNodeMasks = *scene.TlasNodeMasks;
+        if (tlasNodes.empty() || (tlasNodeMasks[0] & rayMask) == 0)
+            return false;
+
+        XMVECTOR worldOrigin = XMLoadFloat3(&worldRay.Origin);
+        XMVECTOR worldDirection = XMLoadFloat3(&worldRay.Direction);
+        TraversalRay ray = MakeTraversalRay(worldOrigin, worldDirection);
+
+        bool occluded = false;
+        auto occludedInstance = [&](uint32_t instanceID, uint32_t)
+        {
+            const ModelInstanceGPUData& inst = (*scene.Instances)[instanceID];
+            occluded = OccludedInstanceBLAS(scene, MakeModelSpaceRay(worldOrigin, worldDirection, inst), instanceID, tMax);
+            return occluded;
+        };
+
+        float tLimit = tMax;
+        if (scene.Layout == CpuBVHLayout::BVH4)
+        {
+            WideBVH::Traverse<true>(scene.WideTlasNodes4->data(), 0, ray, tLimit, occludedInstance, scene.WideTlasChildMasks->data(), rayMask);
+            return occluded;
+        }
+        if (scene.Layout == CpuBVHLayout::BVH8)
+        {
+            WideBVH::Traverse<true>(scene.WideTlasNodes8->data(), 0, ray, tLimit, occludedInstance, scene.WideTlasChildMasks->data(), rayMask);
+            return occluded;
+        }
+
+        int tlasStack[MAX_STACK_DEPTH];
+        int tlasStackPtr = 0;
+        tlasStack[tlasStackPtr++] = 0;
+
+        while (tlasStackPtr > 0)
+        {
+            const BVHNode& node = tlasNodes[tlasStack[--tlasStackPtr]];
+
+            float distToAABB;
+            if (!RayAABB(ray, node.aabbMin, node.aabbMax, distToAABB) || distToAABB > tMax)
+                continue;
+
+            if (node.triangleCount > 0)
+            {
+                if (occludedInstance(node.leftChildOrFirstTriangleIndex, 1))
+                    return true;
+            }
+            else if (tlasStackPtr + 2 <= (int)MAX_STACK_DEPTH)
+            {
+                const int leftChildIndex = node.leftChildOrFirstTriangleIndex;
+                if (tlasNodeMasks[leftChildIndex + 1] & rayMask)
+                {
+                    tlasStack[tlasStackPtr++] = leftChildIndex + 1;
+                }
+                if (tlasNodeMasks[leftChildIndex] & rayMask)
+                {
+                    tlasStack[tlasStackPtr++] = leftChildIndex;
+                }
+            }
+        }
+        return false;
+    }
+
+    // =========================================================================
+    // PACKET TRAVERSAL
+    // =========================================================================
+
+    // Packets of at least this many rays also get the frustum test.
+    const uint32_t FRUSTUM_MIN_RAYS = 8;
+
+    // Up to MAX_PACKET_SIZE rays with the same direction signs, SoA in groups of 4 lanes for the SSE slab tests.
+    // TMax is the culling distance of each lane; lanes that are unused or done hold -1 and never enter a box.
+    struct alignas(16) RayPacket
+    {
+        float OriginX[MAX_PACKET_SIZE], OriginY[MAX_PACKET_SIZE], OriginZ[MAX_PACKET_SIZE];
+        float InvDirX[MAX_PACKET_SIZE], InvDirY[MAX_PACKET_SIZE], InvDirZ[MAX_PACKET_SIZE];
+        float TMax[MAX_PACKET_SIZE];
+        TraversalRay Rays[MAX_PACKET_SIZE];
+        uint32_t Count = 0;
+        uint32_t GroupCount = 0;
+        bool NegativeDirection[3] = {};
+
+        // Bounds of the origins and reciprocal directions over the lanes, for the frustum test
+        bool UseFrustum = false;
+        float OriginMin[3], OriginMax[3], InvDirMin[3], InvDirMax[3];
+    };
+
+    uint32_t CountLanes(uint32_t laneMask)
+    {
+        uint32_t count = 0;
+        for (; laneMask != 0; laneMask &= laneMask - 1)
+        {
+            count++;
+        }
+        return count;
+    }
+
+    // Fills the SoA lanes from Rays and TMax for the lanes in laneMask and parks the others. Returns false if the
+    // direction signs of the lanes differ, since one choice of near and far planes must hold for every lane.
+    bool PreparePacket(RayPacket& packet, uint32_t count, uint32_t laneMask)
+    {
+        uint32_t firstLane = 0;
+        while (((laneMask >> firstLane) & 1u) == 0)
+        {
+            firstLane++;
+        }
+        const TraversalRay& first = packet.Rays[firstLane];
+        const float firstOrigin[3] = { first.Origin.x, first.Origin.y, first.Origin.z };
+        const float firstInvDir[3] = { first.InvDirection.x, first.InvDirection.y, first.InvDirection.z };
+
+        packet.Count = count;
+        packet.GroupCount = (count + 3) / 4;
+        bool finite = true;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            packet.NegativeDirection[axis] = first.NegativeDirection[axis];
+            packet.OriginMin[axis] = packet.OriginMax[axis] = firstOrigin[axis];
+            packet.InvDirMin[axis] = packet.InvDirMax[axis] = firstInvDir[axis];
+        }
+
+        for (uint32_t lane = 0; lane < packet.GroupCount * 4; ++lane)
+        {
+            const bool active = lane < count && ((laneMask >> lane) & 1u) != 0;
+            const TraversalRay& ray = active ? packet.Rays[lane] : first;
+            packet.OriginX[lane] = ray.Origin.x;
+            packet.OriginY[lane] = ray.Origin.y;
+            packet.OriginZ[lane] = ray.Origin.z;
+            packet.InvDirX[lane] = ray.InvDirection.x;
+            packet.InvDirY[lane] = ray.InvDirection.y;
+            packet.InvDirZ[lane] = ray.InvDirection.z;
+            if (!active)
+            {
+                packet.TMax[lane] = -1.0f;
+                continue;
+            }
+
+            const float origin[3] = { ray.Origin.x, ray.Origin.y, ray.Origin.z };
+            const float invDir[3] = { ray.InvDirection.x, ray.InvDirection.y, ray.InvDirection.z };
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if (ray.NegativeDirection[axis] != packet.NegativeDirection[axis])
+                    return false;
+
+                packet.OriginMin[axis] = fminf(packet.OriginMin[axis], origin[axis]);
+                packet.OriginMax[axis] = fmaxf(packet.OriginMax[axis], origin[axis]);
+                packet.InvDirMin[axis] = fminf(packet.InvDirMin[axis], invDir[axis]);
+                packet.InvDirMax[axis] = fmaxf(packet.InvDirMax[axis], invDir[axis]);
+                finite = finite && std::isfinite(invDir[axis]);
+            }
+        }
+
+        // An axis-parallel ray has an infinite reciprocal, which turns the interval products into NaNs
+        packet.UseFrustum = finite && CountLanes(laneMask) >= FRUSTUM_MIN_RAYS;
+        return true;
+    }
+
+    // Interval arithmetic over the whole packet (Boulos et al., "Geometric and Arithmetic Culling Methods for Entire
+    // Ray Packets", 2006): bounds the entry and exit distances of every lane at once. If the latest possible exit
+    // comes before the earliest possible entry, no lane enters the box.
+    bool FrustumMisses(const RayPacket& packet, const float nearPlane[3], const float farPlane[3])
+    {
+        float tNearLow = 0.0f;
+        float tFarHigh = FLT_MAX;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            // (plane - origin) * invDirection is extreme at the corners of the origin and direction intervals
+            const float nearLow = nearPlane[axis] - packet.OriginMax[axis], nearHigh = nearPlane[axis] - packet.OriginMin[axis];
+            const float farLow = farPlane[axis] - packet.OriginMax[axis], farHigh = farPlane[axis] - packet.OriginMin[axis];
+            const float invLow = packet.InvDirMin[axis], invHigh = packet.InvDirMax[axis];
+
+            tNearLow = fmaxf(tNearLow, fminf(fminf(nearLow * invLow, nearLow * invHigh), fminf(nearHigh * invLow, nearHigh * invHigh)));
+            tFarHigh = fminf(tFarHigh, fmaxf(fmaxf(farLow * invLow, farLow * invHigh), fmaxf(farHigh * invLow, farHigh * invHigh)));
+        }
+        return tNearLow > tFarHigh;
+    }
+
+    // Slab test of every lane against one box. Returns the mask of the lanes that enter it before their TMax and
+    // the nearest entry distance among them.
+    uint32_t IntersectPacketAABB(const RayPacket& packet, const XMFLOAT3& aabbMin, const XMFLOAT3& aabbMax, float& outNearest)
+    {
+        // With a negative direction the max plane is entered first.
+        const float nearPlane[3] = {
+            packet.NegativeDirection[0] ? aabbMax.x : aabbMin.x,
+            packet.NegativeDirection[1] ? aabbMax.y : aabbMin.y,
+            packet.NegativeDirection[2] ? aabbMax.z : aabbMin.z };
+        const float farPlane[3] = {
+            packet.NegativeDirection[0] ? aabbMin.x : aabbMax.x,
+            packet.NegativeDirection[1] ? aabbMin.y : aabbMax.y,
+            packet.NegativeDirection[2] ? aabbMin.z : aabbMax.z };
+
+        outNearest = FLT_MAX;
+        if (packet.UseFrustum && FrustumMisses(packet, nearPlane, farPlane))
+            return 0;
+
+        const __m128 nearX = _mm_set1_ps(nearPlane[0]), nearY = _mm_set1_ps(nearPlane[1]), nearZ = _mm_set1_ps(nearPlane[2]);
+        const __m128 farX = _mm_set1_ps(farPlane[0]), farY = _mm_set1_ps(farPlane[1]), farZ = _mm_set1_ps(farPlane[2]);
+        const __m128 noHit = _mm_set1_ps(FLT_MAX);
+
+        __m128 nearest = noHit;
+        uint32_t mask = 0;
+        for (uint32_t lane = 0; lane < packet.GroupCount * 4; lane += 4)
+        {
+            const __m128 ox = _mm_load_ps(packet.OriginX + lane), oy = _mm_load_ps(packet.OriginY + lane), oz = _mm_load_ps(packet.OriginZ + lane);
+            const __m128 ix = _mm_load_ps(packet.InvDirX + lane), iy = _mm_load_ps(packet.InvDirY + lane), iz = _mm_load_ps(packet.InvDirZ + lane);
+
+            __m128 tNear = _mm_max_ps(
+                _mm_max_ps(_mm_mul_ps(_mm_sub_ps(nearX, ox), ix), _mm_mul_ps(_mm_sub_ps(nearY, oy), iy)),
+                _mm_max_ps(_mm_mul_ps(_mm_sub_ps(nearZ, oz), iz), _mm_setzero_ps()));
+            __m128 tFar = _mm_min_ps(
+                _mm_min_ps(_mm_mul_ps(_mm_sub_ps(farX, ox), ix), _mm_mul_ps(_mm_sub_ps(farY, oy), iy)),
+                _mm_min_ps(_mm_mul_ps(_mm_sub_ps(farZ, oz), iz), _mm_load_ps(packet.TMax + lane)));
+
+            __m128 hit = _mm_cmple_ps(tNear, tFar);
+            mask |= static_cast<uint32_t>(_mm_movemask_ps(hit)) << lane;
+            nearest = _mm_min_ps(nearest, _mm_or_ps(_mm_and_ps(hit, tNear), _mm_andnot_ps(hit, noHit)));
+        }
+
+        alignas(16) float distances[4];
+        _mm_store_ps(distances, nearest);
+        outNearest = fminf(fminf(distances[0], distances[1]), fminf(distances[2], distances[3]));
+        return mask;
+    }
+
+    // Records a hit of the BLAS of instanceID for one lane.
+    void RecordLaneHit(const Scene& scene, RayPacket& worldPacket, uint32_t lane, const TraversalRay& modelSpaceRay, uint32_t instanceID,
+        RayHit& modelHit, float u, float v, RayHit& closestHit)
+    {
+        const ModelInstanceGPUData& inst = (*scene.Instances)[instanceID];
+        ResolveBLASHit(modelSpaceRay, *scene.Attributes, u, v, modelHit);
+        AcceptInstanceHit(XMLoadFloat3(&worldPacket.Rays[lane].Origin), inst, instanceID, modelHit, closestHit);
+        worldPacket.TMax[lane] = closestHit.HitDistance;
+    }
+
+    // An occlusion lane is done at its first hit: it only keeps the instance that stopped it.
+    void RecordLaneOcclusion(RayPacket& worldPacket, uint32_t lane, uint32_t instanceID, RayHit& closestHit)
+    {
+        closestHit.InstanceIndex = (int)instanceID;
+        worldPacket.TMax[lane] = -1.0f;
+    }
+
+    // The lanes in laneMask reached a TLAS leaf. They enter the instance's model space as a packet and walk its binary
+    // BLAS together; if only a few lanes arrived, or the transform split their direction signs, each walks the BLAS
+    // of the current layout on its own.
+    template <bool AnyHit>
+    void IntersectInstancePacket(const Scene& scene, RayPacket& worldPacket, uint32_t laneMask, uint32_t instanceID, RayHit* closestHits)
+    {
+        const ModelInstanceGPUData& inst = (*scene.Instances)[instanceID];
+
+        RayPacket packet;
+        for (uint32_t lane = 0, lanes = laneMask; lanes != 0; ++lane, lanes >>= 1)
+        {
+            if ((lanes & 1u) == 0)
+                continue;
+
+            const TraversalRay& worldRay = worldPacket.Rays[lane];
+            packet.Rays[lane] = MakeModelSpaceRay(XMLoadFloat3(&worldRay.Origin), XMLoadFloat3(&worldRay.Direction), inst);
+            packet.TMax[lane] = worldPacket.TMax[lane];
+        }
+
+        if (CountLanes(laneMask) * 4 <= worldPacket.Count || !PreparePacket(packet, worldPacket.Count, laneMask))
+        {
+            for (uint32_t lane = 0, lanes = laneMask; lanes != 0; ++lane, lanes >>= 1)
+            {
+                if ((lanes & 1u) == 0)
+                    continue;
+
+                if (AnyHit)
+                {
+                    if (OccludedInstanceBLAS(scene, packet.Rays[lane], instanceID, packet.TMax[lane]))
+                    {
+                        RecordLaneOcclusion(worldPacket, lane, instanceID, closestHits[lane]);
+                    }
+                    continue;
+                }
+
+                RayHit modelHit = TraverseInstanceBLAS(scene, packet.Rays[lane], instanceID, packet.TMax[lane]);
+                if (modelHit.PrimitiveIndex != -1)
+                {
+                    AcceptInstanceHit(XMLoadFloat3(&worldPacket.Rays[lane].Origin), inst, instanceID, modelHit, closestHits[lane]);
+                    worldPacket.TMax[lane] = closestHits[lane].HitDistance;
+                }
+            }
+            return;
+        }
+
+        RayHit modelHits[MAX_PACKET_SIZE];
+        float bestU[MAX_PACKET_SIZE], bestV[MAX_PACKET_SIZE];
+        for (uint32_t lane = 0; lane < worldPacket.Count; ++lane)
+        {
+            modelHits[lane].HitDistance = packet.TMax[lane];
+        }
+
+        const std::vector<BVHNode>& blasNodes = *scene.BlasNodes;
+        uint32_t activeMask = laneMask;
+        int stack[MAX_STACK_DEPTH];
+        int stackPtr = 0;
+        stack[stackPtr++] = inst.BaseNodeIndex;
+
+        while (stackPtr > 0 && activeMask != 0)
+        {
+            const BVHNode& node = blasNodes[stack[--stackPtr]];
+
+            float nearest;
+            const uint32_t hitMask = IntersectPacketAABB(packet, node.aabbMin, node.aabbMax, nearest);
+            if (hitMask == 0)
+                continue;
+
+            if (node.triangleCount > 0)
+            {
+                const uint32_t firstTriangle = inst.BaseTriangleIndex + node.leftChildOrFirstTriangleIndex;
+                for (uint32_t lane = 0, lanes = hitMask; lanes != 0; ++lane, lanes >>= 1)
+                {
+                    if ((lanes & 1u) == 0)
+                        continue;
+
+                    // An occlusion lane is done at its first hit; a closest-hit lane keeps going with the shorter ray.
+                    if (AnyHit)
+                    {
+                        if (OccludedLeaf(packet.Rays[lane], scene, firstTriangle, node.triangleCount, packet.TMax[lane]))
+                        {
+                            RecordLaneOcclusion(worldPacket, lane, instanceID, closestHits[lane]);
+                            packet.TMax[lane] = -1.0f;
+                            activeMask &= ~(1u << lane);
+                        }
+                        continue;
+                    }
+
+                    IntersectLeaf(packet.Rays[lane], scene, firstTriangle, node.triangleCount, modelHits[lane], bestU[lane], bestV[lane]);
+                    if (modelHits[lane].PrimitiveIndex != -1)
+                    {
+                        packet.TMax[lane] = modelHits[lane].HitDistance;
+                    }
+                }
+            }
+            else if (AnyHit)
+            {
+                // Occlusion lanes stop at any hit, so the children need no ordering: push both and test them when popped
+                if (stackPtr + 2 <= (int)MAX_STACK_DEPTH)
+                {
+                    stack[stackPtr++] = node.leftChildOrFirstTriangleIndex + 1;
+                    stack[stackPtr++] = node.leftChildOrFirstTriangleIndex;
+                }
+            }
+            else
+            {
+                uint32_t leftChildIndex = node.leftChildOrFirstTriangleIndex;
+                uint32_t rightChildIndex = leftChildIndex + 1;
+
+                float distLeft, distRight;
+                bool hitLeft = IntersectPacketAABB(packet, blasNodes[leftChildIndex].aabbMin, blasNodes[leftChildIndex].aabbMax, distLeft) != 0;
+                bool hitRight = IntersectPacketAABB(packet, blasNodes[rightChildIndex].aabbMin, blasNodes[rightChildIndex].aabbMax, distRight) != 0;
+
+                // Push the child the packet enters later first
+                if (hitLeft && hitRight && stackPtr + 2 <= (int)MAX_STACK_DEPTH)
+                {
+                    if (distLeft < distRight)
+                    {
+                        stack[stackPtr++] = rightChildIndex;
+                        stack[stackPtr++] = leftChildIndex;
+                    }
+                    else
+                    {
+                        stack[stackPtr++] = leftChildIndex;
+                        stack[stackPtr++] = rightChildIndex;
+                    }
+                }
+                else if (hitLeft && stackPtr < (int)MAX_STACK_DEPTH)
+                {
+                    stack[stackPtr++] = leftChildIndex;
+                }
+                else if (hitRight && stackPtr < (int)MAX_STACK_DEPTH)
+                {
+                    stack[stackPtr++] = rightChildIndex;
+                }
+            }
+        }
+
+        if (AnyHit)
+            return;
+
+        for (uint32_t lane = 0, lanes = laneMask; lanes != 0; ++lane, lanes >>= 1)
+        {
+            if ((lanes & 1u) != 0 && modelHits[lane].PrimitiveIndex != -1)
+            {
+                RecordLaneHit(scene, worldPacket, lane, packet.Rays[lane], instanceID, modelHits[lane], bestU[lane], bestV[lane], closestHits[lane]);
+            }
+        }
+    }
+
+    // Walks the binary TLAS once for the whole packet, skipping subtrees that hold no instance rayMask sees.
+    template <bool AnyHit>
+    void TracePacket(const Scene& scene, RayPacket& packet, uint8_t rayMask, RayHit* closestHits)
+    {
+        const std::vector<BVHNode>& tlasNodes = *scene.TlasNodes;
+        const std::vector<uint8_t>& tlasNodeMasks = *scene.TlasNodeMasks;
+        int tlasStack[MAX_STACK_DEPTH];
+        int tlasStackPtr = 0;
+        tlasStack[tlasStackPtr++] = 0;
+
+        while (tlasStackPtr > 0)
+        {
+            const int nodeIndex = tlasStack[--tlasStackPtr];
+            if ((tlasNodeMasks[nodeIndex] & rayMask) == 0)
+                continue;
+
+            const BVHNode& node = tlasNodes[nodeIndex];
+
+            float nearest;
+            const uint32_t laneMask = IntersectPacketAABB(packet, node.aabbMin, node.aabbMax, nearest);
+            if (laneMask == 0)
+                continue;
+
+            if (node.triangleCount > 0)
+            {
+                IntersectInstancePacket<AnyHit>(scene, packet, laneMask, node.leftChildOrFirstTriangleIndex, closestHits);
+                if (AnyHit && std::all_of(packet.TMax, packet.TMax + packet.Count, [](float t) { return t < 0.0f; }))
+                    return;
+            }
+            else
+            {
+                uint32_t leftChildIndex = node.leftChildOrFirstTriangleIndex;
+                uint32_t rightChildIndex = leftChildIndex + 1;
+
+                float distLeft, distRight;
+                bool hitLeft = IntersectPacketAABB(packet, tlasNodes[leftChildIndex].aabbMin, tlasNodes[leftChildIndex].aabbMax, distLeft) != 0;
+                bool hitRight = IntersectPacketAABB(packet, tlasNodes[rightChildIndex].aabbMin, tlasNodes[rightChildIndex].aabbMax, distRight) != 0;
+
+                if (hitLeft && hitRight && tlasStackPtr + 2 <= (int)MAX_STACK_DEPTH)
+                {
+                    if (distLeft < distRight)
+                    {
+                        tlasStack[tlasStackPtr++] = rightChildIndex;
+                        tlasStack[tlasStackPtr++] = leftChildIndex;
+                    }
+                    else
+                    {
+                        tlasStack[tlasStackPtr++] = leftChildIndex;
+                        tlasStack[tlasStackPtr++] = rightChildIndex;
+                    }
+                }
+                else if (hitLeft && tlasStackPtr < (int)MAX_STACK_DEPTH)
+                {
+                    tlasStack[tlasStackPtr++] = leftChildIndex;
+                }
+                else if (hitRight && tlasStackPtr < (int)MAX_STACK_DEPTH)
+                {
+                    tlasStack[tlasStackPtr++] = rightChildIndex;
+                }
+            }
+        }
+    }
+
+    // Traces up to MAX_PACKET_SIZE rays: as one packet if their direction signs agree, otherwise one by one.
+    // closestHits[i].InstanceIndex stays -1 for a miss; occlusion rays fill in nothing else.
+    template <bool AnyHit>
+    void TraceRays(const Scene& scene, const Ray* rays, uint32_t count, const float* tMax, uint8_t rayMask, RayHit* closestHits)
+    {
+        RayPacket packet;
+        for (uint32_t lane = 0; lane < count; ++lane)
+        {
+            closestHits[lane] = RayHit();
+            closestHits[lane].HitDistance = tMax[lane];
+            packet.Rays[lane] = MakeTraversalRay(XMLoadFloat3(&rays[lane].Origin), XMLoadFloat3(&rays[lane].Direction));
+            packet.TMax[lane] = tMax[lane];
+        }
+
+        if (count == 0 || scene.TlasNodes->empty())
+            return;
+
+        if (count == 1 || !PreparePacket(packet, count, (1u << count) - 1))
+        {
+            for (uint32_t lane = 0; lane < count; ++lane)
+            {
+                if (AnyHit)
+                {
+                    closestHits[lane].InstanceIndex = OccludedTLAS(scene, rays[lane], tMax[lane], rayMask) ? 0 : -1;
+                }
+                else
+                {
+                    closestHits[lane] = RayQuery::Intersect(scene, rays[lane], tMax[lane], rayMask);
+                }
+            }
+            return;
+        }
+
+        TracePacket<AnyHit>(scene, packet, rayMask, closestHits);
+    }
+}
+
+RayQuery::Scene RayQuery::GetScene(const AccelerationStructureManager& accelManager)
+{
+    Scene scene;
+    scene.Positions = &accelManager.GetCpuTrianglePositions();
+    scene.Attributes = &accelManager.GetCpuTriangleAttributes();
+    scene.BlockWidth = accelManager.GetCpuTriangleBlockWidth();
+    scene.Blocks4 = &accelManager.GetCpuTriangleBlocks4();
+    scene.Blocks8 = &accelManager.GetCpuTriangleBlocks8();
+    scene.LeafFirstBlock = &accelManager.GetCpuLeafFirstBlock();
+    scene.BlasNodes = &accelManager.GetCpuBlasNodes();
+    scene.TlasNodes = &accelManager.GetCpuTLASNodes();
+    scene.TlasNodeMasks = &accelManager.GetCpuTLASNodeMasks();
+    scene.Instances = &accelManager.GetCpuInstanceData();
+    scene.Layout = accelManager.GetCpuBVHLayout();
+    scene.WideBlasNodes4 = &accelManager.GetCpuWideBlasNodes4();
+    scene.WideTlasNodes4 = &accelManager.GetCpuWideTLASNodes4();
+    scene.WideBlasNodes8 = &accelManager.GetCpuWideBlasNodes8();
+    scene.WideTlasNodes8 = &accelManager.GetCpuWideTLASNodes8();
+    scene.WideTlasChildMasks = &accelManager.GetCpuWideTLASChildMasks();
+    scene.CompressedBlasNodes = &accelManager.GetCpuCompressedBlasNodes();
+    scene.InstanceWideRoots = &accelManager.GetCpuInstanceWideRoots();
+    return scene;
+}
+
+RayHit RayQuery::Intersect(const Scene& scene, const Ray& ray, float tMax, uint8_t rayMask)
+{
+    RayHit hit;
+    switch (scene.Layout)
+    {
+    case CpuBVHLayout::BVH4:
+        hit = TraceRayWide(ray, tMax, rayMask, *scene.WideTlasNodes4, *scene.WideBlasNodes4, scene, *scene.Instances, *scene.InstanceWideRoots);
+        break;
+    case CpuBVHLayout::BVH8:
+        hit = TraceRayWide(ray, tMax, rayMask, *scene.WideTlasNodes8, *scene.WideBlasNodes8, scene, *scene.Instances, *scene.InstanceWideRoots);
+        break;
+    default:
+        hit = TraceRay(ray, tMax, *scene.TlasNodes, *scene.Instances, *scene.TlasNodeMasks, rayMask, [&](const TraversalRay& modelSpaceRay, uint32_t instanceID, float blasTMax)
+        {
+            return TraverseInstanceBLAS(scene, modelSpaceRay, instanceID, blasTMax);
+        });
+        break;
+    }
+
+    if (hit.PrimitiveIndex == -1)
+    {
+        hit.HitDistance = FLT_MAX;
+    }
+    return hit;
+}
+
+bool RayQuery::Occluded(const Scene& scene, const Ray& ray, float tMax, uint8_t rayMask)
+{
+    return OccludedTLAS(scene, ray, tMax, rayMask);
+}
+
+void RayQuery::IntersectPacket(const Scene& scene, const Ray* rays, uint32_t rayCount, RayHit* outHits, float tMax, uint8_t rayMask)
+{
+    float laneTMax[MAX_PACKET_SIZE];
+    std::fill(laneTMax, laneTMax + MAX_PACKET_SIZE, tMax);
+
+    for (uint32_t first = 0; first < rayCount; first += MAX_PACKET_SIZE)
+    {
+        const uint32_t count = (std::min)(rayCount - first, MAX_PACKET_SIZE);
+        TraceRays<false>(scene, rays + first, count, laneTMax, rayMask, outHits + first);
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            if (outHits[i].PrimitiveIndex == -1)
+            {
+                outHits[i].HitDistance = FLT_MAX;
+            }
+        }
+    }
+}
+
+void RayQuery::OccludedPacket(const Scene& scene, const Ray* rays, uint32_t rayCount, const float* tMax, bool* outOccluded, uint8_t rayMask)
+{
+    for (uint32_t first = 0; first < rayCount; first += MAX_PACKET_SIZE)
+    {
+        const uint32_t count = (std::min)(rayCount - first, MAX_PACKET_SIZE);
+        RayHit hits[MAX_PACKET_SIZE];
+        TraceRays<true>(scene, rays + first, count, tMax + first, rayMask, hits);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            outOccluded[first + i] = hits[i].InstanceIndex != -1;
+        }
+    }
+}
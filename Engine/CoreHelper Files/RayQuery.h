@@ -0,0 +1,69 @@
+#pragma once
+
+#include "../RenderEngine Files/global.h"
+#include "Ray.h"
+#include "AccelerationStructureManager.h"
+
+#include <vector>
+
+// Ray queries against the CPU copies of the TLAS, BLASes and triangles held by the AccelerationStructureManager, in
+// whichever CpuBVHLayout and triangle block width it currently uses. Instances are entered through the inverse of
+// their ModelInstance transform, so hits come back in world space. The CPU ray tracer, picking, baking and headless
+// renderers all go through here.
+//
+// Queries only read the arrays and keep their state on the stack, so any number of threads may query at once. They
+// must not overlap anything that changes the manager's CPU arrays (BLAS builds or publication, ReleaseBLAS,
+// compaction, refits, TLAS builds and updates, layout changes); background BLAS builds are fine until published.
+namespace RayQuery
+{
+    // Pointers to the manager's arrays, gathered once per frame or batch of queries. Valid until the arrays change.
+    struct Scene
+    {
+        const std::vector<TrianglePositions>* Positions = nullptr;
+        const std::vector<TriangleAttributes>* Attributes = nullptr;
+        uint32_t BlockWidth = 0; // 0 = scalar per-triangle tests
+        const std::vector<TriangleBlock4>* Blocks4 = nullptr;
+        const std::vector<TriangleBlock8>* Blocks8 = nullptr;
+        const std::vector<uint32_t>* LeafFirstBlock = nullptr;
+
+        const std::vector<BVHNode>* BlasNodes = nullptr;
+        const std::vector<BVHNode>* TlasNodes = nullptr;
+        const std::vector<uint8_t>* TlasNodeMasks = nullptr;
+        const std::vector<ModelInstanceGPUData>* Instances = nullptr;
+
+        CpuBVHLayout Layout = CpuBVHLayout::Binary;
+        const std::vector<BVH4Node>* WideBlasNodes4 = nullptr;
+        const std::vector<BVH4Node>* WideTlasNodes4 = nullptr;
+        const std::vector<BVH8Node>* WideBlasNodes8 = nullptr;
+        const std::vector<BVH8Node>* WideTlasNodes8 = nullptr;
+        const std::vector<uint8_t>* WideTlasChildMasks = nullptr;
+        const std::vector<CompressedBVHNode>* CompressedBlasNodes = nullptr;
+        const std::vector<uint32_t>* InstanceWideRoots = nullptr;
+    };
+
+    Scene GetScene(const AccelerationStructureManager& accelManager);
+
+    // Every query takes a ray mask (InstanceMaskBits) and only sees the instances whose InstanceMask shares a bit
+    // with it, e.g. INSTANCE_MASK_SHADOW for shadow rays. TLAS subtrees without such an instance are never opened.
+
+    // Closest hit closer than tMax. ray.Direction must be normalized: tMax and RayHit::HitDistance are world-space
+    // distances along it. A miss leaves PrimitiveIndex at -1 and HitDistance at FLT_MAX.
+    RayHit Intersect(const Scene& scene, const Ray& ray, float tMax = FLT_MAX, uint8_t rayMask = INSTANCE_MASK_ALL);
+
+    // True if anything lies along the ray closer than tMax, e.g. between a shading point and a light. Any-hit: the
+    // walk ends at the first triangle found, visits children unordered and never resolves the hit.
+    bool Occluded(const Scene& scene, const Ray& ray, float tMax, uint8_t rayMask = INSTANCE_MASK_ALL);
+
+    // Packets of coherent rays, such as the camera rays of a pixel block or shadow rays towards one light, walk the
+    // binary TLAS and BLASes once per packet: SSE slab tests of 4 rays at a time on one shared stack, plus an
+    // interval-arithmetic frustum test for packets of 8 or more rays. Rays whose direction signs differ, and
+    // instances reached by only a few rays of the packet, fall back to single-ray traversal in the current layout.
+    // The hits are those of Intersect and Occluded, up to ties between equally distant triangles. Arrays longer than
+    // MAX_PACKET_SIZE are traced as consecutive packets; tMax holds one distance per ray for OccludedPacket.
+    const uint32_t MAX_PACKET_SIZE = 16;
+
+    void IntersectPacket(const Scene& scene, const Ray* rays, uint32_t rayCount, RayHit* outHits, float tMax = FLT_MAX,
+        uint8_t rayMask = INSTANCE_MASK_ALL);
+    void OccludedPacket(const Scene& scene, const Ray* rays, uint32_t rayCount, const float* tMax, bool* outOccluded,
+        uint8_t rayMask = INSTANCE_MASK_ALL);
+}
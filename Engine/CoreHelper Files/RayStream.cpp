@@ -0,0 +1,173 @@
+#include "RayStream.h"
+#include "TaskScheduler.h"
+#include "../RenderEngine Files/Timer.h"
+#include <algorithm>
+
+using namespace DirectX;
+
+namespace
+{
+    // Rays per stream: 32 KB of sort entries, and few enough rays that their walks share the cached upper levels.
+    const uint32_t STREAM_SIZE = 4096;
+
+    // Spreads the low 9 bits of v so that two zero bits separate each of them.
+    inline uint32_t ExpandBits9(uint32_t v)
+    {
+        v &= 0x1ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    uint32_t GetFlags(const RayStreamBatch& rays, uint32_t i)
+    {
+        return rays.Flags ? rays.Flags[i] : RAY_STREAM_CLOSEST_HIT;
+    }
+
+    // Active rays with a non-empty [TMin, TMax) interval; the others keep the default result
+    bool IsTraced(const RayStreamBatch& rays, uint32_t i)
+    {
+        if (GetFlags(rays, i) & RAY_STREAM_INACTIVE)
+            return false;
+
+        const float tMin = rays.TMin ? rays.TMin[i] : 0.0f;
+        const float tMax = rays.TMax ? rays.TMax[i] : FLT_MAX;
+        return !(tMax <= tMin);
+    }
+
+    // Sorts and traces rays [begin, end). Returns the number of rays traced.
+    uint32_t TraceStream(const RayQuery::Scene& scene, const RayStreamBatch& rays, uint32_t begin, uint32_t end,
+        RayHit* outHits, bool* outOccluded)
+    {
+        // 1. Origin bounds of the traced rays
+        XMFLOAT3 originMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+        XMFLOAT3 originMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            if (outHits)
+            {
+                outHits[i] = RayHit();
+            }
+            if (outOccluded)
+            {
+                outOccluded[i] = false;
+            }
+            if (!IsTraced(rays, i))
+                continue;
+
+            originMin = { (std::min)(originMin.x, rays.OriginX[i]), (std::min)(originMin.y, rays.OriginY[i]), (std::min)(originMin.z, rays.OriginZ[i]) };
+            originMax = { (std::max)(originMax.x, rays.OriginX[i]), (std::max)(originMax.y, rays.OriginY[i]), (std::max)(originMax.z, rays.OriginZ[i]) };
+        }
+
+        const float cellCount = 512.0f;
+        const float extent[3] = { originMax.x - originMin.x, originMax.y - originMin.y, originMax.z - originMin.z };
+        float scale[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            scale[axis] = extent[axis] > 1e-6f ? cellCount / extent[axis] : 0.0f;
+        }
+
+        // 2. Sort key per traced ray: kind, direction octant, then the Morton code of the origin (9 bits per axis).
+        //    The local index rides in the low half so that one sort of plain integers orders the rays.
+        uint64_t entries[STREAM_SIZE];
+        uint32_t entryCount = 0;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            if (!IsTraced(rays, i))
+                continue;
+
+            const uint32_t flags = GetFlags(rays, i);
+            const uint32_t octant = (rays.DirectionX[i] < 0.0f ? 4u : 0u) | (rays.DirectionY[i] < 0.0f ? 2u : 0u) | (rays.DirectionZ[i] < 0.0f ? 1u : 0u);
+            const uint32_t cellX = static_cast<uint32_t>(std::clamp((rays.OriginX[i] - originMin.x) * scale[0], 0.0f, cellCount - 1.0f));
+            const uint32_t cellY = static_cast<uint32_t>(std::clamp((rays.OriginY[i] - originMin.y) * scale[1], 0.0f, cellCount - 1.0f));
+            const uint32_t cellZ = static_cast<uint32_t>(std::clamp((rays.OriginZ[i] - originMin.z) * scale[2], 0.0f, cellCount - 1.0f));
+            const uint32_t morton = (ExpandBits9(cellX) << 2) | (ExpandBits9(cellY) << 1) | ExpandBits9(cellZ);
+
+            const uint32_t key = ((flags & RAY_STREAM_OCCLUSION) ? 1u << 30 : 0u) | (octant << 27) | morton;
+            entries[entryCount++] = (static_cast<uint64_t>(key) << 32) | (i - begin);
+        }
+        std::sort(entries, entries + entryCount);
+
+        // 3. Trace in key order. TMin moves the origin forward and is added back to the hit distance.
+        for (uint32_t e = 0; e < entryCount; ++e)
+        {
+            const uint32_t i = begin + static_cast<uint32_t>(entries[e] & 0xffffffffu);
+            const float tMin = rays.TMin ? rays.TMin[i] : 0.0f;
+            const float tMax = rays.TMax ? rays.TMax[i] : FLT_MAX;
+
+            Ray ray;
+            ray.Direction = { rays.DirectionX[i], rays.DirectionY[i], rays.DirectionZ[i] };
+            ray.Origin = { rays.OriginX[i] + ray.Direction.x * tMin, rays.OriginY[i] + ray.Direction.y * tMin, rays.OriginZ[i] + ray.Direction.z * tMin };
+            const float tRange = tMax < FLT_MAX ? tMax - tMin : FLT_MAX;
+            const uint8_t rayMask = rays.Masks ? rays.Masks[i] : static_cast<uint8_t>(INSTANCE_MASK_ALL);
+
+            if (GetFlags(rays, i) & RAY_STREAM_OCCLUSION)
+            {
+                if (outOccluded)
+                {
+                    outOccluded[i] = RayQuery::Occluded(scene, ray, tRange, rayMask);
+                }
+                continue;
+            }
+
+            RayHit hit = RayQuery::Intersect(scene, ray, tRange, rayMask);
+            if (hit.PrimitiveIndex != -1)
+            {
+                hit.HitDistance += tMin;
+            }
+            if (outHits)
+            {
+                outHits[i] = hit;
+            }
+            if (outOccluded)
+            {
+                outOccluded[i] = hit.PrimitiveIndex != -1;
+            }
+        }
+        return entryCount;
+    }
+}
+
+HRESULT RayStream::Trace(const RayQuery::Scene& scene, const RayStreamBatch& rays, RayHit* outHits, bool* outOccluded,
+    TaskScheduler* scheduler, RayStreamStats* outStats)
+{
+    if (!rays.OriginX || !rays.OriginY || !rays.OriginZ || !rays.DirectionX || !rays.DirectionY || !rays.DirectionZ)
+    {
+        return E_INVALIDARG;
+    }
+    if (!scheduler)
+    {
+        scheduler = TaskScheduler::Get();
+    }
+
+    Timer timer;
+
+    const uint32_t streamCount = (rays.Count + STREAM_SIZE - 1) / STREAM_SIZE;
+    std::vector<uint32_t> raysPerStream(streamCount, 0);
+    scheduler->ParallelFor(streamCount, 1, [&](uint32_t firstStream, uint32_t lastStream)
+    {
+        for (uint32_t stream = firstStream; stream < lastStream; ++stream)
+        {
+            const uint32_t begin = stream * STREAM_SIZE;
+            const uint32_t end = (std::min)(begin + STREAM_SIZE, rays.Count);
+            raysPerStream[stream] = TraceStream(scene, rays, begin, end, outHits, outOccluded);
+        }
+    });
+
+    if (outStats)
+    {
+        *outStats = {};
+        for (uint32_t count : raysPerStream)
+        {
+            outStats->RaysTraced += count;
+        }
+        outStats->StreamCount = streamCount;
+        outStats->TraceTimeMs = timer.ElapsedMillis();
+        outStats->MRaysPerSecond = outStats->TraceTimeMs > 0.0f
+            ? (float)(outStats->RaysTraced / (outStats->TraceTimeMs * 1000.0))
+            : 0.0f;
+    }
+    return S_OK;
+}
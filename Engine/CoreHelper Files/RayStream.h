@@ -0,0 +1,52 @@
+#pragma once
+
+#include "RayQuery.h"
+
+class TaskScheduler;
+
+// Per-ray flags of a RayStreamBatch.
+enum RayStreamFlags : uint32_t
+{
+    RAY_STREAM_CLOSEST_HIT = 0,
+    RAY_STREAM_OCCLUSION = 1u << 0, // Only whether anything lies between TMin and TMax, no hit attributes
+    RAY_STREAM_INACTIVE = 1u << 1,  // Not traced, reported as a miss
+};
+
+// A batch of rays as SoA arrays of Count entries, e.g. every texel ray of a lightmap or AO bake. Directions must be
+// normalized. TMin, TMax, Flags and Masks are optional and default to 0, FLT_MAX, RAY_STREAM_CLOSEST_HIT and
+// INSTANCE_MASK_ALL (see RayQuery for ray masks).
+struct RayStreamBatch
+{
+    const float* OriginX = nullptr;
+    const float* OriginY = nullptr;
+    const float* OriginZ = nullptr;
+    const float* DirectionX = nullptr;
+    const float* DirectionY = nullptr;
+    const float* DirectionZ = nullptr;
+    const float* TMin = nullptr;
+    const float* TMax = nullptr;
+    const uint32_t* Flags = nullptr;
+    const uint8_t* Masks = nullptr;
+    uint32_t Count = 0;
+};
+
+struct RayStreamStats
+{
+    uint64_t RaysTraced = 0;
+    uint32_t StreamCount = 0;
+    float TraceTimeMs = 0.0f;
+    float MRaysPerSecond = 0.0f;
+};
+
+// Batched queries for large numbers of incoherent rays. The batch is cut into streams of a few thousand rays whose
+// sort keys and share of the BVH stay in cache; the streams are spread over the scheduler's threads. Each stream
+// is sorted by kind (closest hit or occlusion), direction octant and the Morton code of the ray origins before it
+// is traced, so that consecutive rays walk the same nodes. Results come back in batch order.
+namespace RayStream
+{
+    // outHits[i] receives the closest hit of ray i (a miss for occlusion and inactive rays) and outOccluded[i]
+    // whether ray i hit anything; either may be null. Hit distances are measured from the origin, not from TMin.
+    // Uses the shared TaskScheduler when scheduler is null.
+    HRESULT Trace(const RayQuery::Scene& scene, const RayStreamBatch& rays, RayHit* outHits, bool* outOccluded,
+        TaskScheduler* scheduler = nullptr, RayStreamStats* outStats = nullptr);
+}
@@ -1,6 +1,7 @@
 #include "ResourceManager.h"
 
 #include "CommonFunction.h" 
+#include "AccelerationStructureManager.h"
 #include "../RenderEngine Files/RenderEngine.h" 
 #include "extraPackages/d3dx12.h"
 #include "thirdParty/stb_image.h" 
@@ -187,6 +188,9 @@ Model* ResourceManager::GetModel(const std::string& name)
 void ResourceManager::UnloadModel(const std::string& name)
 {
 	if (m_models.count(name)) {
+		// Free the model's BLAS ranges before the pointer keying them dies; uploaded with the next UpdateGpuBuffers.
+		// Its instances in the TLAS are masked out until the caller removes them and the TLAS is updated.
+		AccelerationStructureManager::Get()->ReleaseBLAS(nullptr, m_models[name].get());
 		m_models.erase(name); // unique_ptr releases resources
 		fprintf(gpFile, "Model '%s' unloaded.\n", name.c_str());
 	}
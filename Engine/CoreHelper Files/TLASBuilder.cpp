@@ -1,7 +1,312 @@
 
 #include "TLASBuilder.h"
 #include "AccelerationStructureManager.h"
+#include "BVHOptimizer.h"
+#include "TaskScheduler.h"
+#include "../RenderEngine Files/Timer.h"
 #include <algorithm>
+#include <cassert>
+#include <immintrin.h>
+
+// Binned SAH TLAS build. Every leaf holds exactly one instance, so a subtree over n instances always has 2n - 1
+// nodes. That fixes the position of every subtree in the node array before it is built: a node's children are
+// allocated as a pair, followed by the left subtree and then the right one (the midpoint builder's layout), and
+// subtrees can be built as independent tasks without a shared node counter. Large nodes bin in parallel blocks;
+// bin reductions (counts, min/max) are exact, so the tree is the same for any number of threads.
+namespace
+{
+    const int TLAS_NUM_BINS = 16;
+
+    // Nodes with at least this many instances bin in parallel...
+    const uint32_t PARALLEL_BIN_THRESHOLD = 16 * 1024;
+    // ...split into blocks of this many instances.
+    const uint32_t PARALLEL_BLOCK_SIZE = 4 * 1024;
+    // Children with at least this many instances are built as separate tasks.
+    const uint32_t SUBTREE_TASK_THRESHOLD = 512;
+
+    // A TLASPrimitive with its bounds and centroid loaded into SSE registers (w lanes unused)
+    struct TLASBuildPrimitive
+    {
+        __m128 aabbMin;
+        __m128 aabbMax;
+        __m128 centroid;
+        uint32_t instanceIndex;
+    };
+
+    // Instance bounds and centroid bounds of a set of instances
+    struct TLASBounds
+    {
+        __m128 aabbMin;
+        __m128 aabbMax;
+        __m128 centroidMin;
+        __m128 centroidMax;
+        uint32_t count;
+
+        void Reset()
+        {
+            aabbMin = centroidMin = _mm_set1_ps(FLT_MAX);
+            aabbMax = centroidMax = _mm_set1_ps(-FLT_MAX);
+            count = 0;
+        }
+
+        void Grow(const TLASBuildPrimitive& prim)
+        {
+            aabbMin = _mm_min_ps(aabbMin, prim.aabbMin);
+            aabbMax = _mm_max_ps(aabbMax, prim.aabbMax);
+            centroidMin = _mm_min_ps(centroidMin, prim.centroid);
+            centroidMax = _mm_max_ps(centroidMax, prim.centroid);
+            count++;
+        }
+
+        void Grow(const TLASBounds& other)
+        {
+            aabbMin = _mm_min_ps(aabbMin, other.aabbMin);
+            aabbMax = _mm_max_ps(aabbMax, other.aabbMax);
+            centroidMin = _mm_min_ps(centroidMin, other.centroidMin);
+            centroidMax = _mm_max_ps(centroidMax, other.centroidMax);
+            count += other.count;
+        }
+
+        float SurfaceArea() const
+        {
+            alignas(16) float extent[4];
+            _mm_store_ps(extent, _mm_sub_ps(aabbMax, aabbMin));
+            return 2.0f * (extent[0] * extent[1] + extent[0] * extent[2] + extent[1] * extent[2]);
+        }
+    };
+
+    struct TLASBins
+    {
+        TLASBounds bins[3][TLAS_NUM_BINS];
+
+        void Reset()
+        {
+            for (int axis = 0; axis < 3; ++axis)
+                for (int b = 0; b < TLAS_NUM_BINS; ++b)
+                    bins[axis][b].Reset();
+        }
+    };
+
+    // Maps centroids to bins on all three axes at once. The split evaluation and the partition must agree
+    // exactly, so both use this.
+    struct TLASBinMapping
+    {
+        __m128 axisMin;
+        __m128 binScale; // 0 on axes without centroid extent
+
+        void BinIndices(const TLASBuildPrimitive& prim, int outBins[4]) const
+        {
+            __m128 bin = _mm_mul_ps(_mm_sub_ps(prim.centroid, axisMin), binScale);
+            bin = _mm_min_ps(_mm_max_ps(bin, _mm_setzero_ps()), _mm_set1_ps((float)(TLAS_NUM_BINS - 1)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(outBins), _mm_cvttps_epi32(bin));
+        }
+    };
+
+    // A range of instances to split, with the bounds its parent already computed
+    struct TLASBuildRange
+    {
+        uint32_t nodeIndex;
+        uint32_t startIndex;
+        uint32_t count;
+        uint32_t firstFreeNode; // Its 2 * count - 2 descendants are stored from here
+        TLASBounds bounds;
+    };
+
+    struct TLASBuildContext
+    {
+        std::vector<TLASBuildPrimitive>& primitives;
+        std::vector<BVHNode>& nodes;
+        TaskScheduler* scheduler;
+        TaskGroup* subtreeTasks;
+    };
+
+    void BinRange(const std::vector<TLASBuildPrimitive>& primitives, uint32_t begin, uint32_t end, const TLASBinMapping& mapping, const bool axisActive[3], TLASBins& out)
+    {
+        alignas(16) int bin[4];
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const TLASBuildPrimitive& prim = primitives[i];
+            mapping.BinIndices(prim, bin);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if (axisActive[axis]) out.bins[axis][bin[axis]].Grow(prim);
+            }
+        }
+    }
+
+    void BinPrimitives(TLASBuildContext& ctx, const TLASBuildRange& range, const TLASBinMapping& mapping, const bool axisActive[3], TLASBins& outBins)
+    {
+        outBins.Reset();
+        const uint32_t endIndex = range.startIndex + range.count;
+        if (range.count < PARALLEL_BIN_THRESHOLD)
+        {
+            BinRange(ctx.primitives, range.startIndex, endIndex, mapping, axisActive, outBins);
+            return;
+        }
+
+        // Per-block bins merged in block order
+        const uint32_t blockCount = (range.count + PARALLEL_BLOCK_SIZE - 1) / PARALLEL_BLOCK_SIZE;
+        std::vector<TLASBins> blockBins(blockCount);
+        ctx.scheduler->ParallelFor(blockCount, 1, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t block = begin; block < end; ++block)
+            {
+                uint32_t blockStart = range.startIndex + block * PARALLEL_BLOCK_SIZE;
+                uint32_t blockEnd = (std::min)(blockStart + PARALLEL_BLOCK_SIZE, endIndex);
+                blockBins[block].Reset();
+                BinRange(ctx.primitives, blockStart, blockEnd, mapping, axisActive, blockBins[block]);
+            }
+        });
+
+        for (const TLASBins& block : blockBins)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                for (int b = 0; b < TLAS_NUM_BINS; ++b)
+                {
+                    outBins.bins[axis][b].Grow(block.bins[axis][b]);
+                }
+            }
+        }
+    }
+
+    void WriteNodeBounds(BVHNode& node, const TLASBounds& bounds)
+    {
+        alignas(16) float aabbMin[4];
+        alignas(16) float aabbMax[4];
+        _mm_store_ps(aabbMin, bounds.aabbMin);
+        _mm_store_ps(aabbMax, bounds.aabbMax);
+        node.aabbMin = { aabbMin[0], aabbMin[1], aabbMin[2] };
+        node.aabbMax = { aabbMax[0], aabbMax[1], aabbMax[2] };
+    }
+
+    // Picks the cheapest bin boundary, area(left) * count(left) + area(right) * count(right), over all axes.
+    // Returns false when every centroid coincides and no boundary separates them.
+    bool FindBestSplit(TLASBuildContext& ctx, const TLASBuildRange& range, TLASBinMapping& outMapping, TLASBins& bins, int& outAxis, int& outSplit)
+    {
+        alignas(16) float axisMin[4];
+        alignas(16) float axisMax[4];
+        _mm_store_ps(axisMin, range.bounds.centroidMin);
+        _mm_store_ps(axisMax, range.bounds.centroidMax);
+
+        alignas(16) float binScale[4] = {};
+        bool axisActive[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float extent = axisMax[axis] - axisMin[axis];
+            axisActive[axis] = extent > 0.0f;
+            binScale[axis] = axisActive[axis] ? TLAS_NUM_BINS / extent : 0.0f;
+        }
+        if (!axisActive[0] && !axisActive[1] && !axisActive[2])
+            return false;
+
+        outMapping.axisMin = range.bounds.centroidMin;
+        outMapping.binScale = _mm_load_ps(binScale);
+        BinPrimitives(ctx, range, outMapping, axisActive, bins);
+
+        float bestCost = FLT_MAX;
+        outAxis = -1;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (!axisActive[axis]) continue;
+
+            float rightCost[TLAS_NUM_BINS];
+            TLASBounds right;
+            right.Reset();
+            for (int b = TLAS_NUM_BINS - 1; b > 0; --b)
+            {
+                right.Grow(bins.bins[axis][b]);
+                rightCost[b] = right.count > 0 ? right.SurfaceArea() * right.count : 0.0f;
+            }
+
+            TLASBounds left;
+            left.Reset();
+            for (int split = 1; split < TLAS_NUM_BINS; ++split)
+            {
+                left.Grow(bins.bins[axis][split - 1]);
+                if (left.count == 0 || left.count == range.count) continue;
+
+                float cost = left.SurfaceArea() * left.count + rightCost[split];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    outAxis = axis;
+                    outSplit = split;
+                }
+            }
+        }
+        return outAxis >= 0;
+    }
+
+    void SubdivideSAH(TLASBuildContext& ctx, const TLASBuildRange& range)
+    {
+        BVHNode& node = ctx.nodes[range.nodeIndex];
+        if (range.count == 1)
+        {
+            node.leftChildOrFirstTriangleIndex = ctx.primitives[range.startIndex].instanceIndex;
+            node.triangleCount = 1;
+            return;
+        }
+
+        // 1. Split on the best bin boundary; the children's bounds come from the bins. Pairs need no search, and
+        //    identical centroids cannot be split by position, so both are halved in their current order.
+        TLASBounds leftBounds;
+        TLASBounds rightBounds;
+        leftBounds.Reset();
+        rightBounds.Reset();
+
+        auto first = ctx.primitives.begin() + range.startIndex;
+        TLASBinMapping mapping;
+        TLASBins bins;
+        int axis;
+        int split;
+        if (range.count > 2 && FindBestSplit(ctx, range, mapping, bins, axis, split))
+        {
+            std::partition(first, first + range.count, [&mapping, axis, split](const TLASBuildPrimitive& prim)
+            {
+                alignas(16) int bin[4];
+                mapping.BinIndices(prim, bin);
+                return bin[axis] < split;
+            });
+
+            for (int b = 0; b < TLAS_NUM_BINS; ++b)
+            {
+                (b < split ? leftBounds : rightBounds).Grow(bins.bins[axis][b]);
+            }
+        }
+        else
+        {
+            const uint32_t half = range.count / 2;
+            for (uint32_t i = 0; i < range.count; ++i)
+            {
+                (i < half ? leftBounds : rightBounds).Grow(first[i]);
+            }
+        }
+        const uint32_t leftCount = leftBounds.count;
+
+        // 2. Children as a pair, then the left subtree's nodes followed by the right subtree's
+        const uint32_t leftChildIndex = range.firstFreeNode;
+        assert(leftChildIndex > range.nodeIndex);
+        node.leftChildOrFirstTriangleIndex = leftChildIndex;
+        node.triangleCount = 0; // Internal node
+        WriteNodeBounds(ctx.nodes[leftChildIndex], leftBounds);
+        WriteNodeBounds(ctx.nodes[leftChildIndex + 1], rightBounds);
+
+        TLASBuildRange leftRange = { leftChildIndex, range.startIndex, leftCount, range.firstFreeNode + 2, leftBounds };
+        TLASBuildRange rightRange = { leftChildIndex + 1, range.startIndex + leftCount, range.count - leftCount, range.firstFreeNode + 2 * leftCount, rightBounds };
+
+        // Hand the right subtree to another worker if it is big enough to be worth it, keep the left one.
+        if (rightRange.count >= SUBTREE_TASK_THRESHOLD)
+        {
+            ctx.subtreeTasks->Run([&ctx, rightRange] { SubdivideSAH(ctx, rightRange); });
+        }
+        else
+        {
+            SubdivideSAH(ctx, rightRange);
+        }
+        SubdivideSAH(ctx, leftRange);
+    }
+}
 
 namespace TLASBuilder
 {
@@ -79,13 +384,14 @@ namespace TLASBuilder
                 return center < splitPos;
             });
 
-        int leftCount = static_cast<int>(std::distance(primitives.begin() + startIndex, partition_iterator));
+        uint32_t leftCount = static_cast<uint32_t>(std::distance(primitives.begin() + startIndex, partition_iterator));
         if (leftCount == 0 || leftCount == count) {
             leftCount = count / 2;
         }
 
         uint32_t leftChildIndex = nodesUsed++;
         uint32_t rightChildIndex = nodesUsed++;
+        assert(leftChildIndex > static_cast<uint32_t>(&node - tlasNodes.data()));
 
         node.leftChildOrFirstTriangleIndex = leftChildIndex;
         node.triangleCount = 0; // Internal node
@@ -100,45 +406,110 @@ namespace TLASBuilder
         Subdivide(rightChild, primitives, tlasNodes, startIndex + leftCount, count - leftCount, nodesUsed);
     }
 
-    void Build(
+    TLASBuildStats Build(
         const std::vector<ModelInstance>& instances,
         std::vector<BVHNode>& outTlasNodes,
-        const AccelerationStructureManager* pAccelManager)
+        const AccelerationStructureManager* pAccelManager,
+        const TLASBuildSettings& settings,
+        TaskScheduler* scheduler)
     {
-        if (instances.empty()) {
-            outTlasNodes.clear();
-            return;
-        }
+        TLASBuildStats stats;
+        Timer buildTimer;
+        if (!scheduler) scheduler = TaskScheduler::Get();
 
-        // 1. Create primitives for the builder (world-space AABBs)
-        std::vector<TLASPrimitive> primitives;
-        primitives.reserve(instances.size());
-        for (uint32_t i = 0; i < instances.size(); ++i)
+        // 1. Create primitives for the builder (world-space AABBs), skipping instances without a BLAS
+        const uint32_t instanceCount = static_cast<uint32_t>(instances.size());
+        std::vector<TLASPrimitive> primitives(instanceCount);
+        std::vector<uint8_t> hasBlas(instanceCount, 0);
+        scheduler->ParallelFor(instanceCount, 1024, [&](uint32_t begin, uint32_t end)
         {
-            const auto& inst = instances[i];
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                const auto& inst = instances[i];
+                const BuiltBLAS* builtBlas = pAccelManager->GetCachedBLAS(inst.SourceModel);
+                if (!builtBlas) continue;
 
-            auto nonConstManager = const_cast<AccelerationStructureManager*>(pAccelManager);
-            const BuiltBLAS* builtBlas = nonConstManager->GetCachedBLAS(inst.SourceModel);
-            if (!builtBlas) continue;
+                const BVHNode& rootBlasNode = builtBlas->RootNode;
 
-            const BVHNode& rootBlasNode = builtBlas->RootNode;
+                TLASPrimitive& prim = primitives[i];
+                prim.instanceIndex = i;
+                TransformAABB(rootBlasNode.aabbMin, rootBlasNode.aabbMax, inst.Transform, prim.aabbMin, prim.aabbMax);
+                hasBlas[i] = 1;
+            }
+        });
 
-            TLASPrimitive prim;
-            prim.instanceIndex = i;
+        uint32_t primitiveCount = 0;
+        for (uint32_t i = 0; i < instanceCount; ++i)
+        {
+            if (hasBlas[i]) primitives[primitiveCount++] = primitives[i];
+        }
+        primitives.resize(primitiveCount);
 
-            TransformAABB(rootBlasNode.aabbMin, rootBlasNode.aabbMax, inst.Transform, prim.aabbMin, prim.aabbMax);
-            primitives.push_back(prim);
+        if (primitives.empty())
+        {
+            outTlasNodes.clear();
+            stats.BuildTimeMs = buildTimer.ElapsedMillis();
+            return stats;
         }
 
         // 2. Build the BVH
         outTlasNodes.resize(primitives.size() * 2);
-
         BVHNode& root = outTlasNodes[0];
-        ComputeBounds(primitives, 0, (uint32_t)primitives.size(), root.aabbMin, root.aabbMax);
 
-        uint32_t nodesUsed = 1;
-        Subdivide(root, primitives, outTlasNodes, 0, (uint32_t)primitives.size(), nodesUsed);
+        if (settings.Mode == TLASBuildMode::Midpoint)
+        {
+            ComputeBounds(primitives, 0, primitiveCount, root.aabbMin, root.aabbMax);
+
+            uint32_t nodesUsed = 1;
+            Subdivide(root, primitives, outTlasNodes, 0, primitiveCount, nodesUsed);
+            outTlasNodes.resize(nodesUsed);
+        }
+        else
+        {
+            // Load the primitives into SSE form and compute the root bounds, in parallel blocks
+            std::vector<TLASBuildPrimitive> buildPrimitives(primitiveCount);
+            const uint32_t blockCount = (primitiveCount + PARALLEL_BLOCK_SIZE - 1) / PARALLEL_BLOCK_SIZE;
+            std::vector<TLASBounds> blockBounds(blockCount);
+            scheduler->ParallelFor(blockCount, 1, [&](uint32_t begin, uint32_t end)
+            {
+                const __m128 half = _mm_set1_ps(0.5f);
+                for (uint32_t block = begin; block < end; ++block)
+                {
+                    TLASBounds& bounds = blockBounds[block];
+                    bounds.Reset();
+                    uint32_t blockEnd = (std::min)((block + 1) * PARALLEL_BLOCK_SIZE, primitiveCount);
+                    for (uint32_t i = block * PARALLEL_BLOCK_SIZE; i < blockEnd; ++i)
+                    {
+                        const TLASPrimitive& prim = primitives[i];
+                        TLASBuildPrimitive& buildPrim = buildPrimitives[i];
+                        buildPrim.aabbMin = _mm_setr_ps(prim.aabbMin.x, prim.aabbMin.y, prim.aabbMin.z, 0.0f);
+                        buildPrim.aabbMax = _mm_setr_ps(prim.aabbMax.x, prim.aabbMax.y, prim.aabbMax.z, 0.0f);
+                        buildPrim.centroid = _mm_mul_ps(_mm_add_ps(buildPrim.aabbMin, buildPrim.aabbMax), half);
+                        buildPrim.instanceIndex = prim.instanceIndex;
+                        bounds.Grow(buildPrim);
+                    }
+                }
+            });
+
+            TLASBuildRange rootRange = { 0, 0, primitiveCount, 1, {} };
+            rootRange.bounds.Reset();
+            for (const TLASBounds& bounds : blockBounds)
+            {
+                rootRange.bounds.Grow(bounds);
+            }
+            WriteNodeBounds(root, rootRange.bounds);
+
+            TaskGroup subtreeTasks(scheduler);
+            TLASBuildContext ctx = { buildPrimitives, outTlasNodes, scheduler, &subtreeTasks };
+            SubdivideSAH(ctx, rootRange);
+            subtreeTasks.Wait();
+            outTlasNodes.resize(2 * primitiveCount - 1);
+        }
 
-        outTlasNodes.resize(nodesUsed);
+        stats.InstanceCount = primitiveCount;
+        stats.NodeCount = static_cast<uint32_t>(outTlasNodes.size());
+        stats.SAHCost = BVHOptimizer::ComputeSAHCost(outTlasNodes);
+        stats.BuildTimeMs = buildTimer.ElapsedMillis();
+        return stats;
     }
-}
\ No newline at end of file
+}
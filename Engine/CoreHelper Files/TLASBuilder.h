@@ -10,14 +10,40 @@ struct TLASPrimitive
     uint32_t instanceIndex;
 };
 
+enum class TLASBuildMode
+{
+    Midpoint, // Splits the longest axis in the middle. Fastest, but poor when instances overlap or vary in size.
+    BinnedSAH // Parallel binned SAH over the instance bounds
+};
+
+struct TLASBuildSettings
+{
+    TLASBuildMode Mode = TLASBuildMode::BinnedSAH;
+};
+
+struct TLASBuildStats
+{
+    uint32_t InstanceCount = 0; // Instances with a BLAS, one per leaf
+    uint32_t NodeCount = 0;
+    float SAHCost = 0.0f;       // See BVHOptimizer::ComputeSAHCost
+    float BuildTimeMs = 0.0f;
+};
+
 class AccelerationStructureManager;
+class TaskScheduler;
 
 namespace TLASBuilder
 {
-    void Build(
+    // Every leaf holds one instance (its index in instances); instances without a built BLAS are skipped.
+    // Both modes store a node's children after it (child index > parent index, asserted while building), which the
+    // manager's reverse sweeps and refit levels rely on. The binned SAH build gives the same tree for any thread count.
+    // scheduler: pool to run on (nullptr = the shared TaskScheduler::Get()).
+    TLASBuildStats Build(
         const std::vector<ModelInstance>& instances,
         std::vector<BVHNode>& outTlasNodes,
-        const AccelerationStructureManager* pAccelManager
+        const AccelerationStructureManager* pAccelManager,
+        const TLASBuildSettings& settings = TLASBuildSettings(),
+        TaskScheduler* scheduler = nullptr
     );
     void TransformAABB(const DirectX::XMFLOAT3& localMin, const DirectX::XMFLOAT3& localMax, const DirectX::XMMATRIX& transform, DirectX::XMFLOAT3& outWorldMin, DirectX::XMFLOAT3& outWorldMax);
 }
@@ -0,0 +1,203 @@
+#include "TaskScheduler.h"
+
+// Identifies the pool (and the slot in it) that the current thread works for.
+static thread_local TaskScheduler* t_currentScheduler = nullptr;
+static thread_local uint32_t t_workerIndex = 0;
+
+TaskScheduler* TaskScheduler::Get()
+{
+    // Function-local static so that builders started from several threads at once still get a single pool.
+    static TaskScheduler s_instance;
+    return &s_instance;
+}
+
+TaskScheduler::TaskScheduler(uint32_t threadCount, bool callerHelps)
+    : m_callerHelps(callerHelps)
+{
+    if (threadCount == 0)
+    {
+        threadCount = (std::max)(1u, std::thread::hardware_concurrency());
+    }
+
+    // The calling thread helps while it waits, so only threadCount - 1 background workers are started.
+    uint32_t workerCount = callerHelps ? threadCount - 1 : threadCount;
+    for (uint32_t i = 0; i <= workerCount; ++i)
+    {
+        m_queues.push_back(std::make_unique<TaskQueue>());
+    }
+
+    m_workers.reserve(workerCount);
+    for (uint32_t i = 0; i < workerCount; ++i)
+    {
+        m_workers.emplace_back(&TaskScheduler::WorkerLoop, this, i);
+    }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stopping = true;
+    }
+    m_wakeCondition.notify_all();
+
+    for (auto& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+void TaskScheduler::Submit(Task&& task)
+{
+    // Workers push onto their own deque; everyone else goes through the injection queue.
+    TaskQueue& queue = (t_currentScheduler == this) ? *m_queues[t_workerIndex] : *m_queues.back();
+    {
+        std::lock_guard<std::mutex> lock(queue.Mutex);
+        queue.Tasks.push_back(std::move(task));
+    }
+    m_queuedTaskCount.fetch_add(1);
+
+    // Taking the sleep mutex orders this notify after any worker's predicate check, so no wake-up is lost.
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+    }
+    m_wakeCondition.notify_one();
+}
+
+bool TaskScheduler::PopTask(Task& outTask)
+{
+    const uint32_t workerCount = static_cast<uint32_t>(m_workers.size());
+    const bool isWorker = (t_currentScheduler == this);
+
+    auto tryPop = [&](TaskQueue& queue, bool fromBack)
+    {
+        std::lock_guard<std::mutex> lock(queue.Mutex);
+        if (queue.Tasks.empty())
+            return false;
+
+        if (fromBack)
+        {
+            outTask = std::move(queue.Tasks.back());
+            queue.Tasks.pop_back();
+        }
+        else
+        {
+            outTask = std::move(queue.Tasks.front());
+            queue.Tasks.pop_front();
+        }
+        return true;
+    };
+
+    bool found = false;
+
+    // 1. Own deque, newest first
+    if (isWorker)
+    {
+        found = tryPop(*m_queues[t_workerIndex], true);
+    }
+
+    // 2. Work submitted from outside the pool
+    if (!found)
+    {
+        found = tryPop(*m_queues.back(), false);
+    }
+
+    // 3. Steal the oldest task from another worker, starting with our neighbour
+    for (uint32_t i = 0; !found && i < workerCount; ++i)
+    {
+        uint32_t victim = isWorker ? (t_workerIndex + 1 + i) % workerCount : i;
+        if (isWorker && victim == t_workerIndex)
+            continue;
+        found = tryPop(*m_queues[victim], false);
+    }
+
+    if (found)
+    {
+        m_queuedTaskCount.fetch_sub(1);
+    }
+    return found;
+}
+
+bool TaskScheduler::TryRunTask()
+{
+    Task task;
+    if (!PopTask(task))
+        return false;
+
+    task.Work();
+    task.Group->m_pendingCount.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+void TaskScheduler::WorkerLoop(uint32_t workerIndex)
+{
+    t_currentScheduler = this;
+    t_workerIndex = workerIndex;
+
+    while (true)
+    {
+        if (TryRunTask())
+            continue;
+
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wakeCondition.wait(lock, [this] { return m_stopping || m_queuedTaskCount.load() > 0; });
+        if (m_stopping && m_queuedTaskCount.load() == 0)
+            return;
+    }
+}
+
+void TaskScheduler::ParallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t, uint32_t)>& func)
+{
+    if (count == 0)
+        return;
+
+    grainSize = (std::max)(grainSize, 1u);
+    const uint32_t chunkCount = (count + grainSize - 1) / grainSize;
+    if (chunkCount == 1)
+    {
+        func(0, count);
+        return;
+    }
+
+    TaskGroup group(this);
+    for (uint32_t chunk = 1; chunk < chunkCount; ++chunk)
+    {
+        uint32_t begin = chunk * grainSize;
+        uint32_t end = (std::min)(begin + grainSize, count);
+        group.Run([&func, begin, end] { func(begin, end); });
+    }
+    func(0, (std::min)(grainSize, count));
+    group.Wait();
+}
+
+TaskGroup::TaskGroup(TaskScheduler* scheduler)
+    : m_scheduler(scheduler ? scheduler : TaskScheduler::Get())
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    Wait();
+}
+
+void TaskGroup::Run(std::function<void()> work)
+{
+    m_pendingCount.fetch_add(1, std::memory_order_relaxed);
+
+    TaskScheduler::Task task;
+    task.Work = std::move(work);
+    task.Group = this;
+    m_scheduler->Submit(std::move(task));
+}
+
+void TaskGroup::Wait()
+{
+    // Help with whatever is queued (not necessarily our own tasks) until the group drains.
+    while (m_pendingCount.load(std::memory_order_acquire) > 0)
+    {
+        if (!m_scheduler->TryRunTask())
+        {
+            std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+// Work-stealing thread pool shared by the CPU-side builders and the CPU ray tracer.
+// Every worker owns a deque: it pushes and pops its own tasks at the back (LIFO, cache friendly)
+// while idle workers steal from the front (FIFO, i.e. the largest pending pieces of work).
+// Threads that are not part of the pool submit into a separate injection queue.
+class TaskScheduler
+{
+public:
+    // threadCount counts the calling thread, which takes part while waiting on a TaskGroup.
+    // 0 = one thread per hardware thread.
+    // callerHelps = false starts threadCount workers instead, for pools whose owner never waits on a TaskGroup.
+    explicit TaskScheduler(uint32_t threadCount = 0, bool callerHelps = true);
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // The shared engine-wide pool.
+    static TaskScheduler* Get();
+
+    uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_workers.size()) + (m_callerHelps ? 1 : 0); }
+
+    // Runs func(begin, end) over [0, count) in chunks of at most grainSize items and waits for completion.
+    // Chunk boundaries depend only on count and grainSize, never on the number of threads.
+    void ParallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t, uint32_t)>& func);
+
+private:
+    friend class TaskGroup;
+
+    struct Task
+    {
+        std::function<void()> Work;
+        TaskGroup* Group = nullptr;
+    };
+
+    struct TaskQueue
+    {
+        std::mutex Mutex;
+        std::deque<Task> Tasks;
+    };
+
+    void Submit(Task&& task);
+    bool TryRunTask();
+    bool PopTask(Task& outTask);
+    void WorkerLoop(uint32_t workerIndex);
+
+    std::vector<std::thread> m_workers;
+    bool m_callerHelps = true;
+    std::vector<std::unique_ptr<TaskQueue>> m_queues; // One per worker, plus the injection queue at the end
+
+    std::atomic<uint32_t> m_queuedTaskCount{ 0 };
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wakeCondition;
+    bool m_stopping = false;
+};
+
+// A set of tasks that can be waited on together. Wait() executes pending tasks on the calling
+// thread instead of blocking, so groups can be nested freely inside other tasks.
+class TaskGroup
+{
+public:
+    explicit TaskGroup(TaskScheduler* scheduler = nullptr);
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void Run(std::function<void()> work);
+    void Wait();
+
+    TaskScheduler* GetScheduler() const { return m_scheduler; }
+
+private:
+    friend class TaskScheduler;
+
+    TaskScheduler* m_scheduler;
+    std::atomic<uint32_t> m_pendingCount{ 0 };
+};
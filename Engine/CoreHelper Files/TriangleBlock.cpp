@@ -0,0 +1,282 @@
+#include "TriangleBlock.h"
+#include "TaskScheduler.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <immintrin.h>
+
+namespace
+{
+    struct LeafRange
+    {
+        uint32_t firstTriangle;
+        uint32_t count;
+    };
+
+    // Picks the closest lane set in hitMask; on equal distances the lower lane wins.
+    bool SelectClosestLane(uint32_t hitMask, const float* t, const float* u, const float* v, uint32_t firstTriangle,
+        TriangleBlockHit& outHit)
+    {
+        if (hitMask == 0)
+            return false;
+
+        float bestT = FLT_MAX;
+        for (uint32_t lane = 0; hitMask != 0; ++lane, hitMask >>= 1)
+        {
+            if ((hitMask & 1) && t[lane] < bestT)
+            {
+                bestT = t[lane];
+                outHit = { t[lane], u[lane], v[lane], firstTriangle + lane };
+            }
+        }
+        return true;
+    }
+
+    // Loads the used lanes of the block from its triangles; the unused lanes keep their zeros.
+    template <int Width>
+    void FillLanes(TriangleBlock<Width>& block, const std::vector<TrianglePositions>& triangles)
+    {
+        for (uint32_t lane = 0; lane < block.Count; ++lane)
+        {
+            const TrianglePositions& tri = triangles[block.FirstTriangle + lane];
+            const float* v0 = &tri.v0.x;
+            const float* v1 = &tri.v1.x;
+            const float* v2 = &tri.v2.x;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                block.V0[axis][lane] = v0[axis];
+                block.Edge1[axis][lane] = v1[axis] - v0[axis];
+                block.Edge2[axis][lane] = v2[axis] - v0[axis];
+            }
+        }
+    }
+}
+
+template <int Width>
+void TriangleBlocks::Pack(const std::vector<BVHNode>& nodes, uint32_t rootIndex, const std::vector<TrianglePositions>& triangles,
+    uint32_t baseTriangleIndex, std::vector<TriangleBlock<Width>>& outBlocks, std::vector<uint32_t>& outLeafFirstBlock)
+{
+    // 1. Collect the leaves; treelet restructuring can leave them out of triangle order, so sort them
+    std::vector<LeafRange> leaves;
+    std::vector<uint32_t> stack = { rootIndex };
+    while (!stack.empty())
+    {
+        const BVHNode& node = nodes[stack.back()];
+        stack.pop_back();
+        if (node.triangleCount > 0)
+        {
+            leaves.push_back({ baseTriangleIndex + node.leftChildOrFirstTriangleIndex, static_cast<uint32_t>(node.triangleCount) });
+        }
+        else
+        {
+            stack.push_back(node.leftChildOrFirstTriangleIndex + 1);
+            stack.push_back(node.leftChildOrFirstTriangleIndex);
+        }
+    }
+    std::sort(leaves.begin(), leaves.end(), [](const LeafRange& a, const LeafRange& b) { return a.firstTriangle < b.firstTriangle; });
+
+    if (outLeafFirstBlock.size() < triangles.size())
+    {
+        outLeafFirstBlock.resize(triangles.size(), INVALID_BLOCK);
+    }
+
+    // 2. Pack each leaf into ceil(count / Width) blocks
+    for (const LeafRange& leaf : leaves)
+    {
+        outLeafFirstBlock[leaf.firstTriangle] = static_cast<uint32_t>(outBlocks.size());
+        for (uint32_t start = 0; start < leaf.count; start += Width)
+        {
+            TriangleBlock<Width>& block = outBlocks.emplace_back();
+            memset(&block, 0, sizeof(block));
+            block.FirstTriangle = leaf.firstTriangle + start;
+            block.Count = (std::min)(leaf.count - start, (uint32_t)Width);
+
+            FillLanes(block, triangles);
+        }
+    }
+}
+
+template <int Width>
+void TriangleBlocks::Refit(std::vector<TriangleBlock<Width>>& blocks, uint32_t firstBlock, uint32_t blockCount,
+    const std::vector<TrianglePositions>& triangles)
+{
+    TaskScheduler::Get()->ParallelFor(blockCount, 1024, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t b = firstBlock + begin; b < firstBlock + end; ++b)
+        {
+            FillLanes(blocks[b], triangles);
+        }
+    });
+}
+
+template void TriangleBlocks::Pack<4>(const std::vector<BVHNode>&, uint32_t, const std::vector<TrianglePositions>&, uint32_t,
+    std::vector<TriangleBlock4>&, std::vector<uint32_t>&);
+template void TriangleBlocks::Pack<8>(const std::vector<BVHNode>&, uint32_t, const std::vector<TrianglePositions>&, uint32_t,
+    std::vector<TriangleBlock8>&, std::vector<uint32_t>&);
+template void TriangleBlocks::Refit<4>(std::vector<TriangleBlock4>&, uint32_t, uint32_t, const std::vector<TrianglePositions>&);
+template void TriangleBlocks::Refit<8>(std::vector<TriangleBlock8>&, uint32_t, uint32_t, const std::vector<TrianglePositions>&);
+
+bool TriangleBlocks::Intersect(const TriangleBlock4& block, const WideTraversalRay& ray, float tMax, TriangleBlockHit& outHit)
+{
+    const __m128 dx = _mm_set1_ps(ray.Direction.x), dy = _mm_set1_ps(ray.Direction.y), dz = _mm_set1_ps(ray.Direction.z);
+    const __m128 e1x = _mm_load_ps(block.Edge1[0]), e1y = _mm_load_ps(block.Edge1[1]), e1z = _mm_load_ps(block.Edge1[2]);
+    const __m128 e2x = _mm_load_ps(block.Edge2[0]), e2y = _mm_load_ps(block.Edge2[1]), e2z = _mm_load_ps(block.Edge2[2]);
+
+    // 1. h = d x e2, a = e1 . h; reject rays parallel to the triangle (and the empty lanes, where a = 0)
+    const __m128 hx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 hy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 hz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    const __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+    __m128 valid = _mm_or_ps(_mm_cmple_ps(a, _mm_set1_ps(-1e-6f)), _mm_cmpge_ps(a, _mm_set1_ps(1e-6f)));
+    if (_mm_movemask_ps(valid) == 0)
+        return false;
+
+    // 2. Barycentrics
+    const __m128 f = _mm_div_ps(_mm_set1_ps(1.0f), a);
+    const __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.Origin.x), _mm_load_ps(block.V0[0]));
+    const __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.Origin.y), _mm_load_ps(block.V0[1]));
+    const __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.Origin.z), _mm_load_ps(block.V0[2]));
+    const __m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(u, _mm_setzero_ps()), _mm_cmple_ps(u, _mm_set1_ps(1.0f))));
+
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    const __m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(v, _mm_setzero_ps()), _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f))));
+
+    // 3. Distance
+    const __m128 t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(0.0001f)), _mm_cmplt_ps(t, _mm_set1_ps(tMax))));
+
+    const uint32_t hitMask = static_cast<uint32_t>(_mm_movemask_ps(valid));
+    if (hitMask == 0)
+        return false;
+
+    alignas(16) float tLanes[4], uLanes[4], vLanes[4];
+    _mm_store_ps(tLanes, t);
+    _mm_store_ps(uLanes, u);
+    _mm_store_ps(vLanes, v);
+    return SelectClosestLane(hitMask, tLanes, uLanes, vLanes, block.FirstTriangle, outHit);
+}
+
+bool TriangleBlocks::Intersect(const TriangleBlock8& block, const WideTraversalRay& ray, float tMax, TriangleBlockHit& outHit)
+{
+    const __m256 dx = _mm256_set1_ps(ray.Direction.x), dy = _mm256_set1_ps(ray.Direction.y), dz = _mm256_set1_ps(ray.Direction.z);
+    const __m256 e1x = _mm256_load_ps(block.Edge1[0]), e1y = _mm256_load_ps(block.Edge1[1]), e1z = _mm256_load_ps(block.Edge1[2]);
+    const __m256 e2x = _mm256_load_ps(block.Edge2[0]), e2y = _mm256_load_ps(block.Edge2[1]), e2z = _mm256_load_ps(block.Edge2[2]);
+
+    // 1. h = d x e2, a = e1 . h; reject rays parallel to the triangle (and the empty lanes, where a = 0)
+    const __m256 hx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    const __m256 hy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    const __m256 hz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    const __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz));
+    __m256 valid = _mm256_or_ps(_mm256_cmp_ps(a, _mm256_set1_ps(-1e-6f), _CMP_LE_OQ), _mm256_cmp_ps(a, _mm256_set1_ps(1e-6f), _CMP_GE_OQ));
+    if (_mm256_movemask_ps(valid) == 0)
+        return false;
+
+    // 2. Barycentrics
+    const __m256 f = _mm256_div_ps(_mm256_set1_ps(1.0f), a);
+    const __m256 sx = _mm256_sub_ps(_mm256_set1_ps(ray.Origin.x), _mm256_load_ps(block.V0[0]));
+    const __m256 sy = _mm256_sub_ps(_mm256_set1_ps(ray.Origin.y), _mm256_load_ps(block.V0[1]));
+    const __m256 sz = _mm256_sub_ps(_mm256_set1_ps(ray.Origin.z), _mm256_load_ps(block.V0[2]));
+    const __m256 u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)), _mm256_mul_ps(sz, hz)));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(u, _mm256_set1_ps(1.0f), _CMP_LE_OQ)));
+
+    const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+    const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+    const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+    const __m256 v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ),
+        _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ)));
+
+    // 3. Distance
+    const __m256 t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(0.0001f), _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ)));
+
+    const uint32_t hitMask = static_cast<uint32_t>(_mm256_movemask_ps(valid));
+    if (hitMask == 0)
+        return false;
+
+    alignas(32) float tLanes[8], uLanes[8], vLanes[8];
+    _mm256_store_ps(tLanes, t);
+    _mm256_store_ps(uLanes, u);
+    _mm256_store_ps(vLanes, v);
+    return SelectClosestLane(hitMask, tLanes, uLanes, vLanes, block.FirstTriangle, outHit);
+}
+
+bool TriangleBlocks::Occluded(const TriangleBlock4& block, const WideTraversalRay& ray, float tMax)
+{
+    const __m128 dx = _mm_set1_ps(ray.Direction.x), dy = _mm_set1_ps(ray.Direction.y), dz = _mm_set1_ps(ray.Direction.z);
+    const __m128 e1x = _mm_load_ps(block.Edge1[0]), e1y = _mm_load_ps(block.Edge1[1]), e1z = _mm_load_ps(block.Edge1[2]);
+    const __m128 e2x = _mm_load_ps(block.Edge2[0]), e2y = _mm_load_ps(block.Edge2[1]), e2z = _mm_load_ps(block.Edge2[2]);
+
+    // 1. h = d x e2, a = e1 . h; reject rays parallel to the triangle (and the empty lanes, where a = 0)
+    const __m128 hx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 hy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 hz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    const __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+    __m128 valid = _mm_or_ps(_mm_cmple_ps(a, _mm_set1_ps(-1e-6f)), _mm_cmpge_ps(a, _mm_set1_ps(1e-6f)));
+    if (_mm_movemask_ps(valid) == 0)
+        return false;
+
+    // 2. Unnormalized barycentrics, with the sign of a moved over so that they compare against |a|
+    const __m128 sign = _mm_and_ps(a, _mm_set1_ps(-0.0f));
+    const __m128 det = _mm_xor_ps(a, sign);
+    const __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.Origin.x), _mm_load_ps(block.V0[0]));
+    const __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.Origin.y), _mm_load_ps(block.V0[1]));
+    const __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.Origin.z), _mm_load_ps(block.V0[2]));
+    const __m128 u = _mm_xor_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)), sign);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(u, _mm_setzero_ps()), _mm_cmple_ps(u, det)));
+
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    const __m128 v = _mm_xor_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), sign);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(v, _mm_setzero_ps()), _mm_cmple_ps(_mm_add_ps(u, v), det)));
+
+    // 3. Distance, scaled by |a| like the bounds it is compared with
+    const __m128 t = _mm_xor_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), sign);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, _mm_mul_ps(det, _mm_set1_ps(0.0001f))), _mm_cmplt_ps(t, _mm_mul_ps(det, _mm_set1_ps(tMax)))));
+
+    return _mm_movemask_ps(valid) != 0;
+}
+
+bool TriangleBlocks::Occluded(const TriangleBlock8& block, const WideTraversalRay& ray, float tMax)
+{
+    const __m256 dx = _mm256_set1_ps(ray.Direction.x), dy = _mm256_set1_ps(ray.Direction.y), dz = _mm256_set1_ps(ray.Direction.z);
+    const __m256 e1x = _mm256_load_ps(block.Edge1[0]), e1y = _mm256_load_ps(block.Edge1[1]), e1z = _mm256_load_ps(block.Edge1[2]);
+    const __m256 e2x = _mm256_load_ps(block.Edge2[0]), e2y = _mm256_load_ps(block.Edge2[1]), e2z = _mm256_load_ps(block.Edge2[2]);
+
+    // 1. h = d x e2, a = e1 . h; reject rays parallel to the triangle (and the empty lanes, where a = 0)
+    const __m256 hx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    const __m256 hy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    const __m256 hz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    const __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz));
+    __m256 valid = _mm256_or_ps(_mm256_cmp_ps(a, _mm256_set1_ps(-1e-6f), _CMP_LE_OQ), _mm256_cmp_ps(a, _mm256_set1_ps(1e-6f), _CMP_GE_OQ));
+    if (_mm256_movemask_ps(valid) == 0)
+        return false;
+
+    // 2. Unnormalized barycentrics, with the sign of a moved over so that they compare against |a|
+    const __m256 sign = _mm256_and_ps(a, _mm256_set1_ps(-0.0f));
+    const __m256 det = _mm256_xor_ps(a, sign);
+    const __m256 sx = _mm256_sub_ps(_mm256_set1_ps(ray.Origin.x), _mm256_load_ps(block.V0[0]));
+    const __m256 sy = _mm256_sub_ps(_mm256_set1_ps(ray.Origin.y), _mm256_load_ps(block.V0[1]));
+    const __m256 sz = _mm256_sub_ps(_mm256_set1_ps(ray.Origin.z), _mm256_load_ps(block.V0[2]));
+    const __m256 u = _mm256_xor_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)), _mm256_mul_ps(sz, hz)), sign);
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(u, det, _CMP_LE_OQ)));
+
+    const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+    const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+    const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+    const __m256 v = _mm256_xor_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), sign);
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ),
+        _mm256_cmp_ps(_mm256_add_ps(u, v), det, _CMP_LE_OQ)));
+
+    // 3. Distance, scaled by |a| like the bounds it is compared with
+    const __m256 t = _mm256_xor_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), sign);
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_mul_ps(det, _mm256_set1_ps(0.0001f)), _CMP_GT_OQ),
+        _mm256_cmp_ps(t, _mm256_mul_ps(det, _mm256_set1_ps(tMax)), _CMP_LT_OQ)));
+
+    return _mm256_movemask_ps(valid) != 0;
+}
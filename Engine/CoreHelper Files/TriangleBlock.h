@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Mesh.h"
+#include "WideBVH.h"
+
+// Up to Width consecutive triangles of one BLAS leaf in SoA form, with the Moller-Trumbore edges precomputed,
+// so that one ray is tested against the whole block with a single SSE (Width 4) or AVX (Width 8) kernel.
+// Unused lanes are zero and never report a hit.
+template <int Width>
+struct alignas(Width * 4) TriangleBlock
+{
+    static constexpr int WIDTH = Width;
+
+    float V0[3][Width];
+    float Edge1[3][Width]; // v1 - v0
+    float Edge2[3][Width]; // v2 - v0
+    uint32_t FirstTriangle; // Absolute index in the uber triangle arrays of lane 0; lane i holds FirstTriangle + i
+    uint32_t Count;
+};
+
+using TriangleBlock4 = TriangleBlock<4>; // 160 bytes
+using TriangleBlock8 = TriangleBlock<8>; // 320 bytes
+
+struct TriangleBlockHit
+{
+    float T;
+    float U;
+    float V;
+    uint32_t Triangle; // Absolute triangle index
+};
+
+namespace TriangleBlocks
+{
+    const uint32_t INVALID_BLOCK = 0xFFFFFFFFu;
+
+    // Packs the leaves of the BLAS rooted at nodes[rootIndex] into blocks and appends them to outBlocks.
+    // Leaf triangle indices are relative to baseTriangleIndex, child indices absolute (as in the uber BLAS array).
+    // Every leaf starts a new block and leaves are packed in triangle order, so a range made of adjacent leaves
+    // (as wide leaves are) covers consecutive blocks. outLeafFirstBlock is indexed by absolute triangle index and
+    // receives the first block of each leaf; it is grown to cover the triangles.
+    template <int Width>
+    void Pack(const std::vector<BVHNode>& nodes, uint32_t rootIndex, const std::vector<TrianglePositions>& triangles,
+        uint32_t baseTriangleIndex, std::vector<TriangleBlock<Width>>& outBlocks, std::vector<uint32_t>& outLeafFirstBlock);
+
+    // Reloads blockCount blocks from firstBlock on (one packed BLAS) from moved triangles.
+    // Leaf ranges do not change on a refit, so the block layout and the leaf-to-block table stay valid.
+    template <int Width>
+    void Refit(std::vector<TriangleBlock<Width>>& blocks, uint32_t firstBlock, uint32_t blockCount,
+        const std::vector<TrianglePositions>& triangles);
+
+    // Closest hit in the block with t in (0.0001, tMax); ties go to the lower lane, as with sequential tests.
+    // The arithmetic matches the scalar test operation for operation, so both report the same hits.
+    bool Intersect(const TriangleBlock4& block, const WideTraversalRay& ray, float tMax, TriangleBlockHit& outHit);
+
+    // AVX kernel; only call it when CpuFeatures::Get().AVX is set.
+    bool Intersect(const TriangleBlock8& block, const WideTraversalRay& ray, float tMax, TriangleBlockHit& outHit);
+
+    // Whether any triangle of the block is hit with t in (0.0001, tMax), for occlusion rays. Nothing but the answer
+    // is needed, so the barycentrics and distance are compared against the determinant instead of divided by it.
+    // The 8-wide kernel needs AVX as well.
+    bool Occluded(const TriangleBlock4& block, const WideTraversalRay& ray, float tMax);
+    bool Occluded(const TriangleBlock8& block, const WideTraversalRay& ray, float tMax);
+}
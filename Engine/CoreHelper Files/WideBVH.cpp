@@ -0,0 +1,309 @@
+#include "WideBVH.h"
+#include <algorithm>
+#include <cfloat>
+
+namespace
+{
+    inline float NodeSurfaceArea(const DirectX::XMFLOAT3& aabbMin, const DirectX::XMFLOAT3& aabbMax)
+    {
+        float ex = aabbMax.x - aabbMin.x;
+        float ey = aabbMax.y - aabbMin.y;
+        float ez = aabbMax.z - aabbMin.z;
+        return 2.0f * (ex * ey + ex * ez + ey * ez);
+    }
+
+    // Per binary node: SAH cost of the subtree and, if its triangles form one contiguous range, that range.
+    struct SubtreeInfo
+    {
+        float Cost = 0.0f;
+        uint32_t FirstPrimitive = 0;
+        uint32_t PrimitiveCount = 0;
+        bool Contiguous = false;
+        bool MakeLeaf = false; // Becomes a single leaf in the wide tree
+    };
+
+    template <int Width>
+    struct CollapseContext
+    {
+        const std::vector<BVHNode>& binaryNodes;
+        std::vector<WideBVHNode<Width>>& wideNodes;
+        std::vector<SubtreeInfo> info; // Indexed by binary node index - indexOffset
+        uint32_t indexOffset = 0;
+        uint32_t maxLeafSize = 1;
+
+        CollapseContext(const std::vector<BVHNode>& binary, std::vector<WideBVHNode<Width>>& wide)
+            : binaryNodes(binary), wideNodes(wide) {}
+
+        SubtreeInfo& Info(uint32_t binaryIndex) { return info[binaryIndex - indexOffset]; }
+    };
+
+    // Finds the range of node indices used by the subtree so the per-node info fits in one flat array.
+    void FindIndexRange(const std::vector<BVHNode>& nodes, uint32_t rootIndex, uint32_t& outMin, uint32_t& outMax)
+    {
+        outMin = outMax = rootIndex;
+        std::vector<uint32_t> stack = { rootIndex };
+        while (!stack.empty())
+        {
+            const BVHNode& node = nodes[stack.back()];
+            stack.pop_back();
+            if (node.triangleCount > 0)
+                continue;
+
+            uint32_t left = static_cast<uint32_t>(node.leftChildOrFirstTriangleIndex);
+            outMin = (std::min)(outMin, left);
+            outMax = (std::max)(outMax, left + 1);
+            stack.push_back(left);
+            stack.push_back(left + 1);
+        }
+    }
+
+    // Bottom-up SAH costs (unit node and triangle costs, as in the builders). A subtree is collapsed into one
+    // leaf when its triangles are contiguous, there are few enough of them and testing them all is cheaper.
+    template <int Width>
+    void ComputeSubtreeInfo(CollapseContext<Width>& ctx, uint32_t binaryIndex)
+    {
+        const BVHNode& node = ctx.binaryNodes[binaryIndex];
+        SubtreeInfo& info = ctx.Info(binaryIndex);
+        const float area = NodeSurfaceArea(node.aabbMin, node.aabbMax);
+
+        if (node.triangleCount > 0)
+        {
+            info.Cost = area * node.triangleCount;
+            info.FirstPrimitive = static_cast<uint32_t>(node.leftChildOrFirstTriangleIndex);
+            info.PrimitiveCount = static_cast<uint32_t>(node.triangleCount);
+            info.Contiguous = true;
+            info.MakeLeaf = true;
+            return;
+        }
+
+        const uint32_t leftIndex = static_cast<uint32_t>(node.leftChildOrFirstTriangleIndex);
+        ComputeSubtreeInfo(ctx, leftIndex);
+        ComputeSubtreeInfo(ctx, leftIndex + 1);
+        const SubtreeInfo& left = ctx.Info(leftIndex);
+        const SubtreeInfo& right = ctx.Info(leftIndex + 1);
+
+        info.Cost = area + left.Cost + right.Cost;
+        info.PrimitiveCount = left.PrimitiveCount + right.PrimitiveCount;
+        info.FirstPrimitive = (std::min)(left.FirstPrimitive, right.FirstPrimitive);
+        info.Contiguous = left.Contiguous && right.Contiguous &&
+            (left.FirstPrimitive + left.PrimitiveCount == right.FirstPrimitive || right.FirstPrimitive + right.PrimitiveCount == left.FirstPrimitive);
+        info.MakeLeaf = info.Contiguous && info.PrimitiveCount <= ctx.maxLeafSize && area * info.PrimitiveCount <= info.Cost;
+    }
+
+    template <int Width>
+    uint32_t EmitWideNode(CollapseContext<Width>& ctx, uint32_t binaryIndex)
+    {
+        const std::vector<BVHNode>& nodes = ctx.binaryNodes;
+
+        // 1. Start from the two children (or the node itself when the whole tree is one leaf)
+        uint32_t slots[Width];
+        int slotCount = 0;
+        if (ctx.Info(binaryIndex).MakeLeaf)
+        {
+            slots[slotCount++] = binaryIndex;
+        }
+        else
+        {
+            slots[slotCount++] = static_cast<uint32_t>(nodes[binaryIndex].leftChildOrFirstTriangleIndex);
+            slots[slotCount++] = slots[0] + 1;
+        }
+
+        // 2. Open the internal child with the largest surface area until the node is full. Its children take its
+        //    place so that the slot order stays the binary left-to-right order.
+        while (slotCount < Width)
+        {
+            int best = -1;
+            float bestArea = -1.0f;
+            for (int i = 0; i < slotCount; ++i)
+            {
+                if (ctx.Info(slots[i]).MakeLeaf)
+                    continue;
+
+                float area = NodeSurfaceArea(nodes[slots[i]].aabbMin, nodes[slots[i]].aabbMax);
+                if (area > bestArea)
+                {
+                    bestArea = area;
+                    best = i;
+                }
+            }
+            if (best < 0)
+                break;
+
+            uint32_t left = static_cast<uint32_t>(nodes[slots[best]].leftChildOrFirstTriangleIndex);
+            for (int i = slotCount; i > best + 1; --i)
+            {
+                slots[i] = slots[i - 1];
+            }
+            slots[best] = left;
+            slots[best + 1] = left + 1;
+            slotCount++;
+        }
+
+        // 3. Write the node; empty slots get inverted bounds
+        const uint32_t wideIndex = static_cast<uint32_t>(ctx.wideNodes.size());
+        WideBVHNode<Width> wideNode;
+        for (int i = 0; i < Width; ++i)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                wideNode.BoundsMin[axis][i] = FLT_MAX;
+                wideNode.BoundsMax[axis][i] = -FLT_MAX;
+            }
+            wideNode.Child[i] = -1;
+            wideNode.PrimitiveCount[i] = 0;
+        }
+
+        for (int i = 0; i < slotCount; ++i)
+        {
+            const BVHNode& child = nodes[slots[i]];
+            wideNode.BoundsMin[0][i] = child.aabbMin.x;
+            wideNode.BoundsMin[1][i] = child.aabbMin.y;
+            wideNode.BoundsMin[2][i] = child.aabbMin.z;
+            wideNode.BoundsMax[0][i] = child.aabbMax.x;
+            wideNode.BoundsMax[1][i] = child.aabbMax.y;
+            wideNode.BoundsMax[2][i] = child.aabbMax.z;
+
+            const SubtreeInfo& info = ctx.Info(slots[i]);
+            if (info.MakeLeaf)
+            {
+                wideNode.Child[i] = static_cast<int>(info.FirstPrimitive);
+                wideNode.PrimitiveCount[i] = info.PrimitiveCount;
+            }
+        }
+        ctx.wideNodes.push_back(wideNode);
+
+        // 4. Recurse into the internal children; the array may grow, so write the indices back afterwards
+        for (int i = 0; i < slotCount; ++i)
+        {
+            if (ctx.Info(slots[i]).MakeLeaf)
+                continue;
+
+            uint32_t childIndex = EmitWideNode(ctx, slots[i]);
+            ctx.wideNodes[wideIndex].Child[i] = static_cast<int>(childIndex);
+        }
+        return wideIndex;
+    }
+
+    // Post-order: refits every used slot of the node and returns the union of their bounds.
+    template <int Width>
+    void RefitWideNode(std::vector<WideBVHNode<Width>>& nodes, uint32_t index, const std::vector<TrianglePositions>& triangles,
+        uint32_t baseTriangleIndex, float outMin[3], float outMax[3])
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            outMin[axis] = FLT_MAX;
+            outMax[axis] = -FLT_MAX;
+        }
+
+        for (int i = 0; i < Width; ++i)
+        {
+            const int child = nodes[index].Child[i];
+            if (child < 0)
+                continue;
+
+            float childMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+            float childMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            const uint32_t primitiveCount = nodes[index].PrimitiveCount[i];
+            if (primitiveCount > 0)
+            {
+                for (uint32_t t = 0; t < primitiveCount; ++t)
+                {
+                    const TrianglePositions& tri = triangles[baseTriangleIndex + static_cast<uint32_t>(child) + t];
+                    const float* vertices[3] = { &tri.v0.x, &tri.v1.x, &tri.v2.x };
+                    for (const float* v : vertices)
+                    {
+                        for (int axis = 0; axis < 3; ++axis)
+                        {
+                            childMin[axis] = (std::min)(childMin[axis], v[axis]);
+                            childMax[axis] = (std::max)(childMax[axis], v[axis]);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                RefitWideNode(nodes, static_cast<uint32_t>(child), triangles, baseTriangleIndex, childMin, childMax);
+            }
+
+            WideBVHNode<Width>& node = nodes[index];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                node.BoundsMin[axis][i] = childMin[axis];
+                node.BoundsMax[axis][i] = childMax[axis];
+                outMin[axis] = (std::min)(outMin[axis], childMin[axis]);
+                outMax[axis] = (std::max)(outMax[axis], childMax[axis]);
+            }
+        }
+    }
+}
+
+namespace WideBVH
+{
+    template <int Width>
+    uint32_t Collapse(const std::vector<BVHNode>& binaryNodes, uint32_t rootIndex, std::vector<WideBVHNode<Width>>& outNodes, uint32_t maxLeafSize)
+    {
+        CollapseContext<Width> ctx(binaryNodes, outNodes);
+        ctx.maxLeafSize = (std::max)(maxLeafSize, 1u);
+
+        uint32_t minIndex, maxIndex;
+        FindIndexRange(binaryNodes, rootIndex, minIndex, maxIndex);
+        ctx.indexOffset = minIndex;
+        ctx.info.resize(maxIndex - minIndex + 1);
+
+        ComputeSubtreeInfo(ctx, rootIndex);
+        return EmitWideNode(ctx, rootIndex);
+    }
+
+    template <int Width>
+    void Refit(std::vector<WideBVHNode<Width>>& nodes, uint32_t rootIndex, const std::vector<TrianglePositions>& triangles, uint32_t baseTriangleIndex)
+    {
+        if (rootIndex >= nodes.size())
+            return;
+
+        float rootMin[3], rootMax[3];
+        RefitWideNode(nodes, rootIndex, triangles, baseTriangleIndex, rootMin, rootMax);
+    }
+
+    template <int Width>
+    void ComputeChildMasks(const std::vector<WideBVHNode<Width>>& nodes, const std::vector<uint8_t>& primitiveMasks, std::vector<uint8_t>& outChildMasks)
+    {
+        outChildMasks.assign(nodes.size() * Width, 0);
+
+        // Children come after their parent, so a reverse sweep finishes every child before its parent.
+        for (size_t n = nodes.size(); n-- > 0;)
+        {
+            const WideBVHNode<Width>& node = nodes[n];
+            for (int i = 0; i < Width; ++i)
+            {
+                if (node.Child[i] < 0)
+                    continue;
+
+                uint8_t mask = 0;
+                if (node.PrimitiveCount[i] > 0)
+                {
+                    for (uint32_t p = 0; p < node.PrimitiveCount[i]; ++p)
+                    {
+                        const size_t primitive = static_cast<size_t>(node.Child[i]) + p;
+                        mask |= primitive < primitiveMasks.size() ? primitiveMasks[primitive] : 0;
+                    }
+                }
+                else
+                {
+                    const uint8_t* grandchildMasks = &outChildMasks[static_cast<size_t>(node.Child[i]) * Width];
+                    for (int c = 0; c < Width; ++c)
+                    {
+                        mask |= grandchildMasks[c];
+                    }
+                }
+                outChildMasks[n * Width + i] = mask;
+            }
+        }
+    }
+
+    template uint32_t Collapse<4>(const std::vector<BVHNode>&, uint32_t, std::vector<WideBVHNode<4>>&, uint32_t);
+    template uint32_t Collapse<8>(const std::vector<BVHNode>&, uint32_t, std::vector<WideBVHNode<8>>&, uint32_t);
+    template void Refit<4>(std::vector<WideBVHNode<4>>&, uint32_t, const std::vector<TrianglePositions>&, uint32_t);
+    template void Refit<8>(std::vector<WideBVHNode<8>>&, uint32_t, const std::vector<TrianglePositions>&, uint32_t);
+    template void ComputeChildMasks<4>(const std::vector<WideBVHNode<4>>&, const std::vector<uint8_t>&, std::vector<uint8_t>&);
+    template void ComputeChildMasks<8>(const std::vector<WideBVHNode<8>>&, const std::vector<uint8_t>&, std::vector<uint8_t>&);
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+#include <immintrin.h>
+#include "Mesh.h"
+
+// N-ary BVH node for SIMD traversal on the CPU, collapsed from the binary BVHNode trees.
+// Child bounds are stored SoA (BoundsMin[axis][child]) so that one slab test covers every child of a node.
+// Unused child slots have inverted bounds (+FLT_MAX / -FLT_MAX) and never pass the slab test.
+template <int Width>
+struct alignas(32) WideBVHNode
+{
+    static constexpr int WIDTH = Width;
+
+    float BoundsMin[3][Width];
+    float BoundsMax[3][Width];
+    // If PrimitiveCount > 0 (leaf): index of the first triangle (BLAS) or the instance index (TLAS).
+    // If PrimitiveCount == 0 (internal): index of the child node. -1 for an unused slot.
+    int Child[Width];
+    uint32_t PrimitiveCount[Width];
+};
+
+using BVH4Node = WideBVHNode<4>; // 128 bytes, 32 per child
+using BVH8Node = WideBVHNode<8>; // 256 bytes, 32 per child
+
+// A ray prepared for wide traversal: reciprocal direction and per-axis near/far plane selection.
+struct WideTraversalRay
+{
+    DirectX::XMFLOAT3 Origin;
+    DirectX::XMFLOAT3 Direction;
+    DirectX::XMFLOAT3 InvDirection;
+    bool NegativeDirection[3];
+};
+
+namespace WideBVH
+{
+    // Collapses the binary tree rooted at binaryNodes[rootIndex] and appends the wide nodes to outNodes.
+    // Binary child indices must be absolute in binaryNodes (as in the uber BLAS array and the TLAS); wide child
+    // indices are absolute in outNodes and leaf indices are copied unchanged. Returns the index of the wide root.
+    // Binary subtrees holding a contiguous range of at most maxLeafSize triangles become a single leaf when the
+    // SAH says that is cheaper; pass 1 for the TLAS, whose leaves are single instances.
+    template <int Width>
+    uint32_t Collapse(const std::vector<BVHNode>& binaryNodes, uint32_t rootIndex, std::vector<WideBVHNode<Width>>& outNodes, uint32_t maxLeafSize = Width);
+
+    // Recomputes the child bounds of the wide tree rooted at nodes[rootIndex] from moved triangles, keeping the
+    // topology Collapse chose. Leaf indices are relative to baseTriangleIndex, as in the binary BLAS. Gives the same
+    // boxes as collapsing the refit binary tree would, without re-deciding which nodes to open.
+    template <int Width>
+    void Refit(std::vector<WideBVHNode<Width>>& nodes, uint32_t rootIndex, const std::vector<TrianglePositions>& triangles, uint32_t baseTriangleIndex);
+
+    // Per-child visibility masks of a wide TLAS: outChildMasks[n * Width + i] is the OR of primitiveMasks over every
+    // instance below child i of nodes[n], 0 for unused slots. Children must be stored after their parent, as
+    // Collapse emits them.
+    template <int Width>
+    void ComputeChildMasks(const std::vector<WideBVHNode<Width>>& nodes, const std::vector<uint8_t>& primitiveMasks, std::vector<uint8_t>& outChildMasks);
+
+    inline WideTraversalRay MakeRay(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction)
+    {
+        WideTraversalRay ray;
+        ray.Origin = origin;
+        ray.Direction = direction;
+        ray.InvDirection = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+        ray.NegativeDirection[0] = ray.InvDirection.x < 0.0f;
+        ray.NegativeDirection[1] = ray.InvDirection.y < 0.0f;
+        ray.NegativeDirection[2] = ray.InvDirection.z < 0.0f;
+        return ray;
+    }
+
+    namespace Detail
+    {
+        // Slab test of 4 boxes given as SoA near/far planes; returns the hit mask and stores the entry distances.
+        inline uint32_t SlabTest4(const __m128 nearPlanes[3], const __m128 farPlanes[3], const WideTraversalRay& ray, float tMax, float* outDistances)
+        {
+            const __m128 ox = _mm_set1_ps(ray.Origin.x), oy = _mm_set1_ps(ray.Origin.y), oz = _mm_set1_ps(ray.Origin.z);
+            const __m128 ix = _mm_set1_ps(ray.InvDirection.x), iy = _mm_set1_ps(ray.InvDirection.y), iz = _mm_set1_ps(ray.InvDirection.z);
+
+            __m128 tNear = _mm_max_ps(
+                _mm_max_ps(_mm_mul_ps(_mm_sub_ps(nearPlanes[0], ox), ix), _mm_mul_ps(_mm_sub_ps(nearPlanes[1], oy), iy)),
+                _mm_max_ps(_mm_mul_ps(_mm_sub_ps(nearPlanes[2], oz), iz), _mm_setzero_ps()));
+            __m128 tFar = _mm_min_ps(
+                _mm_min_ps(_mm_mul_ps(_mm_sub_ps(farPlanes[0], ox), ix), _mm_mul_ps(_mm_sub_ps(farPlanes[1], oy), iy)),
+                _mm_min_ps(_mm_mul_ps(_mm_sub_ps(farPlanes[2], oz), iz), _mm_set1_ps(tMax)));
+
+            _mm_storeu_ps(outDistances, tNear);
+            return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar)));
+        }
+
+#ifdef __AVX__
+        inline uint32_t SlabTest8(const __m256 nearPlanes[3], const __m256 farPlanes[3], const WideTraversalRay& ray, float tMax, float* outDistances)
+        {
+            const __m256 ox = _mm256_set1_ps(ray.Origin.x), oy = _mm256_set1_ps(ray.Origin.y), oz = _mm256_set1_ps(ray.Origin.z);
+            const __m256 ix = _mm256_set1_ps(ray.InvDirection.x), iy = _mm256_set1_ps(ray.InvDirection.y), iz = _mm256_set1_ps(ray.InvDirection.z);
+
+            __m256 tNear = _mm256_max_ps(
+                _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(nearPlanes[0], ox), ix), _mm256_mul_ps(_mm256_sub_ps(nearPlanes[1], oy), iy)),
+                _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(nearPlanes[2], oz), iz), _mm256_setzero_ps()));
+            __m256 tFar = _mm256_min_ps(
+                _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(farPlanes[0], ox), ix), _mm256_mul_ps(_mm256_sub_ps(farPlanes[1], oy), iy)),
+                _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(farPlanes[2], oz), iz), _mm256_set1_ps(tMax)));
+
+            _mm256_storeu_ps(outDistances, tNear);
+            return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)));
+        }
+#endif
+
+        // Bit i is set if childMasks[i] shares a bit with rayMask.
+        template <int Width>
+        inline uint32_t MatchChildMasks(const uint8_t* childMasks, uint8_t rayMask)
+        {
+            uint8_t packed[8] = {};
+            memcpy(packed, childMasks, Width);
+            __m128i masks = _mm_and_si128(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(packed)), _mm_set1_epi8(static_cast<char>(rayMask)));
+            uint32_t rejected = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(masks, _mm_setzero_si128())));
+            return ~rejected & ((1u << Width) - 1);
+        }
+    }
+
+    // Tests the ray against every child of the node. Returns a bit mask of the children whose box is entered
+    // before tMax and writes their entry distances to outDistances[0..Width).
+    template <int Width>
+    inline uint32_t IntersectChildren(const WideBVHNode<Width>& node, const WideTraversalRay& ray, float tMax, float* outDistances)
+    {
+        // With a negative direction the max plane is entered first.
+        const float* nearX = ray.NegativeDirection[0] ? node.BoundsMax[0] : node.BoundsMin[0];
+        const float* nearY = ray.NegativeDirection[1] ? node.BoundsMax[1] : node.BoundsMin[1];
+        const float* nearZ = ray.NegativeDirection[2] ? node.BoundsMax[2] : node.BoundsMin[2];
+        const float* farX = ray.NegativeDirection[0] ? node.BoundsMin[0] : node.BoundsMax[0];
+        const float* farY = ray.NegativeDirection[1] ? node.BoundsMin[1] : node.BoundsMax[1];
+        const float* farZ = ray.NegativeDirection[2] ? node.BoundsMin[2] : node.BoundsMax[2];
+
+#ifdef __AVX__
+        if constexpr (Width == 8)
+        {
+            const __m256 nearPlanes[3] = { _mm256_load_ps(nearX), _mm256_load_ps(nearY), _mm256_load_ps(nearZ) };
+            const __m256 farPlanes[3] = { _mm256_load_ps(farX), _mm256_load_ps(farY), _mm256_load_ps(farZ) };
+            return Detail::SlabTest8(nearPlanes, farPlanes, ray, tMax, outDistances);
+        }
+#endif
+        // SSE builds test 8-wide nodes as two halves.
+        uint32_t mask = 0;
+        for (int base = 0; base < Width; base += 4)
+        {
+            const __m128 nearPlanes[3] = { _mm_load_ps(nearX + base), _mm_load_ps(nearY + base), _mm_load_ps(nearZ + base) };
+            const __m128 farPlanes[3] = { _mm_load_ps(farX + base), _mm_load_ps(farY + base), _mm_load_ps(farZ + base) };
+            mask |= Detail::SlabTest4(nearPlanes, farPlanes, ray, tMax, outDistances + base) << base;
+        }
+        return mask;
+    }
+
+    // Closest-hit traversal of a wide BVH. intersectLeaf(firstPrimitive, primitiveCount) is called for every leaf
+    // the ray reaches and must lower tMax when it finds a closer hit. Leaves are intersected as soon as they are
+    // found and internal children are visited nearest first, skipping any that tMax has moved past in the meantime.
+    // Returns the number of nodes visited.
+    // With AnyHit (occlusion rays), intersectLeaf returns true on any hit below tMax, which ends the walk, and the
+    // children are pushed unsorted.
+    // With childMasks (see ComputeChildMasks), children whose mask shares no bit with rayMask are skipped unopened.
+    template <bool AnyHit = false, typename NodeType, typename LeafFunction>
+    inline uint32_t Traverse(const NodeType* nodes, uint32_t rootIndex, const WideTraversalRay& ray, float& tMax, LeafFunction&& intersectLeaf,
+        const uint8_t* childMasks = nullptr, uint8_t rayMask = 0xff)
+    {
+        constexpr int Width = NodeType::WIDTH;
+        // Each level adds at most Width - 1 entries on top of the one it consumed.
+        constexpr int STACK_SIZE = 64 * (Width - 1);
+
+        struct StackEntry
+        {
+            uint32_t NodeIndex;
+            float Distance;
+        };
+        StackEntry stack[STACK_SIZE];
+        int stackPtr = 0;
+        stack[stackPtr++] = { rootIndex, 0.0f };
+
+        uint32_t nodesVisited = 0;
+        while (stackPtr > 0)
+        {
+            const StackEntry entry = stack[--stackPtr];
+            if (entry.Distance > tMax)
+                continue;
+
+            uint32_t visibleMask = (1u << Width) - 1;
+            if (childMasks)
+            {
+                visibleMask = Detail::MatchChildMasks<Width>(childMasks + static_cast<size_t>(entry.NodeIndex) * Width, rayMask);
+                if (visibleMask == 0)
+                    continue;
+            }
+
+            const NodeType& node = nodes[entry.NodeIndex];
+            nodesVisited++;
+
+            alignas(32) float distances[Width];
+            uint32_t hitMask = IntersectChildren(node, ray, tMax, distances) & visibleMask;
+
+            // Sort the internal children by descending distance so that the nearest ends up on top of the stack.
+            int sorted[Width];
+            int sortedCount = 0;
+            for (int i = 0; hitMask != 0; ++i, hitMask >>= 1)
+            {
+                if ((hitMask & 1u) == 0)
+                    continue;
+
+                if (node.PrimitiveCount[i] > 0)
+                {
+                    if (distances[i] <= tMax)
+                    {
+                        if constexpr (AnyHit)
+                        {
+                            if (intersectLeaf(static_cast<uint32_t>(node.Child[i]), static_cast<uint32_t>(node.PrimitiveCount[i])))
+                                return nodesVisited;
+                        }
+                        else
+                        {
+                            intersectLeaf(static_cast<uint32_t>(node.Child[i]), static_cast<uint32_t>(node.PrimitiveCount[i]));
+                        }
+                    }
+                    continue;
+                }
+
+                if constexpr (AnyHit)
+                {
+                    sorted[sortedCount++] = i;
+                    continue;
+                }
+
+                int slot = sortedCount++;
+                while (slot > 0 && distances[sorted[slot - 1]] < distances[i])
+                {
+                    sorted[slot] = sorted[slot - 1];
+                    slot--;
+                }
+                sorted[slot] = i;
+            }
+
+            for (int i = 0; i < sortedCount && stackPtr < STACK_SIZE; ++i)
+            {
+                stack[stackPtr++] = { static_cast<uint32_t>(node.Child[sorted[i]]), distances[sorted[i]] };
+            }
+        }
+        return nodesVisited;
+    }
+}
@@ -0,0 +1,507 @@
+// Headless CPU path tracer: renders a glTF model with CpuRayTracer and writes a PNG.
+// No window, swap chain or D3D12 device is created.
+//
+// usage: HeadlessRenderer <model.gltf|glb> [-o out.png] [-w width] [-h height] [-frames n]
+//                         [-spp n] [-bounces n] [-threads n] [-tile n] [-sbvh [budget]]
+//                         [-lbvh [sahTopLevelBits]] [-treelets passes] [-width 2|4|8] [-compressed]
+//                         [-blocks 0|4|8] [-cache dir] [-tlas midpoint|sah] [-sort] [-verifybuild]
+//
+// -verifybuild checks the binned SAH, SBVH and LBVH builders (other build, treelet and block options as given) and
+// exits: 0 if every build gives the same nodes and triangle order with one worker and with several, stays within
+// BVHBuilder::MAX_DEPTH, and the CPU traversal finds the same hits in every CpuBVHLayout as a port of the shader's
+// TraverseBLAS; 1 if not.
+
+#include "IApplication.h"
+#include "CoreHelper Files/AccelerationStructureManager.h"
+#include "CoreHelper Files/CpuRayTracer.h"
+#include "CoreHelper Files/RayQuery.h"
+#include "CoreHelper Files/Camera.h"
+#include "CoreHelper Files/Image.h"
+#include "CoreHelper Files/TaskScheduler.h"
+#include "RenderEngine Files/Timer.h"
+#include "CoreHelper Files/ThirdParty/stb_image_write.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+
+// D3D.cpp (pulled in through gpFile) references the application factory; there is none here.
+std::unique_ptr<IApplication> CreateApplication()
+{
+    return nullptr;
+}
+
+struct HeadlessOptions
+{
+    std::string ModelPath;
+    std::string OutputPath = "HeadlessRender.png";
+    uint32_t Width = 800;
+    uint32_t Height = 600;
+    uint32_t Frames = 16;
+    CpuRenderSettings Render;
+    BVHBuildSettings Build;
+    BVHOptimizeSettings Optimize;
+    TLASBuildSettings TLASBuild;
+    CpuBVHLayout Layout = CpuBVHLayout::BVH4;
+    uint32_t TriangleBlockWidth = 4;
+    std::string CacheDirectory; // On-disk BLAS cache; empty = always build
+    bool VerifyBuild = false;
+};
+
+static void PrintUsage()
+{
+    printf("usage: HeadlessRenderer <model.gltf|glb> [-o out.png] [-w width] [-h height] [-frames n]\n");
+    printf("                        [-spp n] [-bounces n] [-threads n] [-tile n] [-sbvh [budget]]\n");
+    printf("                        [-lbvh [sahTopLevelBits]] [-treelets passes] [-width 2|4|8] [-compressed]\n");
+    printf("                        [-blocks 0|4|8] [-cache dir] [-tlas midpoint|sah] [-sort] [-verifybuild]\n");
+}
+
+static bool ParseArguments(int argc, char* argv[], HeadlessOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        bool hasValue = (i + 1) < argc;
+
+        if (strcmp(arg, "-o") == 0 && hasValue) options.OutputPath = argv[++i];
+        else if (strcmp(arg, "-w") == 0 && hasValue) options.Width = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(arg, "-h") == 0 && hasValue) options.Height = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(arg, "-frames") == 0 && hasValue) options.Frames = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(arg, "-spp") == 0 && hasValue) options.Render.NumRaysPerPixel = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(arg, "-bounces") == 0 && hasValue) options.Render.NumBounces = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(arg, "-threads") == 0 && hasValue) options.Render.ThreadCount = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(arg, "-tile") == 0 && hasValue) options.Render.TileSize = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(arg, "-sort") == 0) options.Render.SortSecondaryRays = true;
+        else if (strcmp(arg, "-verifybuild") == 0) options.VerifyBuild = true;
+        else if (strcmp(arg, "-sbvh") == 0)
+        {
+            options.Build.Mode = BVHBuildMode::SpatialSplits;
+            if (hasValue && argv[i + 1][0] != '-' && atof(argv[i + 1]) > 0.0) options.Build.SpatialSplitBudget = (float)atof(argv[++i]);
+        }
+        else if (strcmp(arg, "-lbvh") == 0)
+        {
+            options.Build.Mode = BVHBuildMode::Linear;
+            if (hasValue && argv[i + 1][0] != '-' && atoi(argv[i + 1]) > 0) options.Build.SAHTopLevelBits = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "-treelets") == 0 && hasValue) options.Optimize.TreeletPasses = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(arg, "-width") == 0 && hasValue)
+        {
+            int width = atoi(argv[++i]);
+            if (width == 2) options.Layout = CpuBVHLayout::Binary;
+            else if (width == 4) options.Layout = CpuBVHLayout::BVH4;
+            else if (width == 8) options.Layout = CpuBVHLayout::BVH8;
+            else return false;
+        }
+        else if (strcmp(arg, "-compressed") == 0) options.Layout = CpuBVHLayout::Compressed;
+        else if (strcmp(arg, "-blocks") == 0 && hasValue)
+        {
+            // Leaves are sized to fill one block; scalar tests keep the default leaf size
+            options.TriangleBlockWidth = (uint32_t)atoi(argv[++i]);
+            if (options.TriangleBlockWidth != 0 && options.TriangleBlockWidth != 4 && options.TriangleBlockWidth != 8) return false;
+            if (options.TriangleBlockWidth > 0) options.Build.MaxLeafSize = options.TriangleBlockWidth;
+        }
+        else if (strcmp(arg, "-cache") == 0 && hasValue) options.CacheDirectory = argv[++i];
+        else if (strcmp(arg, "-tlas") == 0 && hasValue)
+        {
+            const char* mode = argv[++i];
+            if (strcmp(mode, "midpoint") == 0) options.TLASBuild.Mode = TLASBuildMode::Midpoint;
+            else if (strcmp(mode, "sah") == 0) options.TLASBuild.Mode = TLASBuildMode::BinnedSAH;
+            else return false;
+        }
+        else if (arg[0] != '-' && options.ModelPath.empty()) options.ModelPath = arg;
+        else return false;
+    }
+    return !options.ModelPath.empty() && options.Width > 0 && options.Height > 0 && options.Frames > 0 && options.Render.TileSize > 0;
+}
+
+// Builds the triangles once per thread count and checks that every build matches the single-threaded one and stays
+// within the depth the traversal stacks support.
+static bool VerifyBuildDeterminism(const std::vector<Triangle>& triangles, const BVHBuildSettings& settings, uint32_t threadCount)
+{
+    std::vector<BVHNode> referenceNodes;
+    std::vector<uint32_t> referenceOrder;
+    bool passed = true;
+    for (uint32_t threads : { 1u, threadCount })
+    {
+        TaskScheduler scheduler(threads);
+        std::vector<Triangle> buildTriangles = triangles;
+        std::vector<BVHNode> nodes;
+        std::vector<uint32_t> order;
+        Timer buildTimer;
+        BVHBuilder::Build(buildTriangles, nodes, 0, settings, &scheduler, &order);
+        const float buildMs = buildTimer.ElapsedMillis();
+        const uint32_t depth = BVHBuilder::ComputeDepth(nodes);
+        passed = passed && depth <= BVHBuilder::MAX_DEPTH;
+
+        bool same = true;
+        if (threads == 1)
+        {
+            referenceNodes = std::move(nodes);
+            referenceOrder = std::move(order);
+        }
+        else
+        {
+            same = nodes.size() == referenceNodes.size() && order == referenceOrder &&
+                memcmp(nodes.data(), referenceNodes.data(), nodes.size() * sizeof(BVHNode)) == 0;
+            passed = passed && same;
+        }
+        printf("  build with %2u threads: %zu triangles, %zu nodes, %u levels in %.2f ms%s%s\n", threads, triangles.size(),
+            threads == 1 ? referenceNodes.size() : nodes.size(), depth, buildMs, same ? "" : " (DIFFERS from 1 thread)",
+            depth <= BVHBuilder::MAX_DEPTH ? "" : " (DEEPER than the traversal limit)");
+    }
+    return passed;
+}
+
+// RayAABB, IntersectTriangle and TraverseBLAS of RayTracerCS.hlsl, on the arrays the GPU buffers are uploaded from.
+static bool GpuRayAABB(const Ray& ray, const XMFLOAT3& invDirection, const XMFLOAT3& aabbMin, const XMFLOAT3& aabbMax, float& hitDist)
+{
+    const float t0x = (aabbMin.x - ray.Origin.x) * invDirection.x, t1x = (aabbMax.x - ray.Origin.x) * invDirection.x;
+    const float t0y = (aabbMin.y - ray.Origin.y) * invDirection.y, t1y = (aabbMax.y - ray.Origin.y) * invDirection.y;
+    const float t0z = (aabbMin.z - ray.Origin.z) * invDirection.z, t1z = (aabbMax.z - ray.Origin.z) * invDirection.z;
+    const float tEnter = (std::max)((std::max)((std::min)(t0x, t1x), (std::min)(t0y, t1y)), (std::min)(t0z, t1z));
+    const float tExit = (std::min)((std::min)((std::max)(t0x, t1x), (std::max)(t0y, t1y)), (std::max)(t0z, t1z));
+    if (tExit >= tEnter && tExit > 0.0f)
+    {
+        hitDist = (std::max)(tEnter, 0.0f);
+        return true;
+    }
+    hitDist = 3.4e38f;
+    return false;
+}
+
+static float GpuIntersectTriangle(const Ray& ray, const TrianglePositions& tri)
+{
+    const XMFLOAT3 edge1 = { tri.v1.x - tri.v0.x, tri.v1.y - tri.v0.y, tri.v1.z - tri.v0.z };
+    const XMFLOAT3 edge2 = { tri.v2.x - tri.v0.x, tri.v2.y - tri.v0.y, tri.v2.z - tri.v0.z };
+    const XMFLOAT3& d = ray.Direction;
+    const XMFLOAT3 h = { d.y * edge2.z - d.z * edge2.y, d.z * edge2.x - d.x * edge2.z, d.x * edge2.y - d.y * edge2.x };
+    const float a = edge1.x * h.x + edge1.y * h.y + edge1.z * h.z;
+    if (a > -1e-6f && a < 1e-6f)
+        return -1.0f;
+
+    const float f = 1.0f / a;
+    const XMFLOAT3 s = { ray.Origin.x - tri.v0.x, ray.Origin.y - tri.v0.y, ray.Origin.z - tri.v0.z };
+    const float u = f * (s.x * h.x + s.y * h.y + s.z * h.z);
+    if (u < 0.0f || u > 1.0f)
+        return -1.0f;
+
+    const XMFLOAT3 q = { s.y * edge1.z - s.z * edge1.y, s.z * edge1.x - s.x * edge1.z, s.x * edge1.y - s.y * edge1.x };
+    const float v = f * (d.x * q.x + d.y * q.y + d.z * q.z);
+    if (v < 0.0f || u + v > 1.0f)
+        return -1.0f;
+
+    const float t = f * (edge2.x * q.x + edge2.y * q.y + edge2.z * q.z);
+    return t > 0.0001f ? t : -1.0f;
+}
+
+// Closest hit as the shader finds it, including its 32-entry stack. outOverflow is set if a push would not fit.
+static RayHit TraverseBLASLikeGpu(const std::vector<BVHNode>& nodes, const std::vector<TrianglePositions>& triangles,
+    uint32_t baseNodeIndex, uint32_t baseTriangleIndex, const Ray& ray, bool& outOverflow)
+{
+    const int GPU_STACK_SIZE = 32;
+    const XMFLOAT3 invDirection = { 1.0f / ray.Direction.x, 1.0f / ray.Direction.y, 1.0f / ray.Direction.z };
+
+    int stack[GPU_STACK_SIZE];
+    int stackPtr = 0;
+    stack[stackPtr++] = static_cast<int>(baseNodeIndex);
+    RayHit closestHit;
+    closestHit.HitDistance = 3.4e38f;
+    auto push = [&](int nodeIndex)
+    {
+        if (stackPtr < GPU_STACK_SIZE)
+            stack[stackPtr++] = nodeIndex;
+        else
+            outOverflow = true;
+    };
+
+    while (stackPtr > 0)
+    {
+        const BVHNode& node = nodes[stack[--stackPtr]];
+        float distToAABB;
+        if (!GpuRayAABB(ray, invDirection, node.aabbMin, node.aabbMax, distToAABB) || distToAABB > closestHit.HitDistance)
+            continue;
+
+        if (node.triangleCount > 0)
+        {
+            for (int i = 0; i < node.triangleCount; ++i)
+            {
+                const uint32_t triIndex = baseTriangleIndex + node.leftChildOrFirstTriangleIndex + i;
+                const float t = GpuIntersectTriangle(ray, triangles[triIndex]);
+                if (t > 0.0f && t < closestHit.HitDistance)
+                {
+                    closestHit.HitDistance = t;
+                    closestHit.PrimitiveIndex = static_cast<int>(triIndex);
+                }
+            }
+            continue;
+        }
+
+        const int leftChildIndex = node.leftChildOrFirstTriangleIndex;
+        const int rightChildIndex = leftChildIndex + 1;
+        float distLeft, distRight;
+        bool hitLeft = GpuRayAABB(ray, invDirection, nodes[leftChildIndex].aabbMin, nodes[leftChildIndex].aabbMax, distLeft);
+        bool hitRight = GpuRayAABB(ray, invDirection, nodes[rightChildIndex].aabbMin, nodes[rightChildIndex].aabbMax, distRight);
+        hitLeft = hitLeft && distLeft < closestHit.HitDistance;
+        hitRight = hitRight && distRight < closestHit.HitDistance;
+
+        // Farther child first so the closer one is processed next
+        if (hitLeft && hitRight)
+        {
+            push(distLeft < distRight ? rightChildIndex : leftChildIndex);
+            push(distLeft < distRight ? leftChildIndex : rightChildIndex);
+        }
+        else if (hitLeft)
+        {
+            push(leftChildIndex);
+        }
+        else if (hitRight)
+        {
+            push(rightChildIndex);
+        }
+    }
+    return closestHit;
+}
+
+// Builds the model's BLAS through the manager (with the treelet and triangle block options) and traces the same
+// rays with the shader's traversal and with the CPU traversal of every CpuBVHLayout. The hits must agree.
+static bool VerifyTraversal(Model& model, const BVHBuildSettings& settings, const HeadlessOptions& options)
+{
+    const uint32_t RAY_COUNT = 4096;
+
+    AccelerationStructureManager manager;
+    manager.SetBLASBuildSettings(settings);
+    manager.SetBLASOptimizeSettings(options.Optimize);
+    manager.SetCpuTriangleBlockWidth(options.TriangleBlockWidth);
+    const BuiltBLAS* blas = manager.GetOrBuildBLAS(nullptr, &model);
+    if (!blas)
+    {
+        printf("  BLAS build FAILED\n");
+        return false;
+    }
+    const BLASStats stats = manager.AnalyzeBLAS(blas, false);
+    const bool depthOk = stats.maxDepth <= BVHBuilder::MAX_DEPTH;
+
+    std::vector<ModelInstance> instances(1);
+    instances[0].SourceModel = &model;
+    manager.BuildTLAS(instances);
+
+    // 1. Rays from a sphere around the model, half of them aimed at triangles and half through the middle
+    const std::vector<TrianglePositions>& positions = manager.GetCpuTrianglePositions();
+    const XMVECTOR boundsMin = XMLoadFloat3(&blas->RootNode.aabbMin);
+    const XMVECTOR boundsMax = XMLoadFloat3(&blas->RootNode.aabbMax);
+    const XMVECTOR center = XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f);
+    const float radius = (std::max)(0.5f * XMVectorGetX(XMVector3Length(XMVectorSubtract(boundsMax, boundsMin))), 1e-3f);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    auto randomVector = [&]() { return XMVectorSet(uniform(rng), uniform(rng), uniform(rng), 0.0f); };
+
+    std::vector<Ray> rays(RAY_COUNT);
+    for (uint32_t i = 0; i < RAY_COUNT; ++i)
+    {
+        const XMVECTOR origin = XMVectorAdd(center, XMVectorScale(XMVector3Normalize(randomVector()), 2.0f * radius));
+        XMVECTOR target = XMVectorAdd(center, XMVectorScale(randomVector(), 0.5f * radius));
+        if (i % 2 == 0 && blas->TriangleCount > 0)
+        {
+            const TrianglePositions& tri = positions[blas->BaseTriangleIndex + rng() % blas->TriangleCount];
+            target = XMVectorScale(XMVectorAdd(XMVectorAdd(XMLoadFloat3(&tri.v0), XMLoadFloat3(&tri.v1)), XMLoadFloat3(&tri.v2)), 1.0f / 3.0f);
+        }
+        XMStoreFloat3(&rays[i].Origin, origin);
+        XMStoreFloat3(&rays[i].Direction, XMVector3Normalize(XMVectorSubtract(target, origin)));
+    }
+
+    // 2. What the shader finds
+    std::vector<RayHit> gpuHits(RAY_COUNT);
+    bool overflow = false;
+    for (uint32_t i = 0; i < RAY_COUNT; ++i)
+    {
+        gpuHits[i] = TraverseBLASLikeGpu(manager.GetCpuBlasNodes(), positions, blas->BaseNodeIndex, blas->BaseTriangleIndex, rays[i], overflow);
+    }
+
+    // 3. The CPU traversal in every layout. The world-space distance is recomputed from the hit position, so it
+    //    only matches to rounding.
+    bool passed = depthOk && !overflow;
+    printf("  %u nodes, %u levels%s; GPU stack %s; CPU traversal of %u rays:", stats.nodeCount, stats.maxDepth,
+        depthOk ? "" : " (DEEPER than the traversal limit)", overflow ? "OVERFLOWS" : "ok", RAY_COUNT);
+    const struct { CpuBVHLayout Layout; const char* Name; } layouts[] = {
+        { CpuBVHLayout::Binary, "binary" }, { CpuBVHLayout::BVH4, "BVH4" }, { CpuBVHLayout::BVH8, "BVH8" }, { CpuBVHLayout::Compressed, "compressed" } };
+    for (const auto& layout : layouts)
+    {
+        manager.SetCpuBVHLayout(layout.Layout);
+        const RayQuery::Scene scene = RayQuery::GetScene(manager);
+        uint32_t mismatches = 0;
+        for (uint32_t i = 0; i < RAY_COUNT; ++i)
+        {
+            const RayHit cpuHit = RayQuery::Intersect(scene, rays[i]);
+            const bool gpuHit = gpuHits[i].PrimitiveIndex != -1;
+            if ((cpuHit.PrimitiveIndex != -1) != gpuHit ||
+                (gpuHit && fabsf(cpuHit.HitDistance - gpuHits[i].HitDistance) > 1e-4f * (std::max)(gpuHits[i].HitDistance, 1.0f)))
+            {
+                mismatches++;
+            }
+        }
+        passed = passed && mismatches == 0;
+        if (mismatches == 0)
+            printf(" %s ok", layout.Name);
+        else
+            printf(" %s %u MISMATCHES", layout.Name, mismatches);
+    }
+    printf("\n");
+    return passed;
+}
+
+// Every BLAS builder (binned SAH, SBVH, LBVH) with the other build options as given: deterministic, within
+// BVHBuilder::MAX_DEPTH, and traversed alike on the GPU and the CPU.
+static bool VerifyBuild(Model& model, const HeadlessOptions& options, uint32_t threadCount)
+{
+    std::vector<Triangle> triangles;
+    AccelerationStructureManager::GatherTriangles(model, triangles);
+
+    const struct { BVHBuildMode Mode; const char* Name; } modes[] = {
+        { BVHBuildMode::BinnedSAH, "Binned SAH" }, { BVHBuildMode::SpatialSplits, "SBVH" }, { BVHBuildMode::Linear, "LBVH" } };
+    bool passed = true;
+    for (const auto& mode : modes)
+    {
+        BVHBuildSettings settings = options.Build;
+        settings.Mode = mode.Mode;
+        printf("%s BLAS:\n", mode.Name);
+        passed = VerifyBuildDeterminism(triangles, settings, threadCount) && passed;
+        passed = VerifyTraversal(model, settings, options) && passed;
+    }
+    return passed;
+}
+
+int main(int argc, char* argv[])
+{
+    HeadlessOptions options;
+    if (!ParseArguments(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    fopen_s(&gpFile, gszLogFileName, "w");
+
+    // 1. Load the model on the CPU only (no resource manager means no GPU buffers or textures)
+    Model model;
+    ModelLoader loader;
+    if (FAILED(loader.LoadGLTF(nullptr, options.ModelPath, model)))
+    {
+        printf("Failed to load model '%s'\n", options.ModelPath.c_str());
+        return 1;
+    }
+    model.EnsureDefaultMaterial();
+
+    if (options.VerifyBuild)
+    {
+        uint32_t threadCount = options.Render.ThreadCount > 0 ? options.Render.ThreadCount : std::thread::hardware_concurrency();
+        bool passed = VerifyBuild(model, options, (std::max)(threadCount, 2u));
+        printf("Build determinism, depth and traversal: %s\n", passed ? "ok" : "FAILED");
+        return passed ? 0 : 1;
+    }
+
+    // 2. Build the BLAS and a single-instance TLAS
+    AccelerationStructureManager* accelManager = AccelerationStructureManager::Get();
+    accelManager->SetBLASBuildSettings(options.Build);
+    accelManager->SetBLASOptimizeSettings(options.Optimize);
+    accelManager->SetCpuBVHLayout(options.Layout);
+    accelManager->SetCpuTriangleBlockWidth(options.TriangleBlockWidth);
+    accelManager->SetTLASBuildSettings(options.TLASBuild);
+    if (FAILED(accelManager->SetBLASCacheDirectory(options.CacheDirectory)))
+    {
+        printf("Cannot use '%s' as the BLAS cache directory, building without it\n", options.CacheDirectory.c_str());
+    }
+    Timer buildTimer;
+    if (!accelManager->GetOrBuildBLAS(nullptr, &model))
+    {
+        printf("Failed to build BLAS for '%s'\n", options.ModelPath.c_str());
+        return 1;
+    }
+
+    std::vector<ModelInstance> instances(1);
+    instances[0].Name = "HeadlessInstance";
+    instances[0].SourceModel = &model;
+    instances[0].MaterialOffset = 0;
+    accelManager->BuildTLAS(instances);
+    printf("Built acceleration structures for %zu triangles in %.2f ms\n", accelManager->GetCpuTrianglePositions().size(), buildTimer.ElapsedMillis());
+    const TLASBuildStats& tlasStats = accelManager->GetLastTLASBuildStats();
+    printf("TLAS: %u instances, SAH %.2f, built in %.2f ms\n", tlasStats.InstanceCount, tlasStats.SAHCost, tlasStats.BuildTimeMs);
+    if (!options.CacheDirectory.empty())
+    {
+        const BLASCacheStats& cacheStats = accelManager->GetBLASCacheStats();
+        printf("BLAS cache: %u hits, %u misses\n", cacheStats.Hits, cacheStats.Misses);
+    }
+    if (options.Optimize.TreeletPasses > 0 && accelManager->GetBLASCacheStats().Hits == 0)
+    {
+        const BVHOptimizeStats& optimizeStats = accelManager->GetLastBLASOptimizeStats();
+        printf("Treelet optimization: SAH %.2f -> %.2f (%u treelets restructured in %.2f ms)\n",
+            optimizeStats.SAHCostBefore, optimizeStats.SAHCostAfter, optimizeStats.TreeletsRestructured, optimizeStats.OptimizeTimeMs);
+    }
+
+    if (accelManager->GetCpuTLASNodes().empty())
+    {
+        printf("'%s' contains no geometry\n", options.ModelPath.c_str());
+        return 1;
+    }
+
+    // 3. Frame the model: look at the centre of the TLAS bounds from a distance that fits it in view
+    const BVHNode& root = accelManager->GetCpuTLASNodes()[0];
+    XMVECTOR boundsMin = XMLoadFloat3(&root.aabbMin);
+    XMVECTOR boundsMax = XMLoadFloat3(&root.aabbMax);
+    XMVECTOR center = XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f);
+    float radius = 0.5f * XMVectorGetX(XMVector3Length(XMVectorSubtract(boundsMax, boundsMin)));
+
+    Camera camera;
+    camera.OnResize(options.Width, options.Height);
+    camera.SetPosition(XMVectorAdd(center, XMVectorSet(0.0f, 0.0f, 2.5f * radius, 0.0f)));
+    camera.SetForwardDirection(XMFLOAT3(0.0f, 0.0f, -1.0f));
+
+    // 4. Render progressively into a CPU-only image
+    Image image;
+    if (FAILED(image.InitializeCpuOnly(options.Width, options.Height)))
+    {
+        printf("Failed to allocate a %ux%u image\n", options.Width, options.Height);
+        return 1;
+    }
+
+    CpuRayTracer rayTracer;
+    rayTracer.SetSettings(options.Render);
+
+    uint64_t totalRays = 0;
+    float totalMs = 0.0f;
+    for (uint32_t frame = 0; frame < options.Frames; ++frame)
+    {
+        if (FAILED(rayTracer.RenderFrame(accelManager, model.Materials, camera, frame, &image)))
+        {
+            printf("Frame %u failed\n", frame);
+            return 1;
+        }
+
+        const CpuRenderStats& stats = rayTracer.GetLastFrameStats();
+        totalRays += stats.RaysTraced;
+        totalMs += stats.RenderTimeMs;
+        printf("Frame %3u: %8.2f ms, %6.2f Mrays/s (%u tiles, %u threads)\n",
+            frame, stats.RenderTimeMs, stats.MRaysPerSecond, stats.TileCount, stats.ThreadCount);
+    }
+
+    printf("Total: %llu rays in %.2f ms, %.2f Mrays/s\n", (unsigned long long)totalRays, totalMs,
+        totalMs > 0.0f ? (float)(totalRays / (totalMs * 1000.0)) : 0.0f);
+
+    // 5. Write the tonemapped result
+    if (!stbi_write_png(options.OutputPath.c_str(), options.Width, options.Height, 4, image.GetPixelBuffer(), options.Width * 4))
+    {
+        printf("Failed to write '%s'\n", options.OutputPath.c_str());
+        return 1;
+    }
+    printf("Wrote %s\n", options.OutputPath.c_str());
+
+    if (gpFile)
+    {
+        fclose(gpFile);
+        gpFile = NULL;
+    }
+    return 0;
+}
@@ -774,7 +774,7 @@ void DefaultScene::RenderImGui()
 				m_blasBuildTimeMs = static_cast<float>(buildDuration) / 1000.0f;
 				if (blas)
 				{
-					m_blasStats = accelManager->AnalyzeBLAS(blas);
+					m_blasStats = accelManager->AnalyzeBLAS(blas, false); // EPO is too slow for interactive use; see BVHAnalyzer
 				}
 			}
 		}
@@ -915,6 +915,11 @@ void DefaultScene::RenderImGui()
 		ImGui::Text("Max: %u", m_blasStats.maxTrianglesPerLeaf);
 		ImGui::Text("Average: %.2f", m_blasStats.averageTrianglesPerLeaf);
 		ImGui::Separator();
+		ImGui::Text("Quality:");
+		ImGui::Text("SAH Cost: %.2f", m_blasStats.sahCost);
+		ImGui::Text("Sibling Overlap: %.3f", m_blasStats.siblingOverlap);
+		ImGui::Text("Memory: %.2f MB nodes, %.2f MB triangles", m_blasStats.nodeBytes / (1024.0 * 1024.0), m_blasStats.triangleBytes / (1024.0 * 1024.0));
+		ImGui::Separator();
 		ImGui::Text("Build Performance:");
 		ImGui::Text("Model Load Time: %.3f ms", m_modelLoadTimeMs);
 		ImGui::Text("BLAS Build Time: %.3f ms", m_blasBuildTimeMs);